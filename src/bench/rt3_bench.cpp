@@ -0,0 +1,556 @@
+/*!
+ * Benchmarks of the renderer's hot paths, plus end-to-end renders of the
+ * example scenes, with results written as JSON.
+ *
+ * Every benchmark is run `--repeats` times. A micro-benchmark first calibrates
+ * how many iterations fill `--min-time` milliseconds, so a sample is never a
+ * single short call; the reported times are per iteration. Inputs are fixed
+ * (no random data, fixed resolution and thread count), so two runs of the
+ * same build measure the same work, and runs of two builds can be compared
+ * benchmark by benchmark.
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../core/api.h"
+#include "../core/background.h"
+#include "../core/film.h"
+#include "../core/image_io.h"
+#include "../core/paramset.h"
+#include "../core/parser.h"
+#include "../core/resolve.h"
+#include "../core/rt3.h"
+#include "../core/thread_pool.h"
+
+#ifndef RT3_BENCH_SCENE_DIR
+#define RT3_BENCH_SCENE_DIR "scene"
+#endif
+#ifndef RT3_BUILD_TYPE
+#define RT3_BUILD_TYPE "unknown"
+#endif
+
+using namespace rt3;
+namespace fs = std::filesystem;
+
+/// Keeps the compiler from optimizing away a result that is never used.
+template <typename T> static void do_not_optimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void *sink;
+  sink = &value;
+#endif
+}
+
+// =============================================
+// Harness
+// =============================================
+
+/// Command line options.
+struct BenchOptions {
+  std::string json_file{ "rt3_bench.json" };
+  std::string filter;  //!< Only benchmarks whose name contains this.
+  std::string scene_dir{ RT3_BENCH_SCENE_DIR };
+  int repeats{ 5 };
+  double min_time_ms{ 50 };  //!< Per sample of a micro-benchmark.
+  size_t n_threads{ 0 };     //!< 0 = one per core.
+  int resolution[2]{ 640, 480 };  //!< Of the end-to-end renders.
+  bool skip_scenes{ false };
+};
+
+/// One line of the report.
+struct BenchResult {
+  std::string name;
+  std::string kind;         //!< "micro" or "scene".
+  size_t iterations{ 0 };   //!< Per sample.
+  std::vector<double> ms;   //!< Time per iteration of each sample.
+  double items{ 0 };        //!< Work per iteration (pixels, values, ...).
+  std::string item_unit;
+
+  double min() const { return *std::min_element(ms.begin(), ms.end()); }
+  double median() const {
+    std::vector<double> sorted{ ms };
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    return n % 2 == 1 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+  }
+  double mean() const {
+    double sum{ 0 };
+    for (double t : ms) {
+      sum += t;
+    }
+    return sum / double(ms.size());
+  }
+};
+
+class Bench {
+ public:
+  explicit Bench(const BenchOptions &opt) : m_opt{ opt } {}
+
+  bool selected(const std::string &name) const {
+    return m_opt.filter.empty() or name.find(m_opt.filter) != std::string::npos;
+  }
+
+  /*!
+   * Times `fn`, which does `items` units of `unit` per call. The number of
+   * calls per sample is doubled until a sample takes `min_time_ms`.
+   */
+  void micro(const std::string &name, double items, const std::string &unit,
+             const std::function<void()> &fn) {
+    if (not selected(name)) {
+      return;
+    }
+    using clock = std::chrono::steady_clock;
+    auto run = [&](size_t n) {
+      auto start = clock::now();
+      for (size_t i{ 0 }; i < n; ++i) {
+        fn();
+      }
+      return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+    fn();  // Warm up caches and lazy tables.
+    size_t n{ 1 };
+    while (n < (size_t{ 1 } << 30)) {
+      if (run(n) >= m_opt.min_time_ms) {
+        break;
+      }
+      n *= 2;
+    }
+    BenchResult r{ name, "micro", n, {}, items, unit };
+    for (int k{ 0 }; k < m_opt.repeats; ++k) {
+      r.ms.push_back(run(n) / double(n));
+    }
+    report(std::move(r));
+  }
+
+  /// Times `repeats` calls of `fn`, one per sample, after a warm-up call.
+  void once(const std::string &name, const std::string &kind, double items,
+            const std::string &unit, const std::function<void()> &fn) {
+    if (not selected(name)) {
+      return;
+    }
+    fn();
+    BenchResult r{ name, kind, 1, {}, items, unit };
+    for (int k{ 0 }; k < m_opt.repeats; ++k) {
+      auto start = std::chrono::steady_clock::now();
+      fn();
+      r.ms.push_back(
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+          .count());
+    }
+    report(std::move(r));
+  }
+
+  const std::vector<BenchResult> &results() const { return m_results; }
+
+ private:
+  void report(BenchResult &&r) {
+    char line[256];
+    std::snprintf(line, sizeof(line), "[bench] %-36s median %10.4f ms  (%.3g %s/s)", r.name.c_str(),
+                  r.median(), r.items / (r.median() * 1e-3), r.item_unit.c_str());
+    std::cerr << line << std::endl;
+    m_results.push_back(std::move(r));
+  }
+
+  const BenchOptions &m_opt;
+  std::vector<BenchResult> m_results;
+};
+
+/// `s` as a JSON string literal.
+static std::string json_string(const std::string &s) {
+  std::string out{ "\"" };
+  for (char c : s) {
+    if (c == '"' or c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char esc[8];
+      std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+      out += esc;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+static void write_json(std::ostream &os, const BenchOptions &opt, size_t n_threads,
+                       const std::vector<BenchResult> &results) {
+  std::time_t now = std::time(nullptr);
+  char timestamp[32];
+  std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+  os << "{\n"
+     << "  \"context\": {\n"
+     << "    \"date\": " << json_string(timestamp) << ",\n"
+     << "    \"build_type\": " << json_string(RT3_BUILD_TYPE) << ",\n"
+#if defined(__VERSION__)
+     << "    \"compiler\": " << json_string(__VERSION__) << ",\n"
+#endif
+     << "    \"threads\": " << n_threads << ",\n"
+     << "    \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+     << "    \"repeats\": " << opt.repeats << ",\n"
+     << "    \"scene_resolution\": [" << opt.resolution[0] << ", " << opt.resolution[1] << "]\n"
+     << "  },\n"
+     << "  \"benchmarks\": [";
+  for (size_t i{ 0 }; i < results.size(); ++i) {
+    const BenchResult &r = results[i];
+    os << (i == 0 ? "\n" : ",\n") << "    {\"name\": " << json_string(r.name)
+       << ", \"kind\": " << json_string(r.kind) << ", \"iterations\": " << r.iterations
+       << ", \"min_ms\": " << r.min() << ", \"median_ms\": " << r.median()
+       << ", \"mean_ms\": " << r.mean() << ", \"items_per_second\": "
+       << r.items / (r.median() * 1e-3) << ", \"item\": " << json_string(r.item_unit)
+       << ", \"samples_ms\": [";
+    for (size_t k{ 0 }; k < r.ms.size(); ++k) {
+      os << (k == 0 ? "" : ", ") << r.ms[k];
+    }
+    os << "]}";
+  }
+  os << "\n  ]\n}\n";
+}
+
+// =============================================
+// Benchmarks
+// =============================================
+
+/// `n` reals as the text of an XML attribute, e.g. "0.5 1.25 ...".
+static std::string real_list(size_t n) {
+  std::ostringstream oss;
+  for (size_t i{ 0 }; i < n; ++i) {
+    oss << (i == 0 ? "" : " ") << float(i % 1000) * 0.125f - 60.f;
+  }
+  return oss.str();
+}
+
+/// Attribute parsing, as `parse_tags()` does it for a triangle mesh.
+static void bench_parsing(Bench &bench) {
+  constexpr size_t n_values{ 3 * 20000 };
+  const std::string xml = "<object type=\"trianglemesh\" ntriangles=\"1\" vertices=\""
+                          + real_list(n_values) + "\" radius=\"1.5\" center=\"0 1 2\"/>";
+  tinyxml2::XMLDocument doc;
+  doc.Parse(xml.c_str(), xml.size());
+  tinyxml2::XMLElement *element = doc.FirstChildElement();
+  // Borrows the attribute texts, as `parse_tags()` does; `doc` outlives the
+  // parameter sets.
+  const std::shared_ptr<const void> owner{ std::shared_ptr<void>{}, &doc };
+  const std::vector<std::pair<param_type_e, std::string>> arrays{
+    { param_type_e::ARR_POINT3F, "vertices" }
+  };
+  // Recording the attributes, then decoding them on first read.
+  bench.micro("parse/read_array_point3f", double(n_values), "values", [&] {
+    ParamSet ps;
+    parse_parameters(element, arrays, &ps, owner);
+    do_not_optimize(retrieve_span<Point3f>(ps, "vertices").size());
+  });
+  const std::vector<std::pair<param_type_e, std::string>> scalars{
+    { param_type_e::STRING, "type" },
+    { param_type_e::INT, "ntriangles" },
+    { param_type_e::REAL, "radius" },
+    { param_type_e::POINT3F, "center" }
+  };
+  bench.micro("parse/scalar_attributes", double(scalars.size()), "attributes", [&] {
+    ParamSet ps;
+    parse_parameters(element, scalars, &ps, owner);
+    ps.decode_all();
+    do_not_optimize(ps.size());
+  });
+}
+
+/// `retrieve()` over a parameter set of typical size.
+static void bench_retrieve(Bench &bench) {
+  ParamSet ps;
+  ps.add<std::string>("type", "perspective");
+  ps.add<int>("x_res", 800);
+  ps.add<int>("y_res", 600);
+  ps.add<real_type>("fovy", 40);
+  ps.add<Point3f>("look_from", Point3f{ 0, 3, -8 });
+  ps.add<Point3f>("look_at", Point3f{ 0, 0.5f, 0 });
+  ps.add<Vector3f>("up", Vector3f{ 0, 1, 0 });
+  ps.add<std::string>("filename", "image.png");
+  ps.add<std::string>("img_type", "png");
+  ps.add<std::string>("gamma_corrected", "yes");
+  ps.add_array<real_type>("screen_window", std::vector<real_type>{ -1, 1, -1, 1 });
+  const ParamKey keys[]{ "x_res", "fovy", "up", "img_type", "screen_window", "missing" };
+  bench.micro("paramset/retrieve_interned", 6, "lookups", [&] {
+    int x = retrieve(ps, keys[0], 0);
+    real_type f = retrieve(ps, keys[1], real_type{ 90 });
+    Vector3f u = retrieve(ps, keys[2], Vector3f{});
+    const std::string &t = retrieve(ps, keys[3], std::string{});
+    auto sw = retrieve_span<real_type>(ps, keys[4]);
+    int m = retrieve(ps, keys[5], 7);
+    do_not_optimize(x + int(f) + int(u.y) + int(t.size()) + int(sw.size()) + m);
+  });
+  bench.micro("paramset/retrieve_by_name", 6, "lookups", [&] {
+    int x = retrieve(ps, "x_res", 0);
+    real_type f = retrieve(ps, "fovy", real_type{ 90 });
+    Vector3f u = retrieve(ps, "up", Vector3f{});
+    const std::string &t = retrieve(ps, "img_type", std::string{});
+    auto sw = retrieve_span<real_type>(ps, "screen_window");
+    int m = retrieve(ps, "missing", 7);
+    do_not_optimize(x + int(f) + int(u.y) + int(t.size()) + int(sw.size()) + m);
+  });
+}
+
+/// Screen-mapped background spans, one 1920-pixel row per iteration.
+static void bench_background(Bench &bench) {
+  constexpr size_t width{ 1920 };
+  std::vector<Spectrum> row(width);
+  const BackgroundColor gradient{ Spectrum{ 0.f, 0.f, 0.2f }, Spectrum{ 0.f, 1.f, 0.2f },
+                                  Spectrum{ 1.f, 1.f, 0.2f }, Spectrum{ 1.f, 0.f, 0.2f } };
+  const BackgroundColor solid{ Spectrum{ 0.6f, 0.8f, 1.f }, Spectrum{ 0.6f, 0.8f, 1.f },
+                               Spectrum{ 0.6f, 0.8f, 1.f }, Spectrum{ 0.6f, 0.8f, 1.f } };
+  float v{ 0 };
+  bench.micro("background/gradient_span", double(width), "pixels", [&] {
+    gradient.sample_span(v, 0.5f / width, 1.f / width, width, row.data());
+    v = v < 1.f ? v + 1.f / 1080.f : 0.f;
+    do_not_optimize(row[width / 2]);
+  });
+  bench.micro("background/solid_span", double(width), "pixels", [&] {
+    solid.sample_span(0.5f, 0.5f / width, 1.f / width, width, row.data());
+    do_not_optimize(row[width / 2]);
+  });
+  bench.micro("background/sample_xyz", double(width), "pixels", [&] {
+    for (size_t i{ 0 }; i < width; ++i) {
+      row[i] = gradient.sampleXYZ(Point2f{ (float(i) + 0.5f) / width, 0.5f });
+    }
+    do_not_optimize(row[width / 2]);
+  });
+}
+
+/// A 1920x1080 film filled with a smooth pattern, in [0,1] with overshoot.
+static std::unique_ptr<Film> make_full_hd_film() {
+  auto film = std::make_unique<Film>(Point2i{ 1920, 1080 }, "unused.png", Film::image_type_e::PNG);
+  std::vector<ColorXYZ> span(Film::default_tile_size);
+  for (int y{ 0 }; y < 1080; ++y) {
+    for (int x0{ 0 }; x0 < 1920; x0 += Film::default_tile_size) {
+      for (int i{ 0 }; i < Film::default_tile_size; ++i) {
+        float u = float(x0 + i) / 1920.f, v = float(y) / 1080.f;
+        span[size_t(i)] = ColorXYZ{ u * 1.1f, v, 0.5f * (u + v) };
+      }
+      film->add_span(x0, y, span.size(), span.data());
+    }
+  }
+  return film;
+}
+
+/// Resolving the accumulation buffer into file samples.
+static void bench_resolve(Bench &bench) {
+  std::unique_ptr<Film> film{ make_full_hd_film() };
+  const double pixels{ 1920.0 * 1080.0 };
+  std::vector<unsigned char> bytes(size_t(pixels) * 3 * 2);
+  const struct {
+    const char *name;
+    Resolver resolver;
+  } variants[]{ { "resolve/linear_8bit", Resolver{ false, false, 8 } },
+                { "resolve/srgb_8bit", Resolver{ true, false, 8 } },
+                { "resolve/srgb_dither_8bit", Resolver{ true, true, 8 } },
+                { "resolve/srgb_16bit", Resolver{ true, false, 16 } } };
+  for (const auto &variant : variants) {
+    film->m_resolver = variant.resolver;
+    bench.micro(variant.name, pixels, "pixels", [&] {
+      film->resolve_rows(0, 1080, bytes.data());
+      do_not_optimize(bytes[bytes.size() / 2]);
+    });
+  }
+  bench.micro("resolve/pow_reference", pixels, "pixels", [&] {
+    // What a naive resolve costs: one pow() per channel.
+    unsigned char *out = bytes.data();
+    for (int y{ 0 }; y < 1080; ++y) {
+      for (int x{ 0 }; x < 1920; ++x) {
+        ColorXYZ c = film->m_color_buffer_ptr->resolve(x, y);
+        for (int k{ 0 }; k < 3; ++k) {
+          *out++ = (unsigned char)(std::pow(Clamp(c[k], 0.f, 1.f), 1.f / 2.2f) * 255.f + 0.5f);
+        }
+      }
+    }
+    do_not_optimize(bytes[bytes.size() / 2]);
+  });
+}
+
+/// Writing a 1920x1080 image through the streaming writers.
+static void bench_writers(Bench &bench, ThreadPool &pool, const fs::path &dir) {
+  std::unique_ptr<Film> film{ make_full_hd_film() };
+  const size_t w{ 1920 }, h{ 1080 };
+  std::vector<unsigned char> rgb(w * h * 3);
+  film->resolve_rows(0, int(h), rgb.data());
+  const double pixels{ double(w * h) };
+  auto write_all = [&](std::unique_ptr<ImageWriter> writer) {
+    if (not writer or not writer->write_rows(rgb.data(), h) or not writer->close()) {
+      std::cerr << "rt3_bench: could not write into " << dir << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+  };
+  const std::string png{ (dir / "bench.png").string() };
+  const std::string ppm{ (dir / "bench.ppm").string() };
+  bench.once("write/png_level6", "micro", pixels, "pixels",
+             [&] { write_all(open_png_writer(png, w, h, 3, 6, nullptr)); });
+  bench.once("write/png_level6_parallel", "micro", pixels, "pixels",
+             [&] { write_all(open_png_writer(png, w, h, 3, 6, &pool)); });
+  bench.once("write/png_level1", "micro", pixels, "pixels",
+             [&] { write_all(open_png_writer(png, w, h, 3, 1, nullptr)); });
+  bench.once("write/ppm6", "micro", pixels, "pixels",
+             [&] { write_all(open_ppm6_writer(ppm, w, h, 3)); });
+  bench.once("write/ppm3", "micro", pixels, "pixels",
+             [&] { write_all(open_ppm3_writer(ppm, w, h, 3, nullptr)); });
+  bench.once("write/ppm3_parallel", "micro", pixels, "pixels",
+             [&] { write_all(open_ppm3_writer(ppm, w, h, 3, &pool)); });
+}
+
+/*!
+ * Full renders (parse, build, trace, write) of every `scene_0*.xml`. Scenes
+ * write their images relative to the working directory (often into
+ * `../images`), so they run from a scratch directory inside `dir`.
+ */
+static void bench_scenes(Bench &bench, const BenchOptions &opt, const fs::path &dir) {
+  std::vector<fs::path> scenes;
+  std::error_code ec;
+  for (const auto &entry : fs::directory_iterator(opt.scene_dir, ec)) {
+    const std::string name{ entry.path().filename().string() };
+    if (entry.path().extension() == ".xml" and name.rfind("scene_0", 0) == 0) {
+      scenes.push_back(fs::absolute(entry.path()));
+    }
+  }
+  if (ec or scenes.empty()) {
+    std::cerr << "rt3_bench: no scene_0*.xml in \"" << opt.scene_dir << "\"; skipping scenes."
+              << std::endl;
+    return;
+  }
+  std::sort(scenes.begin(), scenes.end());
+  RunningOptions run_opt;
+  run_opt.n_threads = opt.n_threads;
+  run_opt.resolution[0] = opt.resolution[0];
+  run_opt.resolution[1] = opt.resolution[1];
+  const double pixels{ double(opt.resolution[0]) * double(opt.resolution[1]) };
+  const fs::path cwd{ fs::current_path() };
+  fs::create_directories(dir / "images");
+  fs::create_directories(dir / "work");
+  fs::current_path(dir / "work");
+  for (const auto &scene : scenes) {
+    run_opt.filename = scene.string();
+    run_opt.scene_files = { run_opt.filename };
+    // Crop windows make some scenes render fewer pixels than the frame has.
+    bench.once("scene/" + scene.stem().string(), "scene", pixels, "frame_pixels", [&] {
+      API::init_engine(run_opt);
+      API::run();
+      API::clean_up();
+    });
+  }
+  fs::current_path(cwd);
+}
+
+// =============================================
+// main
+// =============================================
+
+static void usage(const char *msg = nullptr) {
+  if (msg != nullptr) {
+    std::cout << "rt3_bench: " << msg << "\n\n";
+  }
+  std::cout << "Usage: rt3_bench [<options>]\n"
+            << "    --help                  Print this help text.\n"
+            << "    --json <file>           Where the results go (default rt3_bench.json).\n"
+            << "    --filter <text>         Only run benchmarks whose name contains <text>.\n"
+            << "    --repeats <n>           Samples per benchmark (default 5).\n"
+            << "    --min-time <ms>         Minimum time per micro-benchmark sample (default 50).\n"
+            << "    --threads <n>           Worker threads (0 = one per core, the default).\n"
+            << "    --resolution <w> <h>    Resolution of the scene renders (default 640 480).\n"
+            << "    --scene-dir <dir>       Where the scene_0*.xml files are.\n"
+            << "    --no-scenes             Run the micro-benchmarks only.\n";
+  std::exit(msg != nullptr ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static BenchOptions parse_options(int argc, char *argv[]) {
+  BenchOptions opt;
+  for (int i{ 1 }; i < argc; ++i) {
+    const std::string option{ argv[i] };
+    auto value = [&]() -> std::string {
+      if (i + 1 == argc) {
+        usage(("missing value after " + option).c_str());
+      }
+      return argv[++i];
+    };
+    // The next argument, which must be a number of the type of `zero` and
+    // nothing else.
+    auto number = [&](auto zero) {
+      const std::string text{ value() };
+      decltype(zero) v{ zero };
+      const char *end = text.data() + text.size();
+      auto [ptr, ec] = std::from_chars(text.data(), end, v);
+      if (ec != std::errc{} or ptr != end or text.empty()) {
+        usage(("invalid value for " + option + ": \"" + text + "\"").c_str());
+      }
+      return v;
+    };
+    if (option == "--json") {
+      opt.json_file = value();
+    } else if (option == "--filter") {
+      opt.filter = value();
+    } else if (option == "--repeats") {
+      opt.repeats = std::max(1, number(0));
+    } else if (option == "--min-time") {
+      opt.min_time_ms = std::max(1.0, number(0.0));
+    } else if (option == "--threads" or option == "-t") {
+      opt.n_threads = number(size_t{ 0 });
+    } else if (option == "--resolution") {
+      opt.resolution[0] = number(0);
+      opt.resolution[1] = number(0);
+      if (opt.resolution[0] <= 0 or opt.resolution[1] <= 0) {
+        usage("--resolution needs two positive values");
+      }
+    } else if (option == "--scene-dir") {
+      opt.scene_dir = value();
+    } else if (option == "--no-scenes") {
+      opt.skip_scenes = true;
+    } else if (option == "--help" or option == "-h") {
+      usage();
+    } else {
+      usage(("unknown option " + option).c_str());
+    }
+  }
+  return opt;
+}
+
+int main(int argc, char *argv[]) {
+  const BenchOptions opt{ parse_options(argc, argv) };
+  // Scratch files (images written by the benchmarks) live here.
+  const fs::path dir{ fs::temp_directory_path() / "rt3_bench" };
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    std::cerr << "rt3_bench: cannot create " << dir << ": " << ec.message() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  ThreadPool pool{ ThreadPool::resolve_thread_count(opt.n_threads) };
+  Bench bench{ opt };
+  bench_parsing(bench);
+  bench_retrieve(bench);
+  bench_background(bench);
+  bench_resolve(bench);
+  bench_writers(bench, pool, dir);
+  if (not opt.skip_scenes) {
+    bench_scenes(bench, opt, dir);
+  }
+
+  std::ofstream json{ opt.json_file };
+  if (not json.is_open()) {
+    std::cerr << "rt3_bench: cannot write \"" << opt.json_file << "\"." << std::endl;
+    return EXIT_FAILURE;
+  }
+  write_json(json, opt, pool.size(), bench.results());
+  std::cerr << "[bench] " << bench.results().size() << " results written to \"" << opt.json_file
+            << "\"." << std::endl;
+  fs::remove_all(dir, ec);
+  return EXIT_SUCCESS;
+}
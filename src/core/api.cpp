@@ -1,24 +1,46 @@
 #include "api.h"
 #include "background.h"
+#include "bvh.h"
+#include "camera.h"
+#include "distributed.h"
+#include "log.h"
+#include "material.h"
+#include "render.h"
+#include "render_server.h"
+#include "sampler.h"
+#include "scene.h"
+#include "shape.h"
+#include "stats.h"
+#include "texture_cache.h"
+#include "wide_bvh.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <future>
 #include <memory>
 
 namespace rt3 {
 
-void render() {}
-
 //=== API's static members declaration and initialization.
 API::APIState API::curr_state = APIState::Uninitialized;
 RunningOptions API::curr_run_opt;
+MemoryArena API::scene_arena;
+MemoryArena *API::build_arena{&scene_arena};
 std::unique_ptr<RenderOptions> API::render_opt;
-// GraphicsState API::curr_GS;
+std::unique_ptr<ThreadPool> API::thread_pool;
+std::unique_ptr<ThreadPool> API::encode_pool;
+std::unique_ptr<TextureCache> API::texture_cache;
+bool API::frame_open{false};
+GraphicsState API::curr_GS;
 
 // THESE FUNCTIONS ARE NEEDED ONLY IN THIS SOURCE FILE (NO HEADER NECESSARY)
 // ˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇˇ
 
 Film *API::make_film(const std::string &name , const ParamSet &ps) {
-  std::cout << ">>> Inside API::make_film()\n";
+  RT3_LOG_INFO(">>> Inside API::make_film()");
+  // Mostly allocating and clearing the color buffer.
+  ScopedTimer timer{phase_e::SCENE_BUILD, "make film"};
   Film *film{nullptr};
   film = create_film(ps);
 
@@ -27,14 +49,526 @@ Film *API::make_film(const std::string &name , const ParamSet &ps) {
 }
 
 Background *API::make_background(const std::string &name, const ParamSet &ps) {
-  std::cout << ">>> Inside API::background()\n";
+  RT3_LOG_INFO(">>> Inside API::background()");
   Background *bkg{nullptr};
-  bkg = create_color_background(ps);
+  if (name == "image") {
+    bkg = create_image_background(ps);
+  } else if (name == "skybox") {
+    bkg = create_skybox_background(ps);
+  } else {
+    bkg = create_color_background(ps);
+  }
 
   // Return the newly created background.
   return bkg;
 }
 
+Camera *API::make_camera(const std::string &name, const ParamSet &ps,
+                         const Film &film) {
+  RT3_LOG_INFO(">>> Inside API::make_camera()");
+  Camera *camera{nullptr};
+  if (name == "orthographic") {
+    camera = create_orthographic_camera(ps, film);
+  } else if (name == "perspective") {
+    camera = create_perspective_camera(ps, film);
+  } else {
+    RT3_WARNING("Camera type \"" + name + "\" is not supported; using \"perspective\".");
+    camera = create_perspective_camera(ps, film);
+  }
+  return camera;
+}
+
+std::vector<const Shape *> API::make_shapes(const std::string &name,
+                                            const ParamSet &ps) {
+  RT3_LOG_INFO(">>> Inside API::make_shapes()");
+  std::vector<const Shape *> shapes;
+  if (name == "sphere") {
+    shapes.push_back(create_sphere(ps));
+  } else if (name == "trianglemesh") {
+    shapes = create_triangle_mesh(ps);
+  } else {
+    RT3_WARNING("Object type \"" + name + "\" is not supported; ignoring it.");
+  }
+  return shapes;
+}
+
+Material *API::make_material(const std::string &name, const ParamSet &ps) {
+  RT3_LOG_INFO(">>> Inside API::make_material()");
+  Material *material{nullptr};
+  if (name == "flat") {
+    material = create_flat_material(ps);
+  } else {
+    RT3_WARNING("Material type \"" + name + "\" is not supported; using \"flat\".");
+    material = create_flat_material(ps);
+  }
+  return material;
+}
+
+Sampler *API::make_sampler(const std::string &name, const ParamSet &ps) {
+  RT3_LOG_INFO(">>> Inside API::make_sampler()");
+  Sampler *sampler{nullptr};
+  if (name == "fixed") {
+    sampler = create_fixed_sampler(ps);
+  } else if (name == "adaptive") {
+    sampler = create_adaptive_sampler(ps);
+  } else {
+    RT3_WARNING("Sampler type \"" + name + "\" is not supported; using \"fixed\".");
+    sampler = create_fixed_sampler(ps);
+  }
+  return sampler;
+}
+
+Primitive *API::make_accelerator(const std::string &name,
+                                 std::vector<const Primitive *> prims,
+                                 const ParamSet &ps) {
+  RT3_LOG_INFO(">>> Inside API::make_accelerator()");
+  Primitive *aggregate{nullptr};
+  // "wide" picks the width that matches the SIMD registers of the target.
+  int width{native_packet_width};
+  if (name == "bvh") {
+    width = 2;
+  } else if (name == "bvh4") {
+    width = 4;
+  } else if (name == "bvh8") {
+    width = 8;
+  } else if (name != "wide") {
+    RT3_WARNING("Accelerator type \"" + name + "\" is not supported; using \"wide\".");
+  }
+  if (width == 4) {
+    aggregate = create_wide_bvh_accelerator<4>(std::move(prims), ps, thread_pool.get());
+  } else if (width == 8) {
+    aggregate = create_wide_bvh_accelerator<8>(std::move(prims), ps, thread_pool.get());
+  } else {
+    aggregate = create_bvh_accelerator(std::move(prims), ps, thread_pool.get());
+  }
+  return aggregate;
+}
+
+/// Bounds of the shapes an object tag gives, without building them; empty if
+/// unknown.
+static Bounds3f object_bounds(const std::string &type, const ParamSet &ps) {
+  Bounds3f bounds;
+  if (type == "sphere") {
+    // Same defaults as `create_sphere()`.
+    const Point3f center = retrieve(ps, "center", Point3f{0, 0, 0});
+    const float radius = retrieve(ps, "radius", real_type{1});
+    const Vector3f r{radius, radius, radius};
+    bounds = Bounds3f{center - r, center + r};
+  } else if (type == "trianglemesh") {
+    // Only the vertices are decoded; indices and normals wait.
+    for (const Point3f &v : retrieve_span<Point3f>(ps, "vertices")) {
+      bounds = bounds_union(bounds, v);
+    }
+  }
+  return bounds;
+}
+
+std::vector<const Primitive *> API::make_primitives(const Camera *camera,
+                                                     const Film *film) {
+  // Samples stay inside their pixel, but the adaptive sampler also looks at
+  // the ring of pixels around each tile.
+  Bounds2i window;
+  if (camera != nullptr) {
+    const auto tiles = film->tiles();
+    window = Bounds2i{Point2i{0, 0}, Point2i{0, 0}};
+    if (not tiles.empty()) {
+      window = Bounds2i{Point2i{tiles.front().x0 - 1, tiles.front().y0 - 1},
+                        Point2i{tiles.back().x1 + 1, tiles.back().y1 + 1}};
+    }
+  }
+  std::vector<const Primitive *> prims;
+  size_t n_culled{0};
+  for (const ObjectOptions &obj : render_opt->objects) {
+    if (camera != nullptr) {
+      const Bounds3f bounds{object_bounds(obj.type, obj.ps)};
+      if (not bounds.empty() and not camera->may_see(bounds, window)) {
+        ++n_culled;
+        continue;
+      }
+    }
+    for (const Shape *shape : make_shapes(obj.type, obj.ps)) {
+      // Primitives own nothing; the arena takes them back in one go.
+      prims.push_back(RT3_ARENA_ALLOC(*build_arena,
+                                      GeometricPrimitive)(shape, obj.material));
+    }
+  }
+  if (n_culled > 0) {
+    RT3_MESSAGE("    " + std::to_string(n_culled) + " of " +
+                std::to_string(render_opt->objects.size()) +
+                " objects are out of view; not built.\n");
+  }
+  // Nothing refers to the parameters anymore, apart from the shapes' own
+  // copies; texts never decoded go with them.
+  render_opt->objects.clear();
+  return prims;
+}
+
+/// Size of the tree behind `aggregate`, for the render log.
+static std::string describe_accelerator(const Primitive *aggregate) {
+  if (const auto *bvh = dynamic_cast<const BVHAccel *>(aggregate)) {
+    return "binary BVH, " + std::to_string(bvh->node_count()) + " nodes, depth " +
+           std::to_string(bvh->depth());
+  }
+  if (const auto *bvh = dynamic_cast<const BVH4Accel *>(aggregate)) {
+    return "4-wide BVH, " + std::to_string(bvh->node_count()) + " nodes, depth " +
+           std::to_string(bvh->depth());
+  }
+  if (const auto *bvh = dynamic_cast<const BVH8Accel *>(aggregate)) {
+    return "8-wide BVH, " + std::to_string(bvh->node_count()) + " nodes, depth " +
+           std::to_string(bvh->depth());
+  }
+  return "unknown";
+}
+
+/// Prints the timing of a render.
+static void print_report(const RenderReport &report,
+                         std::chrono::steady_clock::duration diff) {
+  // Seconds
+  auto diff_sec = std::chrono::duration_cast<std::chrono::seconds>(diff);
+  RT3_MESSAGE("    Time elapsed: " + std::to_string(diff_sec.count()) +
+              " seconds (" +
+              std::to_string(
+                  std::chrono::duration<double, std::milli>(diff).count()) +
+              " ms) \n");
+  RT3_MESSAGE("    Tiles: " + std::to_string(report.n_tiles) + " on " +
+              std::to_string(report.n_threads) +
+              " threads; time per tile (min/avg/max): " +
+              std::to_string(report.tile_ms_min) + " / " +
+              std::to_string(report.tile_ms_avg) + " / " +
+              std::to_string(report.tile_ms_max) + " ms\n");
+  const TextureCache::Stats tex{API::texture_cache->stats()};
+  if (tex.hits + tex.misses > 0) {
+    RT3_MESSAGE("    Texture cache: " + std::to_string(tex.misses) +
+                " tiles read, " + std::to_string(tex.hits) + " hits, " +
+                std::to_string(tex.evictions) + " evicted; " +
+                std::to_string(tex.bytes_used >> 20) + " of " +
+                std::to_string(API::texture_cache->capacity() >> 20) +
+                " MiB in use\n");
+  }
+  if (report.n_samples > report.n_pixels and report.n_pixels > 0) {
+    RT3_MESSAGE("    Samples: " + std::to_string(report.n_samples) + " (" +
+                std::to_string(double(report.n_samples) /
+                               double(report.n_pixels)) +
+                " per pixel on average)\n");
+  }
+  if (API::curr_run_opt.quick_render) {
+    RT3_MESSAGE("    Refinement passes: " + std::to_string(report.n_passes) +
+                (report.out_of_time ? " (stopped by the time budget)" : "") +
+                "\n");
+  }
+}
+
+/// Output name of frame `frame` of a sequence: "anim.png" -> "anim_0007.png".
+static std::string frame_filename(const std::string &base, size_t frame) {
+  char number[24];  // Room for any size_t.
+  std::snprintf(number, sizeof(number), "_%04zu", frame);
+  auto dot = base.find_last_of('.');
+  auto slash = base.find_last_of("/\\");
+  if (dot == std::string::npos or (slash != std::string::npos and dot < slash)) {
+    return base + number;
+  }
+  return base.substr(0, dot) + number + base.substr(dot);
+}
+
+void API::render_still(Film &the_film, const Camera &the_camera,
+                       const Scene &the_scene) {
+  // Structure biding, c++17.
+  auto res = the_film.get_resolution();
+  size_t w = res[0];
+  size_t h = res[1];
+  RT3_MESSAGE("    Image dimensions in pixels (W x H): " + std::to_string(w) +
+              " x " + std::to_string(h) + ".\n");
+  RT3_MESSAGE(
+      "    Ray tracing is usually a slow process, please be patient: \n");
+
+  ArenaPtr<Sampler> the_sampler{
+      make_sampler(render_opt->sampler_type, render_opt->sampler_ps)};
+
+  //================================================================================
+  auto start = std::chrono::steady_clock::now();
+  RenderReport report;
+  ScopedTimer timer{phase_e::RENDER, "render"};
+  const bool worker{not curr_run_opt.worker_address.empty()};
+  if (worker) {
+    // The coordinator says which tiles to render, and writes the image.
+    report = serve_leases(the_film, the_scene, the_camera, *the_sampler,
+                          *thread_pool);
+  } else if (curr_run_opt.quick_render) {
+    if (curr_run_opt.coordinator_port > 0) {
+      RT3_WARNING("--quick renders are not distributed; rendering locally.");
+    }
+    // Successive refinement; the image is written after the first pass and
+    // at the end, so there is no streaming while rendering.
+    report = render_progressive(the_film, the_scene, the_camera, *thread_pool,
+                                curr_run_opt.time_budget_ms);
+  } else {
+    // Finished bands of tiles are encoded while the rest is rendered.
+    the_film.open_output(encode_pool.get());
+    if (curr_run_opt.coordinator_port > 0) {
+      report = render_distributed(the_film, the_scene, the_camera,
+                                  *the_sampler, *thread_pool,
+                                  curr_run_opt.coordinator_port);
+    } else {
+      report = render(the_film, the_scene, the_camera, *the_sampler,
+                      *thread_pool);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  //================================================================================
+  stats_add(counter_e::RENDER_NS,
+            uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         end - start).count()));
+  print_report(report, end - start);
+
+  if (not worker) {
+    the_film.write_image(thread_pool.get());
+  }
+}
+
+void API::render_frames(const Scene &the_scene) {
+  const size_t n_frames{render_opt->frames.size()};
+  if (not curr_run_opt.worker_address.empty()) {
+    RT3_WARNING("Frame sequences are not distributed; the coordinator renders "
+                "this scene alone.");
+    return;
+  }
+  if (curr_run_opt.coordinator_port > 0) {
+    RT3_WARNING("Frame sequences are not distributed; rendering locally.");
+  }
+  ArenaPtr<Sampler> the_sampler{
+      make_sampler(render_opt->sampler_type, render_opt->sampler_ps)};
+  // The frame being encoded, on its own thread, while the next one renders.
+  std::future<void> encoding;
+  for (size_t i{0}; i < n_frames; ++i) {
+    const FrameOptions &frame = render_opt->frames[i];
+    // Frame parameters override the scene's.
+    ParamSet film_ps{render_opt->film_ps};
+    film_ps.merge(frame.film_ps);
+    std::shared_ptr<Film> the_film{make_film(render_opt->film_type, film_ps),
+                                   ArenaDeleter{}};
+    if (not the_film) {
+      continue;
+    }
+    if (not frame.film_ps.contains("filename") and n_frames > 1) {
+      the_film->m_filename = frame_filename(the_film->m_filename, i);
+    }
+    RT3_MESSAGE("    Frame " + std::to_string(i + 1) + "/" +
+                std::to_string(n_frames) + ": \"" + the_film->m_filename +
+                "\" (" + std::to_string(the_film->m_full_resolution[0]) +
+                " x " + std::to_string(the_film->m_full_resolution[1]) +
+                ")\n");
+
+    ParamSet camera_ps{render_opt->lookat_ps};
+    camera_ps.merge(frame.lookat_ps);
+    camera_ps.merge(render_opt->camera_ps);
+    camera_ps.merge(frame.camera_ps);
+    std::string camera_type{
+        retrieve(frame.camera_ps, "type", render_opt->camera_type)};
+    ArenaPtr<Camera> the_camera{make_camera(camera_type, camera_ps, *the_film)};
+
+    the_film->load_base_frame();
+    auto start = std::chrono::steady_clock::now();
+    RenderReport report;
+    {
+      ScopedTimer timer{phase_e::RENDER, "render frame", int(i), 0};
+      if (curr_run_opt.quick_render) {
+        report = render_progressive(*the_film, the_scene, *the_camera,
+                                    *thread_pool, curr_run_opt.time_budget_ms);
+      } else {
+        report = render(*the_film, the_scene, *the_camera, *the_sampler,
+                        *thread_pool);
+      }
+    }
+    auto diff = std::chrono::steady_clock::now() - start;
+    stats_add(counter_e::RENDER_NS,
+              uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           diff).count()));
+    print_report(report, diff);
+
+    // Wait for the previous frame's file, so at most two frames are alive,
+    // then write this one in the background, on the encoders' pool: the
+    // render pool is busy with the next frame.
+    if (encoding.valid()) {
+      encoding.get();
+    }
+    encoding = std::async(std::launch::async, [the_film]() {
+      the_film->write_image(encode_pool.get());
+    });
+  }
+  if (encoding.valid()) {
+    encoding.get();
+  }
+}
+
+void API::serve(Scene &the_scene) {
+  RenderServer server{curr_run_opt.server_port};
+  if (not server.ok()) {
+    return;
+  }
+  // Edits may resize or crop the film, so the command line's overrides
+  // become plain film parameters, which edits can then change.
+  if (curr_run_opt.resolution[0] > 0 and curr_run_opt.resolution[1] > 0) {
+    render_opt->film_ps.add("x_res", curr_run_opt.resolution[0]);
+    render_opt->film_ps.add("y_res", curr_run_opt.resolution[1]);
+    curr_run_opt.resolution[0] = curr_run_opt.resolution[1] = 0;
+  }
+  auto &cw = curr_run_opt.crop_window;
+  if (cw[0][0] != 0 or cw[0][1] != 1 or cw[1][0] != 0 or cw[1][1] != 1) {
+    render_opt->film_ps.add_array(
+        "crop_window", std::vector<real_type>{cw[0][0], cw[0][1], cw[1][0], cw[1][1]});
+    cw[0][0] = cw[1][0] = 0;
+    cw[0][1] = cw[1][1] = 1;
+  }
+  // Every frame is rendered from scratch, and nothing is written to disk.
+  curr_run_opt.incremental = false;
+
+  // Every object an edit may rebuild gets an arena of its own, emptied
+  // right before the object is built again, so the memory of a server stays
+  // flat however many edits come in. The arenas are declared before the
+  // objects, which are therefore destroyed first.
+  constexpr size_t edit_block_size{4 * 1024};
+  MemoryArena film_arena{edit_block_size}, camera_arena{edit_block_size},
+      bkg_arena{edit_block_size}, sampler_arena{edit_block_size};
+  auto build_in = [](MemoryArena &arena, auto &&make) {
+    arena.reset();
+    build_arena = &arena;
+    auto *obj = make();
+    build_arena = &scene_arena;
+    return obj;
+  };
+  ArenaPtr<Film> the_film;
+  ArenaPtr<Camera> the_camera;
+  ArenaPtr<Sampler> the_sampler;
+  SceneScript edit;
+  while (server.next_edit(edit)) {
+    // The geometry is built once; edits may change the view, the film, the
+    // background and the sampler.
+    auto accepted = [](directive_e type) {
+      return type == directive_e::FILM or type == directive_e::CAMERA or
+             type == directive_e::LOOKAT or type == directive_e::BACKGROUND or
+             type == directive_e::SAMPLER;
+    };
+    if (not std::all_of(edit.begin(), edit.end(),
+                        [&](const SceneDirective &d) { return accepted(d.type); })) {
+      edit.clear();
+      server.send_error("only film, camera, lookat, background and sampler tags "
+                        "can be edited; restart the server for other changes");
+      continue;
+    }
+    // Check the edit before any of it is applied: a value no object can be
+    // built from is the client's mistake, and must not end the server.
+    ParamSet film_ps{render_opt->film_ps};
+    for (const SceneDirective &d : edit) {
+      if (d.type == directive_e::FILM) {
+        film_ps.merge(d.ps);
+      }
+    }
+    if (const std::string problem{check_film(film_ps)}; not problem.empty()) {
+      edit.clear();
+      server.send_error(problem);
+      continue;
+    }
+    bool bkg_dirty{false};
+    for (const SceneDirective &d : edit) {
+      switch (d.type) {
+      case directive_e::FILM:
+        render_opt->film_ps.merge(d.ps);
+        the_film.reset();
+        break;
+      case directive_e::CAMERA:
+        render_opt->camera_type = retrieve(d.ps, "type", render_opt->camera_type);
+        render_opt->camera_ps.merge(d.ps);
+        the_camera.reset();
+        break;
+      case directive_e::LOOKAT:
+        render_opt->lookat_ps.merge(d.ps);
+        the_camera.reset();
+        break;
+      case directive_e::BACKGROUND:
+        // Another type starts over; the same type changes some parameters.
+        if (d.ps.contains("type")) {
+          render_opt->bkg_type = retrieve(d.ps, "type", render_opt->bkg_type);
+          render_opt->bkg_ps = d.ps;
+        } else {
+          render_opt->bkg_ps.merge(d.ps);
+        }
+        bkg_dirty = true;
+        break;
+      case directive_e::SAMPLER:
+        render_opt->sampler_type = retrieve(d.ps, "type", render_opt->sampler_type);
+        render_opt->sampler_ps.merge(d.ps);
+        the_sampler.reset();
+        break;
+      default:
+        break;
+      }
+    }
+    edit.clear();
+
+    // A server takes edits for as long as it runs, so its trace keeps the
+    // latest frame only, written out after each one.
+    stats_clear_trace();
+    // Rebuild what the edit touched; the rest stays as it was.
+    std::string rebuilt;
+    auto build_timer = std::make_unique<ScopedTimer>(phase_e::SCENE_BUILD, "scene edit");
+    if (not the_film) {
+      // The camera's screen window follows the film's aspect ratio.
+      the_camera.reset();
+      the_film.reset(build_in(film_arena, [] {
+        return make_film(render_opt->film_type, render_opt->film_ps);
+      }));
+      rebuilt += " film";
+    } else {
+      the_film->m_color_buffer_ptr->clear();
+    }
+    if (not the_camera) {
+      ParamSet camera_ps{render_opt->lookat_ps};
+      camera_ps.merge(render_opt->camera_ps);
+      the_camera.reset(build_in(camera_arena, [&] {
+        return make_camera(render_opt->camera_type, camera_ps, *the_film);
+      }));
+      rebuilt += " camera";
+    }
+    if (bkg_dirty) {
+      // The previous background may live in `bkg_arena`.
+      the_scene.set_background(nullptr);
+      the_scene.set_background(ArenaPtr<Background>{build_in(bkg_arena, [] {
+        return make_background(render_opt->bkg_type, render_opt->bkg_ps);
+      })});
+      rebuilt += " background";
+    }
+    if (not the_sampler) {
+      the_sampler.reset(build_in(sampler_arena, [] {
+        return make_sampler(render_opt->sampler_type, render_opt->sampler_ps);
+      }));
+      rebuilt += " sampler";
+    }
+    build_timer.reset();
+
+    auto start = std::chrono::steady_clock::now();
+    RenderReport report;
+    {
+      ScopedTimer timer{phase_e::RENDER, "render"};
+      report = server.render(*the_film, the_scene, *the_camera, *the_sampler,
+                             *thread_pool);
+    }
+    auto diff = std::chrono::steady_clock::now() - start;
+    stats_add(counter_e::RENDER_NS,
+              uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           diff).count()));
+    print_report(report, diff);
+    server.send_done(std::chrono::duration<double, std::milli>(diff).count(),
+                     report, rebuilt.empty() ? rebuilt : rebuilt.substr(1));
+    if (not curr_run_opt.trace_file.empty() and
+        not stats_write_trace(curr_run_opt.trace_file)) {
+      RT3_WARNING("Could not write trace file \"" + curr_run_opt.trace_file + "\".");
+    }
+  }
+  // A rebuilt background goes with `bkg_arena`; nothing renders anymore.
+  the_scene.set_background(nullptr);
+  RT3_MESSAGE("    Render server shutting down.\n");
+}
+
 // ˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆˆ
 // END OF THE AUXILIARY FUNCTIONS
 // =========================================================================
@@ -43,6 +577,7 @@ Background *API::make_background(const std::string &name, const ParamSet &ps) {
 void API::init_engine(const RunningOptions &opt) {
   // Save running option sent from the main().
   curr_run_opt = opt;
+  set_log_level(opt.verbose);
   // Check current machine state.
   if (curr_state != APIState::Uninitialized) {
     RT3_ERROR("API::init_engine() has already been called! ");
@@ -51,8 +586,28 @@ void API::init_engine(const RunningOptions &opt) {
   curr_state = APIState::SetupBlock;
   // Preprare render infrastructure for a new scene.
   render_opt = std::make_unique<RenderOptions>();
+  // Spin up the worker threads, unless a previous cycle left a suitable pool.
+  size_t n_threads = ThreadPool::resolve_thread_count(opt.n_threads);
+  if (not thread_pool or thread_pool->size() != n_threads) {
+    thread_pool = std::make_unique<ThreadPool>(n_threads);
+  }
+  // A quarter as many for the encoders, which mostly wait for bands.
+  const size_t n_encoders{n_threads > 1 ? std::max<size_t>(2, n_threads / 4) : 0};
+  if (n_encoders == 0) {
+    encode_pool.reset();
+  } else if (not encode_pool or encode_pool->size() != n_encoders) {
+    encode_pool = std::make_unique<ThreadPool>(n_encoders, "encoder");
+  }
+  // Same for the texture cache, which keeps the tiles loaded so far.
+  const size_t cache_bytes{opt.texture_cache_mb << 20};
+  if (not texture_cache or texture_cache->capacity() != cache_bytes) {
+    texture_cache = std::make_unique<TextureCache>(cache_bytes);
+  }
+  // Counters start over with every scene.
+  stats_reset();
+  stats_enable_trace(not opt.trace_file.empty());
   // Create a new initial GS
-  // curr_GS = GraphicsState();
+  curr_GS = GraphicsState();
   RT3_MESSAGE("[1] Rendering engine initiated.\n");
 }
 
@@ -65,12 +620,25 @@ void API::clean_up() {
   }
   curr_state = APIState::Uninitialized;
 
+  stats_print_report();
+  // The trace holds every scene rendered so far, so the last write covers
+  // the whole batch.
+  if (not curr_run_opt.trace_file.empty()) {
+    if (stats_write_trace(curr_run_opt.trace_file)) {
+      RT3_MESSAGE("    Trace written to \"" + curr_run_opt.trace_file + "\".\n");
+    } else {
+      RT3_WARNING("Could not write trace file \"" + curr_run_opt.trace_file +
+                  "\".");
+    }
+  }
   RT3_MESSAGE("[4] Rendering engine clean up concluded. Shutting down...\n");
 }
 
 void API::run() {
   // Try to load and parse the scene from a file.
   RT3_MESSAGE("[2] Beginning scene file parsing...\n");
+  // Rendering happens inside, at `world_end`, and is timed on its own.
+  ScopedTimer timer{phase_e::PARSE, "parse"};
   // Recall that the file name comes from the running option struct.
   parse(curr_run_opt.filename.c_str());
 }
@@ -85,41 +653,71 @@ void API::world_end() {
   // The scene has been properly set up and the scene has
   // already been parsed. It's time to render the scene.
 
-  // At this point, we have the background as a solitary pointer here.
-  // In the future, the background will be parte of the scene object.
-  std::unique_ptr<Background> the_background{
+  // The background and the geometry make up the scene, which is built once
+  // and shared by every frame.
+  auto build_timer = std::make_unique<ScopedTimer>(phase_e::SCENE_BUILD, "scene build");
+  ArenaPtr<Background> the_background{
       make_background(render_opt->bkg_type, render_opt->bkg_ps)};
-  // Same with the film, that later on will belong to a camera object.
-  std::unique_ptr<Film> the_film{
-      make_film(render_opt->film_type, render_opt->film_ps)};
 
-  // Run only if we got film and background.
-  if (the_film and the_background) {
+  // Run only if we got a background.
+  if (the_background) {
+    // A still image has a single view, known before the geometry is built,
+    // so objects out of it can be skipped; frames may each look elsewhere.
+    // The server's view changes with every edit, so it keeps everything.
+    const bool serving{curr_run_opt.server_port > 0};
+    ArenaPtr<Film> the_film;
+    ArenaPtr<Camera> the_camera;
+    if (render_opt->frames.empty() and not serving) {
+      the_film.reset(make_film(render_opt->film_type, render_opt->film_ps));
+      if (the_film) {
+        // Incremental crops start from the previous frame, which may also
+        // grow the crop window to the full frame.
+        the_film->load_base_frame();
+        // The legacy camera parameters of the `lookat` tag may also come
+        // inside the `camera` tag, which wins.
+        ParamSet camera_ps{render_opt->lookat_ps};
+        camera_ps.merge(render_opt->camera_ps);
+        the_camera.reset(
+            make_camera(render_opt->camera_type, camera_ps, *the_film));
+      }
+    }
+    ArenaPtr<Primitive> the_aggregate;
+    std::vector<const Primitive *> prims;
+    if (the_film or serving or not render_opt->frames.empty()) {
+      prims = make_primitives(the_camera.get(), the_film.get());
+    }
+    if (not prims.empty()) {
+      const size_t n_prims{prims.size()};
+      auto start = std::chrono::steady_clock::now();
+      the_aggregate.reset(make_accelerator(render_opt->accelerator_type,
+                                           std::move(prims),
+                                           render_opt->accelerator_ps));
+      auto diff = std::chrono::steady_clock::now() - start;
+      RT3_MESSAGE(
+          "    Accelerator: " + describe_accelerator(the_aggregate.get()) +
+          " over " + std::to_string(n_prims) + " primitives; built in " +
+          std::to_string(std::chrono::duration<double, std::milli>(diff).count()) +
+          " ms\n");
+    }
+    // Scope of the scene: it must be gone before `reset_engine()` frees the
+    // arena its objects live in.
+    Scene the_scene{std::move(the_background), std::move(the_aggregate)};
+    build_timer.reset();
     RT3_MESSAGE("    Parsing scene successfuly done!\n");
     RT3_MESSAGE("[2] Starting ray tracing progress.\n");
-
-    // Structure biding, c++17.
-    auto res = the_film->get_resolution();
-    size_t w = res[0];
-    size_t h = res[1];
-    RT3_MESSAGE("    Image dimensions in pixels (W x H): " + std::to_string(w) +
-                " x " + std::to_string(h) + ".\n");
-    RT3_MESSAGE(
-        "    Ray tracing is usually a slow process, please be patient: \n");
-
-    //================================================================================
-    auto start = std::chrono::steady_clock::now();
-    render(); // TODO: This is the ray tracer's  main loop.
-    auto end = std::chrono::steady_clock::now();
-    //================================================================================
-    auto diff = end - start; // Store the time difference between start and end
-    // Seconds
-    auto diff_sec = std::chrono::duration_cast<std::chrono::seconds>(diff);
-    RT3_MESSAGE("    Time elapsed: " + std::to_string(diff_sec.count()) +
-                " seconds (" +
-                std::to_string(
-                    std::chrono::duration<double, std::milli>(diff).count()) +
-                " ms) \n");
+    if (serving) {
+      if (not render_opt->frames.empty()) {
+        RT3_WARNING("Frame sequences are not served; the server renders the "
+                    "scene's own film and camera.");
+      }
+      serve(the_scene);
+    } else if (render_opt->frames.empty()) {
+      if (the_film) {
+        render_still(*the_film, *the_camera, the_scene);
+      }
+    } else {
+      render_frames(the_scene);
+    }
   }
   // [4] Basic clean up
   curr_state = APIState::SetupBlock; // correct machine state.
@@ -131,14 +729,17 @@ void API::world_end() {
 /// camera setup. Hard reset on the engine. User needs to setup all entities,
 /// such as camera, integrator, accelerator, etc.
 void API::reset_engine() {
-  // curr_GS = GraphicsState();
+  curr_GS = GraphicsState();
   // This will delete all information on integrator, cameras, filters,
   // acceleration structures, etc., that has been set previously.
   render_opt = std::make_unique<RenderOptions>();
+  // Every object built for the previous scene has been destroyed by now, so
+  // its memory can be taken back in one go.
+  scene_arena.reset();
 }
 
 void API::background(const ParamSet &ps) {
-  std::cout << ">>> Inside API::background()\n";
+  RT3_LOG_INFO(">>> Inside API::background()");
   VERIFY_WORLD_BLOCK("API::background");
 
   // retrieve type from ps.
@@ -148,8 +749,52 @@ void API::background(const ParamSet &ps) {
   render_opt->bkg_ps = ps;
 }
 
+void API::accelerator(const ParamSet &ps) {
+  RT3_LOG_INFO(">>> Inside API::accelerator()");
+  VERIFY_SETUP_BLOCK("API::accelerator");
+
+  std::string type = retrieve(ps, "type", string{"wide"});
+  render_opt->accelerator_type = type;
+  render_opt->accelerator_ps = ps;
+}
+
+void API::sampler(const ParamSet &ps) {
+  RT3_LOG_INFO(">>> Inside API::sampler()");
+  VERIFY_SETUP_BLOCK("API::sampler");
+
+  std::string type = retrieve(ps, "type", string{"fixed"});
+  render_opt->sampler_type = type;
+  render_opt->sampler_ps = ps;
+}
+
+void API::material(const ParamSet &ps) {
+  RT3_LOG_INFO(">>> Inside API::material()");
+  VERIFY_WORLD_BLOCK("API::material");
+
+  std::string type = retrieve(ps, "type", string{"flat"});
+  // Becomes the material of every object from here on.
+  curr_GS.curr_material = make_material(type, ps);
+}
+
+void API::object(const ParamSet &ps) {
+  RT3_LOG_INFO(">>> Inside API::object()");
+  VERIFY_WORLD_BLOCK("API::object");
+
+  std::string type = retrieve(ps, "type", string{"unknown"});
+  if (curr_GS.curr_material == nullptr) {
+    // Objects before any `material` tag are plain white.
+    curr_GS.curr_material = make_material("flat", ParamSet{});
+  }
+  // Built at `world_end()`, once the view is known.
+  render_opt->objects.push_back({type, ps, curr_GS.curr_material});
+}
+
 void API::film(const ParamSet &ps) {
-  std::cout << ">>> Inside API::film()\n";
+  RT3_LOG_INFO(">>> Inside API::film()");
+  if (frame_open) {
+    render_opt->frames.back().film_ps.merge(ps);
+    return;
+  }
   VERIFY_SETUP_BLOCK("API::film");
 
   // retrieve type from ps.
@@ -158,4 +803,42 @@ void API::film(const ParamSet &ps) {
   render_opt->film_ps = ps;
 }
 
+void API::camera(const ParamSet &ps) {
+  RT3_LOG_INFO(">>> Inside API::camera()");
+  if (frame_open) {
+    render_opt->frames.back().camera_ps.merge(ps);
+    return;
+  }
+  VERIFY_SETUP_BLOCK("API::camera");
+
+  // retrieve type from ps.
+  std::string type = retrieve(ps, "type", string{"unknown"});
+  render_opt->camera_type = type;
+  render_opt->camera_ps = ps;
+}
+
+void API::look_at(const ParamSet &ps) {
+  RT3_LOG_INFO(">>> Inside API::look_at()");
+  if (frame_open) {
+    render_opt->frames.back().lookat_ps.merge(ps);
+    return;
+  }
+  VERIFY_SETUP_BLOCK("API::look_at");
+  render_opt->lookat_ps = ps;
+}
+
+void API::frame_begin() {
+  VERIFY_INITIALIZED("API::frame_begin");
+  if (frame_open) {
+    RT3_ERROR("Frames cannot be nested.");
+  }
+  render_opt->frames.emplace_back();
+  frame_open = true;
+}
+
+void API::frame_end() {
+  VERIFY_INITIALIZED("API::frame_end");
+  frame_open = false;
+}
+
 } // namespace rt3
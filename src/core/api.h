@@ -4,7 +4,9 @@
 #include <string>
 
 #include "rt3.h"
+#include "memory.h"
 #include "paramset.h"
+#include "thread_pool.h"
 
 //=== API Macro definitions
 
@@ -34,6 +36,22 @@
  }
 
 namespace rt3 {
+/// What one frame of a sequence changes. These parameters are merged over
+/// the scene's own film, camera and lookat parameters.
+struct FrameOptions {
+  ParamSet film_ps;
+  ParamSet camera_ps;
+  ParamSet lookat_ps;
+};
+
+/// An `object` tag, as recorded by `API::object()`; its shapes are built by
+/// `API::world_end()`, if some camera ray may reach them.
+struct ObjectOptions {
+  string type;
+  ParamSet ps;
+  const Material* material;
+};
+
 /// Collection of objects and diretives that control rendering, such as camera,
 /// lights, prims.
 struct RenderOptions {
@@ -43,15 +61,29 @@ struct RenderOptions {
   /// the Camera
   string camera_type{ "perspective" };
   ParamSet camera_ps;
+  /// Legacy camera location (`lookat` tag).
+  ParamSet lookat_ps;
   /// the Bakcground
   string bkg_type{ "solid" };  // "image", "interpolated"
   ParamSet bkg_ps;
+  /// the Accelerator
+  string accelerator_type{ "wide" };  // "bvh", "bvh4", "bvh8"
+  ParamSet accelerator_ps;
+  /// the Sampler
+  string sampler_type{ "fixed" };  // "adaptive"
+  ParamSet sampler_ps;
+  /// Every object of the world, in order.
+  std::vector<ObjectOptions> objects;
+  /// Frames of a sequence; empty for a single image.
+  std::vector<FrameOptions> frames;
 };
 
 /// Collection of data related to a Graphics state, such as current material,
 /// lib of material, etc.
 struct GraphicsState {
-  // Not necessary in Project 01 through Project 07.
+  /// Material given to the objects that follow; `nullptr` until the first
+  /// `material` tag or object (which gets a default one).
+  const Material* curr_material{ nullptr };
 };
 
 /// Static class that manages the render process
@@ -66,6 +98,15 @@ class API {
 
   /// Stores the running options collect in main().
   static RunningOptions curr_run_opt;
+  /// Holds the scene objects built by the factories (film, background, ...),
+  /// which share the lifetime of the scene. Released by `reset_engine()`.
+  static MemoryArena scene_arena;
+  /// Where the factories place what they build: `scene_arena`, except while
+  /// `serve()` rebuilds an object in an arena of its own.
+  static MemoryArena* build_arena;
+  /// Tiles of the image backgrounds. Created by `init_engine()` and kept
+  /// across the scenes this process renders, like the thread pool.
+  static std::unique_ptr<TextureCache> texture_cache;
 
  private:
   /// Current API state
@@ -77,9 +118,17 @@ class API {
    */
   /// Unique infrastructure to render a scene (camera, integrator, etc.).
   static std::unique_ptr<RenderOptions> render_opt;
-  // [NO NECESSARY IN THIS PROJECT]
-  // /// The current GraphicsState
-  // static GraphicsState curr_GS;
+  /// Worker threads shared by every render. It survives `clean_up()`, so
+  /// the threads are created only once per process.
+  static std::unique_ptr<ThreadPool> thread_pool;
+  /// A few threads of their own for the image encoders that run while
+  /// `thread_pool` renders (streamed output, animation frames), so their
+  /// work never queues behind tiles. None with a single render thread.
+  static std::unique_ptr<ThreadPool> encode_pool;
+  /// Inside a `frame` tag: film/camera/lookat go to the current frame.
+  static bool frame_open;
+  /// The current GraphicsState
+  static GraphicsState curr_GS;
   // [NOT NECESSARY IN THIS PROJECT]
   // /// Pointer to the scene. We keep it as parte of the API because it may be
   // reused later [1] Create the integrator. static unique_ptr< Scene >
@@ -89,7 +138,29 @@ class API {
   ///
   static Film* make_film(const string& name, const ParamSet& ps);
   static Background* make_background(const string& name, const ParamSet& ps);
-  static Camera* make_camera(const string& name, const ParamSet& ps);
+  /// `ps` holds the camera and `lookat` parameters; the film gives the
+  /// resolution (and the default aspect ratio).
+  static Camera* make_camera(const string& name, const ParamSet& ps, const Film& film);
+  static std::vector<const Shape*> make_shapes(const string& name, const ParamSet& ps);
+  static Material* make_material(const string& name, const ParamSet& ps);
+  static Sampler* make_sampler(const string& name, const ParamSet& ps);
+  static Primitive* make_accelerator(const string& name,
+                                     std::vector<const Primitive*> prims,
+                                     const ParamSet& ps);
+  /*!
+   * Builds the primitives of `render_opt->objects`, in the scene arena.
+   * With a `camera`, objects whose bounds no ray through the rendered part
+   * of `film` can reach are left out, and their parameters never decoded.
+   */
+  static std::vector<const Primitive*> make_primitives(const Camera* camera, const Film* film);
+  /// Renders and writes a single image.
+  static void render_still(Film& film, const Camera& camera, const Scene& scene);
+  /// Renders every frame of `render_opt->frames` over the same world. Frame
+  /// N is encoded on a separate thread while frame N+1 renders.
+  static void render_frames(const Scene& scene);
+  /// Server mode (`--server`): renders `scene` for the clients of a
+  /// `RenderServer`, applying their edits, until one of them quits.
+  static void serve(Scene& scene);
 
  public:
   //=== API function begins here.
@@ -100,7 +171,14 @@ class API {
 
   static void film(const ParamSet& ps);
   static void camera(const ParamSet& ps);
+  static void look_at(const ParamSet& ps);
   static void background(const ParamSet& ps);
+  static void accelerator(const ParamSet& ps);
+  static void sampler(const ParamSet& ps);
+  static void material(const ParamSet& ps);
+  static void object(const ParamSet& ps);
+  static void frame_begin();
+  static void frame_end();
   static void world_begin();
   static void world_end();
 };
@@ -1,4 +1,5 @@
 #include "background.h"
+#include "api.h"
 
 namespace rt3 {
 /*!
@@ -9,12 +10,168 @@ namespace rt3 {
  * \return The interpolated color.
  */
 Spectrum Background::sampleXYZ(const Point2f &pixel_ndc) const {
-  // TODO
   return Spectrum{0, 0, 0};
 }
 
+void Background::sample_span(float v, float u0, float du, size_t n,
+                             Spectrum *out) const {
+  for (size_t i{0}; i < n; ++i) {
+    out[i] = sampleXYZ(Point2f{u0 + float(i) * du, v});
+  }
+}
+
+void Background::sample_rays(const Ray *, size_t n, Spectrum *out) const {
+  std::fill(out, out + n, Spectrum{0, 0, 0});
+}
+
+/// Colors in the scene file may be given either in [0,1] or in [0,255].
+static Spectrum normalize_color(const Spectrum &c, bool byte_range) {
+  return byte_range ? c / 255.f : c;
+}
+
 BackgroundColor *create_color_background(const ParamSet &ps) {
-  // TODO
-  return new BackgroundColor();
+  // Corner colors only have a meaning on the screen.
+  if (retrieve(ps, "mapping", string{"screen"}) == "spherical") {
+    RT3_WARNING("Color backgrounds only support screen mapping; ignoring "
+                "\"spherical\".");
+  }
+  auto mapping = Background::mapping_t::screen;
+
+  // Either a single color or four corners. A missing corner takes the
+  // single color (black, if none is given).
+  Spectrum color = retrieve(ps, "color", Spectrum{0, 0, 0});
+  Spectrum bl = retrieve(ps, "bl", color);
+  Spectrum tl = retrieve(ps, "tl", color);
+  Spectrum tr = retrieve(ps, "tr", color);
+  Spectrum br = retrieve(ps, "br", color);
+
+  // Any component above 1 means the scene uses 8-bit color values.
+  bool byte_range = std::max({color.max_component(), bl.max_component(),
+                              tl.max_component(), tr.max_component(),
+                              br.max_component()}) > 1.f;
+
+  return RT3_ARENA_ALLOC(*API::build_arena, BackgroundColor)(
+      normalize_color(bl, byte_range), normalize_color(tl, byte_range),
+      normalize_color(tr, byte_range), normalize_color(br, byte_range),
+      mapping);
+}
+// === Image backgrounds
+
+namespace {
+constexpr float inv_pi{float(1.0 / M_PI)};
+constexpr float inv_two_pi{float(0.5 / M_PI)};
+
+/// Angle between the first two rays of a batch, in radians: how much of
+/// the sphere of directions a film sample covers. 0 for a single ray.
+float ray_spacing(const Ray *rays, size_t n) {
+  if (n < 2) {
+    return 0.f;
+  }
+  // The chord is as good as the angle for the small angles between pixels.
+  return (normalize(rays[1].d) - normalize(rays[0].d)).length();
+}
+
+/// Parameters for the color background that stands in for a missing image,
+/// which has no use for the image's mapping.
+ParamSet without_mapping(const ParamSet &ps) {
+  ParamSet fallback{ps};
+  fallback.erase("mapping");
+  return fallback;
+}
+}  // namespace
+
+Spectrum BackgroundSphereImage::sampleXYZ(const Point2f &pixel_ndc) const {
+  TextureSampler sampler{m_cache, m_texture};
+  return sampler.lookup(0, pixel_ndc[0], pixel_ndc[1], false);
+}
+
+void BackgroundSphereImage::sample_span(float v, float u0, float du, size_t n,
+                                        Spectrum *out) const {
+  TextureSampler sampler{m_cache, m_texture};
+  const int level = m_texture.level_for(du * float(m_texture.width()));
+  for (size_t i{0}; i < n; ++i) {
+    out[i] = sampler.lookup(level, u0 + float(i) * du, v, false);
+  }
+}
+
+void BackgroundSphereImage::sample_rays(const Ray *rays, size_t n,
+                                        Spectrum *out) const {
+  TextureSampler sampler{m_cache, m_texture};
+  // The image spans 2*pi radians horizontally.
+  const int level = m_texture.level_for(ray_spacing(rays, n) *
+                                        float(m_texture.width()) * inv_two_pi);
+  for (size_t i{0}; i < n; ++i) {
+    const Vector3f d = normalize(rays[i].d);
+    const float u = 0.5f + std::atan2(d.x, d.z) * inv_two_pi;
+    const float v = std::acos(Clamp(d.y, -1.f, 1.f)) * inv_pi;
+    out[i] = sampler.lookup(level, u, v, true);
+  }
+}
+
+void BackgroundSkyBoxImage::sample_rays(const Ray *rays, size_t n,
+                                        Spectrum *out) const {
+  // Directions to the right and downwards on each face.
+  static const Vector3f right_dir[6]{{0, 0, -1}, {0, 0, 1}, {1, 0, 0},
+                                     {1, 0, 0},  {1, 0, 0}, {-1, 0, 0}};
+  static const Vector3f down_dir[6]{{0, -1, 0}, {0, -1, 0}, {0, 0, 1},
+                                    {0, 0, -1}, {0, -1, 0}, {0, -1, 0}};
+  TextureSampler samplers[6]{{m_cache, *m_faces[0]}, {m_cache, *m_faces[1]},
+                             {m_cache, *m_faces[2]}, {m_cache, *m_faces[3]},
+                             {m_cache, *m_faces[4]}, {m_cache, *m_faces[5]}};
+  // A face spans pi/2 radians.
+  const float spacing = ray_spacing(rays, n) * 2.f * inv_pi;
+  int level[6];
+  for (int f{0}; f < 6; ++f) {
+    level[f] = m_faces[f]->level_for(spacing * float(m_faces[f]->width()));
+  }
+  for (size_t i{0}; i < n; ++i) {
+    const Vector3f &d = rays[i].d;
+    // The face is the one of the axis the ray is closest to.
+    int axis = std::abs(d.x) > std::abs(d.y) ? 0 : 1;
+    axis = std::abs(d[axis]) > std::abs(d.z) ? axis : 2;
+    const float major = std::abs(d[axis]);
+    if (not(major > 0.f)) {
+      out[i] = Spectrum{0, 0, 0};
+      continue;
+    }
+    const int f = 2 * axis + (d[axis] < 0.f ? 1 : 0);
+    const float u = 0.5f + 0.5f * dot(d, right_dir[f]) / major;
+    const float v = 0.5f + 0.5f * dot(d, down_dir[f]) / major;
+    out[i] = samplers[f].lookup(level[f], u, v, false);
+  }
+}
+
+Background *create_image_background(const ParamSet &ps) {
+  const std::string filename = retrieve(ps, "filename", string{});
+  auto mapping = retrieve(ps, "mapping", string{"spherical"}) == "screen"
+                     ? Background::mapping_t::screen
+                     : Background::mapping_t::spherical;
+  const Texture *texture =
+      filename.empty() ? nullptr : API::texture_cache->texture(filename);
+  if (texture == nullptr) {
+    RT3_WARNING("Image background \"" + filename +
+                "\" is not available; using a color background.");
+    return create_color_background(without_mapping(ps));
+  }
+  return RT3_ARENA_ALLOC(*API::build_arena, BackgroundSphereImage)(
+      *API::texture_cache, *texture, mapping);
+}
+
+Background *create_skybox_background(const ParamSet &ps) {
+  // Same order as `BackgroundSkyBoxImage::Face_e`.
+  static const char *face_names[6]{"right", "left",  "top",
+                                   "bottom", "front", "back"};
+  std::array<const Texture *, 6> faces;
+  for (int f{0}; f < 6; ++f) {
+    const std::string filename = retrieve(ps, face_names[f], string{});
+    faces[f] = filename.empty() ? nullptr : API::texture_cache->texture(filename);
+    if (faces[f] == nullptr) {
+      RT3_WARNING(std::string{"Skybox face \""} + face_names[f] +
+                  "\" is not available; using a color background.");
+      return create_color_background(without_mapping(ps));
+    }
+  }
+  return RT3_ARENA_ALLOC(*API::build_arena, BackgroundSkyBoxImage)(
+      *API::texture_cache, faces);
 }
 }  // namespace rt3
@@ -1,12 +1,12 @@
 #ifndef BACKGROUND_H
 #define BACKGROUND_H
 
+#include "packet.h"
 #include "rt3-base.h"
 #include "rt3.h"
+#include "texture_cache.h"
 
 namespace rt3 {
-// TODO: Create a virtual class Background and derive BackgroundColor,
-// BackgroundSphereImage, BackgroundSkyBoxImage.
 /*!
  * A background is basically a rectangle, have a color associated to each
  * corner. A background might be sampled based on a normalized coordinate in
@@ -33,13 +33,37 @@ class Background {
   }
 
   virtual ~Background(){/* empty */};
-  Spectrum sampleXYZ(const Point2f &pixel_ndc) const;
+  /// Samples a single color at `pixel_ndc`, in \f$[0,1]^2\f$.
+  virtual Spectrum sampleXYZ(const Point2f &pixel_ndc) const;
+  /*!
+   * Batch version of `sampleXYZ()`: fills `out[i]` with the color at
+   * NDC coordinates \f$(u_0 + i\,\Delta u, v)\f$, for `i` in `[0,n)`. The
+   * render loop calls it once per scanline span of a tile, instead of
+   * once per pixel. The default implementation just calls `sampleXYZ()`.
+   */
+  virtual void sample_span(float v, float u0, float du, size_t n, Spectrum *out) const;
+  /*!
+   * Colors seen along the directions of `rays`, for backgrounds with
+   * spherical mapping; the render loop calls it instead of `sample_span()`
+   * for those. Consecutive rays go through neighboring samples of the film,
+   * which tells the background how much of it a sample covers. The default
+   * implementation gives black.
+   */
+  virtual void sample_rays(const Ray *rays, size_t n, Spectrum *out) const;
 };
 
-class BackgroundColor : public Background {
+/*!
+ * A background defined by four corner colors, bilinearly interpolated over
+ * the screen. NDC coordinates follow the raster: \f$u\f$ grows to the right,
+ * \f$v\f$ grows downwards, so \f$(0,0)\f$ is the top-left corner and
+ * \f$(0,1)\f$ the bottom-left one. A solid background is the special case of
+ * four equal corners.
+ *
+ * The class is `final` and its sampling is inline, so the render loops,
+ * which are specialized on the concrete background, inline the span.
+ */
+class BackgroundColor final : public Background {
  private:
-  /// Each corner has a color associated with.
-  // Spectrum corners[4] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
   /// Corner indices.
   enum Corners_e {
     bl = 0,  //!< Bottom left corner.
@@ -47,17 +71,116 @@ class BackgroundColor : public Background {
     tr,      //!< Top right corner.
     br       //!< Bottom right corner.
   };
+  /// Each corner has a color associated with.
+  Spectrum corners[4];
+  bool m_is_solid;  //!< All corners are the same color.
 
  public:
   /// Ctro receives a list of four colors, for each corner.
-  BackgroundColor() {
-    // TODO
+  BackgroundColor(const Spectrum &bl_color,
+                  const Spectrum &tl_color,
+                  const Spectrum &tr_color,
+                  const Spectrum &br_color,
+                  mapping_t mt = mapping_t::screen)
+      : Background{ mt }, corners{ bl_color, tl_color, tr_color, br_color } {
+    m_is_solid = bl_color == tl_color and bl_color == tr_color and bl_color == br_color;
   }
+  /// Ctro receiving a single color for the entire background.
+  explicit BackgroundColor(const Spectrum &color, mapping_t mt = mapping_t::screen)
+      : BackgroundColor{ color, color, color, color, mt } {}
 
   virtual ~BackgroundColor(){};
+
+  Spectrum sampleXYZ(const Point2f &pixel_ndc) const override;
+  void sample_span(float v, float u0, float du, size_t n, Spectrum *out) const override;
+};
+
+/*!
+ * An image background. With spherical mapping the image is an environment
+ * map in latitude-longitude layout: \f$u\f$ is the longitude, with the
+ * center of the image straight ahead along \f$+z\f$, and \f$v\f$ goes
+ * from \f$+y\f$ (top row) to \f$-y\f$ (bottom row). With screen mapping
+ * the image is stretched over the screen.
+ *
+ * Texels come from the `TextureCache`, at the mip level that matches the
+ * size of a sample, with bilinear filtering.
+ */
+class BackgroundSphereImage final : public Background {
+ public:
+  BackgroundSphereImage(TextureCache &cache, const Texture &texture, mapping_t mt)
+      : Background{ mt }, m_cache{ cache }, m_texture{ texture } {}
+
+  Spectrum sampleXYZ(const Point2f &pixel_ndc) const override;
+  void sample_span(float v, float u0, float du, size_t n, Spectrum *out) const override;
+  void sample_rays(const Ray *rays, size_t n, Spectrum *out) const override;
+
+ private:
+  TextureCache &m_cache;
+  const Texture &m_texture;
 };
 
+/*!
+ * Six images on the faces of a cube around the scene (spherical mapping
+ * only). Each face is the view along its axis from the center of the cube,
+ * with the camera conventions of the scene: up is \f$+y\f$ for the side
+ * faces, \f$-z\f$ for the top one and \f$+z\f$ for the bottom one, so the
+ * bottom edge of the top face and the top edge of the bottom face meet the
+ * front face.
+ */
+class BackgroundSkyBoxImage final : public Background {
+ public:
+  /// Faces, in the order of the constructor's textures.
+  enum Face_e { right = 0, left, top, bottom, front, back };  // +x -x +y -y +z -z
+
+  BackgroundSkyBoxImage(TextureCache &cache, const std::array<const Texture *, 6> &faces)
+      : Background{ mapping_t::spherical }, m_cache{ cache }, m_faces{ faces } {}
+
+  void sample_rays(const Ray *rays, size_t n, Spectrum *out) const override;
+
+ private:
+  TextureCache &m_cache;
+  std::array<const Texture *, 6> m_faces;
+};
+
+/// Bilinear interpolation of the four corners.
+inline Spectrum BackgroundColor::sampleXYZ(const Point2f &pixel_ndc) const {
+  Spectrum top = lerp(pixel_ndc[0], corners[tl], corners[tr]);
+  Spectrum bottom = lerp(pixel_ndc[0], corners[bl], corners[br]);
+  return lerp(pixel_ndc[1], top, bottom);
+}
+
+/*!
+ * Along a scanline the bilinear interpolation reduces to a linear one
+ * between the left and right edge colors, so each pixel costs one
+ * multiply-add per channel. The loop has no branches and no calls, which
+ * lets the compiler vectorize it.
+ */
+inline void BackgroundColor::sample_span(float v, float u0, float du, size_t n,
+                                         Spectrum *out) const {
+  if (m_is_solid) {
+    std::fill(out, out + n, corners[bl]);
+    return;
+  }
+  const Spectrum left = lerp(v, corners[tl], corners[bl]);
+  const Spectrum right = lerp(v, corners[tr], corners[br]);
+  const Spectrum delta = right - left;
+  const float l0{left[0]}, l1{left[1]}, l2{left[2]};
+  const float d0{delta[0]}, d1{delta[1]}, d2{delta[2]};
+  float *dst = &out[0].c[0];
+  RT3_SIMD_LOOP
+  for (size_t i = 0; i < n; ++i) {
+    float u = u0 + float(i) * du;
+    dst[3 * i + 0] = l0 + d0 * u;
+    dst[3 * i + 1] = l1 + d1 * u;
+    dst[3 * i + 2] = l2 + d2 * u;
+  }
+}
+
 // factory pattern functions.
 BackgroundColor *create_color_background(const ParamSet &ps);
+/// Falls back to a color background if the image cannot be read.
+Background *create_image_background(const ParamSet &ps);
+/// Falls back to a color background if a face is missing.
+Background *create_skybox_background(const ParamSet &ps);
 }  // namespace rt3
 #endif
@@ -0,0 +1,71 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H 1
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace rt3 {
+
+/*!
+ * A blocking FIFO of at most `capacity` items, to hand work from one stage
+ * of a pipeline to the next. A producer that gets ahead waits in `push()`,
+ * which bounds the memory held by items in flight; a consumer with nothing
+ * to do waits in `pop()`. Once the producer calls `close()`, the consumer
+ * drains what is left and then gets an empty `pop()`.
+ */
+template <typename T> class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : m_capacity{ capacity > 0 ? capacity : 1 } {}
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  /// Appends `item`, waiting for room. Returns `false` (dropping the item)
+  /// if the queue is closed.
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_not_full.wait(lock, [this] { return m_closed or m_items.size() < m_capacity; });
+    if (m_closed) {
+      return false;
+    }
+    m_items.push_back(std::move(item));
+    m_not_empty.notify_one();
+    return true;
+  }
+
+  /// Takes the oldest item, waiting for one; empty once the queue is closed
+  /// and drained.
+  std::optional<T> pop() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_not_empty.wait(lock, [this] { return m_closed or not m_items.empty(); });
+    if (m_items.empty()) {
+      return std::nullopt;
+    }
+    T item{ std::move(m_items.front()) };
+    m_items.pop_front();
+    m_not_full.notify_one();
+    return item;
+  }
+
+  /// No more items will come. Waiting consumers wake up.
+  void close() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_closed = true;
+    m_not_empty.notify_all();
+    m_not_full.notify_all();
+  }
+
+ private:
+  const size_t m_capacity;
+  std::mutex m_mtx;
+  std::condition_variable m_not_empty;
+  std::condition_variable m_not_full;
+  std::deque<T> m_items;
+  bool m_closed{ false };
+};
+
+}  // namespace rt3
+
+#endif  // BOUNDED_QUEUE_H
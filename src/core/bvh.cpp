@@ -0,0 +1,354 @@
+#include "bvh.h"
+#include "api.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+
+namespace rt3 {
+
+/*!
+ * Builds the binary tree that `BVHAccel` flattens.
+ *
+ * Every node and every leaf range is claimed with an atomic increment on
+ * storage sized up front (a binary tree over _n_ primitives with non-empty
+ * leaves has at most _2n-1_ nodes), so concurrent subtree builds never
+ * allocate and never lock.
+ */
+class BVHAccel::Builder {
+ public:
+  /// Subtrees with at least this many primitives are built as separate tasks.
+  static constexpr size_t parallel_grain{4096};
+  /// Past this depth the tree splits at the median, down to leaves of the
+  /// usual size: what is left halves at every level, so even a degenerate
+  /// input ends in small leaves before `max_depth`, where the traversal
+  /// stack ends and a leaf is forced.
+  static constexpr int median_depth{max_depth - 24};
+  /// Largest leaf a `LinearNode` can describe.
+  static constexpr size_t max_leaf_size{std::numeric_limits<uint16_t>::max()};
+
+  struct BuildNode {
+    Bounds3f bounds;
+    int32_t children[2]{-1, -1};
+    int32_t first_prim{0};
+    int32_t n_prims{0};  //!< 0 for interior nodes.
+    uint8_t axis{0};
+  };
+
+  Builder(const std::vector<const Primitive *> &prims, int max_prims_in_node, ThreadPool *pool)
+      : nodes(prims.empty() ? 0 : 2 * prims.size() - 1), ordered(prims.size()), m_prims{prims},
+        m_info(prims.size()), m_max_prims{size_t(max_prims_in_node)}, m_pool{pool} {
+    for (size_t i{0}; i < prims.size(); ++i) {
+      m_info[i].bounds = prims[i]->world_bounds();
+      m_info[i].centroid = m_info[i].bounds.centroid();
+      m_info[i].index = uint32_t(i);
+    }
+  }
+
+  /// Builds the subtree over `m_info[begin,end)` and returns its root.
+  int32_t build(size_t begin, size_t end, int depth);
+
+  std::vector<BuildNode> nodes;
+  std::atomic<int32_t> n_nodes{0};
+  std::vector<const Primitive *> ordered;  //!< Primitives in leaf order.
+  std::atomic<int> max_depth_seen{0};
+
+ private:
+  struct PrimInfo {
+    Bounds3f bounds;
+    Point3f centroid;
+    uint32_t index;
+  };
+
+  /// Copies `m_info[begin,end)` out to a new range of `ordered`.
+  void make_leaf(BuildNode &node, size_t begin, size_t end);
+  /// SAH split of `m_info[begin,end)`; returns `end` if a leaf is cheaper.
+  size_t sah_split(size_t begin, size_t end, int axis, const Bounds3f &bounds,
+                   const Bounds3f &centroid_bounds);
+
+  const std::vector<const Primitive *> &m_prims;
+  std::vector<PrimInfo> m_info;
+  size_t m_max_prims;
+  ThreadPool *m_pool;
+  std::atomic<size_t> m_n_ordered{0};
+};
+
+void BVHAccel::Builder::make_leaf(BuildNode &node, size_t begin, size_t end) {
+  size_t first = m_n_ordered.fetch_add(end - begin, std::memory_order_relaxed);
+  for (size_t i{begin}; i < end; ++i) {
+    ordered[first + i - begin] = m_prims[m_info[i].index];
+  }
+  node.first_prim = int32_t(first);
+  node.n_prims = int32_t(end - begin);
+}
+
+size_t BVHAccel::Builder::sah_split(size_t begin, size_t end, int axis, const Bounds3f &bounds,
+                                    const Bounds3f &centroid_bounds) {
+  auto bucket_of = [&](const PrimInfo &p) {
+    int b = int(float(n_buckets) * centroid_bounds.offset(p.centroid)[axis]);
+    return std::min(b, n_buckets - 1);
+  };
+  struct Bucket {
+    size_t count{0};
+    Bounds3f bounds;
+  } buckets[n_buckets];
+  for (size_t i{begin}; i < end; ++i) {
+    Bucket &b = buckets[bucket_of(m_info[i])];
+    ++b.count;
+    b.bounds = bounds_union(b.bounds, m_info[i].bounds);
+  }
+
+  // Cost of splitting after each bucket, relative to intersecting one
+  // primitive, with a sweep from each side: C = 1/8 + (N_l A_l + N_r A_r) / A.
+  float below_area[n_buckets];
+  size_t below_count[n_buckets];
+  Bounds3f acc;
+  size_t count{0};
+  for (int b{0}; b < n_buckets; ++b) {
+    acc = bounds_union(acc, buckets[b].bounds);
+    count += buckets[b].count;
+    below_area[b] = acc.surface_area();
+    below_count[b] = count;
+  }
+  float min_cost{std::numeric_limits<float>::infinity()};
+  int min_bucket{-1};
+  acc = Bounds3f{};
+  count = 0;
+  const float inv_area = bounds.surface_area() > 0.f ? 1.f / bounds.surface_area() : 0.f;
+  for (int b{n_buckets - 1}; b > 0; --b) {
+    acc = bounds_union(acc, buckets[b].bounds);
+    count += buckets[b].count;
+    // Both sides must get something.
+    if (count == 0 or below_count[b - 1] == 0) {
+      continue;
+    }
+    float cost = 0.125f + (float(below_count[b - 1]) * below_area[b - 1]
+                           + float(count) * acc.surface_area()) * inv_area;
+    if (cost < min_cost) {
+      min_cost = cost;
+      min_bucket = b - 1;
+    }
+  }
+
+  const size_t n = end - begin;
+  if (min_bucket < 0 or (n <= m_max_prims and min_cost >= float(n))) {
+    return end;
+  }
+  auto *mid = std::partition(&m_info[begin], &m_info[end - 1] + 1, [&](const PrimInfo &p) {
+    return bucket_of(p) <= min_bucket;
+  });
+  return size_t(mid - &m_info[0]);
+}
+
+int32_t BVHAccel::Builder::build(size_t begin, size_t end, int depth) {
+  const int32_t index = n_nodes.fetch_add(1, std::memory_order_relaxed);
+  BuildNode &node = nodes[index];
+  int seen = max_depth_seen.load(std::memory_order_relaxed);
+  while (seen < depth and not max_depth_seen.compare_exchange_weak(seen, depth)) {
+  }
+
+  Bounds3f bounds, centroid_bounds;
+  for (size_t i{begin}; i < end; ++i) {
+    bounds = bounds_union(bounds, m_info[i].bounds);
+    centroid_bounds = bounds_union(centroid_bounds, m_info[i].centroid);
+  }
+  node.bounds = bounds;
+  const size_t n = end - begin;
+  if (n == 1) {
+    make_leaf(node, begin, end);
+    return index;
+  }
+
+  const int axis = centroid_bounds.maximum_extent();
+  size_t mid;
+  const bool coincident{centroid_bounds.p_max[axis] == centroid_bounds.p_min[axis]};
+  if (coincident and n <= max_leaf_size) {
+    // No plane separates the centroids, so no split would help.
+    make_leaf(node, begin, end);
+    return index;
+  }
+  if (coincident or depth >= median_depth) {
+    // Too many for one leaf, or the tree is already deep. 24 halvings leave
+    // far fewer than `max_leaf_size` for the forced leaves.
+    if (n <= m_max_prims or depth + 1 >= max_depth) {
+      make_leaf(node, begin, end);
+      return index;
+    }
+    mid = begin + n / 2;
+    std::nth_element(&m_info[begin], &m_info[mid], &m_info[end - 1] + 1,
+                     [axis](const PrimInfo &a, const PrimInfo &b) {
+                       return a.centroid[axis] < b.centroid[axis];
+                     });
+  } else {
+    mid = sah_split(begin, end, axis, bounds, centroid_bounds);
+    if (mid == end) {
+      make_leaf(node, begin, end);
+      return index;
+    }
+  }
+
+  node.axis = uint8_t(axis);
+  if (m_pool != nullptr and n >= parallel_grain) {
+    // Left half on the pool, right half here; help out while waiting.
+    auto left = m_pool->async([this, begin, mid, depth]() { return build(begin, mid, depth + 1); });
+    node.children[1] = build(mid, end, depth + 1);
+    while (left.wait_for(std::chrono::seconds(0)) != std::future_status::ready
+           and m_pool->help_one()) {
+    }
+    node.children[0] = left.get();
+  } else {
+    node.children[0] = build(begin, mid, depth + 1);
+    node.children[1] = build(mid, end, depth + 1);
+  }
+  return index;
+}
+
+BVHAccel::BVHAccel(std::vector<const Primitive *> prims, int max_prims_in_node,
+                   ThreadPool *pool) {
+  if (prims.empty()) {
+    return;
+  }
+  Builder builder{prims, max_prims_in_node, pool};
+  builder.build(0, prims.size(), 1);
+  m_depth = builder.max_depth_seen.load();
+
+  // Depth-first flattening: the first child is always the next node.
+  m_nodes.resize(size_t(builder.n_nodes.load()));
+  int32_t next{0};
+  auto flatten = [&](auto &self, int32_t b) -> int32_t {
+    const Builder::BuildNode &bn = builder.nodes[b];
+    const int32_t offset = next++;
+    LinearNode &ln = m_nodes[offset];
+    ln.bounds = bn.bounds;
+    ln.pad = 0;
+    if (bn.n_prims > 0) {
+      ln.primitives_offset = bn.first_prim;
+      ln.n_primitives = uint16_t(bn.n_prims);
+      ln.axis = 0;
+    } else {
+      ln.axis = bn.axis;
+      ln.n_primitives = 0;
+      self(self, bn.children[0]);
+      m_nodes[offset].second_child_offset = self(self, bn.children[1]);
+    }
+    return offset;
+  };
+  flatten(flatten, 0);
+  m_primitives = std::move(builder.ordered);
+}
+
+Bounds3f BVHAccel::world_bounds() const {
+  return m_nodes.empty() ? Bounds3f{} : m_nodes[0].bounds;
+}
+
+/*!
+ * Slab test against a node's box. `inv_dir` and `dir_is_neg` are computed
+ * once per ray. The comparisons are written so that a NaN distance (0 times
+ * infinity, for a ray parallel to a slab whose origin lies on its plane)
+ * leaves the interval alone instead of poisoning it.
+ */
+static inline bool hit_bounds(const Bounds3f &b, const Ray &r, const Vector3f &inv_dir,
+                              const int dir_is_neg[3]) {
+  float t0 = r.t_min;
+  float t1 = r.t_max;
+  for (int a{0}; a < 3; ++a) {
+    float near = (b[dir_is_neg[a]][a] - r.o[a]) * inv_dir[a];
+    float far = (b[1 - dir_is_neg[a]][a] - r.o[a]) * inv_dir[a] * slab_padding;
+    t0 = near > t0 ? near : t0;
+    t1 = far < t1 ? far : t1;
+    if (t0 > t1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool BVHAccel::intersect(const Ray &r, Surfel *sf) const {
+  if (m_nodes.empty()) {
+    return false;
+  }
+  const Vector3f inv_dir{1.f / r.d.x, 1.f / r.d.y, 1.f / r.d.z};
+  const int dir_is_neg[3] = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+  int32_t to_visit[max_depth];
+  int n_to_visit{0};
+  int32_t current{0};
+  bool hit{false};
+  while (true) {
+    const LinearNode &node = m_nodes[current];
+    if (hit_bounds(node.bounds, r, inv_dir, dir_is_neg)) {
+      if (node.n_primitives > 0) {
+        // Each hit shortens `r.t_max`, so the rest only accept nearer hits.
+        for (int i{0}; i < node.n_primitives; ++i) {
+          hit |= m_primitives[node.primitives_offset + i]->intersect(r, sf);
+        }
+        if (n_to_visit == 0) break;
+        current = to_visit[--n_to_visit];
+      } else if (dir_is_neg[node.axis]) {
+        // Near child first.
+        to_visit[n_to_visit++] = current + 1;
+        current = node.second_child_offset;
+      } else {
+        to_visit[n_to_visit++] = node.second_child_offset;
+        current = current + 1;
+      }
+    } else {
+      if (n_to_visit == 0) break;
+      current = to_visit[--n_to_visit];
+    }
+  }
+  return hit;
+}
+
+bool BVHAccel::intersect_p(const Ray &r) const {
+  if (m_nodes.empty()) {
+    return false;
+  }
+  const Vector3f inv_dir{1.f / r.d.x, 1.f / r.d.y, 1.f / r.d.z};
+  const int dir_is_neg[3] = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+  int32_t to_visit[max_depth];
+  int n_to_visit{0};
+  int32_t current{0};
+  while (true) {
+    const LinearNode &node = m_nodes[current];
+    if (hit_bounds(node.bounds, r, inv_dir, dir_is_neg)) {
+      if (node.n_primitives > 0) {
+        for (int i{0}; i < node.n_primitives; ++i) {
+          if (m_primitives[node.primitives_offset + i]->intersect_p(r)) {
+            return true;
+          }
+        }
+        if (n_to_visit == 0) break;
+        current = to_visit[--n_to_visit];
+      } else if (dir_is_neg[node.axis]) {
+        to_visit[n_to_visit++] = current + 1;
+        current = node.second_child_offset;
+      } else {
+        to_visit[n_to_visit++] = node.second_child_offset;
+        current = current + 1;
+      }
+    } else {
+      if (n_to_visit == 0) break;
+      current = to_visit[--n_to_visit];
+    }
+  }
+  return false;
+}
+
+int retrieve_max_prims_in_node(const ParamSet &ps) {
+  int max_prims = retrieve(ps, "max_prims_per_node", BVHAccel::default_max_prims_in_node);
+  if (max_prims < 1 or max_prims > 255) {
+    RT3_WARNING("max_prims_per_node must be in [1,255]; clamping " + std::to_string(max_prims)
+                + ".");
+    max_prims = Clamp(max_prims, 1, 255);
+  }
+  return max_prims;
+}
+
+BVHAccel *create_bvh_accelerator(std::vector<const Primitive *> prims, const ParamSet &ps,
+                                 ThreadPool *pool) {
+  return RT3_ARENA_ALLOC(*API::build_arena, BVHAccel)(std::move(prims),
+                                                     retrieve_max_prims_in_node(ps), pool);
+}
+}  // namespace rt3
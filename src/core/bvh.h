@@ -0,0 +1,96 @@
+#ifndef BVH_H
+#define BVH_H 1
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "paramset.h"
+#include "primitive.h"
+
+namespace rt3 {
+class ThreadPool;
+
+/// Far slab distances are scaled by this (\f$1 + 2\gamma_3\f$, as in pbrt),
+/// so rounding error cannot make a ray slip between two boxes that share a
+/// face.
+constexpr float slab_padding{ 1.f + 2.f * 3.f * 0.5f * std::numeric_limits<float>::epsilon()
+                              / (1.f - 3.f * 0.5f * std::numeric_limits<float>::epsilon()) };
+
+/*!
+ * Bounding volume hierarchy over a set of primitives.
+ *
+ * **Build.** Top-down, splitting each node where the surface area heuristic
+ * (SAH) predicts the cheapest traversal. Centroids are binned into
+ * `n_buckets` slots along the longest axis, so choosing a split is linear in
+ * the number of primitives of the node. Large subtrees are built as separate
+ * tasks on the thread pool; the two halves of a split never share data, and
+ * the only shared state is a pair of atomic counters that hand out node slots
+ * and leaf ranges.
+ *
+ * **Layout.** The tree is then flattened to an array of 32-byte nodes (two
+ * per cache line) in depth-first order: the first child of an interior node
+ * is the next node in the array, and only the offset of the second child is
+ * stored. Leaves refer to a contiguous range of the reordered primitives.
+ *
+ * **Traversal.** A short explicit stack, no recursion. At each interior node
+ * the child on the near side of the split axis (given the ray's direction
+ * sign) is visited first, so hits found there cut off the far child early.
+ */
+class BVHAccel : public AggregatePrimitive {
+ public:
+  /// Primitives per leaf, at most.
+  static constexpr int default_max_prims_in_node{ 4 };
+  /// SAH buckets per split.
+  static constexpr int n_buckets{ 12 };
+
+  /// Builds the tree, on `pool` if given. `prims` must outlive the tree.
+  BVHAccel(std::vector<const Primitive *> prims,
+           int max_prims_in_node = default_max_prims_in_node,
+           ThreadPool *pool = nullptr);
+
+  Bounds3f world_bounds() const override;
+  bool intersect(const Ray &r, Surfel *sf) const override;
+  bool intersect_p(const Ray &r) const override;
+
+  size_t primitive_count() const { return m_primitives.size(); }
+  size_t node_count() const { return m_nodes.size(); }
+  /// Length of the longest root-to-leaf path (1 for a single leaf).
+  int depth() const { return m_depth; }
+
+ private:
+  class Builder;
+  /// Wide trees are collapsed from a binary one.
+  template <int W> friend class WideBVHAccel;
+
+  /// A node of the flattened tree.
+  struct alignas(32) LinearNode {
+    Bounds3f bounds;
+    union {
+      int32_t primitives_offset;    //!< Leaf: first primitive.
+      int32_t second_child_offset;  //!< Interior: index of the second child.
+    };
+    uint16_t n_primitives;  //!< 0 for interior nodes.
+    uint8_t axis;           //!< Interior: split axis.
+    uint8_t pad;
+  };
+  static_assert(sizeof(LinearNode) == 32, "BVH nodes must stay half a cache line");
+
+  /// Deepest tree the traversal stack can handle.
+  static constexpr int max_depth{ 64 };
+
+  std::vector<const Primitive *> m_primitives;  //!< In leaf order.
+  std::vector<LinearNode> m_nodes;
+  int m_depth{ 0 };
+};
+
+/// The `max_prims_per_node` parameter of an accelerator, validated.
+int retrieve_max_prims_in_node(const ParamSet &ps);
+
+// factory pattern functions.
+BVHAccel *create_bvh_accelerator(std::vector<const Primitive *> prims,
+                                 const ParamSet &ps,
+                                 ThreadPool *pool);
+}  // namespace rt3
+
+#endif  // BVH_H
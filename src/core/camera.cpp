@@ -0,0 +1,162 @@
+#include "camera.h"
+#include "api.h"
+
+#include <new>
+
+namespace rt3 {
+
+Camera::Camera(const Point3f &look_from,
+               const Point3f &look_at,
+               const Vector3f &up,
+               const ScreenWindow &screen_window,
+               const Point2i &resolution)
+    : m_eye{ look_from } {
+  Vector3f gaze = look_at - look_from;
+  if (gaze.length_squared() == 0.f) {
+    RT3_WARNING("Camera looks at its own position; looking down +z instead.");
+    gaze = Vector3f{ 0, 0, 1 };
+  }
+  m_w = normalize(gaze);
+  Vector3f u = cross(up, m_w);
+  if (u.length_squared() == 0.f) {
+    RT3_WARNING("Camera up vector is parallel to the view direction; picking another one.");
+    u = cross(std::abs(m_w.y) < 0.9f ? Vector3f{ 0, 1, 0 } : Vector3f{ 1, 0, 0 }, m_w);
+  }
+  u = normalize(u);
+  const Vector3f v = cross(m_w, u);
+
+  // Raster x grows to the right (l to r), raster y downwards (t to b).
+  const auto [l, r, b, t] = screen_window;
+  m_corner = u * l + v * t;
+  m_dx = u * ((r - l) / float(resolution[0]));
+  m_dy = v * ((b - t) / float(resolution[1]));
+}
+
+void Camera::generate_tile(const Tile &tile, Ray *rays) const {
+  const size_t n = size_t(tile.x1 - tile.x0);
+  for (int y{ tile.y0 }; y < tile.y1; ++y, rays += n) {
+    generate_span(float(tile.x0) + 0.5f, float(y) + 0.5f, 1.f, n, rays);
+  }
+}
+
+/*!
+ * The rays through `window` fill a convex volume, bounded by the four planes
+ * that hold the rays through consecutive corners of the window and by the
+ * plane the rays start from. The box is out of sight if its eight corners
+ * lie outside one of them.
+ */
+bool Camera::may_see(const Bounds3f &box, const Bounds2i &window) const {
+  const float x0{ float(window.p_min.x) }, y0{ float(window.p_min.y) };
+  const float x1{ float(window.p_max.x) }, y1{ float(window.p_max.y) };
+  const Ray corners[4]{ generate_ray(x0, y0), generate_ray(x1, y0), generate_ray(x1, y1),
+                        generate_ray(x0, y1) };
+  const Ray center{ generate_ray((x0 + x1) / 2, (y0 + y1) / 2) };
+  // Every corner of the box is strictly on the far side of the plane through
+  // `o` with normal `n`, away from the inside point `in`.
+  auto outside = [&](const Point3f &o, const Vector3f &n, const Point3f &in) {
+    const float side{ dot(n, in - o) };
+    if (side == 0.f) {
+      return false;  // Degenerate plane.
+    }
+    for (int i{ 0 }; i < 8; ++i) {
+      const Point3f c{ box[i & 1].x, box[(i >> 1) & 1].y, box[(i >> 2) & 1].z };
+      if (dot(n, c - o) * side >= 0.f) {
+        return false;
+      }
+    }
+    return true;
+  };
+  const Point3f inside{ center.o + center.d };
+  for (int k{ 0 }; k < 4; ++k) {
+    const Ray &a = corners[k];
+    const Ray &b = corners[(k + 1) % 4];
+    if (outside(a.o, cross(a.d, (b.o + b.d) - a.o), inside)) {
+      return false;
+    }
+  }
+  // Nothing behind the ray origins.
+  return not outside(center.o, center.d, inside);
+}
+
+// === Orthographic
+
+Ray OrthographicCamera::generate_ray(float x, float y) const {
+  return Ray{ m_eye + (m_corner + m_dx * x + m_dy * y), m_w };
+}
+
+void OrthographicCamera::generate_span(float x0, float y, float dx, size_t n, Ray *rays) const {
+  const Point3f o0 = m_eye + (m_corner + m_dx * x0 + m_dy * y);
+  const Vector3f step = m_dx * dx;
+  for (size_t i{ 0 }; i < n; ++i) {
+    new (rays + i) Ray{ o0 + step * float(i), m_w };
+  }
+}
+
+// === Perspective
+
+PerspectiveCamera::PerspectiveCamera(const Point3f &look_from,
+                                     const Point3f &look_at,
+                                     const Vector3f &up,
+                                     const ScreenWindow &screen_window,
+                                     const Point2i &resolution,
+                                     float fovy)
+    : Camera{ look_from, look_at, up, screen_window, resolution } {
+  // Rays start at the eye, so the screen corner doubles as the direction
+  // through it once the screen is pushed out along w.
+  m_corner += m_w * (1.f / std::tan(Radians(fovy) / 2.f));
+}
+
+Ray PerspectiveCamera::generate_ray(float x, float y) const {
+  return Ray{ m_eye, m_corner + m_dx * x + m_dy * y };
+}
+
+void PerspectiveCamera::generate_span(float x0, float y, float dx, size_t n, Ray *rays) const {
+  const Vector3f d0 = m_corner + m_dx * x0 + m_dy * y;
+  const Vector3f step = m_dx * dx;
+  for (size_t i{ 0 }; i < n; ++i) {
+    new (rays + i) Ray{ m_eye, d0 + step * float(i) };
+  }
+}
+
+// === Factories
+
+/// The `screen_window` parameter, or the default one: \f$[-1,1]\f$ along the
+/// shorter image axis, proportional along the longer one.
+static Camera::ScreenWindow retrieve_screen_window(const ParamSet &ps, const Film &film) {
+  auto res = film.get_resolution();
+  float aspect = retrieve(ps, "frame_aspectratio", real_type(res[0]) / real_type(res[1]));
+  if (not(aspect > 0.f)) {
+    RT3_WARNING("frame_aspectratio must be positive; using the film's.");
+    aspect = float(res[0]) / float(res[1]);
+  }
+  Camera::ScreenWindow window = aspect >= 1.f
+                                  ? Camera::ScreenWindow{ -aspect, aspect, -1.f, 1.f }
+                                  : Camera::ScreenWindow{ -1.f, 1.f, -1.f / aspect, 1.f / aspect };
+  std::vector<real_type> sw = retrieve(ps, "screen_window", std::vector<real_type>{});
+  if (sw.size() == 4) {
+    window = { sw[0], sw[1], sw[2], sw[3] };
+  } else if (not sw.empty()) {
+    RT3_WARNING("screen_window needs 4 values (l r b t); ignoring it.");
+  }
+  return window;
+}
+
+OrthographicCamera *create_orthographic_camera(const ParamSet &ps, const Film &film) {
+  return RT3_ARENA_ALLOC(*API::build_arena, OrthographicCamera)(
+      retrieve(ps, "look_from", Point3f{ 0, 0, 0 }), retrieve(ps, "look_at", Point3f{ 0, 0, 1 }),
+      retrieve(ps, "up", Vector3f{ 0, 1, 0 }), retrieve_screen_window(ps, film),
+      film.get_resolution());
+}
+
+PerspectiveCamera *create_perspective_camera(const ParamSet &ps, const Film &film) {
+  float fovy = retrieve(ps, "fovy", real_type{ 90 });
+  if (not(fovy > 0.f and fovy < 180.f)) {
+    RT3_WARNING("fovy must be in (0, 180) degrees; using 90.");
+    fovy = 90.f;
+  }
+  return RT3_ARENA_ALLOC(*API::build_arena, PerspectiveCamera)(
+      retrieve(ps, "look_from", Point3f{ 0, 0, 0 }), retrieve(ps, "look_at", Point3f{ 0, 0, 1 }),
+      retrieve(ps, "up", Vector3f{ 0, 1, 0 }), retrieve_screen_window(ps, film),
+      film.get_resolution(), fovy);
+}
+}  // namespace rt3
@@ -0,0 +1,98 @@
+#ifndef CAMERA_H
+#define CAMERA_H 1
+
+#include "film.h"
+#include "paramset.h"
+#include "rt3.h"
+
+namespace rt3 {
+
+/*!
+ * Turns raster positions into primary rays.
+ *
+ * The camera frame follows the `lookat` tag: \f$w\f$ points from
+ * `look_from` to `look_at`, \f$u = up \times w\f$ points to the right of the
+ * image and \f$v = w \times u\f$ to its top. The screen window
+ * \f$[l,r] \times [b,t]\f$ is laid over the film, so the screen point of a
+ * raster position depends linearly on it:
+ * \f[ s(x, y) = c + x\,\Delta_x + y\,\Delta_y, \f]
+ * where \f$c\f$ is the screen point of the top-left corner of the image.
+ * The three vectors are computed once, by the constructor; a ray then costs
+ * a few multiply-adds, and rays along a scanline only add \f$\Delta_x\f$.
+ *
+ * Raster coordinates are continuous and span the full resolution of the
+ * film (crop windows included): \f$(0,0)\f$ is the top-left corner of the
+ * image and pixel \f$(i,j)\f$ has its center at \f$(i + 0.5, j + 0.5)\f$.
+ * Directions are not normalized.
+ */
+class Camera {
+ public:
+  /// Screen window bounds: l, r, b, t.
+  using ScreenWindow = std::array<float, 4>;
+
+  Camera(const Point3f &look_from,
+         const Point3f &look_at,
+         const Vector3f &up,
+         const ScreenWindow &screen_window,
+         const Point2i &resolution);
+  virtual ~Camera() = default;
+
+  /// The ray through raster position \f$(x, y)\f$.
+  virtual Ray generate_ray(float x, float y) const = 0;
+  /*!
+   * Batch version of `generate_ray()`: `rays[i]` becomes the ray through
+   * \f$(x_0 + i\,dx, y)\f$, for `i` in `[0,n)`. `rays` may be uninitialized
+   * memory.
+   */
+  virtual void generate_span(float x0, float y, float dx, size_t n, Ray *rays) const = 0;
+  /// Rays through the centers of the pixels of `tile`, row by row, which is
+  /// the order `Primitive::intersect_packet()` traces coherently.
+  void generate_tile(const Tile &tile, Ray *rays) const;
+  /*!
+   * Whether a ray through some point of the raster rectangle `window`
+   * (pixel edges, so `[x0,x1] x [y0,y1]` in raster units) may hit something
+   * inside `box`. Conservative: `false` means no such ray can reach the box.
+   */
+  bool may_see(const Bounds3f &box, const Bounds2i &window) const;
+
+ protected:
+  Point3f m_eye;     //!< `look_from`.
+  Vector3f m_w;      //!< Unit view direction.
+  Vector3f m_corner;  //!< Screen point of raster (0,0), relative to the eye.
+  Vector3f m_dx;      //!< Screen step per raster unit to the right.
+  Vector3f m_dy;      //!< Screen step per raster unit downwards.
+};
+
+/// Parallel rays along \f$w\f$, starting on the screen window.
+class OrthographicCamera : public Camera {
+ public:
+  using Camera::Camera;
+
+  Ray generate_ray(float x, float y) const override;
+  void generate_span(float x0, float y, float dx, size_t n, Ray *rays) const override;
+};
+
+/*!
+ * Rays from the eye through the screen window, which sits at distance
+ * \f$1/\tan(fovy/2)\f$ along \f$w\f$; a vertical screen extent of
+ * \f$[-1,1]\f$ thus spans `fovy` degrees.
+ */
+class PerspectiveCamera : public Camera {
+ public:
+  PerspectiveCamera(const Point3f &look_from,
+                    const Point3f &look_at,
+                    const Vector3f &up,
+                    const ScreenWindow &screen_window,
+                    const Point2i &resolution,
+                    float fovy);
+
+  Ray generate_ray(float x, float y) const override;
+  void generate_span(float x0, float y, float dx, size_t n, Ray *rays) const override;
+};
+
+// factory pattern functions. `ps` holds the camera and lookat parameters.
+OrthographicCamera *create_orthographic_camera(const ParamSet &ps, const Film &film);
+PerspectiveCamera *create_perspective_camera(const ParamSet &ps, const Film &film);
+}  // namespace rt3
+
+#endif  // CAMERA_H
@@ -0,0 +1,50 @@
+#include "color_buffer.h"
+
+namespace rt3 {
+
+ColorBuffer::ColorBuffer(int width, int height)
+    : m_width{ width }, m_height{ height } {
+  m_tiles_x = size_t((width + tile_size - 1) / tile_size);
+  size_t tiles_y = size_t((height + tile_size - 1) / tile_size);
+  // Border tiles are padded, so every tile starts on a cache line boundary.
+  m_n_lines = m_tiles_x * tiles_y * tile_size * tile_size / pixels_per_line;
+  m_lines = std::make_unique<CacheLine[]>(m_n_lines);
+  clear();
+}
+
+/// Lock-free `a += v` for an atomic float.
+static void atomic_add(std::atomic<float> &a, float v) {
+  float old = a.load(std::memory_order_relaxed);
+  while (not a.compare_exchange_weak(old, old + v, std::memory_order_relaxed)) {
+    // `old` is refreshed by compare_exchange_weak(); just try again.
+  }
+}
+
+void ColorBuffer::splat(int x, int y, const ColorXYZ &color, float weight) {
+  Pixel &p = pixel(x, y);
+  for (int c{ 0 }; c < 3; ++c) {
+    atomic_add(p.rgbw[c], weight * color[c]);
+  }
+  atomic_add(p.rgbw[3], weight);
+}
+
+void ColorBuffer::enable_moments() {
+  if (not m_moments) {
+    m_moments = std::make_unique<Moments[]>(m_n_lines * pixels_per_line);
+  }
+}
+
+void ColorBuffer::clear() {
+  for (size_t i{ 0 }; i < m_n_lines; ++i) {
+    for (auto &px : m_lines[i].px) {
+      for (auto &c : px.rgbw) {
+        c.store(0.f, std::memory_order_relaxed);
+      }
+    }
+  }
+  if (m_moments) {
+    std::fill(m_moments.get(), m_moments.get() + m_n_lines * pixels_per_line, Moments{});
+  }
+}
+
+}  // namespace rt3
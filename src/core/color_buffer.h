@@ -0,0 +1,188 @@
+#ifndef COLOR_BUFFER_H
+#define COLOR_BUFFER_H 1
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "rt3.h"
+
+namespace rt3 {
+
+/*!
+ * Floating point accumulation buffer used by the `Film`.
+ *
+ * Each pixel holds the weighted sum of its samples plus the sum of the
+ * weights, so the final color is simply `sum / weight`. Pixels are not stored
+ * in scanline order: the image is divided into square tiles of `tile_size`
+ * pixels, and each tile occupies a contiguous block of memory (16x16 pixels
+ * of 16 bytes = 4 KiB). A worker rendering a tile therefore touches only its
+ * own cache lines, and two workers never share one.
+ *
+ * There are two ways to add samples:
+ *  - `add()` is meant for the thread that owns the tile being rendered. It
+ *    does a plain read-modify-write, with no lock and no atomic RMW.
+ *  - `splat()` may be called by any thread, for samples that land on tiles
+ *    owned by someone else. It uses a lock-free compare-and-swap loop.
+ */
+class ColorBuffer {
+ public:
+  static constexpr int tile_shift{ 4 };
+  static constexpr int tile_size{ 1 << tile_shift };  //!< Tile side, in pixels.
+
+  /// Allocates a buffer of `width x height` pixels, cleared to zero.
+  ColorBuffer(int width, int height);
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+
+  /// Accumulates `color` with `weight` into pixel (x,y). Tile owner only.
+  void add(int x, int y, const ColorXYZ &color, float weight = 1.f) {
+    Pixel &p = pixel(x, y);
+    for (int c{ 0 }; c < 3; ++c) {
+      p.rgbw[c].store(p.rgbw[c].load(std::memory_order_relaxed) + weight * color[c],
+                      std::memory_order_relaxed);
+    }
+    p.rgbw[3].store(p.rgbw[3].load(std::memory_order_relaxed) + weight,
+                    std::memory_order_relaxed);
+  }
+
+  /*!
+   * Accumulates `n` consecutive pixels of row `y`, starting at `x`, with
+   * weight 1. The span must not cross a tile border, so the pixels are
+   * contiguous in memory. Tile owner only.
+   */
+  void add_span(int x, int y, size_t n, const ColorXYZ *colors) {
+    Pixel *p = &pixel(x, y);
+    for (size_t i{ 0 }; i < n; ++i) {
+      for (int c{ 0 }; c < 3; ++c) {
+        p[i].rgbw[c].store(p[i].rgbw[c].load(std::memory_order_relaxed) + colors[i][c],
+                           std::memory_order_relaxed);
+      }
+      p[i].rgbw[3].store(p[i].rgbw[3].load(std::memory_order_relaxed) + 1.f,
+                         std::memory_order_relaxed);
+    }
+  }
+
+  /*!
+   * Turns on a second channel with the running mean and variance of the
+   * luminance of each pixel's samples (Welford's algorithm), for adaptive
+   * sampling. It is off by default, and costs 16 more bytes per pixel.
+   */
+  void enable_moments();
+  bool has_moments() const { return m_moments != nullptr; }
+  /// `add()` with weight 1, also updating the luminance moments (which must be
+  /// enabled). Tile owner only.
+  void add_tracked(int x, int y, const ColorXYZ &color) {
+    add(x, y, color);
+    Moments &m = m_moments[offset(x, y)];
+    const float l{ color.luminance() };
+    const float delta{ l - m.mean };
+    m.mean += delta / float(++m.n);
+    m.m2 += delta * (l - m.mean);
+  }
+  /// Samples taken through `add_tracked()` for pixel (x,y).
+  uint32_t tracked_count(int x, int y) const { return m_moments[offset(x, y)].n; }
+  /// Sample variance of the luminance of pixel (x,y); 0 below two samples.
+  float variance(int x, int y) const {
+    const Moments &m = m_moments[offset(x, y)];
+    return m.n > 1 ? m.m2 / float(m.n - 1) : 0.f;
+  }
+
+  /// Accumulates `color` with `weight` into pixel (x,y). Safe from any thread.
+  void splat(int x, int y, const ColorXYZ &color, float weight = 1.f);
+
+  /// Returns the normalized color of pixel (x,y), or black if it has no samples.
+  ColorXYZ resolve(int x, int y) const {
+    const Pixel &p = pixel(x, y);
+    float w = p.rgbw[3].load(std::memory_order_relaxed);
+    if (w == 0.f) {
+      return ColorXYZ{ 0, 0, 0 };
+    }
+    float inv_w{ 1.f / w };
+    return ColorXYZ{ p.rgbw[0].load(std::memory_order_relaxed) * inv_w,
+                     p.rgbw[1].load(std::memory_order_relaxed) * inv_w,
+                     p.rgbw[2].load(std::memory_order_relaxed) * inv_w };
+  }
+
+  /// `resolve()` of the `n` pixels of row `y` starting at `x`, as `3 * n`
+  /// floats. Like `add_span()`, the span must not cross a tile border.
+  void resolve_span(int x, int y, size_t n, float *rgb) const {
+    const Pixel *p = &pixel(x, y);
+    for (size_t i{ 0 }; i < n; ++i, rgb += 3) {
+      const float w = p[i].rgbw[3].load(std::memory_order_relaxed);
+      const float inv_w{ w == 0.f ? 0.f : 1.f / w };
+      for (int c{ 0 }; c < 3; ++c) {
+        rgb[c] = p[i].rgbw[c].load(std::memory_order_relaxed) * inv_w;
+      }
+    }
+  }
+
+  /// Raw RGB sums and weight of pixel (x,y), e.g. to save the buffer to a file.
+  void load_raw(int x, int y, float rgbw[4]) const {
+    const Pixel &p = pixel(x, y);
+    for (int c{ 0 }; c < 4; ++c) {
+      rgbw[c] = p.rgbw[c].load(std::memory_order_relaxed);
+    }
+  }
+  /// Overwrites pixel (x,y) with raw sums and weight. Tile owner only.
+  void store_raw(int x, int y, const float rgbw[4]) {
+    Pixel &p = pixel(x, y);
+    for (int c{ 0 }; c < 4; ++c) {
+      p.rgbw[c].store(rgbw[c], std::memory_order_relaxed);
+    }
+  }
+
+  /// Resets every pixel to zero.
+  void clear();
+
+ private:
+  /// RGB + weight. Relaxed atomics compile down to plain loads and stores, so
+  /// `add()` costs the same as with regular floats.
+  struct Pixel {
+    std::atomic<float> rgbw[4];
+  };
+  static constexpr int pixels_per_line{ 4 };
+  /// Four pixels fill exactly one cache line.
+  struct alignas(64) CacheLine {
+    Pixel px[pixels_per_line];
+  };
+  // No padding between lines: pixels of a tile row are contiguous.
+  static_assert(sizeof(CacheLine) == pixels_per_line * sizeof(Pixel));
+
+  /// Position of pixel (x,y) in the tiled layout.
+  size_t offset(int x, int y) const {
+    size_t tile = size_t(y >> tile_shift) * m_tiles_x + size_t(x >> tile_shift);
+    size_t in_tile = size_t(y & (tile_size - 1)) * tile_size + size_t(x & (tile_size - 1));
+    return (tile << (2 * tile_shift)) + in_tile;
+  }
+  Pixel &pixel(int x, int y) {
+    size_t i = offset(x, y);
+    return m_lines[i / pixels_per_line].px[i % pixels_per_line];
+  }
+  const Pixel &pixel(int x, int y) const {
+    size_t i = offset(x, y);
+    return m_lines[i / pixels_per_line].px[i % pixels_per_line];
+  }
+
+  /// Welford state of a pixel: sample count, mean and sum of squared
+  /// deviations of the luminance.
+  struct Moments {
+    float mean;
+    float m2;
+    uint32_t n;
+    uint32_t unused;
+  };
+
+  int m_width;
+  int m_height;
+  size_t m_tiles_x;  //!< Tiles per row (borders are padded to a full tile).
+  size_t m_n_lines;  //!< Number of allocated cache lines.
+  std::unique_ptr<CacheLine[]> m_lines;
+  /// Same layout as the pixels; `nullptr` unless `enable_moments()`.
+  std::unique_ptr<Moments[]> m_moments;
+};
+
+}  // namespace rt3
+
+#endif  // COLOR_BUFFER_H
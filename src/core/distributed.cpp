@@ -0,0 +1,680 @@
+#include "distributed.h"
+#include "api.h"
+#include "net.h"
+#include "scene_cache.h"
+#include "stats.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(RT3_HAS_SOCKETS)
+#include <poll.h>
+#endif
+
+namespace rt3 {
+
+#if defined(RT3_HAS_SOCKETS)
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+// Messages are framed as `net.h` says.
+constexpr uint32_t protocol_version{ 1 };
+enum class message_e : uint32_t {
+  SCENE = 1,  //!< Coordinator to worker: version, resolution, scene file, cache.
+  READY,      //!< Worker to coordinator: scene built; worker thread count.
+  LEASE,      //!< Coordinator to worker: lease id, tile rectangles.
+  RESULT,     //!< Worker to coordinator: lease id, samples, time, pixel sums.
+  DONE        //!< Coordinator to worker: the frame is complete.
+};
+constexpr uint64_t max_message_bytes{ uint64_t(1) << 32 };
+
+constexpr int max_tiles_per_lease{ 32 };
+constexpr int max_leases_in_flight{ 2 };  //!< Per worker.
+constexpr int max_copies_per_lease{ 2 };  //!< Remote copies of a straggling lease.
+/// A running lease is a straggler after twice the average lease time, and
+/// never before this.
+constexpr double min_straggler_ms{ 250 };
+constexpr int connect_attempts{ 120 };  //!< Half a second apart: one minute.
+
+//=== Sockets
+
+using net::Decoder;
+using net::Encoder;
+
+bool send_message(int fd, message_e type, const std::vector<unsigned char> &payload) {
+  return net::send_message(fd, uint32_t(type), payload);
+}
+
+bool recv_message(int fd, message_e &type, std::vector<unsigned char> &payload) {
+  uint32_t t{ 0 };
+  const bool ok{ net::recv_message(fd, t, payload, max_message_bytes) };
+  type = message_e(t);
+  return ok;
+}
+
+//=== Tile payloads
+
+size_t pixel_count(const std::vector<Tile> &tiles) {
+  size_t n{ 0 };
+  for (const auto &t : tiles) {
+    n += size_t(t.x1 - t.x0) * size_t(t.y1 - t.y0);
+  }
+  return n;
+}
+
+/// Appends the raw sums of `tiles` (4 floats per pixel, tile after tile, rows
+/// in order), deflated, to `out`.
+bool pack_tiles(const Film &film, const std::vector<Tile> &tiles, Encoder &out) {
+  Encoder raw;
+  raw.data().reserve(pixel_count(tiles) * 16);
+  float rgbw[4];
+  for (const auto &t : tiles) {
+    for (int y{ t.y0 }; y < t.y1; ++y) {
+      for (int x{ t.x0 }; x < t.x1; ++x) {
+        film.m_color_buffer_ptr->load_raw(x, y, rgbw);
+        for (float v : rgbw) {
+          raw.f32(v);
+        }
+      }
+    }
+  }
+  // The fastest level: float sums do not shrink much more at higher ones.
+  std::vector<unsigned char> packed(compressBound(uLong(raw.data().size())));
+  uLongf packed_size = uLongf(packed.size());
+  if (compress2(packed.data(), &packed_size, raw.data().data(), uLong(raw.data().size()), 1)
+      != Z_OK) {
+    return false;
+  }
+  out.u64(raw.data().size());
+  out.bytes(packed.data(), packed_size);
+  return true;
+}
+
+/// Inflates what `pack_tiles()` made; `false` unless it is exactly the pixels
+/// of `tiles`.
+bool unpack_tiles(Decoder &in, const std::vector<Tile> &tiles, std::vector<unsigned char> &raw) {
+  const uint64_t raw_size{ in.u64() };
+  if (not in.ok() or raw_size != pixel_count(tiles) * 16) {
+    return false;
+  }
+  size_t n;
+  const unsigned char *packed = in.rest(n);
+  raw.resize(size_t(raw_size));
+  uLongf size = uLongf(raw.size());
+  return uncompress(raw.data(), &size, packed, uLong(n)) == Z_OK and size == raw.size();
+}
+
+/// Overwrites the pixels of `tiles` with the sums in `raw`.
+void store_tiles(Film &film, const std::vector<Tile> &tiles, const std::vector<unsigned char> &raw) {
+  Decoder d{ raw };
+  float rgbw[4];
+  for (const auto &t : tiles) {
+    for (int y{ t.y0 }; y < t.y1; ++y) {
+      for (int x{ t.x0 }; x < t.x1; ++x) {
+        for (float &v : rgbw) {
+          v = d.f32();
+        }
+        film.m_color_buffer_ptr->store_raw(x, y, rgbw);
+      }
+    }
+  }
+}
+
+//=== Coordinator
+
+/// Runs of at most `max_tiles_per_lease` consecutive tiles of a tile row.
+std::vector<std::vector<Tile>> make_leases(const std::vector<Tile> &tiles) {
+  std::vector<std::vector<Tile>> leases;
+  for (const auto &t : tiles) {
+    if (leases.empty() or leases.back().size() == size_t(max_tiles_per_lease)
+        or leases.back().back().y0 != t.y0) {
+      leases.emplace_back();
+    }
+    leases.back().push_back(t);
+  }
+  return leases;
+}
+
+/*!
+ * Who renders which lease. Worker ids are `>= 0`; `local` is the
+ * coordinator's own pool, which renders straight into the film: once it
+ * claims a lease, results for that lease from anywhere else are dropped, so
+ * no pixel is ever written twice.
+ */
+class LeaseBoard {
+ public:
+  static constexpr int local{ -1 };
+
+  explicit LeaseBoard(size_t n_leases) : m_leases(n_leases) {
+    for (size_t i{ 0 }; i < n_leases; ++i) {
+      m_pending.push_back(i);
+    }
+  }
+
+  /// A lease for `worker` to render: a pending one, or else a copy of a
+  /// straggler. Empty if there is nothing to do for now.
+  std::optional<size_t> acquire(int worker) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    const auto now = clock::now();
+    if (not m_pending.empty()) {
+      const size_t l{ m_pending.front() };
+      m_pending.pop_front();
+      assign(l, worker, now);
+      return l;
+    }
+    const double threshold{ std::max(min_straggler_ms, 2 * average_ms()) };
+    std::optional<size_t> oldest;
+    for (size_t l{ 0 }; l < m_leases.size(); ++l) {
+      const Lease &lease = m_leases[l];
+      if (lease.done or lease.local or lease.holders.empty()
+          or std::find(lease.holders.begin(), lease.holders.end(), worker) != lease.holders.end()
+          or (worker != local and lease.holders.size() >= size_t(max_copies_per_lease))
+          or std::chrono::duration<double, std::milli>(now - lease.issued).count() < threshold) {
+        continue;
+      }
+      if (not oldest or lease.issued < m_leases[*oldest].issued) {
+        oldest = l;
+      }
+    }
+    if (oldest) {
+      ++m_reissued;
+      assign(*oldest, worker, now);
+    }
+    return oldest;
+  }
+
+  /*!
+   * `worker` has rendered lease `l` in `ms` milliseconds. Returns whether
+   * its pixels go into the film; `false` for a copy that lost the race.
+   */
+  bool complete(size_t l, int worker, double ms) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    Lease &lease = m_leases[l];
+    auto it = std::find(lease.holders.begin(), lease.holders.end(), worker);
+    if (it != lease.holders.end()) {
+      lease.holders.erase(it);
+    }
+    if (lease.done or (worker != local and lease.local)) {
+      ++m_dropped;
+      return false;
+    }
+    lease.done = true;
+    lease.ms = ms;
+    lease.by_local = worker == local;
+    ++m_n_done;
+    m_total_ms += ms;
+    m_cv.notify_all();
+    return true;
+  }
+
+  /// `worker` is gone: leases only it was rendering go back to the queue.
+  void drop_worker(int worker) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (size_t l{ 0 }; l < m_leases.size(); ++l) {
+      Lease &lease = m_leases[l];
+      auto it = std::find(lease.holders.begin(), lease.holders.end(), worker);
+      if (it == lease.holders.end()) {
+        continue;
+      }
+      lease.holders.erase(it);
+      if (not lease.done and not lease.local and lease.holders.empty()) {
+        m_pending.push_front(l);
+        ++m_reissued;
+      }
+    }
+    m_cv.notify_all();
+  }
+
+  bool finished() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_n_done == m_leases.size();
+  }
+  /// Waits a little for something to change (a lease done or back in the queue).
+  void wait() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_cv.wait_for(lock, std::chrono::milliseconds(20));
+  }
+
+  size_t reissued() const { return m_reissued; }
+  size_t dropped() const { return m_dropped; }
+  /// Leases rendered by the local pool.
+  size_t done_locally() const {
+    return size_t(std::count_if(m_leases.begin(), m_leases.end(),
+                                [](const Lease &l) { return l.by_local; }));
+  }
+  /// Time it took to render lease `l`.
+  double lease_ms(size_t l) const { return m_leases[l].ms; }
+
+ private:
+  struct Lease {
+    bool done{ false };
+    bool local{ false };       //!< Claimed by the local pool.
+    bool by_local{ false };    //!< The film got the local pool's pixels.
+    std::vector<int> holders;  //!< Workers rendering it.
+    clock::time_point issued;  //!< When it was first handed out.
+    double ms{ 0 };
+  };
+
+  void assign(size_t l, int worker, clock::time_point now) {
+    Lease &lease = m_leases[l];
+    if (lease.holders.empty() and not lease.local) {
+      lease.issued = now;
+    }
+    if (worker == local) {
+      lease.local = true;
+    } else {
+      lease.holders.push_back(worker);
+    }
+  }
+  double average_ms() const { return m_n_done > 0 ? m_total_ms / double(m_n_done) : 0.0; }
+
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::vector<Lease> m_leases;
+  std::deque<size_t> m_pending;
+  size_t m_n_done{ 0 };
+  double m_total_ms{ 0 };
+  size_t m_reissued{ 0 };
+  size_t m_dropped{ 0 };
+};
+
+/// A worker connected to the coordinator.
+struct RemoteWorker {
+  int fd{ -1 };
+  int id{ 0 };
+  bool ready{ false };  //!< Has built the scene.
+  int in_flight{ 0 };   //!< Leases sent and not answered yet.
+  size_t n_threads{ 0 };
+};
+
+/// The SCENE message for `film`: the scene file as it is on disk, and its
+/// cache if scene caching is on.
+bool scene_message(const Film &film, Encoder &out) {
+  namespace fs = std::filesystem;
+  const std::string &scene_file{ API::curr_run_opt.filename };
+  std::ifstream ifs{ scene_file, std::ios::binary };
+  if (not ifs.is_open()) {
+    return false;
+  }
+  std::ostringstream xml;
+  xml << ifs.rdbuf();
+  std::string cache;
+  if (API::curr_run_opt.cache_scene) {
+    std::ifstream cfs{ scene_cache_filename(scene_file), std::ios::binary };
+    if (cfs.is_open()) {
+      std::ostringstream oss;
+      oss << cfs.rdbuf();
+      cache = oss.str();
+    }
+  }
+  std::error_code ec;
+  const auto mtime = fs::last_write_time(scene_file, ec);
+  out.u32(protocol_version);
+  out.i32(film.m_full_resolution[0]);
+  out.i32(film.m_full_resolution[1]);
+  out.blob(fs::path{ scene_file }.filename().string());
+  out.i64(ec ? 0 : int64_t(mtime.time_since_epoch().count()));
+  out.blob(xml.str());
+  out.blob(cache);
+  return true;
+}
+
+//=== Worker
+
+int g_coordinator{ -1 };                 //!< Connection of this worker.
+std::filesystem::path g_scene_dir;       //!< Where the scene copy lives.
+
+}  // namespace
+
+RenderReport render_distributed(Film &film,
+                                const Scene &scene,
+                                const Camera &camera,
+                                const Sampler &sampler,
+                                ThreadPool &pool,
+                                int port) {
+  const std::vector<Tile> tiles{ film.tiles() };
+  const std::vector<std::vector<Tile>> leases{ make_leases(tiles) };
+  Encoder scene_msg;
+  const int listen_fd{ scene_message(film, scene_msg) ? net::listen_on(port) : -1 };
+  if (listen_fd < 0) {
+    RT3_WARNING("Could not serve the scene on port " + std::to_string(port)
+                + "; rendering locally.");
+    return render(film, scene, camera, sampler, pool, tiles);
+  }
+  RT3_MESSAGE("    Coordinator: listening on port " + std::to_string(port) + "; "
+              + std::to_string(leases.size()) + " leases of up to "
+              + std::to_string(max_tiles_per_lease) + " tiles.\n");
+
+  LeaseBoard board{ leases.size() };
+  // The local pool takes leases like any worker, so a run without workers
+  // still finishes.
+  size_t local_samples{ 0 };
+  std::thread local_worker{ [&]() {
+    while (not board.finished()) {
+      auto l = board.acquire(LeaseBoard::local);
+      if (not l) {
+        board.wait();
+        continue;
+      }
+      const auto start = clock::now();
+      local_samples += render(film, scene, camera, sampler, pool, leases[*l]).n_samples;
+      board.complete(*l, LeaseBoard::local,
+                     std::chrono::duration<double, std::milli>(clock::now() - start).count());
+    }
+  } };
+
+  std::vector<RemoteWorker> workers;
+  int next_id{ 0 };
+  size_t remote_samples{ 0 }, peak_workers{ 0 }, remote_threads{ 0 };
+  auto drop = [&](RemoteWorker &w, const std::string &why) {
+    RT3_WARNING("Worker " + std::to_string(w.id) + " " + why + "; its leases go back to the queue.");
+    net::close_socket(w.fd);
+    w.fd = -1;
+    board.drop_worker(w.id);
+  };
+  std::vector<unsigned char> payload, raw;
+  while (not board.finished()) {
+    // Keep every ready worker busy.
+    for (auto &w : workers) {
+      while (w.fd >= 0 and w.ready and w.in_flight < max_leases_in_flight) {
+        auto l = board.acquire(w.id);
+        if (not l) {
+          break;
+        }
+        Encoder lease;
+        lease.u32(uint32_t(*l));
+        lease.u32(uint32_t(leases[*l].size()));
+        for (const auto &t : leases[*l]) {
+          lease.i32(t.x0);
+          lease.i32(t.y0);
+          lease.i32(t.x1);
+          lease.i32(t.y1);
+        }
+        if (not send_message(w.fd, message_e::LEASE, lease.data())) {
+          drop(w, "is unreachable");
+          break;
+        }
+        ++w.in_flight;
+      }
+    }
+
+    std::vector<pollfd> fds{ pollfd{ listen_fd, POLLIN, 0 } };
+    for (const auto &w : workers) {
+      fds.push_back(pollfd{ w.fd, POLLIN, 0 });
+    }
+    if (::poll(fds.data(), nfds_t(fds.size()), 20) <= 0) {
+      continue;
+    }
+    if (fds[0].revents & POLLIN) {
+      int fd = net::accept_on(listen_fd);
+      if (fd >= 0) {
+        net::tune_socket(fd, 30);
+        if (send_message(fd, message_e::SCENE, scene_msg.data())) {
+          workers.push_back(RemoteWorker{ fd, next_id++ });
+        } else {
+          net::close_socket(fd);
+        }
+      }
+    }
+    for (size_t i{ 1 }; i < fds.size(); ++i) {
+      RemoteWorker &w = workers[i - 1];
+      if (not(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+        continue;
+      }
+      message_e type;
+      if (not recv_message(w.fd, type, payload)) {
+        drop(w, "disconnected");
+        continue;
+      }
+      Decoder d{ payload };
+      if (type == message_e::READY) {
+        w.n_threads = d.u32();
+        w.ready = true;
+        remote_threads += w.n_threads;
+        peak_workers = std::max(peak_workers, size_t(std::count_if(
+                                                workers.begin(), workers.end(),
+                                                [](const RemoteWorker &r) { return r.ready; })));
+        RT3_MESSAGE("    Worker " + std::to_string(w.id) + " joined with "
+                    + std::to_string(w.n_threads) + " threads.\n");
+        continue;
+      }
+      const size_t l{ d.u32() };
+      const uint64_t n_samples{ d.u64() };
+      const double ms{ double(d.u64()) * 1e-3 };
+      if (type != message_e::RESULT or l >= leases.size() or not unpack_tiles(d, leases[l], raw)) {
+        drop(w, "sent a malformed message");
+        continue;
+      }
+      --w.in_flight;
+      if (board.complete(l, w.id, ms)) {
+        store_tiles(film, leases[l], raw);
+        for (const auto &t : leases[l]) {
+          film.tile_done(t);
+        }
+        remote_samples += n_samples;
+        stats_add(counter_e::SAMPLES, n_samples);
+        stats_add(counter_e::TILES, leases[l].size());
+      }
+    }
+    workers.erase(std::remove_if(workers.begin(), workers.end(),
+                                 [](const RemoteWorker &w) { return w.fd < 0; }),
+                  workers.end());
+  }
+  local_worker.join();
+  for (auto &w : workers) {
+    send_message(w.fd, message_e::DONE, {});
+    net::close_socket(w.fd);
+  }
+  net::close_socket(listen_fd);
+
+  const size_t by_local{ board.done_locally() };
+  RT3_MESSAGE("    Distributed: " + std::to_string(by_local) + " leases rendered here, "
+              + std::to_string(leases.size() - by_local) + " by " + std::to_string(peak_workers)
+              + " worker(s); " + std::to_string(board.reissued()) + " reissued, "
+              + std::to_string(board.dropped()) + " duplicate results dropped.\n");
+
+  RenderReport report;
+  report.n_tiles = tiles.size();
+  report.n_threads = pool.size() + remote_threads;
+  report.n_pixels = pixel_count(tiles);
+  report.n_samples = local_samples + remote_samples;
+  // Per-tile times are only known per lease.
+  double sum{ 0 };
+  report.tile_ms_min = leases.empty() ? 0.0 : 1e300;
+  for (size_t l{ 0 }; l < leases.size(); ++l) {
+    const double per_tile{ board.lease_ms(l) / double(leases[l].size()) };
+    report.tile_ms_min = std::min(report.tile_ms_min, per_tile);
+    report.tile_ms_max = std::max(report.tile_ms_max, per_tile);
+    sum += board.lease_ms(l);
+  }
+  report.tile_ms_avg = tiles.empty() ? 0.0 : sum / double(tiles.size());
+  return report;
+}
+
+bool join_coordinator(const std::string &address, RunningOptions &opt) {
+  namespace fs = std::filesystem;
+  int fd{ -1 };
+  for (int attempt{ 0 }; attempt < connect_attempts and fd < 0; ++attempt) {
+    if (attempt > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    fd = net::connect_to(address);
+  }
+  if (fd < 0) {
+    RT3_WARNING("Could not connect to the coordinator at \"" + address + "\".");
+    return false;
+  }
+  net::tune_socket(fd, 0);
+  message_e type;
+  std::vector<unsigned char> payload;
+  if (not recv_message(fd, type, payload) or type != message_e::SCENE) {
+    RT3_WARNING("The coordinator at \"" + address + "\" sent no scene.");
+    net::close_socket(fd);
+    return false;
+  }
+  Decoder d{ payload };
+  const uint32_t version{ d.u32() };
+  const int w{ d.i32() }, h{ d.i32() };
+  const std::string name{ fs::path{ d.blob() }.filename().string() };
+  const int64_t mtime{ d.i64() };
+  const std::string xml{ d.blob() };
+  const std::string cache{ d.blob() };
+  if (not d.ok() or version != protocol_version or name.empty() or w <= 0 or h <= 0) {
+    RT3_WARNING("The coordinator at \"" + address + "\" speaks another protocol.");
+    net::close_socket(fd);
+    return false;
+  }
+
+  std::error_code ec;
+  g_scene_dir = fs::temp_directory_path(ec) / ("rt3_worker_" + std::to_string(::getpid()));
+  fs::create_directories(g_scene_dir, ec);
+  const std::string scene_file{ (g_scene_dir / name).string() };
+  {
+    std::ofstream ofs{ scene_file, std::ios::binary };
+    ofs.write(xml.data(), std::streamsize(xml.size()));
+  }
+  opt.cache_scene = false;
+  if (not cache.empty()) {
+    // The cache is only valid for a scene file with the original time stamp.
+    fs::last_write_time(scene_file, fs::file_time_type{ fs::file_time_type::duration{ mtime } },
+                        ec);
+    std::ofstream cfs{ scene_cache_filename(scene_file), std::ios::binary };
+    cfs.write(cache.data(), std::streamsize(cache.size()));
+    opt.cache_scene = not ec and cfs.good();
+  }
+  opt.filename = scene_file;
+  opt.scene_files = { scene_file };
+  opt.resolution[0] = w;
+  opt.resolution[1] = h;
+  // The coordinator decides which pixels get rendered, and writes them.
+  opt.crop_window[0][0] = opt.crop_window[1][0] = 0;
+  opt.crop_window[0][1] = opt.crop_window[1][1] = 1;
+  opt.incremental = false;
+  opt.quick_render = false;
+  g_coordinator = fd;
+  RT3_MESSAGE("    Joined the coordinator at \"" + address + "\" for \"" + name + "\".\n");
+  return true;
+}
+
+RenderReport serve_leases(Film &film,
+                          const Scene &scene,
+                          const Camera &camera,
+                          const Sampler &sampler,
+                          ThreadPool &pool) {
+  RenderReport report;
+  report.n_threads = pool.size();
+  Encoder ready;
+  ready.u32(uint32_t(pool.size()));
+  if (g_coordinator < 0 or not send_message(g_coordinator, message_e::READY, ready.data())) {
+    RT3_WARNING("Not connected to a coordinator.");
+    return report;
+  }
+  const auto res = film.get_resolution();
+  std::vector<unsigned char> payload;
+  double total_ms{ 0 };
+  report.tile_ms_min = 1e300;
+  for (;;) {
+    message_e type;
+    if (not recv_message(g_coordinator, type, payload)) {
+      RT3_WARNING("Lost the connection to the coordinator.");
+      break;
+    }
+    if (type == message_e::DONE) {
+      break;
+    }
+    Decoder d{ payload };
+    const uint32_t id{ d.u32() };
+    const uint32_t n{ d.u32() };
+    std::vector<Tile> tiles;
+    bool valid{ type == message_e::LEASE };
+    for (uint32_t i{ 0 }; i < n and valid; ++i) {
+      Tile t{ i, d.i32(), d.i32(), d.i32(), d.i32() };
+      // A tile must lie inside one cell of the tile grid, inside the image.
+      constexpr int ts{ Film::default_tile_size };
+      valid = d.ok() and t.x0 >= 0 and t.y0 >= 0 and t.x1 <= res[0] and t.y1 <= res[1]
+              and t.x0 < t.x1 and t.y0 < t.y1 and (t.x1 - 1) / ts == t.x0 / ts
+              and (t.y1 - 1) / ts == t.y0 / ts;
+      tiles.push_back(t);
+    }
+    if (not valid or not d.ok()) {
+      RT3_WARNING("The coordinator sent a malformed lease.");
+      break;
+    }
+    const auto start = clock::now();
+    const RenderReport r{ render(film, scene, camera, sampler, pool, tiles) };
+    const double ms{ std::chrono::duration<double, std::milli>(clock::now() - start).count() };
+    Encoder result;
+    result.u32(id);
+    result.u64(r.n_samples);
+    result.u64(uint64_t(ms * 1e3));
+    if (not pack_tiles(film, tiles, result)
+        or not send_message(g_coordinator, message_e::RESULT, result.data())) {
+      RT3_WARNING("Could not send lease " + std::to_string(id) + " to the coordinator.");
+      break;
+    }
+    report.n_tiles += r.n_tiles;
+    report.n_pixels += r.n_pixels;
+    report.n_samples += r.n_samples;
+    report.tile_ms_min = std::min(report.tile_ms_min, r.tile_ms_min);
+    report.tile_ms_max = std::max(report.tile_ms_max, r.tile_ms_max);
+    total_ms += r.tile_ms_avg * double(r.n_tiles);
+  }
+  if (report.n_tiles == 0) {
+    report.tile_ms_min = 0;
+  } else {
+    report.tile_ms_avg = total_ms / double(report.n_tiles);
+  }
+  return report;
+}
+
+void leave_coordinator() {
+  if (g_coordinator >= 0) {
+    net::close_socket(g_coordinator);
+    g_coordinator = -1;
+  }
+  if (not g_scene_dir.empty()) {
+    std::error_code ec;
+    std::filesystem::remove_all(g_scene_dir, ec);
+    g_scene_dir.clear();
+  }
+}
+
+#else  // No sockets.
+
+RenderReport render_distributed(Film &film,
+                                const Scene &scene,
+                                const Camera &camera,
+                                const Sampler &sampler,
+                                ThreadPool &pool,
+                                int /* port */) {
+  RT3_WARNING("Distributed rendering is not supported on this platform; rendering locally.");
+  return render(film, scene, camera, sampler, pool);
+}
+
+bool join_coordinator(const std::string & /* address */, RunningOptions & /* opt */) {
+  RT3_WARNING("Distributed rendering is not supported on this platform.");
+  return false;
+}
+
+RenderReport serve_leases(Film &, const Scene &, const Camera &, const Sampler &, ThreadPool &) {
+  return RenderReport{};
+}
+
+void leave_coordinator() {}
+
+#endif
+
+}  // namespace rt3
@@ -0,0 +1,73 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H 1
+
+#include <string>
+
+#include "render.h"
+#include "rt3.h"
+
+namespace rt3 {
+
+/*!
+ * Distributed rendering of a single frame over TCP.
+ *
+ * A *coordinator* (`rt3 --coordinator <port> scene.xml`) parses the scene
+ * as usual, then splits its film into *leases*: runs of tiles of one tile
+ * row, i.e. small crop windows on the film's tile grid. Every *worker*
+ * (`rt3 --worker <host>:<port>`, on any node) that connects receives the
+ * scene file (plus its `.rt3c` cache, with `--cache-scene`), builds its own
+ * copy of the scene, and renders whatever leases it is handed. It sends back
+ * the exact float sums of the lease's pixels, deflated, which the coordinator
+ * stores into its film; the bands then go through the film's usual streaming
+ * output and `write_image()`. The coordinator renders leases on its own
+ * pool as well, so a run without workers still finishes.
+ *
+ * - Each worker has up to two leases in flight, so it never idles waiting
+ *   for the next one.
+ * - Leases of a worker that disconnects go back to the queue.
+ * - Once the queue is empty, idle workers get a copy of the oldest lease
+ *   still running, if it has been out for more than twice the average lease
+ *   time; the first result in wins, the other one is dropped. Slow or hung
+ *   workers therefore only delay the frame by about one lease.
+ *
+ * Workers read textures from their own file system, at the paths the scene
+ * gives, so they should run from an equivalent directory (e.g. a shared
+ * mount). Animations (`frame_begin`) and `--quick` render on the
+ * coordinator alone.
+ */
+
+/*!
+ * Coordinator side: renders the film's tiles on the local pool and on the
+ * workers that connect to `port`, and feeds them to the film's output as
+ * they come in (`film.open_output()` must have been called).
+ */
+RenderReport render_distributed(Film &film,
+                                const Scene &scene,
+                                const Camera &camera,
+                                const Sampler &sampler,
+                                ThreadPool &pool,
+                                int port);
+
+/*!
+ * Worker side, before the engine starts: connects to the coordinator at
+ * `address` (`host:port`), retrying for a while, and receives the scene.
+ * `opt` gets the local copy of the scene file and the coordinator's
+ * resolution. Returns `false` if no scene could be received.
+ */
+bool join_coordinator(const std::string &address, RunningOptions &opt);
+
+/// Worker side, at render time: renders the leases the coordinator sends
+/// into `film` and sends them back, until the coordinator is done.
+RenderReport serve_leases(Film &film,
+                          const Scene &scene,
+                          const Camera &camera,
+                          const Sampler &sampler,
+                          ThreadPool &pool);
+
+/// Worker side, after the engine is done: closes the connection and deletes
+/// the local copy of the scene.
+void leave_coordinator();
+
+}  // namespace rt3
+
+#endif  // DISTRIBUTED_H
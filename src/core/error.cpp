@@ -3,6 +3,8 @@
 #include <cstdlib>  // std::exit
 #include <sstream>
 
+#include "log.h"
+
 inline std::ostream& operator<<(std::ostream& os,
                                 const rt3::SourceContext& sc) {
   os << sc.file << ":" << sc.line;
@@ -13,6 +15,7 @@ namespace rt3 {
 
 /// Prints out the warning, but the program keeps running.
 void Warning(const std::string& msg, const SourceContext& sc) {
+  log_flush();
   std::cerr << std::setw(80) << std::setfill('=') << " " << std::endl
             << "[RT3 Communication System] Warning: \"" << msg << "\"\n"
             << "     REPORTED AT: < " << sc << " > \n"
@@ -21,6 +24,7 @@ void Warning(const std::string& msg, const SourceContext& sc) {
 
 /// Prints out the error message and exits the program.
 void Error(const std::string& msg, const SourceContext& sc) {
+  log_flush();
   std::cerr << std::setw(80) << std::setfill('=') << " " << std::endl
             << "[RT3 Communication System] Severe error: \"" << msg << "\""
             << std::endl
@@ -31,5 +35,8 @@ void Error(const std::string& msg, const SourceContext& sc) {
   std::exit(EXIT_FAILURE);
 }
 
-void Message(const std::string& str) { std::cout << str << std::endl; }
+void Message(const std::string& str) {
+  log_flush();
+  std::cout << str << std::endl;
+}
 }  // namespace rt3
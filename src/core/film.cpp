@@ -1,33 +1,503 @@
 #include "film.h"
 #include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
 
 #include "api.h"
 #include "image_io.h"
+#include "log.h"
 #include "paramset.h"
+#include "stats.h"
 
 namespace rt3 {
 
 //=== Film Method Definitions
-Film::Film(const Point2i &resolution, const std::string &filename, image_type_e imgt)
-    : m_full_resolution{ resolution }, m_filename{ filename }, m_image_type{ imgt }
+Film::Film(const Point2i &resolution,
+           const std::string &filename,
+           image_type_e imgt,
+           int png_compression)
+    : m_full_resolution{ resolution },
+      m_filename{ filename },
+      m_image_type{ imgt },
+      m_png_compression{ png_compression },
+      m_crop{ Point2i{ 0, 0 }, resolution }
 {
-  // TODO
+  m_color_buffer_ptr = std::make_unique<ColorBuffer>(resolution[0], resolution[1]);
 }
 
 Film::~Film()
 {
+  // A film dropped without `write_image()` still stops its threads.
+  if (m_finished_bands) {
+    finish_pipeline();
+  }
+}
+
+std::vector<Tile> Film::tiles(int tile_size) const
+{
+  std::vector<Tile> list;
+  // Start on the grid line at or before the crop corner, then clip.
+  const int tx0 = (m_crop.p_min.x / tile_size) * tile_size;
+  const int ty0 = (m_crop.p_min.y / tile_size) * tile_size;
+  for (int y{ ty0 }; y < m_crop.p_max.y; y += tile_size) {
+    for (int x{ tx0 }; x < m_crop.p_max.x; x += tile_size) {
+      list.push_back(Tile{ list.size(),
+                           std::max(x, m_crop.p_min.x),
+                           std::max(y, m_crop.p_min.y),
+                           std::min(x + tile_size, m_crop.p_max.x),
+                           std::min(y + tile_size, m_crop.p_max.y) });
+    }
+  }
+  return list;
 }
 
 /// Add the color to image.
 void Film::add_sample(const Point2f &pixel_coord, const ColorXYZ &pixel_color)
 {
-  // TODO: add color to the proper location.
+  int x = Clamp(int(pixel_coord[0]), 0, m_full_resolution[0] - 1);
+  int y = Clamp(int(pixel_coord[1]), 0, m_full_resolution[1] - 1);
+  m_color_buffer_ptr->add(x, y, pixel_color);
+}
+
+void Film::add_span(int x, int y, size_t n, const ColorXYZ *colors)
+{
+  m_color_buffer_ptr->add_span(x, y, n, colors);
+}
+
+void Film::fill_block(int x0, int y0, int x1, int y1, const ColorXYZ &color)
+{
+  const float rgbw[4]{ color[0], color[1], color[2], 1.f };
+  for (int y{ y0 }; y < y1; ++y) {
+    for (int x{ x0 }; x < x1; ++x) {
+      m_color_buffer_ptr->store_raw(x, y, rgbw);
+    }
+  }
+}
+
+void Film::splat_sample(const Point2f &pixel_coord, const ColorXYZ &pixel_color)
+{
+  int x = Clamp(int(pixel_coord[0]), 0, m_full_resolution[0] - 1);
+  int y = Clamp(int(pixel_coord[1]), 0, m_full_resolution[1] - 1);
+  m_color_buffer_ptr->splat(x, y, pixel_color);
+}
+
+void Film::resolve_rows(int y0, int y1, unsigned char *out) const
+{
+  const Bounds2i win{ output_window() };
+  const size_t bytes = size_t(m_resolver.bytes_per_sample());
+  ScopedTimer timer{ phase_e::RESOLVE, "resolve" };
+  // Rows are resolved one tile-wide span at a time: the pixels of a span are
+  // contiguous in the buffer, and its floats stay on the stack.
+  float rgb[3 * default_tile_size];
+  for (int y{ y0 }; y < y1; ++y) {
+    for (int x{ win.p_min.x }; x < win.p_max.x;) {
+      const int x1 = std::min((x / default_tile_size + 1) * default_tile_size, win.p_max.x);
+      const size_t n = size_t(x1 - x);
+      m_color_buffer_ptr->resolve_span(x, y, n, rgb);
+      m_resolver.encode(rgb, n, x, y, out);
+      out += 3 * n * bytes;
+      x = x1;
+    }
+  }
+}
+
+void Film::resolve_tile(const Tile &tile, unsigned char *out) const
+{
+  const size_t bytes = size_t(m_resolver.bytes_per_sample());
+  ScopedTimer timer{ phase_e::RESOLVE, "resolve tile", tile.x0, tile.y0 };
+  // A tile row is a single span of the buffer.
+  float rgb[3 * default_tile_size];
+  const size_t n = size_t(tile.x1 - tile.x0);
+  for (int y{ tile.y0 }; y < tile.y1; ++y) {
+    m_color_buffer_ptr->resolve_span(tile.x0, y, n, rgb);
+    m_resolver.encode(rgb, n, tile.x0, y, out);
+    out += 3 * n * bytes;
+  }
+}
+
+bool Film::open_output(ThreadPool *pool)
+{
+  if (not open_writer(pool)) {
+    return false;
+  }
+  m_finished_bands = std::make_unique<BoundedQueue<int>>(size_t(m_n_bands));
+  // Bands with nothing to render are finished from the start.
+  for (int b{ 0 }; b < m_n_bands; ++b) {
+    if (m_band_tiles_total[b] == 0) {
+      m_finished_bands->push(b);
+    }
+  }
+  if (not m_direct_output) {
+    m_resolved_bands = std::make_unique<BoundedQueue<ResolvedBand>>(size_t(pipeline_depth));
+    m_free_buffers = std::make_unique<BoundedQueue<std::vector<unsigned char>>>(
+      size_t(pipeline_depth));
+    for (int i{ 0 }; i < pipeline_depth; ++i) {
+      m_free_buffers->push(std::vector<unsigned char>(m_band_bytes.size()));
+    }
+    m_encode_thread = std::thread{ [this]() { encode_stage(); } };
+  }
+  m_resolve_thread = std::thread{ [this]() { resolve_stage(); } };
+  return true;
+}
+
+bool Film::open_writer(ThreadPool *pool)
+{
+  const Bounds2i win{ output_window() };
+  const size_t w = size_t(win.width());
+  const size_t h = size_t(win.height());
+  const size_t d{ 3 };  // RGB
+  const int bits{ m_resolver.bit_depth() };
+  switch (m_image_type) {
+  case image_type_e::PPM3:
+    m_writer = open_ppm3_writer(m_filename, w, h, d, pool, bits);
+    break;
+  case image_type_e::PPM6:
+    if (m_mmap_output) {
+      m_writer = open_ppm6_mapped_writer(m_filename, w, h, d, bits);
+      if (not m_writer) {
+        RT3_WARNING("Could not memory-map \"" + m_filename + "\"; using regular file output.");
+      }
+    }
+    if (not m_writer) {
+      m_writer = open_ppm6_writer(m_filename, w, h, d, bits);
+    }
+    break;
+  case image_type_e::PNG:
+  default:
+    m_writer = open_png_writer(m_filename, w, h, d, m_png_compression, pool, bits);
+    break;
+  }
+  if (not m_writer) {
+    RT3_WARNING(string{ "Could not open image file \"" } + m_filename + "\" for writing.");
+    return false;
+  }
+  m_pool = pool;
+  // Bands are the tile rows of the full-frame grid that meet the output window.
+  m_first_band = win.p_min.y / default_tile_size;
+  m_n_bands = (win.p_max.y + default_tile_size - 1) / default_tile_size - m_first_band;
+  m_next_band = 0;
+  m_band_tiles_done = std::make_unique<std::atomic<int>[]>(m_n_bands);
+  m_band_tiles_total = std::make_unique<int[]>(m_n_bands);
+  m_band_written = std::make_unique<std::atomic<bool>[]>(m_n_bands);
+  for (int b{ 0 }; b < m_n_bands; ++b) {
+    m_band_tiles_done[b] = 0;
+    m_band_tiles_total[b] = 0;
+    m_band_written[b] = false;
+  }
+  for (const auto &tile : tiles()) {
+    ++m_band_tiles_total[tile.y0 / default_tile_size - m_first_band];
+  }
+  // Direct (mapped) output needs no staging: rows are resolved in place.
+  m_direct_output = m_writer->direct_rows(0, 1) != nullptr;
+  if (not m_direct_output) {
+    m_band_bytes.resize(w * d * size_t(m_resolver.bytes_per_sample()) * default_tile_size);
+  }
+  return true;
+}
+
+void Film::tile_done(const Tile &tile)
+{
+  if (not m_finished_bands) {
+    return;  // Not streaming.
+  }
+  int band = tile.y0 / default_tile_size - m_first_band;
+  if (m_band_tiles_done[band].fetch_add(1) + 1 == m_band_tiles_total[band]) {
+    // Each band comes in once, so this never waits.
+    m_finished_bands->push(band);
+  }
+}
+
+void Film::resolve_stage()
+{
+  std::vector<bool> finished(size_t(m_n_bands), false);
+  // Until `finish_pipeline()` closes the queue; then every band is done.
+  for (;;) {
+    std::optional<int> band{ m_finished_bands->pop() };
+    if (band) {
+      finished[size_t(*band)] = true;
+    } else {
+      std::fill(finished.begin(), finished.end(), true);
+    }
+    if (m_direct_output) {
+      for (int b{ band ? *band : 0 }; b < (band ? *band + 1 : m_n_bands); ++b) {
+        if (not m_band_written[b]) {
+          write_band(b);
+        }
+      }
+    } else {
+      while (m_next_band < m_n_bands and finished[size_t(m_next_band)]) {
+        int y0, y1;
+        band_rows(m_next_band, y0, y1);
+        // Waits while the encoder holds every buffer.
+        std::vector<unsigned char> bytes{ std::move(*m_free_buffers->pop()) };
+        resolve_rows(y0, y1, bytes.data());
+        m_resolved_bands->push(ResolvedBand{ m_next_band, std::move(bytes) });
+        ++m_next_band;
+      }
+    }
+    if (not band) {
+      break;
+    }
+  }
+  if (m_resolved_bands) {
+    m_resolved_bands->close();
+  }
+}
+
+void Film::encode_stage()
+{
+  while (std::optional<ResolvedBand> r{ m_resolved_bands->pop() }) {
+    int y0, y1;
+    band_rows(r->band, y0, y1);
+    {
+      ScopedTimer timer{ phase_e::ENCODE, "write rows" };
+      if (not m_writer->write_rows(r->bytes.data(), size_t(y1 - y0))) {
+        RT3_WARNING(string{ "Error while writing image file \"" } + m_filename + "\".");
+      }
+    }
+    m_band_written[r->band] = true;
+    m_free_buffers->push(std::move(r->bytes));
+  }
+}
+
+void Film::finish_pipeline()
+{
+  m_finished_bands->close();
+  m_resolve_thread.join();
+  if (m_encode_thread.joinable()) {
+    m_encode_thread.join();
+  }
+  m_finished_bands.reset();
+  m_resolved_bands.reset();
+  m_free_buffers.reset();
+}
+
+void Film::band_rows(int band, int &y0, int &y1) const
+{
+  const Bounds2i win{ output_window() };
+  y0 = std::max((m_first_band + band) * default_tile_size, win.p_min.y);
+  y1 = std::min((m_first_band + band + 1) * default_tile_size, win.p_max.y);
+}
+
+void Film::write_band(int band)
+{
+  const Bounds2i win{ output_window() };
+  int y0, y1;
+  band_rows(band, y0, y1);
+  const size_t n_rows = size_t(y1 - y0);
+  bool ok{ true };
+  if (m_direct_output) {
+    resolve_rows(y0, y1, m_writer->direct_rows(size_t(y0 - win.p_min.y), n_rows));
+    ScopedTimer timer{ phase_e::ENCODE, "commit rows" };
+    m_writer->commit_rows(n_rows);
+  } else {
+    resolve_rows(y0, y1, m_band_bytes.data());
+    ScopedTimer timer{ phase_e::ENCODE, "write rows" };
+    ok = m_writer->write_rows(m_band_bytes.data(), n_rows);
+  }
+  if (not ok) {
+    RT3_WARNING(string{ "Error while writing image file \"" } + m_filename + "\".");
+  }
+  m_band_written[band] = true;
+}
+
+void Film::flush_bands()
+{
+  // All of the image, without streaming, is resolved on the pool, if there
+  // is one.
+  const bool parallel{ m_pool != nullptr and m_pool->size() > 1 };
+  if (m_direct_output) {
+    // Order does not matter; just fill in whatever is missing.
+    std::vector<int> pending;
+    for (int b{ 0 }; b < m_n_bands; ++b) {
+      if (not m_band_written[b]) {
+        pending.push_back(b);
+      }
+    }
+    if (parallel) {
+      m_pool->parallel_for(pending.size(), [&](size_t i) { write_band(pending[i]); });
+    } else {
+      for (int b : pending) {
+        write_band(b);
+      }
+    }
+    return;
+  }
+  if (parallel and m_next_band < m_n_bands) {
+    // Batches of one band per worker are resolved side by side into the
+    // staging buffer, then handed to the writer in order.
+    const size_t band_bytes{ m_band_bytes.size() };
+    const int batch{ int(m_pool->size()) };
+    m_band_bytes.resize(band_bytes * size_t(batch));
+    while (m_next_band < m_n_bands) {
+      const int n = std::min(batch, m_n_bands - m_next_band);
+      m_pool->parallel_for(size_t(n), [&](size_t i) {
+        int y0, y1;
+        band_rows(m_next_band + int(i), y0, y1);
+        resolve_rows(y0, y1, m_band_bytes.data() + i * band_bytes);
+      });
+      ScopedTimer timer{ phase_e::ENCODE, "write rows" };
+      for (int i{ 0 }; i < n; ++i, ++m_next_band) {
+        int y0, y1;
+        band_rows(m_next_band, y0, y1);
+        if (not m_writer->write_rows(m_band_bytes.data() + size_t(i) * band_bytes,
+                                     size_t(y1 - y0))) {
+          RT3_WARNING(string{ "Error while writing image file \"" } + m_filename + "\".");
+        }
+        m_band_written[m_next_band] = true;
+      }
+    }
+    m_band_bytes.resize(band_bytes);
+    return;
+  }
+  while (m_next_band < m_n_bands) {
+    write_band(m_next_band);
+    ++m_next_band;
+  }
 }
 
 /// Convert image to RGB, compute final pixel values, write image.
-void Film::write_image(void) const
+void Film::write_image(ThreadPool *pool)
+{
+  std::lock_guard<std::mutex> lock(m_stream_mtx);
+  if (m_finished_bands) {
+    // The bands still in the pipeline go out now.
+    finish_pipeline();
+  } else {
+    if (not m_writer and not open_writer(pool)) {
+      return;
+    }
+    flush_bands();
+  }
+  ScopedTimer timer{ phase_e::WRITE, "write image" };
+  if (not m_writer->close()) {
+    RT3_WARNING(string{ "Could not write image file \"" } + m_filename + "\".");
+  }
+  m_writer.reset();
+  m_pool = nullptr;
+  m_band_tiles_done.reset();
+  m_band_tiles_total.reset();
+  m_band_written.reset();
+  // Keep the exact sums around for the next incremental render.
+  if (m_incremental and not save_buffer()) {
+    RT3_WARNING("Could not write buffer cache \"" + cache_filename() + "\".");
+  }
+}
+
+// Layout of the buffer cache: magic, width and height as 32-bit ints, then
+// RGB sums + weight per pixel, as floats, in scanline order.
+static constexpr char buffer_magic[8]{ 'R', 'T', '3', 'B', 'U', 'F', '1', '\n' };
+
+bool Film::save_buffer() const
 {
-  // TODO: call the proper writing function, either PPM or PNG.
+  std::ofstream ofs{ cache_filename(), std::ios::out | std::ios::binary };
+  if (not ofs.is_open()) {
+    return false;
+  }
+  const int32_t dims[2]{ m_full_resolution[0], m_full_resolution[1] };
+  ofs.write(buffer_magic, sizeof(buffer_magic));
+  ofs.write(reinterpret_cast<const char *>(dims), sizeof(dims));
+  std::vector<float> row(4 * size_t(dims[0]));
+  for (int y{ 0 }; y < dims[1]; ++y) {
+    for (int x{ 0 }; x < dims[0]; ++x) {
+      m_color_buffer_ptr->load_raw(x, y, &row[size_t(x) * 4]);
+    }
+    ofs.write(reinterpret_cast<const char *>(row.data()), std::streamsize(row.size() * sizeof(float)));
+  }
+  return not ofs.fail();
+}
+
+bool Film::load_buffer()
+{
+  std::ifstream ifs{ cache_filename(), std::ios::in | std::ios::binary };
+  if (not ifs.is_open()) {
+    return false;
+  }
+  char magic[sizeof(buffer_magic)];
+  int32_t dims[2];
+  ifs.read(magic, sizeof(magic));
+  ifs.read(reinterpret_cast<char *>(dims), sizeof(dims));
+  if (ifs.fail() or not std::equal(magic, magic + sizeof(magic), buffer_magic)
+      or dims[0] != m_full_resolution[0] or dims[1] != m_full_resolution[1]) {
+    return false;
+  }
+  std::vector<float> row(4 * size_t(dims[0]));
+  for (int y{ 0 }; y < dims[1]; ++y) {
+    ifs.read(reinterpret_cast<char *>(row.data()), std::streamsize(row.size() * sizeof(float)));
+    if (ifs.fail()) {
+      m_color_buffer_ptr->clear();
+      return false;
+    }
+    for (int x{ 0 }; x < dims[0]; ++x) {
+      if (not m_crop.inside(Point2i{ x, y })) {
+        m_color_buffer_ptr->store_raw(x, y, &row[size_t(x) * 4]);
+      }
+    }
+  }
+  return true;
+}
+
+bool Film::load_previous_image()
+{
+  std::vector<unsigned char> rgb;
+  int w{ 0 }, h{ 0 };
+  if (not load_image(m_filename, rgb, w, h) or w != m_full_resolution[0]
+      or h != m_full_resolution[1]) {
+    return false;
+  }
+  // Each pixel becomes a single sample. The 8-bit values lose some precision,
+  // which is why the float cache is preferred.
+  float linear[256];
+  for (int v{ 0 }; v < 256; ++v) {
+    linear[v] = m_resolver.srgb() ? Resolver::srgb_decode(float(v) / 255.f) : float(v) / 255.f;
+  }
+  const unsigned char *px = rgb.data();
+  for (int y{ 0 }; y < h; ++y) {
+    for (int x{ 0 }; x < w; ++x, px += 3) {
+      if (not m_crop.inside(Point2i{ x, y })) {
+        const float rgbw[4]{ linear[px[0]], linear[px[1]], linear[px[2]], 1.f };
+        m_color_buffer_ptr->store_raw(x, y, rgbw);
+      }
+    }
+  }
+  return true;
+}
+
+void Film::load_base_frame()
+{
+  if (not m_incremental) {
+    return;
+  }
+  if (load_buffer()) {
+    RT3_MESSAGE("    Reusing buffer cache \"" + cache_filename() + "\".\n");
+  } else if (load_previous_image()) {
+    RT3_MESSAGE("    Reusing previous image \"" + m_filename + "\".\n");
+  } else {
+    RT3_WARNING("No previous render of \"" + m_filename
+                + "\" matches this film; rendering the full frame.");
+    m_crop = Bounds2i{ Point2i{ 0, 0 }, m_full_resolution };
+  }
+}
+
+/// The resolution `ps` asks for, unless the command line gives one.
+static Point2i retrieve_resolution(const ParamSet &ps) {
+  // A resolution given on the command line wins; the crop window, being
+  // relative, still applies.
+  if (API::curr_run_opt.resolution[0] > 0 and API::curr_run_opt.resolution[1] > 0) {
+    return Point2i{ API::curr_run_opt.resolution[0], API::curr_run_opt.resolution[1] };
+  }
+  return Point2i{ retrieve(ps, "x_res", int(1280)), retrieve(ps, "y_res", int(720)) };
+}
+
+std::string check_film(const ParamSet &ps) {
+  const Point2i res{ retrieve_resolution(ps) };
+  if (res.x < 1 or res.y < 1 or res.x > max_film_resolution or res.y > max_film_resolution) {
+    return "the film resolution must be 1 to " + std::to_string(max_film_resolution)
+           + " pixels along each axis, not " + std::to_string(res.x) + " x "
+           + std::to_string(res.y);
+  }
+  return {};
 }
 
 // Factory function pattern.
@@ -35,7 +505,7 @@ void Film::write_image(void) const
 // all the information we need to create a Film object.
 Film *create_film(const ParamSet &ps)
 {
-  std::cout << ">>> Inside create_film()\n";
+  RT3_LOG_INFO(">>> Inside create_film()");
   std::string filename;
   // Let us check whether user has provided an output file name via
   // command line arguments in main().
@@ -56,26 +526,89 @@ Film *create_film(const ParamSet &ps)
   }
 
   // Read resolution.
-  // Aux function that retrieves info from the ParamSet.
-  int xres = retrieve(ps, "x_res", int(1280));
-  // Aux function that retrieves info from the ParamSet.
-  int yres = retrieve(ps, "y_res", int(720));
-  // Quick render?
-  if (API::curr_run_opt.quick_render == true) {
-    // decrease resolution.
-    xres = std::max(1, xres / 4);
-    yres = std::max(1, yres / 4);
-  }
-
-  // TODO
-  // Read crop window information.
+  const std::string problem{ check_film(ps) };
+  if (not problem.empty()) {
+    RT3_ERROR("Cannot create the film: " + problem + ".");
+  }
+  const Point2i res{ retrieve_resolution(ps) };
+  const int xres{ res.x };
+  const int yres{ res.y };
+
+  // Read crop window information, as fractions of the image: x0 x1 y0 y1.
   std::vector<real_type> cw = retrieve(ps, "crop_window", std::vector<real_type> { 0, 1, 0, 1 });
-  std::cout << "Crop window ";
-  for (const auto &e : cw)
-    std::cout << e << " ";
-  std::cout << '\n';
+  const auto &cli_cw = API::curr_run_opt.crop_window;
+  if (cli_cw[0][0] != 0 or cli_cw[0][1] != 1 or cli_cw[1][0] != 0 or cli_cw[1][1] != 1) {
+    // Crop window supplied on the command line wins.
+    cw = { cli_cw[0][0], cli_cw[0][1], cli_cw[1][0], cli_cw[1][1] };
+  }
+  Bounds2i crop{ Point2i{ 0, 0 }, Point2i{ xres, yres } };
+  if (cw.size() != 4) {
+    RT3_WARNING("crop_window needs 4 values (x0 x1 y0 y1); ignoring it.");
+  } else {
+    for (auto &e : cw) {
+      e = Clamp(e, real_type(0), real_type(1));
+    }
+    // A pixel is in if its upper-left corner is, the same rule as pbrt.
+    crop = Bounds2i{ Point2i{ int(std::ceil(xres * cw[0])), int(std::ceil(yres * cw[2])) },
+                     Point2i{ int(std::ceil(xres * cw[1])), int(std::ceil(yres * cw[3])) } };
+    if (crop.empty()) {
+      RT3_WARNING("crop_window covers no pixels; rendering the full frame.");
+      crop = Bounds2i{ Point2i{ 0, 0 }, Point2i{ xres, yres } };
+    }
+  }
+
+  // Image type: png (default), ppm3 (ascii) or ppm6 (binary).
+  std::string img_type = retrieve(ps, "img_type", std::string{ "png" });
+  std::transform(img_type.begin(), img_type.end(), img_type.begin(), ::tolower);
+  Film::image_type_e image_type{ Film::image_type_e::PNG };
+  if (img_type == "ppm3") {
+    image_type = Film::image_type_e::PPM3;
+  } else if (img_type == "ppm6" or img_type == "ppm") {
+    image_type = Film::image_type_e::PPM6;
+  } else if (img_type != "png") {
+    RT3_WARNING(string{ "Unknown img_type \"" } + img_type + "\", writing a PNG file instead.");
+  }
 
-  // Note that the image type is fixed here. Must be read from ParamSet, though.
-  return new Film(Point2i{ xres, yres }, filename, Film::image_type_e::PNG);
+  // PNG deflate level, from the scene file unless overridden on the CLI.
+  int png_compression = retrieve(ps, "png_compression", int(default_png_compression));
+  if (API::curr_run_opt.png_compression >= 0) {
+    png_compression = API::curr_run_opt.png_compression;
+  }
+  if (png_compression < 0 or png_compression > 9) {
+    RT3_WARNING("png_compression must be in [0,9]; clamping " + std::to_string(png_compression)
+                + ".");
+    png_compression = Clamp(png_compression, 0, 9);
+  }
+
+  // Output encoding: sRGB gamma, dithering and bits per sample.
+  auto retrieve_flag = [&](const char *name) {
+    std::string value = retrieve(ps, name, std::string{ "no" });
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value == "yes" or value == "true";
+  };
+  int bit_depth = retrieve(ps, "bit_depth", int(8));
+  if (bit_depth != 8 and bit_depth != 16) {
+    RT3_WARNING("bit_depth must be 8 or 16; using 8.");
+    bit_depth = 8;
+  }
+
+  Film *film = RT3_ARENA_ALLOC(*API::build_arena, Film)(Point2i{ xres, yres }, filename, image_type, png_compression);
+  film->m_resolver = Resolver{ retrieve_flag("gamma_corrected"), retrieve_flag("dither"), bit_depth };
+  // Memory-mapped output (binary PPM only).
+  std::string mmap_output = retrieve(ps, "mmap_output", std::string{ "no" });
+  film->m_mmap_output = API::curr_run_opt.mmap_output or mmap_output == "yes"
+                        or mmap_output == "true";
+  if (film->m_mmap_output and image_type != Film::image_type_e::PPM6) {
+    RT3_WARNING("mmap_output is only supported for ppm6 images; ignoring it.");
+  }
+  film->m_crop = crop;
+  film->m_incremental = API::curr_run_opt.incremental;
+  if (crop != Bounds2i{ Point2i{ 0, 0 }, Point2i{ xres, yres } }) {
+    std::ostringstream oss;
+    oss << "    Crop window (pixels): " << crop << (film->m_incremental ? ", incremental" : "")
+        << '\n';
+    RT3_MESSAGE(oss.str());
+  }
+  return film;
 }
 }  // namespace rt3
@@ -1,12 +1,29 @@
 #ifndef FILM_H
 #define FILM_H
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "bounded_queue.h"
+#include "color_buffer.h"
 #include "error.h"
+#include "image_io.h"
 #include "paramset.h"
+#include "resolve.h"
 #include "rt3.h"
+#include "thread_pool.h"
 
 namespace rt3 {
 
+/// A rectangular block of pixels, \f$[x_0,x_1) \times [y_0,y_1)\f$, that the
+/// render loop treats as a single unit of work.
+struct Tile {
+  size_t id;   //!< Tile index, in row-major order.
+  int x0, y0;  //!< Upper-left pixel (inclusive).
+  int x1, y1;  //!< Lower-right pixel (exclusive).
+};
+
 /// Represents an image generated by the ray tracer.
 class Film {
  public:
@@ -14,7 +31,10 @@ class Film {
   enum class image_type_e : int { PNG = 0, PPM3, PPM6 };
 
   //=== Film Public Methods
-  Film(const Point2i &resolution, const std::string &filename, image_type_e imgt);
+  Film(const Point2i &resolution,
+       const std::string &filename,
+       image_type_e imgt,
+       int png_compression = default_png_compression);
   virtual ~Film();
 
   /// Retrieve original Film resolution.
@@ -22,21 +42,164 @@ class Film {
   {
     return m_full_resolution;
   };
-  /// Takes a sample `p` and its radiance `L` and updates the image.
+  /// Splits the crop window into square tiles of `tile_size` pixels, in
+  /// row-major order. Tiles follow the full-frame grid, so tiles on the
+  /// borders of the image or of the crop window may be smaller.
+  std::vector<Tile> tiles(int tile_size = default_tile_size) const;
+  /// Pixels that go into the output file: the crop window, or the full frame
+  /// in incremental mode.
+  Bounds2i output_window() const
+  {
+    return m_incremental ? Bounds2i{ Point2i{ 0, 0 }, m_full_resolution } : m_crop;
+  }
+  /*!
+   * Incremental mode only: fills every pixel outside the crop window from the
+   * previous render, so that only the crop window needs to be rendered. The
+   * float buffer cached next to the output file (see `cache_filename()`) is
+   * preferred; otherwise the previous output image is read back. If neither
+   * matches this film, the crop window grows to the full frame.
+   */
+  void load_base_frame();
+  /// Where incremental mode caches the accumulation buffer.
+  std::string cache_filename() const { return m_filename + ".rt3buf"; }
+  /// Takes a sample `p` (in raster coordinates) and its radiance `L` and
+  /// updates the image. Must be called by the thread rendering the tile that
+  /// contains `p`, which is the render loop's contract.
   void add_sample(const Point2f &, const ColorXYZ &);
-  void write_image() const;
+  /// Adds one sample to each pixel of the span `[x, x+n)` of row `y`. The span
+  /// must lie inside a single tile.
+  void add_span(int x, int y, size_t n, const ColorXYZ *colors);
+  /// Keeps the running variance of every pixel from now on (see
+  /// `add_tracked_sample()`), for adaptive sampling.
+  void track_variance() { m_color_buffer_ptr->enable_moments(); }
+  /// Adds a sample to pixel (x,y) and updates the pixel's running variance.
+  /// Needs `track_variance()`. Tile owner only.
+  void add_tracked_sample(int x, int y, const ColorXYZ &color) {
+    m_color_buffer_ptr->add_tracked(x, y, color);
+  }
+  /// Samples taken by `add_tracked_sample()` for pixel (x,y).
+  uint32_t tracked_samples(int x, int y) const { return m_color_buffer_ptr->tracked_count(x, y); }
+  /// Variance of the luminance of those samples; 0 below two samples.
+  float sample_variance(int x, int y) const { return m_color_buffer_ptr->variance(x, y); }
+  /// Same as `add_sample()`, but safe for samples that fall on a tile owned
+  /// by another thread (e.g. filter footprints crossing tile borders).
+  void splat_sample(const Point2f &, const ColorXYZ &);
+  /*!
+   * Opens the output file before rendering starts, and starts the output
+   * pipeline: each band of tile rows is resolved and encoded as soon as its
+   * last tile is done (see `tile_done()`), on two threads of its own, while
+   * the workers go on rendering. If `pool` is given, the encoder may also
+   * use it to compress in parallel; it should not be the pool that renders,
+   * or the encoder's tasks would wait behind the tiles.
+   *
+   * Finished bands go to the *resolve* thread, which turns them into bytes,
+   * in order, in one of `pipeline_depth` staging buffers, and queues them
+   * for the *encode* thread, which hands them to the image writer and gives
+   * the buffer back. A slow encoder therefore holds up the resolver, never
+   * the render workers, and the memory in flight stays bounded. Mapped
+   * output is resolved in place, in any order, and needs no encoder.
+   */
+  bool open_output(ThreadPool *pool = nullptr);
+  /// Tells the film that all samples of `tile` have been added. Thread-safe.
+  void tile_done(const Tile &tile);
+  /// Overwrites the pixels of block \f$[x_0,x_1) \times [y_0,y_1)\f$ with a
+  /// single sample of `color` each, as progressive passes do. The block must
+  /// lie inside a single tile. Tile owner only.
+  void fill_block(int x0, int y0, int x1, int y1, const ColorXYZ &color);
+  /// Resolves the accumulation buffer and writes the image file. With the
+  /// output open, this drains the pipeline; otherwise the output is opened
+  /// here, and resolved on `pool`, if given, and encoded in one go.
+  void write_image(ThreadPool *pool = nullptr);
+  /// Resolves rows `[y0,y1)` of the output window into RGB samples, as
+  /// `m_resolver` says: `3 * width * bytes_per_sample()` bytes per row
+  /// (width of the output window).
+  void resolve_rows(int y0, int y1, unsigned char *out) const;
+  /// Resolves the pixels of `tile` the same way, row after row: `3 * (x1 -
+  /// x0) * bytes_per_sample()` bytes per row.
+  void resolve_tile(const Tile &tile, unsigned char *out) const;
 
   //=== Film Public Data
+  /// Tile side, in pixels. Matches the accumulation buffer's memory tiles, so a
+  /// worker rendering a tile is the sole writer of that block of memory.
+  static constexpr int default_tile_size{ ColorBuffer::tile_size };
+  /// Staging buffers (of a band each) between the resolve and encode stages.
+  static constexpr int pipeline_depth{ 4 };
   const Point2i m_full_resolution;  //!< The image's full resolution values.
   std::string m_filename;           //!< Full path file name + extension.
   image_type_e m_image_type;        //!< Image type, PNG, PPM3, PPM6.
-  // TODO: Create the matrix (or vector) that will hold the image data.
-  // std::unique_ptr< ColorBuffer > m_color_buffer_ptr; //!< Reference to the
-  // color buffer (image) object.
+  int m_png_compression;            //!< Deflate level for PNG, 0-9.
+  /// Write PPM6 output by resolving straight into a memory-mapped file.
+  bool m_mmap_output{ false };
+  Bounds2i m_crop;  //!< Pixels to render; the full frame unless cropped.
+  /// Re-render the crop window over the previous full frame, and write the
+  /// full frame (see `load_base_frame()`).
+  bool m_incremental{ false };
+  /// Gamma, dithering and bit depth of the output file.
+  Resolver m_resolver{ false, false, 8 };
+  std::unique_ptr<ColorBuffer> m_color_buffer_ptr;  //!< Accumulated samples.
+
+ private:
+  /// Creates the image writer and the band bookkeeping.
+  bool open_writer(ThreadPool *pool);
+  /// Resolves and encodes every band not written yet, the render being over.
+  /// Caller must hold `m_stream_mtx`.
+  void flush_bands();
+  /// Body of the resolve thread (see `open_output()`).
+  void resolve_stage();
+  /// Body of the encode thread.
+  void encode_stage();
+  /// Waits for the pipeline to write every band, and stops its threads.
+  void finish_pipeline();
+  /// Rows `[y0,y1)` of band `band`, clipped to the output window.
+  void band_rows(int band, int &y0, int &y1) const;
+  /// Resolves band `band` and hands it over to the writer.
+  void write_band(int band);
+  /// Saves the accumulation buffer to `cache_filename()`.
+  bool save_buffer() const;
+  /// Fills the pixels outside the crop window from `cache_filename()`.
+  bool load_buffer();
+  /// Fills the pixels outside the crop window from the previous output image.
+  bool load_previous_image();
+
+  std::unique_ptr<ImageWriter> m_writer;  //!< Open output stream, if any.
+  /// Resolves the bands left for `write_image()` in parallel, if not null.
+  ThreadPool *m_pool{ nullptr };
+  std::mutex m_stream_mtx;                //!< Guards the writer.
+  /// Finished tiles in each band (row of tiles of the output window).
+  std::unique_ptr<std::atomic<int>[]> m_band_tiles_done;
+  /// Tiles to render in each band; bands with none are complete from the start.
+  std::unique_ptr<int[]> m_band_tiles_total;
+  int m_first_band{ 0 };  //!< Full-frame tile row of band 0.
+  int m_n_bands{ 0 };
+  /// Bands already handed over to the writer.
+  std::unique_ptr<std::atomic<bool>[]> m_band_written;
+  bool m_direct_output{ false };  //!< Writer accepts rows in place, in any order.
+  int m_next_band{ 0 };           //!< First band not written yet (ordered mode).
+  std::vector<unsigned char> m_band_bytes;  //!< Staging for the resolved bands.
+
+  /// A band on its way from the resolve to the encode stage.
+  struct ResolvedBand {
+    int band;
+    std::vector<unsigned char> bytes;
+  };
+  /// Bands whose tiles are all done, as they finish; `nullptr` unless the
+  /// pipeline runs.
+  std::unique_ptr<BoundedQueue<int>> m_finished_bands;
+  std::unique_ptr<BoundedQueue<ResolvedBand>> m_resolved_bands;
+  /// Staging buffers the encoder is done with.
+  std::unique_ptr<BoundedQueue<std::vector<unsigned char>>> m_free_buffers;
+  std::thread m_resolve_thread;
+  std::thread m_encode_thread;
 };
 
 // Factory pattern. It's not part of this class.
 Film *create_film(const ParamSet &ps);
+/// What is wrong with the film `ps` describes, or an empty string if
+/// `create_film()` can make it: the resolution must be 1 to
+/// `max_film_resolution` pixels along each axis.
+std::string check_film(const ParamSet &ps);
+/// The largest film side, in pixels.
+constexpr int max_film_resolution{ 1 << 14 };
 }  // namespace rt3
 
 #endif  // FILM_H
@@ -0,0 +1,299 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H 1
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+namespace rt3 {
+
+/*!
+ * Basic geometric value types: vectors, points and normals in 2D and 3D.
+ *
+ * Points, vectors and normals are distinct types on purpose, so the compiler
+ * catches mixing them up. Only the operations that make geometric sense are
+ * defined, e.g. `Point3 - Point3` yields a `Vector3`, `Point3 + Vector3`
+ * yields a `Point3`, but `Point3 + Point3` does not compile.
+ *
+ * All operations are inline, so they cost the same as hand-written
+ * arithmetic on the components.
+ */
+
+// === 2D types.
+
+template <typename T> class Vector2 {
+ public:
+  T x{ 0 }, y{ 0 };
+
+  constexpr Vector2() = default;
+  constexpr Vector2(T x, T y) : x{ x }, y{ y } {}
+
+  T operator[](int i) const { return i == 0 ? x : y; }
+  T &operator[](int i) { return i == 0 ? x : y; }
+
+  Vector2 operator+(const Vector2 &v) const { return { x + v.x, y + v.y }; }
+  Vector2 operator-(const Vector2 &v) const { return { x - v.x, y - v.y }; }
+  Vector2 operator*(T s) const { return { x * s, y * s }; }
+  Vector2 operator/(T s) const { return { x / s, y / s }; }
+  Vector2 operator-() const { return { -x, -y }; }
+  bool operator==(const Vector2 &v) const { return x == v.x and y == v.y; }
+  bool operator!=(const Vector2 &v) const { return not(*this == v); }
+};
+
+template <typename T> class Point2 {
+ public:
+  T x{ 0 }, y{ 0 };
+
+  constexpr Point2() = default;
+  constexpr Point2(T x, T y) : x{ x }, y{ y } {}
+
+  T operator[](int i) const { return i == 0 ? x : y; }
+  T &operator[](int i) { return i == 0 ? x : y; }
+
+  Point2 operator+(const Vector2<T> &v) const { return { x + v.x, y + v.y }; }
+  Point2 operator-(const Vector2<T> &v) const { return { x - v.x, y - v.y }; }
+  Vector2<T> operator-(const Point2 &p) const { return { x - p.x, y - p.y }; }
+  bool operator==(const Point2 &p) const { return x == p.x and y == p.y; }
+  bool operator!=(const Point2 &p) const { return not(*this == p); }
+};
+
+/// Axis-aligned rectangle \f$[p_{min}, p_{max})\f$; the max corner is
+/// exclusive, so it maps naturally onto ranges of pixels.
+template <typename T> class Bounds2 {
+ public:
+  Point2<T> p_min, p_max;
+
+  constexpr Bounds2() = default;
+  constexpr Bounds2(const Point2<T> &p_min, const Point2<T> &p_max) : p_min{ p_min }, p_max{ p_max } {}
+
+  T width() const { return p_max.x - p_min.x; }
+  T height() const { return p_max.y - p_min.y; }
+  T area() const { return width() * height(); }
+  bool empty() const { return p_max.x <= p_min.x or p_max.y <= p_min.y; }
+  bool inside(const Point2<T> &p) const {
+    return p.x >= p_min.x and p.x < p_max.x and p.y >= p_min.y and p.y < p_max.y;
+  }
+  bool operator==(const Bounds2 &b) const { return p_min == b.p_min and p_max == b.p_max; }
+  bool operator!=(const Bounds2 &b) const { return not(*this == b); }
+};
+
+/// Overlap of two rectangles (possibly empty).
+template <typename T> inline Bounds2<T> intersect(const Bounds2<T> &a, const Bounds2<T> &b) {
+  return { { std::max(a.p_min.x, b.p_min.x), std::max(a.p_min.y, b.p_min.y) },
+           { std::min(a.p_max.x, b.p_max.x), std::min(a.p_max.y, b.p_max.y) } };
+}
+
+// === 3D types.
+
+template <typename T> class Vector3 {
+ public:
+  T x{ 0 }, y{ 0 }, z{ 0 };
+
+  constexpr Vector3() = default;
+  constexpr Vector3(T x, T y, T z) : x{ x }, y{ y }, z{ z } {}
+
+  T operator[](int i) const { return i == 0 ? x : (i == 1 ? y : z); }
+  T &operator[](int i) { return i == 0 ? x : (i == 1 ? y : z); }
+
+  Vector3 operator+(const Vector3 &v) const { return { x + v.x, y + v.y, z + v.z }; }
+  Vector3 operator-(const Vector3 &v) const { return { x - v.x, y - v.y, z - v.z }; }
+  Vector3 operator*(T s) const { return { x * s, y * s, z * s }; }
+  Vector3 operator/(T s) const {
+    T inv = T(1) / s;
+    return { x * inv, y * inv, z * inv };
+  }
+  Vector3 operator-() const { return { -x, -y, -z }; }
+  Vector3 &operator+=(const Vector3 &v) {
+    x += v.x;
+    y += v.y;
+    z += v.z;
+    return *this;
+  }
+  Vector3 &operator-=(const Vector3 &v) {
+    x -= v.x;
+    y -= v.y;
+    z -= v.z;
+    return *this;
+  }
+  Vector3 &operator*=(T s) {
+    x *= s;
+    y *= s;
+    z *= s;
+    return *this;
+  }
+  bool operator==(const Vector3 &v) const { return x == v.x and y == v.y and z == v.z; }
+  bool operator!=(const Vector3 &v) const { return not(*this == v); }
+
+  T length_squared() const { return x * x + y * y + z * z; }
+  T length() const { return std::sqrt(length_squared()); }
+};
+
+template <typename T> class Normal3 {
+ public:
+  T x{ 0 }, y{ 0 }, z{ 0 };
+
+  constexpr Normal3() = default;
+  constexpr Normal3(T x, T y, T z) : x{ x }, y{ y }, z{ z } {}
+  /// Normals and vectors transform differently, so the conversion is explicit.
+  explicit Normal3(const Vector3<T> &v) : x{ v.x }, y{ v.y }, z{ v.z } {}
+  explicit operator Vector3<T>() const { return { x, y, z }; }
+
+  T operator[](int i) const { return i == 0 ? x : (i == 1 ? y : z); }
+  T &operator[](int i) { return i == 0 ? x : (i == 1 ? y : z); }
+
+  Normal3 operator+(const Normal3 &n) const { return { x + n.x, y + n.y, z + n.z }; }
+  Normal3 operator-(const Normal3 &n) const { return { x - n.x, y - n.y, z - n.z }; }
+  Normal3 operator*(T s) const { return { x * s, y * s, z * s }; }
+  Normal3 operator-() const { return { -x, -y, -z }; }
+  bool operator==(const Normal3 &n) const { return x == n.x and y == n.y and z == n.z; }
+  bool operator!=(const Normal3 &n) const { return not(*this == n); }
+
+  T length_squared() const { return x * x + y * y + z * z; }
+  T length() const { return std::sqrt(length_squared()); }
+};
+
+template <typename T> class Point3 {
+ public:
+  T x{ 0 }, y{ 0 }, z{ 0 };
+
+  constexpr Point3() = default;
+  constexpr Point3(T x, T y, T z) : x{ x }, y{ y }, z{ z } {}
+
+  T operator[](int i) const { return i == 0 ? x : (i == 1 ? y : z); }
+  T &operator[](int i) { return i == 0 ? x : (i == 1 ? y : z); }
+
+  Point3 operator+(const Vector3<T> &v) const { return { x + v.x, y + v.y, z + v.z }; }
+  Point3 operator-(const Vector3<T> &v) const { return { x - v.x, y - v.y, z - v.z }; }
+  Vector3<T> operator-(const Point3 &p) const { return { x - p.x, y - p.y, z - p.z }; }
+  Point3 &operator+=(const Vector3<T> &v) {
+    x += v.x;
+    y += v.y;
+    z += v.z;
+    return *this;
+  }
+  bool operator==(const Point3 &p) const { return x == p.x and y == p.y and z == p.z; }
+  bool operator!=(const Point3 &p) const { return not(*this == p); }
+};
+
+// === Free functions.
+
+template <typename T> inline Vector3<T> operator*(T s, const Vector3<T> &v) { return v * s; }
+template <typename T> inline Normal3<T> operator*(T s, const Normal3<T> &n) { return n * s; }
+
+template <typename T> inline T dot(const Vector3<T> &a, const Vector3<T> &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+template <typename T> inline T dot(const Normal3<T> &a, const Vector3<T> &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+template <typename T> inline T dot(const Vector3<T> &a, const Normal3<T> &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+template <typename T> inline Vector3<T> cross(const Vector3<T> &a, const Vector3<T> &b) {
+  return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+template <typename T> inline Vector3<T> normalize(const Vector3<T> &v) { return v / v.length(); }
+template <typename T> inline Normal3<T> normalize(const Normal3<T> &n) {
+  return n * (T(1) / n.length());
+}
+template <typename T> inline T distance(const Point3<T> &a, const Point3<T> &b) {
+  return (a - b).length();
+}
+
+/// Component-wise minimum/maximum, useful for bounding boxes.
+template <typename T> inline Point3<T> min(const Point3<T> &a, const Point3<T> &b) {
+  return { std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z) };
+}
+template <typename T> inline Point3<T> max(const Point3<T> &a, const Point3<T> &b) {
+  return { std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z) };
+}
+
+/*!
+ * Axis-aligned box \f$[p_{min}, p_{max}]\f$, both corners included. A
+ * default box is empty (min above max), so growing it with `bounds_union()`
+ * needs no special first case.
+ */
+template <typename T> class Bounds3 {
+ public:
+  Point3<T> p_min{ std::numeric_limits<T>::max(), std::numeric_limits<T>::max(),
+                   std::numeric_limits<T>::max() };
+  Point3<T> p_max{ std::numeric_limits<T>::lowest(), std::numeric_limits<T>::lowest(),
+                   std::numeric_limits<T>::lowest() };
+
+  constexpr Bounds3() = default;
+  explicit Bounds3(const Point3<T> &p) : p_min{ p }, p_max{ p } {}
+  Bounds3(const Point3<T> &a, const Point3<T> &b) : p_min{ min(a, b) }, p_max{ max(a, b) } {}
+
+  /// Corner 0 is `p_min`, corner 1 is `p_max`.
+  const Point3<T> &operator[](int i) const { return i == 0 ? p_min : p_max; }
+
+  bool empty() const { return p_max.x < p_min.x or p_max.y < p_min.y or p_max.z < p_min.z; }
+  Vector3<T> diagonal() const { return p_max - p_min; }
+  Point3<T> centroid() const {
+    return { (p_min.x + p_max.x) / 2, (p_min.y + p_max.y) / 2, (p_min.z + p_max.z) / 2 };
+  }
+  /// Zero for an empty box.
+  T surface_area() const {
+    if (empty()) return T(0);
+    Vector3<T> d = diagonal();
+    return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+  }
+  /// Axis (0, 1 or 2) along which the box is longest.
+  int maximum_extent() const {
+    Vector3<T> d = diagonal();
+    if (d.x > d.y and d.x > d.z) return 0;
+    return d.y > d.z ? 1 : 2;
+  }
+  /// Position of `p` relative to the box: the min corner maps to 0, the max
+  /// corner to 1 (per axis; flat axes map to 0).
+  Vector3<T> offset(const Point3<T> &p) const {
+    Vector3<T> o = p - p_min;
+    if (p_max.x > p_min.x) o.x /= p_max.x - p_min.x;
+    if (p_max.y > p_min.y) o.y /= p_max.y - p_min.y;
+    if (p_max.z > p_min.z) o.z /= p_max.z - p_min.z;
+    return o;
+  }
+};
+
+/// Smallest box holding both arguments.
+template <typename T> inline Bounds3<T> bounds_union(const Bounds3<T> &b, const Point3<T> &p) {
+  Bounds3<T> r;
+  r.p_min = min(b.p_min, p);
+  r.p_max = max(b.p_max, p);
+  return r;
+}
+template <typename T> inline Bounds3<T> bounds_union(const Bounds3<T> &a, const Bounds3<T> &b) {
+  Bounds3<T> r;
+  r.p_min = min(a.p_min, b.p_min);
+  r.p_max = max(a.p_max, b.p_max);
+  return r;
+}
+
+// === Output, mostly for debugging.
+
+template <typename T> std::ostream &operator<<(std::ostream &os, const Vector2<T> &v) {
+  return os << "[ " << v.x << " " << v.y << " ]";
+}
+template <typename T> std::ostream &operator<<(std::ostream &os, const Point2<T> &p) {
+  return os << "[ " << p.x << " " << p.y << " ]";
+}
+template <typename T> std::ostream &operator<<(std::ostream &os, const Bounds2<T> &b) {
+  return os << "[ " << b.p_min << " - " << b.p_max << " ]";
+}
+template <typename T> std::ostream &operator<<(std::ostream &os, const Bounds3<T> &b) {
+  return os << "[ " << b.p_min << " - " << b.p_max << " ]";
+}
+template <typename T> std::ostream &operator<<(std::ostream &os, const Vector3<T> &v) {
+  return os << "[ " << v.x << " " << v.y << " " << v.z << " ]";
+}
+template <typename T> std::ostream &operator<<(std::ostream &os, const Normal3<T> &n) {
+  return os << "[ " << n.x << " " << n.y << " " << n.z << " ]";
+}
+template <typename T> std::ostream &operator<<(std::ostream &os, const Point3<T> &p) {
+  return os << "[ " << p.x << " " << p.y << " " << p.z << " ]";
+}
+
+}  // namespace rt3
+
+#endif  // GEOMETRY_H
@@ -1,111 +1,637 @@
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "image_io.h"
 
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <iostream>
-#include <iterator>
 #include <vector>
 
-#include "../ext/lodepng.h"
-#include "../ext/stb_image_write.h"
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_ONLY_PNM
+#define STBI_ONLY_JPEG
+#define STBI_ONLY_HDR
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "../ext/stb_image.h"
+#pragma GCC diagnostic pop
+
+#include "mapped_file.h"
+#include "stats.h"
+#include "thread_pool.h"
 
 namespace rt3 {
 
-/// Saves an image as a **binary** PPM file.
-bool save_ppm6(unsigned char *data, size_t w, size_t h, size_t d,
-               const std::string &file_name_) {
-  std::ofstream ofs_file(file_name_, std::ios::out | std::ios::binary);
-  if (not ofs_file.is_open()) return false;
+// =============================================
+// PPM writers
+// =============================================
 
-  ofs_file << "P6\n"
-           << w << " " << h << "\n"
-           << "255\n";
+/// Largest sample value of a PPM file with `bit_depth`-bit samples.
+static unsigned int ppm_maxval(int bit_depth) { return bit_depth == 16 ? 65535 : 255; }
 
-  ofs_file.write((char *)data, d * w * h);
+/// Streams rows of a **binary** PPM file.
+class Ppm6Writer : public ImageWriter {
+ public:
+  Ppm6Writer(size_t w, size_t h, size_t d, int bit_depth)
+      : m_w{ w }, m_h{ h }, m_d{ d * size_t(bit_depth / 8) }, m_bit_depth{ bit_depth } {}
 
-  // Did it not fail?
-  auto result = not ofs_file.fail();
+  bool open(const std::string &file_name_) {
+    m_ofs.open(file_name_, std::ios::out | std::ios::binary);
+    if (not m_ofs.is_open()) return false;
+    m_ofs << "P6\n" << m_w << " " << m_h << "\n" << ppm_maxval(m_bit_depth) << "\n";
+    return not m_ofs.fail();
+  }
 
-  ofs_file.close();
+  bool write_rows(const unsigned char *rows, size_t n_rows) override {
+    m_ofs.write((const char *)rows, m_w * m_d * n_rows);
+    m_rows += n_rows;
+    return not m_ofs.fail();
+  }
 
-  return result;
-}
+  bool close() override {
+    // Did it not fail?
+    auto result = not m_ofs.fail() and m_rows == m_h;
+    m_ofs.close();
+    return result;
+  }
 
-/// Saves an image as a **ascii** PPM file.
-bool save_ppm3(unsigned char *data, size_t w, size_t h, size_t d,
-               const std::string &file_name_) {
-  std::ofstream ofs_file(file_name_, std::ios::out);
-  if (not ofs_file.is_open()) return false;
+ private:
+  size_t m_w, m_h;
+  size_t m_d;  //!< Bytes per pixel.
+  int m_bit_depth;
+  size_t m_rows{ 0 };
+  std::ofstream m_ofs;
+};
+
+/*!
+ * Writes a **binary** PPM file through a memory mapping sized as header +
+ * `w*h*d`. Callers resolve pixels straight into the mapped pages (see
+ * `direct_rows()`), so there is no intermediate byte buffer and no copy into
+ * the kernel.
+ */
+class MappedPpm6Writer : public ImageWriter {
+ public:
+  MappedPpm6Writer(size_t w, size_t h, size_t d, int bit_depth)
+      : m_w{ w }, m_h{ h }, m_d{ d * size_t(bit_depth / 8) }, m_bit_depth{ bit_depth } {}
+
+  bool open(const std::string &file_name_) {
+    std::string header = "P6\n" + std::to_string(m_w) + " " + std::to_string(m_h) + "\n"
+                         + std::to_string(ppm_maxval(m_bit_depth)) + "\n";
+    m_file = MappedFile::create(file_name_, header.size() + m_w * m_h * m_d);
+    if (not m_file) return false;
+    std::memcpy(m_file->data(), header.data(), header.size());
+    m_pixels = m_file->data() + header.size();
+    return true;
+  }
+
+  unsigned char *direct_rows(size_t y0, size_t n_rows) override {
+    return y0 + n_rows <= m_h ? m_pixels + y0 * m_w * m_d : nullptr;
+  }
+
+  void commit_rows(size_t n_rows) override { m_rows.fetch_add(n_rows); }
+
+  bool write_rows(const unsigned char *rows, size_t n_rows) override {
+    size_t y0 = m_next_row;
+    unsigned char *dst = direct_rows(y0, n_rows);
+    if (dst == nullptr) return false;
+    std::memcpy(dst, rows, m_w * m_d * n_rows);
+    m_next_row += n_rows;
+    commit_rows(n_rows);
+    return true;
+  }
+
+  bool close() override {
+    bool result = m_file != nullptr and m_rows.load() == m_h;
+    m_file.reset();  // munmap(); the data is already in the page cache.
+    return result;
+  }
+
+ private:
+  size_t m_w, m_h;
+  size_t m_d;  //!< Bytes per pixel.
+  int m_bit_depth;
+  std::unique_ptr<MappedFile> m_file;
+  unsigned char *m_pixels{ nullptr };
+  size_t m_next_row{ 0 };  //!< Next row for `write_rows()`.
+  std::atomic<size_t> m_rows{ 0 };
+};
+
+/*!
+ * Streams rows of an **ascii** PPM file.
+ *
+ * Components are formatted through a lookup table holding the text of every
+ * value in [0,255] (e.g. `"128 "`), into a user-space buffer that goes to the
+ * file with a single `write()` per batch of rows. Each pixel still ends in a
+ * newline, as before, but the stream is never flushed per pixel.
+ *
+ * With a thread pool, large batches are split into chunks of rows that are
+ * formatted in parallel, each into its own buffer, and then written in order.
+ * 16-bit samples (big-endian pairs of bytes) are too many for the table and
+ * go through `std::to_chars()`.
+ */
+class Ppm3Writer : public ImageWriter {
+ public:
+  Ppm3Writer(size_t w, size_t h, size_t d, ThreadPool *pool, int bit_depth)
+      : m_w{ w }, m_h{ h }, m_d{ d }, m_bytes{ size_t(bit_depth / 8) }, m_pool{ pool } {
+    for (int v{ 0 }; v < 256; ++v) {
+      char *end = std::to_chars(m_lut[v].text, m_lut[v].text + 3, v).ptr;
+      *end++ = ' ';
+      m_lut[v].len = (unsigned char)(end - m_lut[v].text);
+    }
+  }
+
+  bool open(const std::string &file_name_) {
+    m_ofs.open(file_name_, std::ios::out | std::ios::binary);
+    if (not m_ofs.is_open()) return false;
+    const std::string header = "P3\n" + std::to_string(m_w) + " " + std::to_string(m_h) + "\n"
+                               + (m_bytes == 2 ? "65535\n" : "255\n");
+    m_ofs.write(header.data(), std::streamsize(header.size()));
+    return not m_ofs.fail();
+  }
+
+  bool write_rows(const unsigned char *data, size_t n_rows) override {
+    const size_t row_bytes = m_w * m_d * m_bytes;
+    const size_t n_chunks =
+      m_pool != nullptr and m_pool->size() > 1 ? std::min(n_rows, m_pool->size()) : 1;
+    if (m_chunks.size() < n_chunks) m_chunks.resize(n_chunks);
+    auto format_chunk = [&](size_t c) {
+      size_t r0 = n_rows * c / n_chunks;
+      size_t r1 = n_rows * (c + 1) / n_chunks;
+      m_chunks[c].resize((r1 - r0) * max_row_text());
+      char *end = format(data + r0 * row_bytes, (r1 - r0) * m_w, m_chunks[c].data());
+      m_chunks[c].resize(size_t(end - m_chunks[c].data()));
+    };
+    if (n_chunks > 1) {
+      m_pool->parallel_for(n_chunks, format_chunk);
+    } else {
+      format_chunk(0);
+    }
+    for (size_t c{ 0 }; c < n_chunks; ++c) {
+      m_ofs.write(m_chunks[c].data(), std::streamsize(m_chunks[c].size()));
+    }
+    m_rows += n_rows;
+    return not m_ofs.fail();
+  }
+
+  bool close() override {
+    // Did it not fail?
+    auto result = not m_ofs.fail() and m_rows == m_h;
+    m_ofs.close();
+    return result;
+  }
+
+ private:
+  /// The text of one component value, trailing space included.
+  struct Entry {
+    char text[4];
+    unsigned char len;
+  };
+
+  /// Upper bound on the text of a row: "255 " (or "65535 ") per component
+  /// plus a newline per pixel.
+  size_t max_row_text() const { return m_w * (m_d * (m_bytes == 2 ? 6 : 4) + 1); }
+
+  /// Formats `n_pixels` pixels starting at `src` into `dst`; returns the end.
+  char *format(const unsigned char *src, size_t n_pixels, char *dst) const {
+    if (m_bytes == 2) {
+      for (size_t i{ 0 }; i < n_pixels; ++i) {
+        for (size_t k{ 0 }; k < m_d; ++k, src += 2) {
+          dst = std::to_chars(dst, dst + 5, (unsigned(src[0]) << 8) | src[1]).ptr;
+          *dst++ = ' ';
+        }
+        *dst++ = '\n';
+      }
+      return dst;
+    }
+    for (size_t i{ 0 }; i < n_pixels; ++i) {
+      for (size_t k{ 0 }; k < m_d; ++k) {
+        const Entry &e = m_lut[*src++];
+        // Always copy 4 bytes; only `len` of them count.
+        std::memcpy(dst, e.text, 4);
+        dst += e.len;
+      }
+      *dst++ = '\n';
+    }
+    return dst;
+  }
+
+  size_t m_w, m_h, m_d;
+  size_t m_bytes;  //!< Bytes per sample, 1 or 2.
+  ThreadPool *m_pool;
+  size_t m_rows{ 0 };
+  Entry m_lut[256];
+  std::vector<std::vector<char>> m_chunks;  //!< One text buffer per chunk of rows.
+  std::ofstream m_ofs;
+};
+
+// =============================================
+// PNG writer
+// =============================================
+
+/*!
+ * Streams a PNG file through zlib's incremental deflate.
+ *
+ * Each incoming row is filtered (using the previous row, which is the only
+ * image data kept around), fed into the deflate stream, and the compressed
+ * bytes are written out as IDAT chunks whenever the output buffer fills up.
+ *
+ * When a thread pool is available and compression is on, the writer works
+ * like pigz instead: filtered rows are grouped into bands of ~128 KiB, each
+ * band is deflated as an independent raw block sequence on a worker (primed
+ * with the previous band's last 32 KiB as dictionary, so the ratio barely
+ * changes), and the results are concatenated in order. The zlib header,
+ * the terminating empty block and the combined Adler-32 are added by the
+ * writer itself.
+ *
+ * 16-bit images are written the same way: their rows are just twice as
+ * long, and filters look one pixel (`m_bpp` bytes) back.
+ */
+class PngWriter : public ImageWriter {
+ public:
+  PngWriter(size_t w, size_t h, size_t d, int level, ThreadPool *pool, int bit_depth)
+      : m_w{ w },
+        m_h{ h },
+        m_d{ d },
+        m_bit_depth{ bit_depth },
+        m_bpp{ d * size_t(bit_depth / 8) },
+        m_level{ level } {
+    if (pool != nullptr and pool->size() > 1 and level > 0) {
+      m_pool = pool;
+    }
+  }
+
+  ~PngWriter() override {
+    if (m_zs_open) deflateEnd(&m_zs);
+    // Never leave a worker writing into a destroyed object.
+    for (auto &band : m_bands) band.result.wait();
+  }
+
+  bool open(const std::string &file_name_) {
+    m_ofs.open(file_name_, std::ios::out | std::ios::binary);
+    if (not m_ofs.is_open()) return false;
+    // 8 or 16 bits per sample; 1=Y, 2=YA, 3=RGB, 4=RGBA.
+    static const unsigned char color_types[]{ 0, 0, 4, 2, 6 };
+    if (m_d < 1 or m_d > 4 or (m_bit_depth != 8 and m_bit_depth != 16)) return false;
+
+    static const unsigned char signature[]{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    m_ofs.write((const char *)signature, sizeof(signature));
+
+    unsigned char ihdr[13];
+    put_u32(ihdr, uint32_t(m_w));
+    put_u32(ihdr + 4, uint32_t(m_h));
+    ihdr[8] = (unsigned char)m_bit_depth;
+    ihdr[9] = color_types[m_d];
+    ihdr[10] = 0;  // deflate
+    ihdr[11] = 0;  // adaptive filtering
+    ihdr[12] = 0;  // no interlace
+    write_chunk("IHDR", ihdr, sizeof(ihdr));
+
+    const size_t stride{ m_w * m_bpp };
+    m_prev.assign(stride, 0);
+    for (auto &f : m_filtered) f.resize(stride + 1);
 
-  ofs_file << "P3\n"
-           << w << " " << h << "\n"
-           << "255\n";
+    if (m_pool != nullptr) {
+      // zlib header: deflate, 32K window, level hint; `FCHECK` makes it a
+      // multiple of 31.
+      unsigned char flevel = m_level < 2 ? 0 : (m_level < 6 ? 1 : (m_level == 6 ? 2 : 3));
+      unsigned int header = (0x78 << 8) | (flevel << 6);
+      header += 31 - header % 31;
+      m_pending_header[0] = (unsigned char)(header >> 8);
+      m_pending_header[1] = (unsigned char)(header & 0xFF);
+      m_rows_per_band = std::max<size_t>(1, band_bytes / (stride + 1));
+      m_band_data = std::make_shared<std::vector<unsigned char>>();
+      m_band_data->reserve(m_rows_per_band * (stride + 1));
+      return not m_ofs.fail();
+    }
 
-  size_t i{0};
-  while (i < (w * h * d)) {
-    // depth traversal, usually 3.
-    for (auto id{0u}; id < d; id++) ofs_file << (int)*(data + i++) << " ";
-    ofs_file << std::endl;
+    m_zs = z_stream{};
+    if (deflateInit(&m_zs, m_level) != Z_OK) return false;
+    m_zs_open = true;
+    m_zbuf.resize(1 << 16);
+    return not m_ofs.fail();
   }
 
-  // Did it not fail?
-  auto result = not ofs_file.fail();
+  bool write_rows(const unsigned char *rows, size_t n_rows) override {
+    const size_t stride{ m_w * m_bpp };
+    for (size_t r{ 0 }; r < n_rows; ++r) {
+      const unsigned char *row = rows + r * stride;
+      const auto &filtered = filter_row(row);
+      std::copy(row, row + stride, m_prev.begin());
+      ++m_rows;
+      if (m_pool != nullptr) {
+        m_band_data->insert(m_band_data->end(), filtered.begin(), filtered.end());
+        if (m_band_data->size() >= m_rows_per_band * (stride + 1)) submit_band();
+      } else if (not deflate_bytes(filtered.data(), filtered.size(), Z_NO_FLUSH)) {
+        return false;
+      }
+    }
+    if (m_pool != nullptr) write_finished_bands(false);
+    return not m_ofs.fail();
+  }
+
+  bool close() override {
+    bool ok{ true };
+    if (m_pool != nullptr) {
+      if (not m_band_data->empty()) submit_band();
+      write_finished_bands(true);
+      // Empty final fixed-Huffman block, then the Adler-32 of all bands.
+      unsigned char trailer[6]{ 0x03, 0x00 };
+      put_u32(trailer + 2, uint32_t(m_adler));
+      write_idat(trailer, sizeof(trailer));
+    } else {
+      ok = m_zs_open and deflate_bytes(nullptr, 0, Z_FINISH);
+    }
+    write_chunk("IEND", nullptr, 0);
+    ok = ok and not m_failed and not m_ofs.fail() and m_rows == m_h;
+    m_ofs.close();
+    return ok;
+  }
+
+ private:
+  /// Uncompressed bytes per band in parallel mode (pigz's default block size).
+  static constexpr size_t band_bytes{ 128 * 1024 };
+  /// Deflate's window: how much of the previous band primes the next one.
+  static constexpr size_t dict_bytes{ 32 * 1024 };
+
+  /// One band in flight.
+  struct Band {
+    std::future<bool> result;
+    std::vector<unsigned char> compressed;
+    uLong adler{ 1 };
+    size_t raw_size{ 0 };
+  };
+
+  /// Hands the current band over to a worker.
+  void submit_band() {
+    auto data = m_band_data;
+    auto dict = m_prev_band;
+    m_bands.emplace_back();
+    Band *band = &m_bands.back();  // std::deque keeps addresses stable.
+    band->raw_size = data->size();
+    int level = m_level;
+    band->result = m_pool->async([band, data, dict, level]() -> bool {
+      ScopedTimer timer{ phase_e::ENCODE, "deflate band" };
+      band->adler = adler32(1L, data->data(), uInt(data->size()));
+      z_stream zs{};
+      // Negative window bits: raw deflate, no zlib header or trailer.
+      if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+      if (dict and not dict->empty()) {
+        size_t n = std::min(dict->size(), dict_bytes);
+        deflateSetDictionary(&zs, dict->data() + dict->size() - n, uInt(n));
+      }
+      band->compressed.resize(deflateBound(&zs, uLong(data->size())) + 16);
+      zs.next_in = data->data();
+      zs.avail_in = uInt(data->size());
+      zs.next_out = band->compressed.data();
+      zs.avail_out = uInt(band->compressed.size());
+      // A sync flush ends the band on a byte boundary without marking the
+      // last block as final, so bands can be concatenated.
+      int ret = deflate(&zs, Z_SYNC_FLUSH);
+      band->compressed.resize(band->compressed.size() - zs.avail_out);
+      deflateEnd(&zs);
+      return ret == Z_OK or ret == Z_BUF_ERROR;
+    });
+    m_prev_band = data;
+    m_band_data = std::make_shared<std::vector<unsigned char>>();
+    m_band_data->reserve(m_rows_per_band * (m_w * m_bpp + 1));
+  }
+
+  /// Writes the bands at the front of the queue that are done, in order. With
+  /// `wait`, blocks until all of them are written. Waiting also kicks in when
+  /// too many bands are pending, which bounds the memory in use.
+  void write_finished_bands(bool wait) {
+    const size_t max_in_flight{ 2 * m_pool->size() };
+    while (not m_bands.empty()) {
+      Band &band = m_bands.front();
+      bool must_wait = wait or m_bands.size() > max_in_flight;
+      if (band.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        if (not must_wait) return;
+        // Run queued work ourselves rather than just blocking a thread.
+        while (band.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready
+               and m_pool->help_one()) {
+        }
+      }
+      if (not band.result.get()) m_failed = true;
+      if (m_pending_header[0] != 0) {
+        write_idat(m_pending_header, 2);
+        m_pending_header[0] = 0;
+      }
+      write_idat(band.compressed.data(), band.compressed.size());
+      m_adler = adler32_combine(m_adler, band.adler, z_off_t(band.raw_size));
+      m_bands.pop_front();
+    }
+  }
 
-  ofs_file.close();
+  void write_idat(const unsigned char *data, size_t len) {
+    if (len > 0) write_chunk("IDAT", data, len);
+  }
+
+  static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)(v);
+  }
 
-  return result;
+  void write_chunk(const char *type, const unsigned char *data, size_t len) {
+    unsigned char header[8];
+    put_u32(header, uint32_t(len));
+    std::copy(type, type + 4, header + 4);
+    uLong crc = crc32(0L, header + 4, 4);
+    if (len > 0) crc = crc32(crc, data, uInt(len));
+    unsigned char footer[4];
+    put_u32(footer, uint32_t(crc));
+    m_ofs.write((const char *)header, sizeof(header));
+    if (len > 0) m_ofs.write((const char *)data, len);
+    m_ofs.write((const char *)footer, sizeof(footer));
+  }
+
+  /// Runs deflate over `len` bytes, writing out full IDAT chunks as we go.
+  bool deflate_bytes(const unsigned char *data, size_t len, int flush) {
+    m_zs.next_in = const_cast<Bytef *>(data);
+    m_zs.avail_in = uInt(len);
+    for (;;) {
+      m_zs.next_out = m_zbuf.data() + m_zbuf_used;
+      m_zs.avail_out = uInt(m_zbuf.size() - m_zbuf_used);
+      int ret = deflate(&m_zs, flush);
+      if (ret == Z_STREAM_ERROR) return false;
+      m_zbuf_used = m_zbuf.size() - m_zs.avail_out;
+      if (m_zbuf_used == m_zbuf.size() or (ret == Z_STREAM_END and m_zbuf_used > 0)) {
+        write_chunk("IDAT", m_zbuf.data(), m_zbuf_used);
+        m_zbuf_used = 0;
+      }
+      if (ret == Z_STREAM_END) return true;
+      if (flush == Z_NO_FLUSH and m_zs.avail_in == 0) return true;
+    }
+  }
+
+  /// Chooses the PNG filter with the smallest sum of absolute values, the
+  /// usual heuristic (also used by libpng and stb). Level 0 means no
+  /// compression at all, so filtering would be wasted work.
+  const std::vector<unsigned char> &filter_row(const unsigned char *row) {
+    const size_t stride{ m_w * m_bpp };
+    const unsigned char *up = m_prev.data();
+    if (m_level == 0) {
+      m_filtered[0][0] = 0;
+      std::copy(row, row + stride, m_filtered[0].begin() + 1);
+      return m_filtered[0];
+    }
+    size_t best{ 0 };
+    unsigned long best_sum{ ~0UL };
+    for (int type{ 0 }; type < 5; ++type) {
+      auto &out = m_filtered[type];
+      out[0] = (unsigned char)type;
+      unsigned long sum{ 0 };
+      for (size_t i{ 0 }; i < stride; ++i) {
+        int a = i >= m_bpp ? row[i - m_bpp] : 0;  // left
+        int b = up[i];                            // up
+        int c = i >= m_bpp ? up[i - m_bpp] : 0;   // upper left
+        int pred{ 0 };
+        switch (type) {
+        case 1: pred = a; break;
+        case 2: pred = b; break;
+        case 3: pred = (a + b) / 2; break;
+        case 4: {
+          int p = a + b - c;
+          int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+          pred = (pa <= pb and pa <= pc) ? a : (pb <= pc ? b : c);
+        } break;
+        default: break;
+        }
+        unsigned char v = (unsigned char)(row[i] - pred);
+        out[i + 1] = v;
+        sum += (v < 128) ? v : 256 - v;
+      }
+      if (sum < best_sum) {
+        best_sum = sum;
+        best = size_t(type);
+      }
+    }
+    return m_filtered[best];
+  }
+
+  size_t m_w, m_h, m_d;
+  int m_bit_depth;
+  size_t m_bpp;  //!< Bytes per pixel.
+  int m_level;
+  size_t m_rows{ 0 };
+  std::ofstream m_ofs;
+  z_stream m_zs{};
+  bool m_zs_open{ false };
+  std::vector<unsigned char> m_prev;         //!< Previous (unfiltered) row.
+  std::vector<unsigned char> m_filtered[5];  //!< Candidate filtered rows.
+  std::vector<unsigned char> m_zbuf;         //!< Pending compressed bytes.
+  size_t m_zbuf_used{ 0 };
+  // Parallel mode only.
+  ThreadPool *m_pool{ nullptr };
+  size_t m_rows_per_band{ 0 };
+  std::shared_ptr<std::vector<unsigned char>> m_band_data;  //!< Band being filled.
+  std::shared_ptr<std::vector<unsigned char>> m_prev_band;  //!< Dictionary source.
+  std::deque<Band> m_bands;                                 //!< Bands in flight.
+  unsigned char m_pending_header[2]{ 0, 0 };                //!< zlib header, until written.
+  uLong m_adler{ 1 };
+  bool m_failed{ false };
+};
+
+// =============================================
+// Factories
+// =============================================
+
+std::unique_ptr<ImageWriter> open_ppm6_writer(const std::string &file_name_, size_t w, size_t h,
+                                              size_t d, int bit_depth) {
+  auto writer = std::make_unique<Ppm6Writer>(w, h, d, bit_depth);
+  if (not writer->open(file_name_)) return nullptr;
+  return writer;
+}
+
+std::unique_ptr<ImageWriter> open_ppm6_mapped_writer(const std::string &file_name_, size_t w,
+                                                     size_t h, size_t d, int bit_depth) {
+  auto writer = std::make_unique<MappedPpm6Writer>(w, h, d, bit_depth);
+  if (not writer->open(file_name_)) return nullptr;
+  return writer;
+}
+
+std::unique_ptr<ImageWriter> open_ppm3_writer(const std::string &file_name_, size_t w, size_t h,
+                                              size_t d, ThreadPool *pool, int bit_depth) {
+  auto writer = std::make_unique<Ppm3Writer>(w, h, d, pool, bit_depth);
+  if (not writer->open(file_name_)) return nullptr;
+  return writer;
+}
+
+std::unique_ptr<ImageWriter> open_png_writer(const std::string &file_name_, size_t w, size_t h,
+                                             size_t d, int compression, ThreadPool *pool,
+                                             int bit_depth) {
+  auto writer = std::make_unique<PngWriter>(w, h, d, std::min(9, std::max(0, compression)), pool,
+                                            bit_depth);
+  if (not writer->open(file_name_)) return nullptr;
+  return writer;
+}
+
+// =============================================
+// Whole-image helpers, built on top of the streaming writers.
+// =============================================
+
+/// Writes a complete in-memory image through `writer`.
+static bool save_all(std::unique_ptr<ImageWriter> writer, unsigned char *data, size_t h) {
+  if (not writer) return false;
+  bool ok = writer->write_rows(data, h);
+  return writer->close() and ok;
+}
+
+/// Saves an image as a **binary** PPM file.
+bool save_ppm6(unsigned char *data, size_t w, size_t h, size_t d,
+               const std::string &file_name_) {
+  return save_all(open_ppm6_writer(file_name_, w, h, d), data, h);
+}
+
+/// Saves an image as a **ascii** PPM file.
+bool save_ppm3(unsigned char *data, size_t w, size_t h, size_t d,
+               const std::string &file_name_) {
+  return save_all(open_ppm3_writer(file_name_, w, h, d), data, h);
 }
 
 bool save_png(unsigned char *data, size_t w, size_t h, size_t d,
               const std::string &file_name_) {
-  // #define LODEPNG
-#ifdef LODEPNG
-  std::cout << "depth = " << d << std::endl;
-  std::vector<unsigned char> img;  //( w * h * d );
-  std::copy(data, data + (w * h * d), std::back_inserter(img));
-  // Encode from raw pixels to disk with a single function call
-  // The image argument has width * height RGBA pixels or width * height * 4
-  // bytes Encode the image
-  unsigned error = lodepng::encode(file_name_, img, w, h);
-
-  // if there's an error, display it
-  if (error)
-    std::cout << "encoder error " << error << ": " << lodepng_error_text(error)
-              << std::endl;
+  return save_all(open_png_writer(file_name_, w, h, d), data, h);
+}
 
+// =============================================
+// Image loading.
+// =============================================
+
+bool load_image(const std::string &file_name_, std::vector<unsigned char> &rgb, int &w, int &h) {
+  int n{ 0 };
+  unsigned char *pixels = stbi_load(file_name_.c_str(), &w, &h, &n, 3);
+  if (pixels == nullptr) return false;
+  rgb.assign(pixels, pixels + size_t(w) * size_t(h) * 3);
+  stbi_image_free(pixels);
   return true;
+}
 
-#else
-  // =============================================
-  // INFO on the stb_image_write API
-  // =============================================
-  //
-  // int stbi_write_png(char const *filename, int w, int h, int comp, const void
-  // *data, int stride_in_bytes);
-  //
-  // The functions create an image file defined by the parameters. The image
-  // is a rectangle of pixels stored from left-to-right, top-to-bottom.
-  // Each pixel contains 'comp' channels of data stored interleaved with 8-bits
-  // per channel, in the following order: 1=Y, 2=YA, 3=RGB, 4=RGBA. (Y is
-  // monochrome color.) The rectangle is 'w' pixels wide and 'h' pixels tall.
-  // The *data pointer points to the first byte of the top-left-most pixel.
-  // For PNG, "stride_in_bytes" is the distance in bytes from the first byte of
-  // a row of pixels to the first byte of the next row of pixels.
-  // Each function returns 0 on failure and non-0 on success.
-  //
-  // PNG allows you to set the deflate compression level by setting the global
-  // variable 'stbi_write_png_compression_level' (it defaults to 8).
-  // int stbi_write_png_compression_level;    // defaults to 8; set to higher
-  // for more compression
-  //
-  stbi_write_png_compression_level =
-      0;  // defaults to 8; set to higher for more compression
-  return (0 != stbi_write_png(file_name_.c_str(),  // file name
-                              w, h,                // image dimensions
-                              d,                   // # of channels per pixel
-                              data,                // the pixels
-                              w * d));             // length of a row (in bytes), se above.
-#endif
+bool load_image_float(const std::string &file_name_, std::vector<float> &rgb, int &w, int &h) {
+  int n{ 0 };
+  if (stbi_is_hdr(file_name_.c_str())) {
+    float *pixels = stbi_loadf(file_name_.c_str(), &w, &h, &n, 3);
+    if (pixels == nullptr) return false;
+    rgb.assign(pixels, pixels + size_t(w) * size_t(h) * 3);
+    stbi_image_free(pixels);
+    return true;
+  }
+  // Not through `stbi_loadf()`, which would also undo a 2.2 gamma.
+  std::vector<unsigned char> bytes;
+  if (not load_image(file_name_, bytes, w, h)) return false;
+  rgb.resize(bytes.size());
+  for (size_t i{ 0 }; i < bytes.size(); ++i) {
+    rgb[i] = float(bytes[i]) * (1.f / 255.f);
+  }
+  return true;
 }
 
 }  // namespace rt3
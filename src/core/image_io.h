@@ -1,9 +1,93 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace rt3 {
+class ThreadPool;
+
+/// Default deflate level for PNG files (zlib's own default).
+constexpr int default_png_compression{ 6 };
+
+/*!
+ * Incremental image writer.
+ *
+ * The image is sent in scanline order, a few rows at a time, as soon as they
+ * are ready. Writers never hold the full image: the PNG writer deflates each
+ * row as it arrives and the PPM writers send it straight to the file, so the
+ * memory needed is a couple of rows no matter how large the frame is.
+ */
+class ImageWriter {
+ public:
+  virtual ~ImageWriter() = default;
+  /// Appends `n_rows` rows of `width * depth` bytes each, after the last row
+  /// written so far.
+  virtual bool write_rows(const unsigned char* rows, size_t n_rows) = 0;
+  /// Flushes whatever is pending and closes the file. Returns `false` if any
+  /// step failed, or if fewer than `height` rows were written.
+  virtual bool close() = 0;
+
+  /*!
+   * Writers backed by a memory-mapped file let the caller place rows
+   * directly into the file, in any order and from any thread. This returns
+   * where rows `[y0, y0+n_rows)` go, or `nullptr` if the writer only supports
+   * `write_rows()`. Rows written this way must be reported with
+   * `commit_rows()`.
+   */
+  virtual unsigned char* direct_rows(size_t /* y0 */, size_t /* n_rows */) { return nullptr; }
+  /// Reports `n_rows` rows written through `direct_rows()`. Thread-safe.
+  virtual void commit_rows(size_t /* n_rows */) {}
+};
+
+/*
+ * Every writer takes `width`, `height` and `depth` (channels per pixel), and
+ * a `bit_depth` of 8 or 16 bits per sample. 16-bit samples come in rows as
+ * big-endian pairs of bytes, which is how both formats store them.
+ */
+
+/// Opens a streaming writer for a **binary** PPM file; `nullptr` on failure.
+std::unique_ptr<ImageWriter> open_ppm6_writer(const std::string&,
+                                              size_t,
+                                              size_t,
+                                              size_t = 3,
+                                              int bit_depth = 8);
+/// Opens a **binary** PPM writer over a memory-mapped file, which supports
+/// `direct_rows()`; `nullptr` if mapping is not possible.
+std::unique_ptr<ImageWriter> open_ppm6_mapped_writer(const std::string&,
+                                                     size_t,
+                                                     size_t,
+                                                     size_t = 3,
+                                                     int bit_depth = 8);
+/// Opens a streaming writer for an **ascii** PPM file; `nullptr` on failure.
+/// If a thread `pool` is given, large batches of rows are formatted in parallel.
+std::unique_ptr<ImageWriter> open_ppm3_writer(const std::string&,
+                                              size_t,
+                                              size_t,
+                                              size_t = 3,
+                                              ThreadPool* pool = nullptr,
+                                              int bit_depth = 8);
+/*!
+ * Opens a streaming writer for a PNG file; `nullptr` on failure.
+ * `compression` is the deflate level, 0 (none) to 9 (best). If a thread
+ * `pool` is given, bands of rows are compressed in parallel on it.
+ */
+std::unique_ptr<ImageWriter> open_png_writer(const std::string&,
+                                             size_t,
+                                             size_t,
+                                             size_t = 3,
+                                             int compression = default_png_compression,
+                                             ThreadPool* pool = nullptr,
+                                             int bit_depth = 8);
+
+/// Loads an 8-bit image (PNG, JPEG or binary PPM) as RGB, 3 bytes per pixel.
+/// Returns `false` if the file is missing or cannot be decoded.
+bool load_image(const std::string&, std::vector<unsigned char>& rgb, int& w, int& h);
+/// Loads any image `load_image()` reads, plus Radiance HDR, as RGB
+/// floats: 8-bit values are scaled to [0,1], HDR values are kept as they are.
+bool load_image_float(const std::string&, std::vector<float>& rgb, int& w, int& h);
+
 /// Routines to write images to a file.
 bool save_ppm6(unsigned char*, size_t, size_t, size_t = 1,
                const std::string& = "image.ppm");
@@ -0,0 +1,61 @@
+#include "log.h"
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+
+namespace rt3 {
+
+namespace {
+/// Buffered lines are written out once they reach this size.
+constexpr size_t sink_capacity{ 64 * 1024 };
+
+std::atomic<int> g_log_level{ int(log_level_e::NONE) };
+
+/// The shared sink. Flushed when full and at exit.
+struct LogSink {
+  std::mutex mtx;
+  std::string buffer;
+
+  LogSink() { buffer.reserve(sink_capacity); }
+  ~LogSink() { flush(); }
+
+  void append(const std::string &line) {
+    std::lock_guard<std::mutex> lock(mtx);
+    buffer += line;
+    buffer += '\n';
+    if (buffer.size() >= sink_capacity) {
+      write_out();
+    }
+  }
+  void flush() {
+    std::lock_guard<std::mutex> lock(mtx);
+    write_out();
+  }
+  /// Caller holds `mtx`.
+  void write_out() {
+    if (not buffer.empty()) {
+      std::clog.write(buffer.data(), std::streamsize(buffer.size()));
+      std::clog.flush();
+      buffer.clear();
+    }
+  }
+};
+
+LogSink &sink() {
+  static LogSink the_sink;
+  return the_sink;
+}
+}  // namespace
+
+void set_log_level(int level) { g_log_level.store(level, std::memory_order_relaxed); }
+
+bool log_enabled(log_level_e level) {
+  return int(level) <= g_log_level.load(std::memory_order_relaxed);
+}
+
+void log_flush() { sink().flush(); }
+
+LogLine::~LogLine() { sink().append(m_oss.str()); }
+
+}  // namespace rt3
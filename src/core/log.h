@@ -0,0 +1,83 @@
+#ifndef LOG_H
+#define LOG_H 1
+
+#include <sstream>
+#include <string>
+
+#include "error.h"
+
+/*!
+ * Level-gated debug logging.
+ *
+ * Unlike `RT3_MESSAGE()`, which is always shown, log lines are meant for
+ * tracing the engine (parser tags, attributes, ParamSet lookups...) and are
+ * silent unless asked for with `--verbose <level>`.
+ *
+ *     RT3_LOG_DEBUG("Tag `" << tag_name << "` at level " << level);
+ *
+ * The argument is a stream expression and is only evaluated if the line is
+ * going to be printed. Lines above `RT3_LOG_LEVEL` do not even get compiled
+ * in: release builds (`NDEBUG`) default to `RT3_LOG_LEVEL 0`, so every call
+ * vanishes; other builds keep all levels and filter at runtime.
+ *
+ * Finished lines go into a shared, mutex-guarded buffer that is written to
+ * `std::clog` in large blocks: no per-line flush, and lines from different
+ * threads never interleave. Warnings and errors flush it first, to keep the
+ * output in order.
+ */
+
+/// Compile-time verbosity ceiling.
+#ifndef RT3_LOG_LEVEL
+#ifdef NDEBUG
+#define RT3_LOG_LEVEL 0
+#else
+#define RT3_LOG_LEVEL 3
+#endif
+#endif
+
+#define RT3_LOG(level, expr)                                         \
+  do {                                                               \
+    if constexpr (int(level) <= RT3_LOG_LEVEL) {                     \
+      if (::rt3::log_enabled(level)) {                               \
+        ::rt3::LogLine rt3_log_line_;                                \
+        rt3_log_line_.stream() << expr;                              \
+      }                                                              \
+    }                                                                \
+  } while (0)
+
+/// Entities being created, and similar once-per-scene events.
+#define RT3_LOG_INFO(expr) RT3_LOG(::rt3::log_level_e::INFO, expr)
+/// Parser activity: tags and attributes.
+#define RT3_LOG_DEBUG(expr) RT3_LOG(::rt3::log_level_e::DEBUG, expr)
+/// Everything, including every `ParamSet` lookup.
+#define RT3_LOG_TRACE(expr) RT3_LOG(::rt3::log_level_e::TRACE, expr)
+
+namespace rt3 {
+
+/// Verbosity levels; a line is shown if its level is at most the current one.
+enum class log_level_e : int { NONE = 0, INFO, DEBUG, TRACE };
+
+/// Sets the runtime verbosity (`NONE` by default).
+void set_log_level(int level);
+/// Whether lines of `level` are currently shown.
+bool log_enabled(log_level_e level);
+/// Writes out whatever is buffered.
+void log_flush();
+
+/// One log line, collected locally and handed to the sink when destroyed.
+class LogLine {
+ public:
+  LogLine() = default;
+  ~LogLine();
+  LogLine(const LogLine &) = delete;
+  LogLine &operator=(const LogLine &) = delete;
+
+  std::ostringstream &stream() { return m_oss; }
+
+ private:
+  std::ostringstream m_oss;
+};
+
+}  // namespace rt3
+
+#endif  // LOG_H
@@ -0,0 +1,96 @@
+#include "mapped_file.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RT3_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace rt3 {
+
+#ifdef RT3_HAS_MMAP
+
+std::unique_ptr<MappedFile> MappedFile::create(const std::string &path, size_t size) {
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return nullptr;
+  }
+  // Size the file up front; untouched pages cost nothing until written.
+  if (size == 0 or ::ftruncate(fd, off_t(size)) != 0) {
+    ::close(fd);
+    return nullptr;
+  }
+  void *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    ::close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<MappedFile>(new MappedFile(fd, static_cast<unsigned char *>(addr), size));
+}
+
+std::unique_ptr<MappedFile> MappedFile::open_read(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 or st.st_size <= 0) {
+    ::close(fd);
+    return nullptr;
+  }
+  size_t size = size_t(st.st_size);
+  void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    ::close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<MappedFile>(new MappedFile(fd, static_cast<unsigned char *>(addr), size));
+}
+
+MappedFile::~MappedFile() {
+  ::munmap(m_data, m_size);
+  ::close(m_fd);
+}
+
+#else
+
+std::unique_ptr<MappedFile> MappedFile::create(const std::string &, size_t) { return nullptr; }
+
+std::unique_ptr<MappedFile> MappedFile::open_read(const std::string &) { return nullptr; }
+
+MappedFile::~MappedFile() {}
+
+#endif
+
+std::string unique_temp_file(const std::string &target) {
+#ifdef RT3_HAS_MMAP
+  std::string name{ target + ".tmp.XXXXXX" };
+  const int fd{ ::mkstemp(name.data()) };
+  if (fd < 0) {
+    return {};
+  }
+  // mkstemp() makes it private; caches are as readable as any output.
+  ::fchmod(fd, 0644);
+  ::close(fd);
+  return name;
+#else
+  std::random_device rd;
+  for (int attempt{ 0 }; attempt < 16; ++attempt) {
+    const std::string name{ target + ".tmp." + std::to_string(rd()) };
+    // "x": fails if the file exists.
+    if (std::FILE *f = std::fopen(name.c_str(), "wbx")) {
+      std::fclose(f);
+      return name;
+    }
+  }
+  return {};
+#endif
+}
+
+}  // namespace rt3
@@ -0,0 +1,58 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H 1
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace rt3 {
+
+/*!
+ * A file mapped into memory with `mmap()`.
+ *
+ * Writes through `data()` go straight into the page cache, with no
+ * intermediate buffer and no `write()` copy; reads only fault in the pages
+ * actually touched. The mapping is released (and the file closed) by the
+ * destructor.
+ *
+ * Only available on POSIX systems; elsewhere `create()` returns `nullptr` and
+ * callers fall back to regular streams.
+ */
+class MappedFile {
+ public:
+  /// Creates (or truncates) `path` with `size` bytes and maps it read-write.
+  /// Returns `nullptr` on failure.
+  static std::unique_ptr<MappedFile> create(const std::string &path, size_t size);
+  /// Maps an existing file read-only. Returns `nullptr` on failure, or if the
+  /// file is empty.
+  static std::unique_ptr<MappedFile> open_read(const std::string &path);
+
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  unsigned char *data() { return m_data; }
+  const unsigned char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+ private:
+  MappedFile(int fd, unsigned char *data, size_t size) : m_fd{ fd }, m_data{ data }, m_size{ size } {}
+
+  int m_fd;
+  unsigned char *m_data;
+  size_t m_size;
+};
+
+/*!
+ * Creates an empty file of its own next to `target`, and returns its name
+ * (empty if it fails). Files that readers may have mapped (the `.rt3c` and
+ * `.rt3tex` caches) are written there and then renamed over `target`, never
+ * rewritten in place: a mapping of the old file stays valid, a crash leaves
+ * no partial file behind, and processes writing the same file at once never
+ * write into each other's.
+ */
+std::string unique_temp_file(const std::string &target);
+
+}  // namespace rt3
+
+#endif  // MAPPED_FILE_H
@@ -0,0 +1,14 @@
+#include "material.h"
+#include "api.h"
+
+namespace rt3 {
+
+FlatMaterial *create_flat_material(const ParamSet &ps) {
+  Spectrum color = retrieve(ps, "color", Spectrum{1, 1, 1});
+  // Same convention as the background: values above 1 are in [0,255].
+  if (color.max_component() > 1.f) {
+    color = color / 255.f;
+  }
+  return API::build_arena->make<FlatMaterial>(color);
+}
+}  // namespace rt3
@@ -0,0 +1,35 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H 1
+
+#include "paramset.h"
+#include "rt3.h"
+
+namespace rt3 {
+
+/// How a surface responds to light. Materials are shared by every primitive
+/// created while they are current (see `API::material()`).
+class Material {
+ public:
+  virtual ~Material() = default;
+  /// Color of the surface with no lighting at all, as the flat renderer
+  /// paints it.
+  virtual Spectrum flat_color() const = 0;
+};
+
+/// A constant color, with no lighting at all.
+class FlatMaterial : public Material {
+ public:
+  explicit FlatMaterial(const Spectrum &color) : m_color{ color } {}
+
+  const Spectrum &color() const { return m_color; }
+  Spectrum flat_color() const override { return m_color; }
+
+ private:
+  Spectrum m_color;
+};
+
+// factory pattern functions.
+FlatMaterial *create_flat_material(const ParamSet &ps);
+}  // namespace rt3
+
+#endif  // MATERIAL_H
@@ -0,0 +1,53 @@
+#include "memory.h"
+
+#include <algorithm>
+
+namespace rt3 {
+
+void MemoryArena::new_block(size_t min_size) {
+  if (m_cursor != nullptr) {
+    m_used_before += m_current_size - m_remaining;
+  }
+  size_t size = std::max(min_size, m_block_size);
+  std::unique_ptr<unsigned char[]> block{ new unsigned char[size] };
+  m_cursor = block.get();
+  m_remaining = size;
+  m_current_size = size;
+  m_blocks.emplace_back(std::move(block), size);
+}
+
+void MemoryArena::reset() {
+  for (Cleanup *c = m_cleanups; c != nullptr; c = c->next) {
+    c->destroy(c->obj);
+  }
+  m_cleanups = nullptr;
+  m_used_before = 0;
+  if (m_blocks.empty()) {
+    return;
+  }
+  // Keep the largest block and start over at its beginning.
+  auto largest = std::max_element(m_blocks.begin(), m_blocks.end(),
+                                  [](const auto &a, const auto &b) { return a.second < b.second; });
+  auto kept = std::move(*largest);
+  m_blocks.clear();
+  m_cursor = kept.first.get();
+  m_remaining = kept.second;
+  m_current_size = kept.second;
+  m_blocks.push_back(std::move(kept));
+}
+
+size_t MemoryArena::bytes_reserved() const {
+  size_t total{ 0 };
+  for (const auto &b : m_blocks) {
+    total += b.second;
+  }
+  return total;
+}
+
+MemoryArena &scratch_arena() {
+  // Small blocks: tiles only need a few rows of temporaries.
+  thread_local MemoryArena arena{ 64 * 1024 };
+  return arena;
+}
+
+}  // namespace rt3
@@ -0,0 +1,123 @@
+#ifndef MEMORY_H
+#define MEMORY_H 1
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace rt3 {
+
+/// Placement-new an object in an arena, as in
+/// `RT3_ARENA_ALLOC(arena, Film)(resolution, ...)`.
+#define RT3_ARENA_ALLOC(arena, Type) new ((arena).alloc(sizeof(Type), alignof(Type))) Type
+
+/*!
+ * A bump allocator for objects that share a lifetime.
+ *
+ * Memory is carved out of large blocks, so an allocation is a pointer bump
+ * instead of a trip to the heap, and there is no per-object free: everything
+ * goes away at once with `reset()`. After a reset the arena keeps its largest
+ * block, so the next scene (or tile) starts with warm memory.
+ *
+ * `make()` also records the object's destructor, when it has one, and
+ * `reset()` runs those destructors in reverse order of construction. Objects
+ * placed with `RT3_ARENA_ALLOC()` get no such record; their owner destroys
+ * them, typically through an `ArenaPtr`.
+ *
+ * An arena is not thread-safe. The engine uses one scene arena, owned by the
+ * API and reset at `API::reset_engine()`, plus a scratch arena per thread
+ * (see `scratch_arena()`). The render server rebuilds edited objects in
+ * arenas of their own (see `API::build_arena`).
+ */
+class MemoryArena {
+ public:
+  static constexpr size_t default_block_size{ 256 * 1024 };
+
+  explicit MemoryArena(size_t block_size = default_block_size) : m_block_size{ block_size } {}
+  ~MemoryArena() { reset(); }
+  MemoryArena(const MemoryArena &) = delete;
+  MemoryArena &operator=(const MemoryArena &) = delete;
+
+  /// Returns `n_bytes` of uninitialized memory aligned to `alignment` (a
+  /// power of 2), valid until `reset()`.
+  void *alloc(size_t n_bytes, size_t alignment = alignof(std::max_align_t)) {
+    size_t pad = (alignment - (reinterpret_cast<uintptr_t>(m_cursor) & (alignment - 1)))
+                 & (alignment - 1);
+    if (pad + n_bytes > m_remaining) {
+      new_block(n_bytes + alignment);
+      pad = (alignment - (reinterpret_cast<uintptr_t>(m_cursor) & (alignment - 1)))
+            & (alignment - 1);
+    }
+    void *p = m_cursor + pad;
+    m_cursor += pad + n_bytes;
+    m_remaining -= pad + n_bytes;
+    return p;
+  }
+
+  /// Uninitialized room for `n` values of `T` (trivially destructible only).
+  template <typename T> T *alloc_array(size_t n) {
+    static_assert(std::is_trivially_destructible_v<T>, "arena arrays are never destroyed");
+    return static_cast<T *>(alloc(n * sizeof(T), alignof(T)));
+  }
+
+  /// Constructs a `T` in the arena; it is destroyed by `reset()`.
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    T *obj = RT3_ARENA_ALLOC(*this, T)(std::forward<Args>(args)...);
+    if constexpr (not std::is_trivially_destructible_v<T>) {
+      auto *node = RT3_ARENA_ALLOC(*this, Cleanup){ [](void *p) { static_cast<T *>(p)->~T(); }, obj,
+                                                    m_cleanups };
+      m_cleanups = node;
+    }
+    return obj;
+  }
+
+  /// Destroys the objects built with `make()` and releases all memory (the
+  /// largest block is kept for reuse).
+  void reset();
+
+  /// Bytes handed out since the last `reset()`, padding included.
+  size_t bytes_used() const { return m_used_before + (m_current_size - m_remaining); }
+  /// Bytes currently held from the heap.
+  size_t bytes_reserved() const;
+
+ private:
+  /// A pending destructor call, kept in the arena itself.
+  struct Cleanup {
+    void (*destroy)(void *);
+    void *obj;
+    Cleanup *next;
+  };
+
+  void new_block(size_t min_size);
+
+  size_t m_block_size;
+  unsigned char *m_cursor{ nullptr };
+  size_t m_remaining{ 0 };
+  size_t m_current_size{ 0 };  //!< Size of the block `m_cursor` points into.
+  size_t m_used_before{ 0 };   //!< Bytes used in retired blocks.
+  std::vector<std::pair<std::unique_ptr<unsigned char[]>, size_t>> m_blocks;
+  Cleanup *m_cleanups{ nullptr };
+};
+
+/// Deleter for objects placed with `RT3_ARENA_ALLOC()`: runs the destructor
+/// and leaves the memory to the arena.
+struct ArenaDeleter {
+  template <typename T> void operator()(T *obj) const {
+    if (obj != nullptr) obj->~T();
+  }
+};
+
+/// Owning pointer to an object that lives in an arena.
+template <typename T> using ArenaPtr = std::unique_ptr<T, ArenaDeleter>;
+
+/// This thread's scratch arena, for render-time temporaries. The render loop
+/// resets it after every tile.
+MemoryArena &scratch_arena();
+
+}  // namespace rt3
+
+#endif  // MEMORY_H
@@ -0,0 +1,188 @@
+#include "net.h"
+
+#if defined(RT3_HAS_SOCKETS)
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#endif
+
+namespace rt3 {
+namespace net {
+
+#if defined(RT3_HAS_SOCKETS)
+bool send_all(int fd, const void *data, size_t n, int timeout_ms) {
+  using clock = std::chrono::steady_clock;
+  const auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+  const auto *p = static_cast<const char *>(data);
+  int flags{ 0 };
+#if defined(MSG_NOSIGNAL)
+  flags |= MSG_NOSIGNAL;
+#endif
+  if (timeout_ms >= 0) {
+    // The deadline is for the whole buffer: a peer that reads a byte now
+    // and then must not keep us here.
+    flags |= MSG_DONTWAIT;
+  }
+  while (n > 0) {
+    if (timeout_ms >= 0) {
+      const auto left =
+          std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+      pollfd w{};
+      w.fd = fd;
+      w.events = POLLOUT;
+      int ready{ 0 };
+      do {
+        ready = left > 0 ? ::poll(&w, 1, int(left)) : 0;
+      } while (ready < 0 and errno == EINTR);
+      if (ready <= 0) {
+        return false;
+      }
+    }
+    ssize_t sent = ::send(fd, p, n, flags);
+    if (sent < 0 and (errno == EINTR or errno == EAGAIN or errno == EWOULDBLOCK)) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    p += sent;
+    n -= size_t(sent);
+  }
+  return true;
+}
+
+bool recv_all(int fd, void *data, size_t n) {
+  auto *p = static_cast<char *>(data);
+  while (n > 0) {
+    ssize_t got = ::recv(fd, p, n, 0);
+    if (got < 0 and errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    p += got;
+    n -= size_t(got);
+  }
+  return true;
+}
+
+bool send_message(int fd, uint32_t type, const std::vector<unsigned char> &payload,
+                  int timeout_ms) {
+  Encoder header;
+  header.u32(type);
+  header.u64(payload.size());
+  return send_all(fd, header.data().data(), header.data().size(), timeout_ms)
+         and send_all(fd, payload.data(), payload.size(), timeout_ms);
+}
+
+bool recv_message(int fd, uint32_t &type, std::vector<unsigned char> &payload, uint64_t max_bytes) {
+  std::vector<unsigned char> header(12);
+  if (not recv_all(fd, header.data(), header.size())) {
+    return false;
+  }
+  Decoder d{ header };
+  type = d.u32();
+  const uint64_t size{ d.u64() };
+  if (size > max_bytes) {
+    return false;
+  }
+  payload.resize(size_t(size));
+  return recv_all(fd, payload.data(), payload.size());
+}
+
+bool wait_readable(int fd, int timeout_ms) {
+  pollfd p{};
+  p.fd = fd;
+  p.events = POLLIN;
+  int n{ 0 };
+  do {
+    n = ::poll(&p, 1, timeout_ms);
+  } while (n < 0 and errno == EINTR);
+  return n > 0;
+}
+
+void tune_socket(int fd, int recv_timeout_s) {
+  int one{ 1 };
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#if defined(SO_NOSIGPIPE)
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  if (recv_timeout_s > 0) {
+    // A peer that stalls in the middle of a message is given up on, rather
+    // than stalling everyone.
+    timeval tv{};
+    tv.tv_sec = recv_timeout_s;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+}
+
+int listen_on(int port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one{ 1 };
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(uint16_t(port));
+  if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 or ::listen(fd, 64) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int accept_on(int listen_fd) {
+  int fd{ -1 };
+  do {
+    fd = ::accept(listen_fd, nullptr, nullptr);
+  } while (fd < 0 and errno == EINTR);
+  return fd;
+}
+
+int connect_to(const std::string &address) {
+  const auto colon = address.find_last_of(':');
+  if (colon == std::string::npos) {
+    return -1;
+  }
+  const std::string host{ colon == 0 ? "localhost" : address.substr(0, colon) };
+  const std::string port{ address.substr(colon + 1) };
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *found{ nullptr };
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+    return -1;
+  }
+  int fd{ -1 };
+  for (addrinfo *a{ found }; a != nullptr and fd < 0; a = a->ai_next) {
+    fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 and ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(found);
+  return fd;
+}
+
+void close_socket(int fd) {
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+#endif
+
+}  // namespace net
+}  // namespace rt3
@@ -0,0 +1,149 @@
+#ifndef NET_H
+#define NET_H 1
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RT3_HAS_SOCKETS 1
+#endif
+
+namespace rt3 {
+
+/*!
+ * Messages over TCP, shared by the distributed renderer and the render
+ * server.
+ *
+ * Every message is a 12-byte header (type, payload size) and the payload.
+ * Numbers are big-endian; strings and blobs are a 64-bit size and the bytes.
+ * The socket functions exist where `RT3_HAS_SOCKETS` is defined.
+ */
+namespace net {
+
+/// Builds a message payload.
+class Encoder {
+ public:
+  void u32(uint32_t v) {
+    for (int s{ 24 }; s >= 0; s -= 8) {
+      m_bytes.push_back((unsigned char)(v >> s));
+    }
+  }
+  void u64(uint64_t v) {
+    u32(uint32_t(v >> 32));
+    u32(uint32_t(v));
+  }
+  void i32(int32_t v) { u32(uint32_t(v)); }
+  void i64(int64_t v) { u64(uint64_t(v)); }
+  void f32(float v) {
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    u32(bits);
+  }
+  void bytes(const void *data, size_t n) {
+    const auto *p = static_cast<const unsigned char *>(data);
+    m_bytes.insert(m_bytes.end(), p, p + n);
+  }
+  void blob(const std::string &s) {
+    u64(s.size());
+    bytes(s.data(), s.size());
+  }
+  const std::vector<unsigned char> &data() const { return m_bytes; }
+  std::vector<unsigned char> &data() { return m_bytes; }
+
+ private:
+  std::vector<unsigned char> m_bytes;
+};
+
+/// Reads a message payload. Reading past the end clears `ok()` and yields
+/// zeros, so a message is checked once, after it has been fully read.
+class Decoder {
+ public:
+  explicit Decoder(const std::vector<unsigned char> &bytes)
+      : m_p{ bytes.data() }, m_end{ bytes.data() + bytes.size() } {}
+
+  bool ok() const { return m_ok; }
+  uint32_t u32() {
+    if (not need(4)) {
+      return 0;
+    }
+    uint32_t v{ 0 };
+    for (int i{ 0 }; i < 4; ++i) {
+      v = (v << 8) | m_p[i];
+    }
+    m_p += 4;
+    return v;
+  }
+  uint64_t u64() {
+    const uint64_t hi{ u32() };
+    return (hi << 32) | u32();
+  }
+  int32_t i32() { return int32_t(u32()); }
+  int64_t i64() { return int64_t(u64()); }
+  float f32() {
+    const uint32_t bits{ u32() };
+    float v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+  }
+  std::string blob() {
+    const uint64_t n{ u64() };
+    if (not need(n)) {
+      return {};
+    }
+    std::string s{ reinterpret_cast<const char *>(m_p), size_t(n) };
+    m_p += n;
+    return s;
+  }
+  /// The bytes left.
+  const unsigned char *rest(size_t &n) const {
+    n = size_t(m_end - m_p);
+    return m_p;
+  }
+
+ private:
+  bool need(uint64_t n) {
+    if (m_ok and uint64_t(m_end - m_p) >= n) {
+      return true;
+    }
+    m_ok = false;
+    return false;
+  }
+
+  const unsigned char *m_p;
+  const unsigned char *m_end;
+  bool m_ok{ true };
+};
+
+#if defined(RT3_HAS_SOCKETS)
+/// Sends all `n` bytes; `false` if the connection is gone or, with
+/// `timeout_ms >= 0`, if they could not all be sent within that time.
+bool send_all(int fd, const void *data, size_t n, int timeout_ms = -1);
+/// Receives exactly `n` bytes; `false` if the connection is gone or times out.
+bool recv_all(int fd, void *data, size_t n);
+/// Sends a message of type `type`, within `timeout_ms` as for `send_all()`.
+bool send_message(int fd, uint32_t type, const std::vector<unsigned char> &payload,
+                  int timeout_ms = -1);
+/// Receives a message; `false` on a broken connection or a payload larger
+/// than `max_bytes`.
+bool recv_message(int fd, uint32_t &type, std::vector<unsigned char> &payload, uint64_t max_bytes);
+/// Waits for `fd` to have something to read, or for the peer to hang up;
+/// `false` on error or after `timeout_ms` (negative: no limit).
+bool wait_readable(int fd, int timeout_ms);
+/// No Nagle delay, no SIGPIPE, and, if `recv_timeout_s > 0`, a receive timeout.
+void tune_socket(int fd, int recv_timeout_s);
+/// A socket listening on `port` of every interface; -1 if it fails.
+int listen_on(int port);
+/// Waits for a connection on `listen_fd`; -1 if it fails.
+int accept_on(int listen_fd);
+/// Connects to `host:port`; -1 if it fails.
+int connect_to(const std::string &address);
+/// Closes `fd`, if it is a socket (not negative).
+void close_socket(int fd);
+#endif
+
+}  // namespace net
+}  // namespace rt3
+
+#endif  // NET_H
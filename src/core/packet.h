@@ -0,0 +1,166 @@
+#ifndef PACKET_H
+#define PACKET_H 1
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "geometry.h"
+#include "ray.h"
+
+/*!
+ * Wide "packet" types, holding W values in structure-of-arrays layout.
+ *
+ * These are the building blocks for kernels that process 4 or 8 rays (or
+ * pixels) at a time. Each lane operation is a short fixed-length loop over
+ * aligned arrays, which GCC/Clang turn into a single SSE/AVX/NEON
+ * instruction per operation at -O2 and above; no intrinsics are needed, so
+ * the same code builds for x86 and ARM.
+ */
+
+// Tell the compiler the loop has no cross-lane dependencies.
+#if defined(__clang__)
+#define RT3_SIMD_LOOP _Pragma("clang loop vectorize(enable)")
+#elif defined(__GNUC__)
+#define RT3_SIMD_LOOP _Pragma("GCC ivdep")
+#else
+#define RT3_SIMD_LOOP
+#endif
+
+namespace rt3 {
+
+/// Natural packet width for the target: one 256-bit register with AVX,
+/// otherwise one 128-bit register (SSE, NEON).
+#if defined(__AVX__)
+constexpr int native_packet_width{ 8 };
+#else
+constexpr int native_packet_width{ 4 };
+#endif
+
+/// W floats, aligned to a full vector register.
+template <int W> struct alignas(W * sizeof(float)) Floatx {
+  float v[W];
+
+  Floatx() = default;
+  explicit Floatx(float s) {
+    RT3_SIMD_LOOP
+    for (int i = 0; i < W; ++i) v[i] = s;
+  }
+
+  float operator[](int i) const { return v[i]; }
+  float &operator[](int i) { return v[i]; }
+
+  Floatx operator+(const Floatx &b) const {
+    Floatx r;
+    RT3_SIMD_LOOP
+    for (int i = 0; i < W; ++i) r.v[i] = v[i] + b.v[i];
+    return r;
+  }
+  Floatx operator-(const Floatx &b) const {
+    Floatx r;
+    RT3_SIMD_LOOP
+    for (int i = 0; i < W; ++i) r.v[i] = v[i] - b.v[i];
+    return r;
+  }
+  Floatx operator*(const Floatx &b) const {
+    Floatx r;
+    RT3_SIMD_LOOP
+    for (int i = 0; i < W; ++i) r.v[i] = v[i] * b.v[i];
+    return r;
+  }
+  Floatx operator/(const Floatx &b) const {
+    Floatx r;
+    RT3_SIMD_LOOP
+    for (int i = 0; i < W; ++i) r.v[i] = v[i] / b.v[i];
+    return r;
+  }
+};
+
+template <int W> inline Floatx<W> min(const Floatx<W> &a, const Floatx<W> &b) {
+  Floatx<W> r;
+  RT3_SIMD_LOOP
+  for (int i = 0; i < W; ++i) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+  return r;
+}
+template <int W> inline Floatx<W> max(const Floatx<W> &a, const Floatx<W> &b) {
+  Floatx<W> r;
+  RT3_SIMD_LOOP
+  for (int i = 0; i < W; ++i) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+  return r;
+}
+/// Fused `a*b + c`, lane by lane.
+template <int W> inline Floatx<W> fmadd(const Floatx<W> &a, const Floatx<W> &b, const Floatx<W> &c) {
+  Floatx<W> r;
+  RT3_SIMD_LOOP
+  for (int i = 0; i < W; ++i) r.v[i] = a.v[i] * b.v[i] + c.v[i];
+  return r;
+}
+
+/// W 3D vectors (or points), one array per coordinate.
+template <int W> struct Vec3x {
+  Floatx<W> x, y, z;
+
+  Vec3x() = default;
+  /// Broadcasts a single vector to all lanes.
+  explicit Vec3x(const Vector3<float> &v) : x{ v.x }, y{ v.y }, z{ v.z } {}
+  explicit Vec3x(const Point3<float> &p) : x{ p.x }, y{ p.y }, z{ p.z } {}
+
+  void set(int lane, const Vector3<float> &v) {
+    x.v[lane] = v.x;
+    y.v[lane] = v.y;
+    z.v[lane] = v.z;
+  }
+  void set(int lane, const Point3<float> &p) {
+    x.v[lane] = p.x;
+    y.v[lane] = p.y;
+    z.v[lane] = p.z;
+  }
+  Vector3<float> vector(int lane) const { return { x.v[lane], y.v[lane], z.v[lane] }; }
+  Point3<float> point(int lane) const { return { x.v[lane], y.v[lane], z.v[lane] }; }
+
+  Vec3x operator+(const Vec3x &b) const { return make(x + b.x, y + b.y, z + b.z); }
+  Vec3x operator-(const Vec3x &b) const { return make(x - b.x, y - b.y, z - b.z); }
+  Vec3x operator*(const Floatx<W> &s) const { return make(x * s, y * s, z * s); }
+
+  static Vec3x make(const Floatx<W> &x, const Floatx<W> &y, const Floatx<W> &z) {
+    Vec3x r;
+    r.x = x;
+    r.y = y;
+    r.z = z;
+    return r;
+  }
+};
+
+template <int W> inline Floatx<W> dot(const Vec3x<W> &a, const Vec3x<W> &b) {
+  return fmadd(a.x, b.x, fmadd(a.y, b.y, a.z * b.z));
+}
+template <int W> inline Vec3x<W> cross(const Vec3x<W> &a, const Vec3x<W> &b) {
+  return Vec3x<W>::make(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+using Floatx4 = Floatx<4>;
+using Floatx8 = Floatx<8>;
+using Vec3x4 = Vec3x<4>;
+using Vec3x8 = Vec3x<8>;
+
+/// W rays in SoA form, traced together through kernels that operate on all
+/// lanes at once.
+template <int W> struct RayPacket {
+  Vec3x<W> o;       //!< Origins.
+  Vec3x<W> d;       //!< Directions.
+  Floatx<W> t_max;  //!< Closest hit so far (or the ray's extent).
+  int n_active{ W };  //!< Lanes in use; trailing lanes are padding.
+
+  RayPacket() : t_max{ std::numeric_limits<float>::infinity() } {}
+
+  void set(int lane, const Ray &ray) {
+    o.set(lane, ray.o);
+    d.set(lane, ray.d);
+    t_max.v[lane] = ray.t_max;
+  }
+  Ray ray(int lane) const { return Ray{ o.point(lane), d.vector(lane), 0.f, t_max.v[lane] }; }
+};
+
+}  // namespace rt3
+
+#endif  // PACKET_H
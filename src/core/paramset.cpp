@@ -0,0 +1,165 @@
+#include "paramset.h"
+
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace rt3 {
+
+namespace {
+/// Global table of interned names. Names are never removed, so references
+/// returned by `name()` stay valid for the whole run.
+struct KeyTable {
+  std::mutex mtx;
+  std::unordered_map<std::string, uint32_t> ids;
+  std::deque<std::string> names;  //!< Indexed by id; deque keeps references stable.
+
+  KeyTable() { intern(""); }
+
+  uint32_t intern(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto [it, inserted] = ids.try_emplace(name, uint32_t(names.size()));
+    if (inserted) {
+      names.push_back(name);
+    }
+    return it->second;
+  }
+  const std::string &name(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return names[id];
+  }
+};
+
+KeyTable &key_table() {
+  static KeyTable table;
+  return table;
+}
+}  // namespace
+
+ParamKey::ParamKey(const std::string &name) : m_id{ key_table().intern(name) } {}
+
+ParamKey::ParamKey(const char *name) : m_id{ key_table().intern(name) } {}
+
+const std::string &ParamKey::name() const { return key_table().name(m_id); }
+
+const char *param_tag_name(param_tag_e tag) {
+  switch (tag) {
+  case param_tag_e::BOOL: return "bool";
+  case param_tag_e::INT: return "int";
+  case param_tag_e::UINT: return "unsigned int";
+  case param_tag_e::REAL: return "real";
+  case param_tag_e::STRING: return "string";
+  case param_tag_e::VEC3F: return "Vector3f";
+  case param_tag_e::VEC3I: return "Vector3i";
+  case param_tag_e::NORMAL3F: return "Normal3f";
+  case param_tag_e::POINT3F: return "Point3f";
+  case param_tag_e::POINT2I: return "Point2i";
+  case param_tag_e::POINT2F: return "Point2f";
+  case param_tag_e::SPECTRUM: return "Spectrum";
+  }
+  return "unknown";
+}
+
+/// Texts up to this long are copied into the entry instead of borrowed.
+constexpr size_t lazy_copy_limit{ 256 };
+
+/// The text of a lazy entry, and its value once decoded. Shared by the copies
+/// of the entry.
+struct ParamSet::Lazy {
+  const char *text{ nullptr };
+  std::string copy;                   //!< Owns `text`, if short.
+  std::shared_ptr<const void> owner;  //!< Keeps `text` alive, if borrowed.
+  Decoder decode{ nullptr };
+  std::once_flag once;
+  ParamSet value;  //!< The decoded entry; empty if the text was invalid.
+};
+
+void ParamSet::add_lazy(const ParamKey &key, param_tag_e tag, bool is_array, const char *text,
+                        std::shared_ptr<const void> owner, Decoder decode) {
+  auto lazy = std::make_shared<Lazy>();
+  if (owner == nullptr or std::strlen(text) <= lazy_copy_limit) {
+    lazy->copy = text;
+    lazy->text = lazy->copy.c_str();
+  } else {
+    lazy->text = text;
+    lazy->owner = std::move(owner);
+  }
+  lazy->decode = decode;
+  Entry e;
+  e.key = key;
+  e.tag = tag;
+  e.is_array = is_array;
+  e.lazy = std::move(lazy);
+  insert(std::move(e));
+}
+
+const ParamSet::Entry *ParamSet::decoded(const Entry &e) {
+  Lazy &lazy = *e.lazy;
+  // Copies of the entry may be read by several threads.
+  std::call_once(lazy.once, [&] {
+    if (lazy.decode(e.key, lazy.text, lazy.value) and lazy.value.size() == 1) {
+      const Entry &v = lazy.value.m_entries.front();
+      if (v.tag != e.tag or v.is_array != e.is_array) {
+        type_mismatch(v, e.tag, e.is_array);
+      }
+    } else {
+      lazy.value.clear();
+    }
+    // The text is not needed anymore; the document may go.
+    lazy.text = nullptr;
+    std::string{}.swap(lazy.copy);
+    lazy.owner.reset();
+  });
+  return lazy.value.empty() ? nullptr : &lazy.value.m_entries.front();
+}
+
+void ParamSet::decode_all() {
+  std::vector<Entry> entries;
+  entries.reserve(m_entries.size());
+  for (auto &e : m_entries) {
+    if (not e.lazy) {
+      entries.push_back(std::move(e));
+    } else if (const Entry *v = decoded(e)) {
+      entries.push_back(*v);
+    }
+  }
+  m_entries = std::move(entries);
+}
+
+void ParamSet::insert(Entry &&e) {
+  for (auto &old : m_entries) {
+    if (old.key == e.key) {
+      old = std::move(e);
+      return;
+    }
+  }
+  m_entries.push_back(std::move(e));
+}
+
+bool ParamSet::erase(const ParamKey &key) {
+  for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+    if (it->key == key) {
+      m_entries.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ParamSet::merge(const ParamSet &other) {
+  for (const auto &e : other.m_entries) {
+    insert(Entry{ e });
+  }
+}
+
+void ParamSet::type_mismatch(const Entry &e, param_tag_e tag, bool is_array) {
+  auto describe = [](param_tag_e t, bool array) {
+    return std::string{ array ? "an array of " : "a single " } + param_tag_name(t);
+  };
+  RT3_ERROR("ParamSet: parameter \"" + e.key.name() + "\" holds " + describe(e.tag, e.is_array)
+            + ", but was read as " + describe(tag, is_array) + ".");
+  std::abort();  // Not reached: RT3_ERROR() exits.
+}
+
+}  // namespace rt3
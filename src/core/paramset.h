@@ -1,50 +1,268 @@
 #ifndef PARAMSET_H
 #define PARAMSET_H
 
-#include <iostream>
-#include <map>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <vector>
 
-/// Pure virtual basic type. The map stores a pointer to the base class
-class ValueBase {
-public:
-  ValueBase() = default;
-  virtual ~ValueBase() = default;
+#include "error.h"
+#include "log.h"
+#include "rt3.h"
+
+namespace rt3 {
+
+/*!
+ * An interned parameter name.
+ *
+ * Every distinct name gets a small integer id the first time it is seen, so
+ * comparing two keys is an integer compare. Building a key from a string
+ * costs one hash lookup; hot call sites may keep a `static const ParamKey`.
+ */
+class ParamKey {
+ public:
+  ParamKey() = default;
+  ParamKey(const std::string &name);  // NOLINT: implicit on purpose.
+  ParamKey(const char *name);         // NOLINT: implicit on purpose.
+
+  uint32_t id() const { return m_id; }
+  /// The name this key was interned from.
+  const std::string &name() const;
+
+  bool operator==(const ParamKey &k) const { return m_id == k.m_id; }
+  bool operator!=(const ParamKey &k) const { return m_id != k.m_id; }
+
+ private:
+  uint32_t m_id{ 0 };  //!< 0 is the empty name.
+};
+
+/// Type tags of the values a `ParamSet` may hold.
+enum class param_tag_e : uint8_t {
+  BOOL = 0,
+  INT,
+  UINT,
+  REAL,
+  STRING,
+  VEC3F,
+  VEC3I,
+  NORMAL3F,
+  POINT3F,
+  POINT2I,
+  POINT2F,
+  SPECTRUM
 };
 
-/// We must convert the base class object to the proper derived class object.
-template <typename T> class Value : public ValueBase {
-private:
-  T m_value; // The stored data.
+/// Maps each supported C++ type to its tag. Unsupported types do not compile.
+template <typename T> struct ParamTag;
+#define RT3_PARAM_TAG(T, TAG) \
+  template <> struct ParamTag<T> { static constexpr param_tag_e value{ param_tag_e::TAG }; }
+RT3_PARAM_TAG(bool, BOOL);
+RT3_PARAM_TAG(int, INT);
+RT3_PARAM_TAG(unsigned int, UINT);
+RT3_PARAM_TAG(real_type, REAL);
+RT3_PARAM_TAG(std::string, STRING);
+RT3_PARAM_TAG(Vector3f, VEC3F);
+RT3_PARAM_TAG(Vector3i, VEC3I);
+RT3_PARAM_TAG(Normal3f, NORMAL3F);
+RT3_PARAM_TAG(Point3f, POINT3F);
+RT3_PARAM_TAG(Point2i, POINT2I);
+RT3_PARAM_TAG(Point2f, POINT2F);
+RT3_PARAM_TAG(Spectrum, SPECTRUM);
+#undef RT3_PARAM_TAG
 
-public:
-  /// Ctr. always requires an argument.
-  Value(T value) : m_value{value} {}
-  ~Value() override = default;
+/// Name of a tag, for messages.
+const char *param_tag_name(param_tag_e tag);
 
-  /// Copy ctr.
-  Value(const Value &src) : m_value{src.m_value} {}
+/// A borrowed, read-only view of `size()` contiguous values (C++17 has no
+/// `std::span`).
+template <typename T> class Span {
+ public:
+  constexpr Span() = default;
+  constexpr Span(const T *data, size_t size) : m_data{ data }, m_size{ size } {}
+
+  const T *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  const T &operator[](size_t i) const { return m_data[i]; }
+  const T *begin() const { return m_data; }
+  const T *end() const { return m_data + m_size; }
+
+ private:
+  const T *m_data{ nullptr };
+  size_t m_size{ 0 };
+};
 
-  /// Assignemt operator
-  Value &operator=(const Value &src) {
-    if (this != &src) {
-      m_value = src.m_value;
+/*!
+ * A heterogeneous, flat collection of named parameters.
+ *
+ * Each entry is an interned key, a type tag and the value. Small trivially
+ * copyable scalars (numbers, vectors, colors) live inside the entry itself;
+ * strings and arrays live in a block kept alive by a shared owner, so copying
+ * a `ParamSet` never copies array contents. Arrays are read back through a
+ * borrowed `Span`, with no copy and no allocation, and may also borrow memory
+ * owned by someone else (e.g. a memory-mapped file).
+ *
+ * Entries may also be *lazy* (see `add_lazy()`): the parser only records
+ * the attribute text, and the value is decoded the first time it is read.
+ * Copies of a set share the decoded value, so it is decoded once, and values
+ * nobody asks for (legacy parameters, an overridden tag, geometry out of
+ * view) are never decoded at all.
+ *
+ * Parameter sets are small (a dozen entries at most), so lookup is a linear
+ * scan comparing integer ids, which beats any tree or hash table at that size.
+ */
+class ParamSet {
+ public:
+  struct Lazy;
+  /*!
+   * Decodes `text` into a single entry of `out`, stored under `key`.
+   * Returns `false`, adding nothing, if `text` holds no valid value.
+   */
+  using Decoder = bool (*)(const ParamKey &key, const char *text, ParamSet &out);
+
+  /// A stored parameter.
+  struct Entry {
+    ParamKey key;
+    param_tag_e tag{ param_tag_e::INT };
+    bool is_array{ false };
+    bool is_inline{ false };  //!< Scalar stored in `buffer`.
+    size_t count{ 0 };        //!< 1 for scalars.
+    const void *data{ nullptr };
+    std::shared_ptr<const void> owner;  //!< Keeps `data` alive.
+    /// Set for entries of `add_lazy()`, whose value lives in there instead.
+    std::shared_ptr<Lazy> lazy;
+    alignas(8) unsigned char buffer[16];
+
+    /// Pointer to the first value.
+    const void *values() const { return is_inline ? static_cast<const void *>(buffer) : data; }
+  };
+
+  /// Stores a single value under `key`, replacing any previous entry.
+  template <typename T> void add(const ParamKey &key, const T &value) {
+    Entry e{ make_entry<T>(key, false) };
+    e.count = 1;
+    if constexpr (fits_inline<T>()) {
+      new (e.buffer) T(value);
+      e.is_inline = true;
+    } else {
+      auto block = std::make_shared<const T>(value);
+      e.data = block.get();
+      e.owner = std::move(block);
     }
-    return *this;
+    insert(std::move(e));
   }
 
-  /// Retrieve value.
-  T value() { return m_value; }
-};
+  /// Stores an array under `key`, taking over the vector's memory.
+  template <typename T> void add_array(const ParamKey &key, std::vector<T> &&values) {
+    auto block = std::make_shared<const std::vector<T>>(std::move(values));
+    add_array(key, block->data(), block->size(), block);
+  }
 
-namespace rt3 {
-// The ParamSet is just a heterogeneous hash table. All keys are strings.
-using ParamSet = std::map<std::string, std::shared_ptr<ValueBase>>;
+  /// Stores an array under `key` that borrows `n` values at `data`, which
+  /// `owner` keeps alive.
+  template <typename T>
+  void add_array(const ParamKey &key, const T *data, size_t n, std::shared_ptr<const void> owner) {
+    Entry e{ make_entry<T>(key, true) };
+    e.count = n;
+    e.data = data;
+    e.owner = std::move(owner);
+    insert(std::move(e));
+  }
+
+  /*!
+   * Stores an entry of type `tag` under `key`, whose value is decoded from
+   * `text` by `decode` the first time it is read. Long texts are borrowed,
+   * and `owner` keeps them alive until then (e.g. the XML document); short
+   * ones are copied, so they do not keep the owner alive. Without an owner,
+   * the text is always copied.
+   */
+  void add_lazy(const ParamKey &key, param_tag_e tag, bool is_array, const char *text,
+                std::shared_ptr<const void> owner, Decoder decode);
+
+  /// The scalar stored under `key`, or `nullptr` if there is none. Reading an
+  /// entry as the wrong type is an error.
+  template <typename T> const T *find(const ParamKey &key) const {
+    const Entry *e = lookup(key);
+    if (e == nullptr) return nullptr;
+    check_type(*e, ParamTag<T>::value, false);
+    if (e->lazy and (e = decoded(*e)) == nullptr) return nullptr;
+    if constexpr (fits_inline<T>()) {
+      return std::launder(reinterpret_cast<const T *>(e->values()));
+    } else {
+      return static_cast<const T *>(e->values());
+    }
+  }
+
+  /// The array stored under `key`, or an empty span if there is none.
+  template <typename T> Span<T> find_array(const ParamKey &key) const {
+    const Entry *e = lookup(key);
+    if (e == nullptr) return {};
+    check_type(*e, ParamTag<T>::value, true);
+    if (e->lazy and (e = decoded(*e)) == nullptr) return {};
+    return { static_cast<const T *>(e->data), e->count };
+  }
+
+  /// Whether there is a (valid) value under `key`; decodes a lazy one.
+  bool contains(const ParamKey &key) const {
+    const Entry *e = lookup(key);
+    return e != nullptr and (not e->lazy or decoded(*e) != nullptr);
+  }
+  /// Removes the entry under `key`; returns whether there was one.
+  bool erase(const ParamKey &key);
+  /// Copies every entry of `other` into this set, replacing entries with the
+  /// same key. Arrays are shared, not copied.
+  void merge(const ParamSet &other);
+
+  /// Decodes every lazy entry and turns it into a plain one; invalid ones go.
+  void decode_all();
+
+  /// Entries, including lazy ones that may still turn out invalid.
+  size_t size() const { return m_entries.size(); }
+  bool empty() const { return m_entries.empty(); }
+  void clear() { m_entries.clear(); }
+  /// The entries as stored; call `decode_all()` first to read their values
+  /// through `Entry::values()`.
+  const std::vector<Entry> &entries() const { return m_entries; }
+
+ private:
+  template <typename T> static constexpr bool fits_inline() {
+    return std::is_trivially_copyable_v<T> and sizeof(T) <= sizeof(Entry::buffer)
+           and alignof(T) <= alignof(Entry);
+  }
+  template <typename T> static Entry make_entry(const ParamKey &key, bool is_array) {
+    Entry e;
+    e.key = key;
+    e.tag = ParamTag<T>::value;
+    e.is_array = is_array;
+    return e;
+  }
+
+  const Entry *lookup(const ParamKey &key) const {
+    for (const auto &e : m_entries) {
+      if (e.key == key) return &e;
+    }
+    return nullptr;
+  }
+  void insert(Entry &&e);
+  /// The value of lazy entry `e`, decoded on first call; `nullptr` if invalid.
+  static const Entry *decoded(const Entry &e);
+  /// Fails with `RT3_ERROR()` unless `e` holds `tag` values (an array or not).
+  static void check_type(const Entry &e, param_tag_e tag, bool is_array) {
+    if (e.tag != tag or e.is_array != is_array) {
+      type_mismatch(e, tag, is_array);
+    }
+  }
+  [[noreturn]] static void type_mismatch(const Entry &e, param_tag_e tag, bool is_array);
+
+  std::vector<Entry> m_entries;
+};
 
 /*!
  * This is an auxiliary function to avoid the *verbose* access associated
- * with the std::map<>.
+ * with the ParamSet.
  *
  * Tries to retrieve the value associated with `key` from the ParamSet `ps`.
  * In case there is no such key/value pair stored in `ps`, the function returns
@@ -57,31 +275,35 @@ using ParamSet = std::map<std::string, std::shared_ptr<ValueBase>>;
  * or the provided default value otherwise.
  */
 template <typename T>
-T retrieve(const ParamSet &ps, const std::string &key,
-           const T &default_value = T{}) {
-  // Try to retrieve key/data item from the map.
-  auto result = ps.find(key);
-  if (result != ps.end()) {
-    const auto &[key, sptr] = *result;
-    // Alternative ways of converting generic pointer into the desired one.
-    auto rval = dynamic_cast<Value<T> &>(*sptr).value();
-    /* auto rval2 = dynamic_cast<Value<T>&>(*sptr);
-    auto rval3 = dynamic_cast<Value<T>*>(sptr.get());
-    Value<T>* rval4 = (Value<T>*)(sptr.get()); */
-
-    std::cout << "--> ParamSet: Found [\"" << key << "\"]\n";
-    // std::cout << rval<< ".\n";
-    /* std::cout << rval2.value()  << ".\n";
-    std::cout << rval3->value() << ".\n";
-    std::cout << rval4->value() << ".\n"; */
-
-    // Returns the stored value.
-    return rval;
+T retrieve(const ParamSet &ps, const ParamKey &key, const T &default_value = T{}) {
+  if (const T *value = ps.find<T>(key)) {
+    RT3_LOG_TRACE("--> ParamSet: Found [\"" << key.name() << "\"]");
+    return *value;
   }
-  std::cout << "--> ParamSet: Key [\"" << key << "\"] not present.\n";
+  RT3_LOG_TRACE("--> ParamSet: Key [\"" << key.name() << "\"] not present.");
   // Assign a default value in case type is not in the ParamSet object.
   return default_value;
 }
-} // namespace rt3
+
+/// Same as above, for arrays. This one copies the values; use
+/// `retrieve_span()` to read them in place.
+template <typename T>
+std::vector<T> retrieve(const ParamSet &ps, const ParamKey &key,
+                        const std::vector<T> &default_value) {
+  if (ps.contains(key)) {
+    Span<T> values = ps.find_array<T>(key);
+    RT3_LOG_TRACE("--> ParamSet: Found [\"" << key.name() << "\"]");
+    return std::vector<T>(values.begin(), values.end());
+  }
+  RT3_LOG_TRACE("--> ParamSet: Key [\"" << key.name() << "\"] not present.");
+  return default_value;
+}
+
+/// Borrowed view of the array stored under `key`; empty if there is none.
+/// Valid as long as `ps` (or a copy of it) is alive.
+template <typename T> Span<T> retrieve_span(const ParamSet &ps, const ParamKey &key) {
+  return ps.find_array<T>(key);
+}
+}  // namespace rt3
 
 #endif
@@ -5,7 +5,11 @@
 
 #include "parser.h"
 
+#include <charconv>
+#include <cstring>
+
 #include "api.h"
+#include "log.h"
 #include "paramset.h"
 #include "rt3.h"
 
@@ -19,7 +23,85 @@ using rt3::Vector3i;
 
 /// This is the entry function for the parsing process.
 void parse(const char *scene_file_name) {
-  tinyxml2::XMLDocument xml_doc;
+  SceneScript script;
+  const bool use_cache{API::curr_run_opt.cache_scene};
+  const std::string cache_file{scene_cache_filename(scene_file_name)};
+  if (use_cache and load_scene_cache(cache_file, scene_file_name, script)) {
+    RT3_MESSAGE("    Loaded scene cache \"" + cache_file + "\".\n");
+  } else {
+    parse_xml(scene_file_name, script);
+    if (use_cache) {
+      // The cache stores values, not text.
+      for (auto &d : script) {
+        d.ps.decode_all();
+      }
+      if (save_scene_cache(cache_file, scene_file_name, script)) {
+        RT3_MESSAGE("    Wrote scene cache \"" + cache_file + "\".\n");
+      } else {
+        RT3_WARNING("Could not write scene cache \"" + cache_file + "\".");
+      }
+    }
+  }
+  // Parameters nobody read yet still hold on to the XML document; those of
+  // each directive go once it has run.
+  run_scene(script);
+}
+
+/*!
+ * Runs the directives of a parsed scene through the API, in order. Each
+ * directive's parameters are dropped once it has run; the API keeps copies
+ * of those it needs.
+ */
+void run_scene(SceneScript &script) {
+  for (auto &d : script) {
+    switch (d.type) {
+    case directive_e::CAMERA:
+      API::camera(d.ps);
+      break;
+    case directive_e::LOOKAT:
+      API::look_at(d.ps);
+      break;
+    case directive_e::FILM:
+      API::film(d.ps);
+      break;
+    case directive_e::BACKGROUND:
+      API::background(d.ps);
+      break;
+    case directive_e::WORLD_BEGIN:
+      API::world_begin();
+      break;
+    case directive_e::WORLD_END:
+      API::world_end();
+      break;
+    case directive_e::FRAME_BEGIN:
+      API::frame_begin();
+      break;
+    case directive_e::FRAME_END:
+      API::frame_end();
+      break;
+    case directive_e::ACCELERATOR:
+      API::accelerator(d.ps);
+      break;
+    case directive_e::MATERIAL:
+      API::material(d.ps);
+      break;
+    case directive_e::OBJECT:
+      API::object(d.ps);
+      break;
+    case directive_e::SAMPLER:
+      API::sampler(d.ps);
+      break;
+    }
+    d.ps.clear();
+  }
+}
+
+/// Reads the XML scene file into `script`.
+void parse_xml(const char *scene_file_name, SceneScript &script) {
+  // Attribute values are only decoded when read, so the document lives as
+  // long as some parameter still refers to its text.
+  auto doc = std::make_shared<tinyxml2::XMLDocument>();
+  tinyxml2::XMLDocument &xml_doc = *doc;
 
   // Load file.
   if (xml_doc.LoadFile(scene_file_name) != tinyxml2::XML_SUCCESS) {
@@ -43,28 +125,44 @@ void parse(const char *scene_file_name) {
         "No \"children\" tags found inside the \"RT3\" tag. Empty scene file?");
   }
 
-  parse_tags(p_child, /* initial level */ 0);
+  parse_tags(p_child, /* initial level */ 0, script, doc);
+}
+
+/*!
+ * Reads scene tags given as text, e.g. an edit sent to the render server,
+ * into `script`. The tags need no `RT3` root. Returns `false`, leaving
+ * `script` untouched, if the text is not well-formed XML.
+ */
+bool parse_xml_text(const std::string &text, SceneScript &script) {
+  auto doc = std::make_shared<tinyxml2::XMLDocument>();
+  const std::string wrapped{"<RT3>" + text + "</RT3>"};
+  if (doc->Parse(wrapped.c_str(), wrapped.size()) != tinyxml2::XML_SUCCESS) {
+    return false;
+  }
+  SceneScript tags;
+  parse_tags(doc->FirstChildElement()->FirstChildElement(), 0, tags, doc);
+  script.insert(script.end(), std::make_move_iterator(tags.begin()),
+                std::make_move_iterator(tags.end()));
+  return true;
 }
 
 /// Main loop that handles each possible tag we may find in a RT3 scene file.
-void parse_tags(tinyxml2::XMLElement *p_element, int level) {
+void parse_tags(tinyxml2::XMLElement *p_element, int level, SceneScript &script,
+                const std::shared_ptr<const void> &doc) {
   /// Lambda expression that returns a lowercase version of the input string.
   auto csrt_lowercase = [](const char *t) -> std::string {
     std::string str{t};
     std::transform(str.begin(), str.end(), str.begin(), ::tolower);
     return str;
   };
-  // All messages sent to std::clog is for DEBUG purposes.
-  std::clog << "[parse_tags()]: level is " << level << std::endl;
+  RT3_LOG_DEBUG("[parse_tags()]: level is " << level);
 
   // Traverse all items on the children's level.
   while (p_element != nullptr) {
     // Convert the attribute name to lowecase before testing it.
     auto tag_name = csrt_lowercase(p_element->Value());
-    clog << "\n"
-         << setw(level * 3) << ""
-         << "***** Tag id is `" << tag_name << "`, at level " << level
-         << std::endl;
+    RT3_LOG_DEBUG(setw(level * 3) << "" << "***** Tag id is `" << tag_name
+                                  << "`, at level " << level);
 
     // Big switch for each possible RT3 tag type.
     if (tag_name == "camera") {
@@ -92,9 +190,8 @@ void parse_tags(tinyxml2::XMLElement *p_element, int level) {
                             // proportionally along the longer axis.
       };
 
-      parse_parameters(p_element, param_list, /* out */ &ps);
-
-      // API::camera(ps);
+      parse_parameters(p_element, param_list, /* out */ &ps, doc);
+      script.push_back({directive_e::CAMERA, std::move(ps)});
     } else if (tag_name == "background") {
       ParamSet ps;
       vector<std::pair<param_type_e, string>> param_list{
@@ -106,11 +203,17 @@ void parse_tags(tinyxml2::XMLElement *p_element, int level) {
           {param_type_e::COLOR, "tl"}, // Top-left corner
           {param_type_e::COLOR, "tr"}, // Top-right corner
           {param_type_e::COLOR, "bl"}, // Bottom-left corner
-          {param_type_e::COLOR, "br"}  // Bottom-right corner
+          {param_type_e::COLOR, "br"}, // Bottom-right corner
+          // Skybox faces, one image file each.
+          {param_type_e::STRING, "right"},  // +x
+          {param_type_e::STRING, "left"},   // -x
+          {param_type_e::STRING, "top"},    // +y
+          {param_type_e::STRING, "bottom"}, // -y
+          {param_type_e::STRING, "front"},  // +z
+          {param_type_e::STRING, "back"}    // -z
       };
-      parse_parameters(p_element, param_list, /* out */ &ps);
-
-      API::background(ps);
+      parse_parameters(p_element, param_list, /* out */ &ps, doc);
+      script.push_back({directive_e::BACKGROUND, std::move(ps)});
     } else if (tag_name == "film") {
       ParamSet ps;
       vector<std::pair<param_type_e, string>> param_list{
@@ -120,11 +223,14 @@ void parse_tags(tinyxml2::XMLElement *p_element, int level) {
           {param_type_e::INT, "x_res"},
           {param_type_e::INT, "y_res"},
           {param_type_e::ARR_REAL, "crop_window"},
-          {param_type_e::STRING, "gamma_corrected"} // bool
+          {param_type_e::STRING, "gamma_corrected"}, // bool, sRGB output
+          {param_type_e::STRING, "dither"},          // bool
+          {param_type_e::INT, "bit_depth"},          // 8 or 16
+          {param_type_e::INT, "png_compression"},     // deflate level, 0-9
+          {param_type_e::STRING, "mmap_output"}       // bool, ppm6 only
       };
-      parse_parameters(p_element, param_list, /* out */ &ps);
-
-      API::film(ps);
+      parse_parameters(p_element, param_list, /* out */ &ps, doc);
+      script.push_back({directive_e::FILM, std::move(ps)});
     } else if (tag_name == "lookat") {
       ParamSet ps;
       vector<std::pair<param_type_e, string>> param_list{
@@ -132,17 +238,66 @@ void parse_tags(tinyxml2::XMLElement *p_element, int level) {
           {param_type_e::POINT3F, "look_at"},
           {param_type_e::VEC3F, "up"}};
 
-      parse_parameters(p_element, param_list, /* out */ &ps);
-      // API::look_at(ps);
+      parse_parameters(p_element, param_list, /* out */ &ps, doc);
+      script.push_back({directive_e::LOOKAT, std::move(ps)});
+    } else if (tag_name == "accelerator") {
+      ParamSet ps;
+      vector<std::pair<param_type_e, string>> param_list{
+          {param_type_e::STRING, "type"}, // bvh, bvh4, bvh8 or wide
+          {param_type_e::INT, "max_prims_per_node"}};
+
+      parse_parameters(p_element, param_list, /* out */ &ps, doc);
+      script.push_back({directive_e::ACCELERATOR, std::move(ps)});
+    } else if (tag_name == "sampler") {
+      ParamSet ps;
+      vector<std::pair<param_type_e, string>> param_list{
+          {param_type_e::STRING, "type"}, // fixed or adaptive
+          {param_type_e::INT, "samples"},
+          {param_type_e::INT, "min_samples"},
+          {param_type_e::INT, "max_samples"},
+          {param_type_e::REAL, "threshold"}};
+
+      parse_parameters(p_element, param_list, /* out */ &ps, doc);
+      script.push_back({directive_e::SAMPLER, std::move(ps)});
+    } else if (tag_name == "material") {
+      ParamSet ps;
+      vector<std::pair<param_type_e, string>> param_list{
+          {param_type_e::STRING, "type"},
+          {param_type_e::COLOR, "color"}};
+
+      parse_parameters(p_element, param_list, /* out */ &ps, doc);
+      script.push_back({directive_e::MATERIAL, std::move(ps)});
+    } else if (tag_name == "object") {
+      ParamSet ps;
+      vector<std::pair<param_type_e, string>> param_list{
+          {param_type_e::STRING, "type"},
+          {param_type_e::STRING, "flip_normals"}, // bool
+          // Sphere.
+          {param_type_e::REAL, "radius"},
+          {param_type_e::POINT3F, "center"},
+          // Triangle mesh.
+          {param_type_e::INT, "ntriangles"},
+          {param_type_e::ARR_INT, "indices"},
+          {param_type_e::ARR_POINT3F, "vertices"},
+          {param_type_e::ARR_NORMAL3F, "normals"},
+          {param_type_e::STRING, "reverse_vertex_order"}, // bool
+          {param_type_e::STRING, "compute_normals"},      // bool
+          {param_type_e::STRING, "backface_cull"}         // bool
+      };
+
+      parse_parameters(p_element, param_list, /* out */ &ps, doc);
+      script.push_back({directive_e::OBJECT, std::move(ps)});
+    } else if (tag_name == "frame") {
+      // A frame of a sequence: the film/camera/lookat tags inside it
+      // override the scene's for that frame only.
+      script.push_back({directive_e::FRAME_BEGIN, ParamSet{}});
+      parse_tags(p_element->FirstChildElement(), level + 1, script, doc);
+      script.push_back({directive_e::FRAME_END, ParamSet{}});
     } else if (tag_name == "world_begin") {
-      // std::clog << ">>> Entering WorldBegin, at level " << level+1 <<
-      // std::endl;
       //  We should get only one `world` tag per scene file.
-      API::world_begin();
+      script.push_back({directive_e::WORLD_BEGIN, ParamSet{}});
     } else if (tag_name == "world_end") {
-      API::world_end();
-      // std::clog << ">>> Leaving WorldBegin, at level " << level+1 <<
-      // std::endl;
+      script.push_back({directive_e::WORLD_END, ParamSet{}});
     }
     // else RT3_WARNING( "Undefined tag `" + tag_name + "` found!" );
 
@@ -151,107 +306,183 @@ void parse_tags(tinyxml2::XMLElement *p_element, int level) {
   }
 }
 
+/// Records attribute `name`, whose text is `text`, as a lazy entry of type
+/// `T` (an array of them if `is_array`) that `decode` reads.
+template <typename T>
+static void add_lazy_attrib(ParamSet *ps, const string &name, bool is_array, const char *text,
+                            const std::shared_ptr<const void> &doc, ParamSet::Decoder decode) {
+  ps->add_lazy(name, ParamTag<T>::value, is_array, text, doc, decode);
+  RT3_LOG_DEBUG("\tRecorded attribute (" << name << ": " << std::strlen(text) << " chars)");
+}
+
 /// Universal parameters parser.
 /*!
  * This function receives a list of pairs <param_type, name>, traverse all the
- * attributes found in `p_element` and extract the attribute values into the
- * `ps_out` `ParamSet` object. Only named attributes found are read into the
- * `ps_out`.
+ * attributes found in `p_element` and record the attributes found into the
+ * `ps_out` `ParamSet` object. Only named attributes found are recorded.
+ *
+ * Values are not converted here: each entry keeps the attribute's text and
+ * the function that converts it, which runs the first time someone reads
+ * the value (see `ParamSet::add_lazy()`).
  *
  * @param p_element XML element we are extracting information from.
  * @param param_list List of pairs <param_type, name> we need to extract from
  * the XML element.
  * @param ps_out The `ParamSet` object we need to fill in with parameter
  * information extracted from the XML element.
+ * @param doc Owner of the XML document, which keeps long attribute texts
+ * alive until they are decoded; without one they are copied.
  */
 void parse_parameters(tinyxml2::XMLElement *p_element,
                       const vector<std::pair<param_type_e, string>> &param_list,
-                      ParamSet *ps_out) {
-  // std::clog << "parse_parameters(): p_element = " << p_element << endl;
-
+                      ParamSet *ps_out, const std::shared_ptr<const void> &doc) {
   // Traverse the list of paramters pairs: type + name.
   for (const auto &e : param_list) {
     const auto &[type, name] = e; // structured binding, requires C++ 17
-    std::clog << "---Parsing att \"" << name << "\", type = " << (int)type
-              << "\n";
+    // Attribute() returns the value of the attribute as a const char *, or
+    // nullptr if such attribute does not exist.
+    const char *text = p_element->Attribute(name.c_str());
+    if (text == nullptr) {
+      continue;
+    }
+    RT3_LOG_TRACE("---Parsing att \"" << name << "\", type = " << (int)type);
     // This is just a dispatcher to the proper extraction functions.
     switch (type) {
     // ATTENTION: We do not parse bool from the XML file because TinyXML2 cannot
-    // parse one. Bools are treated as strings. case param_type_e::BOOL:
-    // parse_single_BASIC_attrib<bool>( p_element, ps_out, name );
-    // break;
+    // parse one. Bools are treated as strings.
     case param_type_e::UINT:
-      parse_single_BASIC_attrib<unsigned int>(p_element, ps_out, name);
+      add_lazy_attrib<unsigned int>(ps_out, name, false, text, doc,
+                                    &parse_single_BASIC_attrib<unsigned int>);
       break;
     case param_type_e::INT:
-      parse_single_BASIC_attrib<int>(p_element, ps_out, name);
+      add_lazy_attrib<int>(ps_out, name, false, text, doc, &parse_single_BASIC_attrib<int>);
       break;
     case param_type_e::REAL:
-      parse_single_BASIC_attrib<real_type>(p_element, ps_out, name);
+      add_lazy_attrib<real_type>(ps_out, name, false, text, doc,
+                                 &parse_single_BASIC_attrib<real_type>);
       break;
     case param_type_e::STRING:
-      parse_single_BASIC_attrib<std::string>(p_element, ps_out, name);
+      add_lazy_attrib<std::string>(ps_out, name, false, text, doc,
+                                   &parse_single_BASIC_attrib<std::string>);
       break;
     case param_type_e::VEC3F:
-      parse_single_COMPOSITE_attrib<real_type, Vector3f>(p_element, ps_out,
-                                                         name);
+      add_lazy_attrib<Vector3f>(ps_out, name, false, text, doc,
+                                &parse_single_COMPOSITE_attrib<real_type, Vector3f>);
       break;
     case param_type_e::VEC3I:
-      parse_single_COMPOSITE_attrib<int, Vector3i>(p_element, ps_out, name);
+      add_lazy_attrib<Vector3i>(ps_out, name, false, text, doc,
+                                &parse_single_COMPOSITE_attrib<int, Vector3i>);
       break;
     case param_type_e::NORMAL3F:
-      parse_single_COMPOSITE_attrib<real_type, Normal3f>(p_element, ps_out,
-                                                         name);
+      add_lazy_attrib<Normal3f>(ps_out, name, false, text, doc,
+                                &parse_single_COMPOSITE_attrib<real_type, Normal3f>);
       break;
     case param_type_e::POINT3F:
-      parse_single_COMPOSITE_attrib<real_type, Point3f>(p_element, ps_out,
-                                                        name);
+      add_lazy_attrib<Point3f>(ps_out, name, false, text, doc,
+                               &parse_single_COMPOSITE_attrib<real_type, Point3f>);
       break;
-    // case param_type_e::POINT2I:
-    // parse_single_COMPOSITE_attrib<int, Point2i, int(2)>( p_element, ps_out,
-    // name ); break;
     case param_type_e::COLOR:
-      parse_single_COMPOSITE_attrib<real_type, ColorXYZ>(p_element, ps_out,
-                                                         name);
+      add_lazy_attrib<ColorXYZ>(ps_out, name, false, text, doc,
+                                &parse_single_COMPOSITE_attrib<real_type, ColorXYZ>);
       break;
     case param_type_e::SPECTRUM:
-      parse_single_COMPOSITE_attrib<real_type, Spectrum>(p_element, ps_out,
-                                                         name);
+      add_lazy_attrib<Spectrum>(ps_out, name, false, text, doc,
+                                &parse_single_COMPOSITE_attrib<real_type, Spectrum>);
       break;
     case param_type_e::ARR_REAL:
-      parse_array_BASIC_attrib<real_type>(p_element, ps_out, name);
+      add_lazy_attrib<real_type>(ps_out, name, true, text, doc,
+                                 &parse_array_BASIC_attrib<real_type>);
       break;
     case param_type_e::ARR_INT:
-      parse_array_BASIC_attrib<int>(p_element, ps_out, name);
+      add_lazy_attrib<int>(ps_out, name, true, text, doc, &parse_array_BASIC_attrib<int>);
       break;
     case param_type_e::ARR_VEC3F:
-      parse_array_COMPOSITE_attrib<real_type, Vector3f>(p_element, ps_out,
-                                                        name);
+      add_lazy_attrib<Vector3f>(ps_out, name, true, text, doc,
+                                &parse_array_COMPOSITE_attrib<real_type, Vector3f>);
       break;
     case param_type_e::ARR_VEC3I:
-      parse_array_COMPOSITE_attrib<int, Vector3i>(p_element, ps_out, name);
+      add_lazy_attrib<Vector3i>(ps_out, name, true, text, doc,
+                                &parse_array_COMPOSITE_attrib<int, Vector3i>);
       break;
     case param_type_e::ARR_NORMAL3F:
-      parse_array_COMPOSITE_attrib<real_type, Normal3f>(p_element, ps_out,
-                                                        name);
+      add_lazy_attrib<Normal3f>(ps_out, name, true, text, doc,
+                                &parse_array_COMPOSITE_attrib<real_type, Normal3f>);
       break;
     case param_type_e::ARR_POINT3F:
-      parse_array_COMPOSITE_attrib<real_type, Point3f>(p_element, ps_out, name);
+      add_lazy_attrib<Point3f>(ps_out, name, true, text, doc,
+                               &parse_array_COMPOSITE_attrib<real_type, Point3f>);
       break;
     case param_type_e::ARR_COLOR:
-      parse_array_COMPOSITE_attrib<real_type, ColorXYZ>(p_element, ps_out,
-                                                        name);
+      add_lazy_attrib<ColorXYZ>(ps_out, name, true, text, doc,
+                                &parse_array_COMPOSITE_attrib<real_type, ColorXYZ>);
       break;
     default:
       RT3_WARNING(string{"parse_params(): unkonwn param type received!"});
       break;
     }
-    clog << "---Done!\n";
+    RT3_LOG_TRACE("---Done!");
   }
 }
 
 //-------------------------------------------------------------------------------
 
+/// Space-separated list of `values`, for log lines.
+template <typename T> static std::string join(const vector<T> &values) {
+  std::ostringstream oss;
+  for (const auto &e : values) {
+    oss << e << " ";
+  }
+  return oss.str();
+}
+
+// === Number scanner for attribute lists, e.g. points="1 2 3 4 5 6".
+
+/// Whitespace, as far as XML attribute values go.
+static inline bool is_blank(char c) { return c == ' ' or c == '\t' or c == '\n' or c == '\r'; }
+
+/// Number of whitespace-separated tokens in `[p,end)`; an upper bound on the
+/// number of values, used to size the output once.
+static size_t count_tokens(const char *p, const char *end) {
+  size_t n{0};
+  bool in_token{false};
+  for (; p != end; ++p) {
+    bool blank = is_blank(*p);
+    n += (not blank and not in_token);
+    in_token = not blank;
+  }
+  return n;
+}
+
+/*!
+ * Reads the next value of `[p,end)` into `value` with `std::from_chars()`,
+ * advancing `p` past its token. Tokens that do not start with a number are
+ * skipped, and trailing junk in a token is ignored, which is what the old
+ * stringstream extraction did. Returns `false` when the input is over.
+ */
+template <typename T>
+static bool next_value(const char *&p, const char *end, T &value) {
+  while (true) {
+    while (p != end and is_blank(*p)) {
+      ++p;
+    }
+    if (p == end) {
+      return false;
+    }
+    // from_chars() does not take an explicit plus sign.
+    const char *first = (*p == '+') ? p + 1 : p;
+    auto [ptr, ec] = std::from_chars(first, end, value);
+    // Move on to the next token either way.
+    p = (ec == std::errc()) ? ptr : first;
+    while (p != end and not is_blank(*p)) {
+      ++p;
+    }
+    if (ec == std::errc()) {
+      return true;
+    }
+  }
+}
+
+
 /*!
  * This function parses a set of 2 or 3 basic values to form a composite
  * element. For instance, if we have in the scene file points="1 2 3 " and they
@@ -259,50 +490,29 @@ void parse_parameters(tinyxml2::XMLElement *p_element,
  * Point3f{1,2,3}.
  */
 template <typename BASIC, typename COMPOSITE>
-bool parse_single_COMPOSITE_attrib(tinyxml2::XMLElement *p_element,
-                                   rt3::ParamSet *ps, string att_key) {
-  // Attribute() returns the value of the attribute as a const char *, or
-  // nullptr if such attribute does not exist.
-  const char *att_value_cstr = p_element->Attribute(att_key.c_str());
-  // Test whether the att_key exists.
+bool parse_single_COMPOSITE_attrib(const ParamKey &att_key, const char *att_value_cstr,
+                                   rt3::ParamSet &ps) {
+  // Test whether there is a value at all.
   if (att_value_cstr) {
     // Create a temporary array to store all the BASIC data. (e.g. BASIC =
     // float) This read all the BASIC values into a single array.
-    auto result = read_array<BASIC>(p_element, att_key);
-    // Error check
-    if (not result.has_value()) {
-      RT3_ERROR(string{"parse_single_COMPOSITE_attrib(): could not read values "
-                       "for attribute \"" +
-                       att_key + "\"!"});
-    }
-
-    // Values ok, get the value inside optional.
-    vector<BASIC> values{result.value()};
+    vector<BASIC> values{read_array<BASIC>(att_value_cstr)};
     // Get array length
     auto n_basic{values.size()}; // How many?
     // Create the COMPOSITE value.
     COMPOSITE comp;
     if (n_basic == 2) {
-      comp = COMPOSITE{values[0], values[1]};
+      // Missing third component defaults to zero.
+      comp = COMPOSITE{values[0], values[1], BASIC{0}};
     } else if (n_basic == 3) {
       comp = COMPOSITE{values[0], values[1], values[2]};
     } else {
       return false; // Invalid number of basic components.
     }
 
-    // Store the vector of composites in the ParamSet object.
-    // Recall that `ps` is a dictionary, that receives a pair { key, value }.
-    (*ps)[att_key] = std::make_shared<Value<COMPOSITE>>(comp);
-    // --------------------------------------------------------------------------
-    // Show message (DEBUG only, remove it or comment it out if code is
-    // working).
-    // --------------------------------------------------------------------------
-    clog << "\tAdded attribute (" << att_key << ": \"";
-    for (const auto &e : comp) {
-      clog << e << " ";
-    }
-    clog << "\")\n";
-    // --------------------------------------------------------------------------
+    // Store the composite in the ParamSet object.
+    ps.add(att_key, comp);
+    RT3_LOG_DEBUG("\tAdded attribute (" << att_key.name() << ": \"" << comp << "\")");
 
     return true;
   }
@@ -324,74 +534,52 @@ bool parse_single_COMPOSITE_attrib(tinyxml2::XMLElement *p_element,
  * \t_param T_BASIC The basic type of the array elements we want to convert
  * from. \t_param T_COMPOSITE The composite type of the single element we want
  * to convert to. \t_param T_COMPOSITE_SIZE Number of dimensions of the
- * composite type. Default is 3. \param p_element The pointer to the XML Element
- * node. \param ps The output `ParamSet` object we need to fill in. \param
- * att_key The id of the attribute we want to read from.
+ * composite type. Default is 3. \param att_key The key the values go under.
+ * \param att_value_cstr The text of the attribute. \param ps The output
+ * `ParamSet` object we need to fill in.
  *
  * \return `true` if the parsing goes smoothly, `false` otherwise.
  */
 template <typename BASIC, typename COMPOSITE, int COMPOSITE_SIZE>
-bool parse_array_COMPOSITE_attrib(tinyxml2::XMLElement *p_element,
-                                  rt3::ParamSet *ps, string att_key) {
-  // Attribute() returns the value of the attribute as a const char *, or
-  // nullptr if such attribute does not exist.
-  const char *att_value_cstr = p_element->Attribute(att_key.c_str());
-  // Test whether the att_key exists.
+bool parse_array_COMPOSITE_attrib(const ParamKey &att_key, const char *att_value_cstr,
+                                  rt3::ParamSet &ps) {
+  // Test whether there is a value at all.
   if (att_value_cstr) {
     // [1]
-    // Create a temporary array to store all the BASIC data. (e.g. BASIC =
-    // float) This read all the BASIC values into a single array. The next step
-    // is to break it into COMPOSITE units. (e.g. COMPOSITE = Point3f)
-    auto result = read_array<BASIC>(p_element, att_key);
-    // Error check
-    if (not result.has_value()) {
-      RT3_ERROR(string{"parse_array_COMPOSITE_attrib(): could not read values "
-                       "for attribute \"" +
-                       att_key + "\"!"});
-    }
-
-    // Values ok, get the value inside optional.
-    vector<BASIC> values{result.value()};
-    // Get array length
-    auto n_basic{values.size()}; // How many?
-    // Create the vector that will hold the COMPOSITE values.
+    // Size the output once, from the number of tokens in the attribute.
+    const char *p = att_value_cstr;
+    const char *end = p + std::strlen(p);
     vector<COMPOSITE> composit_list;
+    composit_list.reserve(count_tokens(p, end) / COMPOSITE_SIZE);
 
     // [2]
-    // Fill in `composit_list` with `COMPOSITE`: every COMPOSITE_SIZE values we
-    // have a 2D or 3D coordinate. For example, if we have values = { 1, 1, 1,
-    // 2, 2, 2, 4, 4, 4, 8, 8, 8} and COMPOSITE = Vector3f, we must extract 4
-    // Vector3f: Vector3f{1,1,1}, {2,2,2}, ..., {8,8,8}.
-    for (auto i{0U}; i < n_basic / COMPOSITE_SIZE; i++) {
-      std::cout << "COMPOSITE_SIZE = " << COMPOSITE_SIZE << std::endl;
+    // Scan the values straight out of the attribute text: every
+    // COMPOSITE_SIZE values we have a 2D or 3D coordinate. For example, if we
+    // have "1 1 1 2 2 2 4 4 4 8 8 8" and COMPOSITE = Vector3f, we must extract
+    // 4 Vector3f: Vector3f{1,1,1}, {2,2,2}, ..., {8,8,8}. There is no
+    // intermediate array of BASIC values.
+    BASIC v[COMPOSITE_SIZE];
+    while (true) {
+      int k{0};
+      while (k < COMPOSITE_SIZE and next_value(p, end, v[k])) {
+        ++k;
+      }
+      if (k < COMPOSITE_SIZE) {
+        break; // End of input; an incomplete trailing group is dropped.
+      }
       // Call the proper constructor, as in Vector3f{x,y,z} or Vector2f{x,y}.
-      // If, say, COMPOSITE = Vector3f, this will call the constructor
-      // Vector3f{x,y,z}.
-      if (COMPOSITE_SIZE == 3) {
-        composit_list.push_back(
-            COMPOSITE{values[3 * i + 0], values[3 * i + 1], values[3 * i + 2]});
+      if constexpr (COMPOSITE_SIZE == 3) {
+        composit_list.emplace_back(COMPOSITE{v[0], v[1], v[2]});
       } else { // COMPOSITE_SIZE == 2
-        composit_list.push_back(
-            COMPOSITE{values[2 * i + 0], values[2 * i + 1]});
+        composit_list.emplace_back(COMPOSITE{v[0], v[1]});
       }
     }
 
     // [3]
-    // Store the vector of composites in the ParamSet object.
-    // Recall that `ps` is a dictionary, that receives a pair { key, value }.
-    (*ps)[att_key] = std::make_shared<Value<vector<COMPOSITE>>>(composit_list);
-    // --------------------------------------------------------------------------
-    // Show message (DEBUG only, remove it or comment it out if code is
-    // working).
-    // --------------------------------------------------------------------------
-    clog << "\tAdded attribute (" << att_key << ": \"";
-    for (const auto &e : composit_list) {
-      for (const auto &x : e) {
-        clog << x << " ";
-      }
-    }
-    clog << "\")\n";
-    // --------------------------------------------------------------------------
+    // Move the vector of composites into the ParamSet object (no copy).
+    RT3_LOG_DEBUG("\tAdded attribute (" << att_key.name() << ": \""
+                                         << join(composit_list) << "\")");
+    ps.add_array(att_key, std::move(composit_list));
 
     return true;
   }
@@ -399,126 +587,62 @@ bool parse_array_COMPOSITE_attrib(tinyxml2::XMLElement *p_element,
 }
 
 template <typename T>
-bool parse_array_BASIC_attrib(tinyxml2::XMLElement *p_element,
-                              rt3::ParamSet *ps, string att_key) {
-  // Attribute() returns the value of the attribute as a const char *, or
-  // nullptr if such attribute does not exist.
-  const char *att_value_cstr = p_element->Attribute(att_key.c_str());
-  // Test whether the att_key exists.
+bool parse_array_BASIC_attrib(const ParamKey &att_key, const char *att_value_cstr,
+                              rt3::ParamSet &ps) {
+  // Test whether there is a value at all.
   if (att_value_cstr) {
     // Create a temporary array to store all the T data. (e.g. T = float)
     // This read all the T values into a single array.
-    auto result = read_array<T>(p_element, att_key);
-    // Error check
-    if (not result.has_value()) {
-      RT3_ERROR(string{
-          "parse_array_BASIC_attrib(): could not read values for attribute \"" +
-          att_key + "\"!"});
-    }
-    // Values ok, get the value inside optional.
-    vector<T> values{result.value()};
-    // Store the vector of T in the ParamSet object.
-    // Recall that `ps` is a dictionary, that receives a pair { key, value }.
-    (*ps)[att_key] = std::make_shared<Value<vector<T>>>(values);
-    // --------------------------------------------------------------------------
-    // Show message (DEBUG only, remove it or comment it out if code is
-    // working).
-    // --------------------------------------------------------------------------
-    clog << "\tAdded attribute (" << att_key << ": \"";
-    for (const auto &e : values) {
-      clog << e << " ";
-    }
-    clog << "\")\n";
-    // --------------------------------------------------------------------------
+    vector<T> values{read_array<T>(att_value_cstr)};
+    // Move the vector of T into the ParamSet object (no copy).
+    RT3_LOG_DEBUG("\tAdded attribute (" << att_key.name() << ": \"" << join(values) << "\")");
+    ps.add_array(att_key, std::move(values));
 
     return true;
   }
   return false;
 }
 
-/// Parse the XML element `p_element` looking for an attribute `att_key` and
-/// extract one or more values into the `ParamSet` `ps`.
+/// Converts the text `att_value_cstr` of attribute `att_key` into a single
+/// value in the `ParamSet` `ps`.
 template <typename T>
-bool parse_single_BASIC_attrib(tinyxml2::XMLElement *p_element,
-                               rt3::ParamSet *ps, string att_key) {
-  // Test whether the att_key exists. Attribute() returns the value of the
-  // attribute, as a const char *, or nullptr if such attribute does not exist.
-  if (p_element->Attribute(att_key.c_str())) {
-    std::cout << "\tAttribute \"" << att_key
-              << "\" present, let us extract it!\n";
-    auto result = read_single_value<T>(p_element, att_key);
+bool parse_single_BASIC_attrib(const ParamKey &att_key, const char *att_value_cstr,
+                               rt3::ParamSet &ps) {
+  // Test whether there is a value at all.
+  if (att_value_cstr) {
+    RT3_LOG_TRACE("\tAttribute \"" << att_key.name() << "\" present, let us extract it!");
+    auto result = read_single_value<T>(att_value_cstr);
     if (result.has_value()) {
       // Store the BASIC value in the ParamSet object.
-      // Recall that `ps` is a dictionary, that receives a pair { key, value }.
-      // ps->operator[]( att_key ) = values;
-      (*ps)[att_key] = std::make_shared<Value<T>>(result.value());
-      // const auto [ it, success ] = ps->insert({att_key, std::make_shared<
-      // Value<T> >( values )}
-      // ); Show message
-      std::cout << "\tInsertion of \"" << att_key << "\" succeeded\n";
-      clog << "\tAdded attribute (" << att_key << ": \"" << result.value()
-           << "\" )\n";
+      ps.add(att_key, result.value());
+      RT3_LOG_DEBUG("\tAdded attribute (" << att_key.name() << ": \"" << result.value() << "\" )");
       return true;
     }
   }
   return false;
 }
 
-template <typename T>
-std::optional<std::vector<T>> read_array(tinyxml2::XMLElement *p_element,
-                                         const string &att_key) {
+template <typename T> std::vector<T> read_array(const char *value_cstr) {
   // outgoing list of values retrieved from the XML doc.
   vector<T> vec;
-  // C-style string that will store the attributes read from the XML doc.
-  const char *value_cstr{nullptr};
-  // Retrieve the string value into the `value_str` C-style string. Ex. "1 2 3"
-  p_element->QueryStringAttribute(att_key.c_str(), &value_cstr);
-
-  // If query fails, return nothing.
-  if (value_cstr == nullptr) {
-    return std::nullopt;
-  }
 
-  // ==========[ I might make this a function ]======================
-  // auto tokens = get_tokens(value_cstr);
-  // ----------------------------------------------------------------
-  // Separate individual BASIC elements as tokens.
-  string str(value_cstr);
-  std::stringstream tokenizer(str);
-  std::vector<std::string> tokens;
-  tokens.insert(tokens.begin(), std::istream_iterator<std::string>(tokenizer),
-                std::istream_iterator<std::string>());
-  //=====================================================================
-
-  // Check whether we got at least one element.
-  if (!tokens.empty()) {
-    // Convert them to T and add them to the output vector.
-    for_each(tokens.begin(), tokens.end(),
-             // Lambda expression to convert a string "value" to T (BASIC)
-             // value and then store it into a vector.
-             [&vec](const string &token) {
-               T value;
-               // =======================================================================
-               // RT3_WARNING: THIS DOES NOT WORK FOR BOOL VALUES!!!
-               // That's why we use string instead of bool in the XML file.
-               // =======================================================================
-               if (stringstream(token) >> value) {
-                 vec.push_back(value);
-               }
-             });
+  // Size the output once, then scan the values in place.
+  const char *p = value_cstr;
+  const char *end = p + std::strlen(p);
+  vec.reserve(count_tokens(p, end));
+  // =======================================================================
+  // RT3_WARNING: THIS DOES NOT WORK FOR BOOL VALUES!!!
+  // That's why we use string instead of bool in the XML file.
+  // =======================================================================
+  T value;
+  while (next_value(p, end, value)) {
+    vec.push_back(value);
   }
 
   return vec;
 }
 
-template <typename T>
-std::optional<T> read_single_value(tinyxml2::XMLElement *p_element,
-                                   const string &att_key) {
-  // C-style string that will store the attributes read from the XML doc.
-  const char *value_cstr;
-  // Retrieve the string value into the `value_str` C-style string.
-  p_element->QueryStringAttribute(att_key.c_str(), &value_cstr);
-
+template <typename T> std::optional<T> read_single_value(const char *value_cstr) {
   // Separate individual BASIC elements as tokens.
   string str{value_cstr};
   // outgoing value retrieved from the XML doc.
@@ -38,6 +38,7 @@ using std::pair;
 using std::optional;
 
 #include "paramset.h"
+#include "scene_cache.h"
 #include "error.h"
 
 namespace rt3 {
@@ -51,24 +52,26 @@ namespace rt3 {
     // };
 
     // === Support functions
+    /// All the values in the text of an attribute, e.g. "1 2 3".
     template <typename T>
-    std::optional<std::vector< T >> read_array( tinyxml2::XMLElement *, const string& );
+    std::vector< T > read_array( const char *value_cstr );
     template <typename T>
-    std::optional<T> read_single_value( tinyxml2::XMLElement *p_element, const string& att_key );
+    std::optional<T> read_single_value( const char *value_cstr );
 
+    // Decoders of attribute texts, for `ParamSet::add_lazy()`.
     /// Extracts a single COMPOSITE element.
     template < typename BASIC, typename COMPOSITE >
-    bool parse_single_COMPOSITE_attrib( tinyxml2::XMLElement *p_element, rt3::ParamSet *ps, string att_key );
+    bool parse_single_COMPOSITE_attrib( const ParamKey &att_key, const char *att_value_cstr, rt3::ParamSet &ps );
     /// Extracts an array of COMPOSITE elements.
     template < typename BASIC, typename COMPOSITE , int SIZE=3 >
-    bool parse_array_COMPOSITE_attrib( tinyxml2::XMLElement *p_element, rt3::ParamSet *ps, string att_key );
+    bool parse_array_COMPOSITE_attrib( const ParamKey &att_key, const char *att_value_cstr, rt3::ParamSet &ps );
 
     /// Extracts a single BASIC element.
     template < typename T >
-    bool parse_single_BASIC_attrib( tinyxml2::XMLElement *p_element, rt3::ParamSet *ps , string att_key );
+    bool parse_single_BASIC_attrib( const ParamKey &att_key, const char *att_value_cstr, rt3::ParamSet &ps );
     /// Extracts an array of BASIC elements.
     template < typename T >
-    bool parse_array_BASIC_attrib( tinyxml2::XMLElement *p_element, rt3::ParamSet *ps , string att_key );
+    bool parse_array_BASIC_attrib( const ParamKey &att_key, const char *att_value_cstr, rt3::ParamSet &ps );
 
     // === Enumerations
     /// Type of possible parameter types we may read from the input scene file.
@@ -94,8 +97,11 @@ namespace rt3 {
     };
     // === parsing functions.
     void parse( const char* );
-    void parse_tags(  tinyxml2::XMLElement *, int );
-    void parse_parameters( tinyxml2::XMLElement *p_element, const vector<std::pair<param_type_e, string>> &param_list, ParamSet *ps_out );
+    void parse_xml( const char*, SceneScript & );
+    bool parse_xml_text( const std::string &, SceneScript & );
+    void parse_tags(  tinyxml2::XMLElement *, int, SceneScript &, const std::shared_ptr<const void> &doc );
+    void run_scene( SceneScript & );
+    void parse_parameters( tinyxml2::XMLElement *p_element, const vector<std::pair<param_type_e, string>> &param_list, ParamSet *ps_out, const std::shared_ptr<const void> &doc = nullptr );
 
     //-------------------------------------------------------------------------------
 } // namespace RT3
@@ -0,0 +1,70 @@
+#ifndef PRIMITIVE_H
+#define PRIMITIVE_H 1
+
+#include "rt3.h"
+#include "shape.h"
+
+namespace rt3 {
+
+/*!
+ * Something a ray can hit: either a single shape with its material, or an
+ * aggregate (an acceleration structure) holding other primitives.
+ *
+ * `intersect()` finds the closest hit and shortens the (mutable) `t_max` of
+ * the ray to it, so later tests along the same ray only accept nearer hits.
+ */
+class Primitive {
+ public:
+  virtual ~Primitive() = default;
+
+  virtual Bounds3f world_bounds() const = 0;
+  virtual bool intersect(const Ray &r, Surfel *sf) const = 0;
+  /// Whether there is any hit along `r`; cheaper than `intersect()`.
+  virtual bool intersect_p(const Ray &r) const = 0;
+  /*!
+   * Closest hits for `n` rays at once: `hit[i]` and `sf[i]` are what
+   * `intersect(rays[i], &sf[i])` would give. Meant for coherent rays (e.g.
+   * neighboring camera rays), which accelerators may trace together; this
+   * default just traces them one by one.
+   */
+  virtual void intersect_packet(const Ray *rays, size_t n, Surfel *sf, bool *hit) const {
+    for (size_t i = 0; i < n; ++i) {
+      hit[i] = intersect(rays[i], &sf[i]);
+    }
+  }
+  /// Material of the surface; `nullptr` for aggregates.
+  virtual const Material *get_material() const = 0;
+};
+
+/// A shape with a material.
+class GeometricPrimitive final : public Primitive {
+ public:
+  GeometricPrimitive(const Shape *shape, const Material *material)
+      : m_shape{ shape }, m_material{ material } {}
+
+  Bounds3f world_bounds() const override { return m_shape->world_bounds(); }
+  bool intersect(const Ray &r, Surfel *sf) const override {
+    float t_hit;
+    if (not m_shape->intersect(r, &t_hit, sf)) {
+      return false;
+    }
+    r.t_max = t_hit;
+    sf->primitive = this;
+    return true;
+  }
+  bool intersect_p(const Ray &r) const override { return m_shape->intersect_p(r); }
+  const Material *get_material() const override { return m_material; }
+
+ private:
+  const Shape *m_shape;
+  const Material *m_material;
+};
+
+/// Base class of the acceleration structures.
+class AggregatePrimitive : public Primitive {
+ public:
+  const Material *get_material() const override { return nullptr; }
+};
+}  // namespace rt3
+
+#endif  // PRIMITIVE_H
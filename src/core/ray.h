@@ -0,0 +1,32 @@
+#ifndef RAY_H
+#define RAY_H 1
+
+#include <limits>
+
+#include "geometry.h"
+
+namespace rt3 {
+
+/// A semi-infinite line: `o + t*d`, for `t` in `[t_min, t_max]`.
+class Ray {
+ public:
+  Point3<float> o;  //!< Origin.
+  Vector3<float> d;  //!< Direction (not necessarily normalized).
+  float t_min{ 0.f };
+  /// Mutable, so intersection routines can shorten a `const Ray`.
+  mutable float t_max{ std::numeric_limits<float>::infinity() };
+
+  Ray() = default;
+  Ray(const Point3<float> &o,
+      const Vector3<float> &d,
+      float t_min = 0.f,
+      float t_max = std::numeric_limits<float>::infinity())
+      : o{ o }, d{ d }, t_min{ t_min }, t_max{ t_max } {}
+
+  /// Point along the ray at parameter `t`.
+  Point3<float> operator()(float t) const { return o + d * t; }
+};
+
+}  // namespace rt3
+
+#endif  // RAY_H
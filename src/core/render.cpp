@@ -0,0 +1,463 @@
+#include "render.h"
+#include "material.h"
+#include "memory.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+namespace rt3 {
+
+/// Flat shading: pixels whose camera ray hit a surface take its material's
+/// color, the others keep the background sample already in `out`.
+static void shade_hits(const bool *hit, const Surfel *sf, size_t n, Spectrum *out) {
+  for (size_t i{ 0 }; i < n; ++i) {
+    if (hit[i]) {
+      out[i] = sf[i].primitive->get_material()->flat_color();
+    }
+  }
+}
+
+/*!
+ * The tile loops below are templates over the scene's configuration: `Bkg`
+ * is the concrete class of the background (the base class for an unknown
+ * one), `Directional` tells whether it is looked up by ray direction and
+ * `HasGeometry` whether there is anything to intersect. `select_kernels()`
+ * instantiates them for the scene once per render call, so the loops have
+ * no branches on the configuration, and calls on the (`final`) background
+ * classes are direct, inlined for color backgrounds.
+ */
+
+/// Renders all pixels of a single tile, one scanline span at a time.
+template <typename Bkg, bool Directional, bool HasGeometry>
+static void render_tile(const Tile &tile, Film &film, const Scene &scene, const Camera &camera) {
+  auto res = film.get_resolution();
+  const float inv_w{ 1.f / float(res[0]) };
+  const float inv_h{ 1.f / float(res[1]) };
+  Spectrum span[Film::default_tile_size];
+  const size_t n = size_t(tile.x1 - tile.x0);
+  const size_t n_pixels = n * size_t(tile.y1 - tile.y0);
+
+  // The whole tile goes through the accelerator as one batch of rays. They
+  // live in the scratch arena, which the caller resets after the tile.
+  // Backgrounds looked up by direction need the rays too.
+  const Bkg &bkg = static_cast<const Bkg &>(scene.background());
+  [[maybe_unused]] Ray *rays{ nullptr };
+  [[maybe_unused]] const bool *hit{ nullptr };
+  [[maybe_unused]] const Surfel *sf{ nullptr };
+  if constexpr (HasGeometry or Directional) {
+    MemoryArena &arena = scratch_arena();
+    rays = arena.alloc_array<Ray>(n_pixels);
+    camera.generate_tile(tile, rays);
+    if constexpr (HasGeometry) {
+      Surfel *surfels = arena.alloc_array<Surfel>(n_pixels);
+      bool *hits = arena.alloc_array<bool>(n_pixels);
+      scene.intersect_packet(rays, n_pixels, surfels, hits);
+      hit = hits;
+      sf = surfels;
+    }
+  }
+
+  for (int y{ tile.y0 }; y < tile.y1; ++y) {
+    const size_t row = size_t(y - tile.y0) * n;
+    if constexpr (Directional) {
+      bkg.sample_rays(rays + row, n, span);
+    } else {
+      // Sample at the pixel centers.
+      float v = (float(y) + 0.5f) * inv_h;
+      float u0 = (float(tile.x0) + 0.5f) * inv_w;
+      bkg.sample_span(v, u0, inv_w, n, span);
+    }
+    if constexpr (HasGeometry) {
+      shade_hits(hit + row, sf + row, n, span);
+    }
+    film.add_span(tile.x0, y, n, span);
+  }
+}
+
+/*!
+ * Colors of `n` camera samples at raster positions `pos`, whose rays are
+ * `rays`: the background, then the surfaces the rays hit. Temporaries go to
+ * the scratch arena.
+ */
+template <typename Bkg, bool Directional, bool HasGeometry>
+static void shade_samples(const Scene &scene, const Point2f &inv_res, const Point2f *pos,
+                          const Ray *rays, size_t n, Spectrum *out) {
+  const Bkg &bkg = static_cast<const Bkg &>(scene.background());
+  if constexpr (Directional) {
+    bkg.sample_rays(rays, n, out);
+  } else {
+    for (size_t i{ 0 }; i < n; ++i) {
+      out[i] = bkg.sampleXYZ(Point2f{ pos[i].x * inv_res.x, pos[i].y * inv_res.y });
+    }
+  }
+  if constexpr (HasGeometry) {
+    MemoryArena &arena = scratch_arena();
+    Surfel *sf = arena.alloc_array<Surfel>(n);
+    bool *hit = arena.alloc_array<bool>(n);
+    scene.intersect_packet(rays, n, sf, hit);
+    shade_hits(hit, sf, n, out);
+  }
+}
+
+/// Largest difference, over the channels, between two colors.
+static float contrast(const Spectrum &a, const Spectrum &b) {
+  return std::max({ std::abs(a[0] - b[0]), std::abs(a[1] - b[1]), std::abs(a[2] - b[2]) });
+}
+
+/*!
+ * Renders a tile with more than one sample per pixel, as `sampler` says.
+ * Returns how many samples went into the film.
+ */
+template <typename Bkg, bool Directional, bool HasGeometry>
+static size_t render_tile_sampled(const Tile &tile, Film &film, const Scene &scene,
+                                  const Camera &camera, const Sampler &sampler) {
+  auto res = film.get_resolution();
+  const Point2f inv_res{ 1.f / float(res[0]), 1.f / float(res[1]) };
+  const int w{ tile.x1 - tile.x0 };
+  const int h{ tile.y1 - tile.y0 };
+  const size_t n_pixels = size_t(w) * size_t(h);
+  MemoryArena &arena = scratch_arena();
+
+  // First pass: the pixel centers. The adaptive sampler also needs the ring
+  // of pixels around the tile (inside the image) for its contrast test, so
+  // edges that run along tile borders are seen from both sides.
+  const int apron{ sampler.adaptive() ? 1 : 0 };
+  const int ax0{ std::max(tile.x0 - apron, 0) };
+  const int ay0{ std::max(tile.y0 - apron, 0) };
+  const int ax1{ std::min(tile.x1 + apron, res[0]) };
+  const int ay1{ std::min(tile.y1 + apron, res[1]) };
+  const size_t aw = size_t(ax1 - ax0);
+  const size_t n_first = aw * size_t(ay1 - ay0);
+  Spectrum *first = arena.alloc_array<Spectrum>(n_first);
+  const Bkg &bkg = static_cast<const Bkg &>(scene.background());
+  Ray *rays{ nullptr };
+  if constexpr (HasGeometry or Directional) {
+    rays = arena.alloc_array<Ray>(n_first);
+    for (int y{ ay0 }; y < ay1; ++y) {
+      camera.generate_span(float(ax0) + 0.5f, float(y) + 0.5f, 1.f, aw, rays + size_t(y - ay0) * aw);
+    }
+  }
+  for (int y{ ay0 }; y < ay1; ++y) {
+    Spectrum *row = first + size_t(y - ay0) * aw;
+    if constexpr (Directional) {
+      bkg.sample_rays(rays + size_t(y - ay0) * aw, aw, row);
+    } else {
+      bkg.sample_span((float(y) + 0.5f) * inv_res.y, (float(ax0) + 0.5f) * inv_res.x, inv_res.x, aw,
+                      row);
+    }
+  }
+  if constexpr (HasGeometry) {
+    Surfel *sf = arena.alloc_array<Surfel>(n_first);
+    bool *hit = arena.alloc_array<bool>(n_first);
+    scene.intersect_packet(rays, n_first, sf, hit);
+    shade_hits(hit, sf, n_first, first);
+  }
+  // Neighbors outside the image are the pixel itself.
+  auto first_at = [&](int x, int y) -> const Spectrum & {
+    return first[size_t(std::clamp(y, ay0, ay1 - 1) - ay0) * aw
+                 + size_t(std::clamp(x, ax0, ax1 - 1) - ax0)];
+  };
+
+  // Pixels (as tile-relative indices `j * w + i`) that need more samples.
+  uint32_t *active = arena.alloc_array<uint32_t>(n_pixels);
+  size_t n_active{ 0 };
+  for (int j{ 0 }; j < h; ++j) {
+    for (int i{ 0 }; i < w; ++i) {
+      const int x{ tile.x0 + i }, y{ tile.y0 + j };
+      film.add_tracked_sample(x, y, first_at(x, y));
+      bool more{ not sampler.adaptive() };
+      for (int dy{ -1 }; dy <= 1 and not more; ++dy) {
+        for (int dx{ -1 }; dx <= 1 and not more; ++dx) {
+          more = contrast(first_at(x, y), first_at(x + dx, y + dy)) > sampler.threshold();
+        }
+      }
+      if (more) {
+        active[n_active++] = uint32_t(j * w + i);
+      }
+    }
+  }
+
+  // The tile may spend `samples` per pixel; converged pixels leave theirs
+  // to the noisy ones. The fixed sampler takes all of them in one round.
+  size_t budget{ size_t(sampler.samples()) * n_pixels - n_pixels };
+  size_t n_samples{ n_pixels };
+  int batch{ (sampler.adaptive() ? sampler.min_samples() : sampler.samples()) - 1 };
+  while (n_active > 0 and budget > 0) {
+    const size_t share = budget / n_active;
+    if (share == 0) {
+      break;
+    }
+    size_t n_round{ 0 };
+    for (size_t a{ 0 }; a < n_active; ++a) {
+      const int i = int(active[a] % uint32_t(w)), j = int(active[a] / uint32_t(w));
+      const int taken = int(film.tracked_samples(tile.x0 + i, tile.y0 + j));
+      n_round += std::min({ size_t(batch), size_t(sampler.max_samples() - taken), share });
+    }
+    // Samples of a pixel are consecutive, so `sample_rays()` sees them as
+    // close together.
+    Point2f *pos = arena.alloc_array<Point2f>(n_round);
+    rays = arena.alloc_array<Ray>(n_round);
+    uint32_t *round_px = arena.alloc_array<uint32_t>(n_round);
+    Spectrum *colors = arena.alloc_array<Spectrum>(n_round);
+    size_t k{ 0 };
+    for (size_t a{ 0 }; a < n_active; ++a) {
+      const int i = int(active[a] % uint32_t(w)), j = int(active[a] / uint32_t(w));
+      const int taken = int(film.tracked_samples(tile.x0 + i, tile.y0 + j));
+      const int n_px = int(std::min({ size_t(batch), size_t(sampler.max_samples() - taken), share }));
+      for (int s{ 0 }; s < n_px; ++s, ++k) {
+        const Point2f o = Sampler::offset(taken + s);
+        pos[k] = Point2f{ float(tile.x0 + i) + o.x, float(tile.y0 + j) + o.y };
+        new (rays + k) Ray{ camera.generate_ray(pos[k].x, pos[k].y) };
+        round_px[k] = active[a];
+      }
+    }
+    shade_samples<Bkg, Directional, HasGeometry>(scene, inv_res, pos, rays, n_round, colors);
+    for (k = 0; k < n_round; ++k) {
+      film.add_tracked_sample(tile.x0 + int(round_px[k] % uint32_t(w)),
+                              tile.y0 + int(round_px[k] / uint32_t(w)), colors[k]);
+    }
+    budget -= n_round;
+    n_samples += n_round;
+    if (not sampler.adaptive()) {
+      break;
+    }
+
+    // Pixels whose mean is known well enough, or that are at the cap, stop.
+    size_t kept{ 0 };
+    for (size_t a{ 0 }; a < n_active; ++a) {
+      const int x = tile.x0 + int(active[a] % uint32_t(w));
+      const int y = tile.y0 + int(active[a] / uint32_t(w));
+      const uint32_t taken = film.tracked_samples(x, y);
+      const float std_error = std::sqrt(film.sample_variance(x, y) / float(taken));
+      if (int(taken) < sampler.max_samples() and std_error > sampler.threshold()) {
+        active[kept++] = active[a];
+      }
+    }
+    n_active = kept;
+    batch = sampler.min_samples();
+  }
+  return n_samples;
+}
+
+/*!
+ * One refinement pass over a tile, with blocks of `block` pixels. Unless
+ * this is the first pass, blocks whose corner lies on the previous (twice
+ * coarser) grid already hold the right sample and are skipped.
+ */
+template <typename Bkg, bool Directional, bool HasGeometry>
+static void refine_tile(const Tile &tile, int block, bool first_pass, Film &film,
+                        const Scene &scene, const Camera &camera) {
+  auto res = film.get_resolution();
+  const float inv_w{ 1.f / float(res[0]) };
+  const float inv_h{ 1.f / float(res[1]) };
+  Spectrum samples[Film::default_tile_size];
+  // Passes trace a row of block corners at a time.
+  [[maybe_unused]] Ray rays[Film::default_tile_size];
+  [[maybe_unused]] Surfel sf[Film::default_tile_size];
+  [[maybe_unused]] bool hit[Film::default_tile_size];
+  const Bkg &bkg = static_cast<const Bkg &>(scene.background());
+  for (int ry{ 0 }; tile.y0 + ry < tile.y1; ry += block) {
+    const bool coarse_row = not first_pass and ry % (2 * block) == 0;
+    const int rx0 = coarse_row ? block : 0;
+    const int step = coarse_row ? 2 * block : block;
+    if (tile.x0 + rx0 >= tile.x1) {
+      continue;
+    }
+    const size_t n = size_t((tile.x1 - tile.x0 - rx0 + step - 1) / step);
+    const int y = tile.y0 + ry;
+    float v = (float(y) + 0.5f) * inv_h;
+    float u0 = (float(tile.x0 + rx0) + 0.5f) * inv_w;
+    if constexpr (HasGeometry or Directional) {
+      camera.generate_span(float(tile.x0 + rx0) + 0.5f, float(y) + 0.5f, float(step), n, rays);
+    }
+    if constexpr (Directional) {
+      bkg.sample_rays(rays, n, samples);
+    } else {
+      bkg.sample_span(v, u0, float(step) * inv_w, n, samples);
+    }
+    if constexpr (HasGeometry) {
+      scene.intersect_packet(rays, n, sf, hit);
+      shade_hits(hit, sf, n, samples);
+    }
+    for (size_t i{ 0 }; i < n; ++i) {
+      int x = tile.x0 + rx0 + int(i) * step;
+      film.fill_block(x, y, std::min(x + block, tile.x1), std::min(y + block, tile.y1), samples[i]);
+    }
+  }
+}
+
+/// The tile loops, instantiated for one configuration of the scene.
+struct TileKernels {
+  void (*render_tile)(const Tile &, Film &, const Scene &, const Camera &);
+  size_t (*render_tile_sampled)(const Tile &, Film &, const Scene &, const Camera &,
+                                const Sampler &);
+  void (*refine_tile)(const Tile &, int, bool, Film &, const Scene &, const Camera &);
+};
+
+template <typename Bkg, bool Directional, bool HasGeometry> static TileKernels kernels_for() {
+  return TileKernels{ &render_tile<Bkg, Directional, HasGeometry>,
+                      &render_tile_sampled<Bkg, Directional, HasGeometry>,
+                      &refine_tile<Bkg, Directional, HasGeometry> };
+}
+
+template <bool HasGeometry> static TileKernels kernels_for(const Background &bkg) {
+  const bool spherical{ bkg.mapping_type == Background::mapping_t::spherical };
+  if (dynamic_cast<const BackgroundColor *>(&bkg) and not spherical) {
+    return kernels_for<BackgroundColor, false, HasGeometry>();
+  }
+  if (dynamic_cast<const BackgroundSphereImage *>(&bkg)) {
+    return spherical ? kernels_for<BackgroundSphereImage, true, HasGeometry>()
+                     : kernels_for<BackgroundSphereImage, false, HasGeometry>();
+  }
+  if (dynamic_cast<const BackgroundSkyBoxImage *>(&bkg) and spherical) {
+    return kernels_for<BackgroundSkyBoxImage, true, HasGeometry>();
+  }
+  // Any other background goes through its virtual functions.
+  return spherical ? kernels_for<Background, true, HasGeometry>()
+                   : kernels_for<Background, false, HasGeometry>();
+}
+
+/// Picks the tile loops that match `scene`.
+static TileKernels select_kernels(const Scene &scene) {
+  return scene.has_geometry() ? kernels_for<true>(scene.background())
+                              : kernels_for<false>(scene.background());
+}
+
+RenderReport render_progressive(Film &film,
+                                const Scene &scene,
+                                const Camera &camera,
+                                ThreadPool &pool,
+                                double time_budget_ms) {
+  using clock = std::chrono::steady_clock;
+  const std::vector<Tile> tiles{ film.tiles() };
+  std::vector<double> tile_ms(tiles.size(), 0.0);
+  const auto start = clock::now();
+  std::atomic<bool> out_of_time{ false };
+  const TileKernels kernels{ select_kernels(scene) };
+
+  RenderReport report;
+  report.n_passes = 0;
+  for (int block{ Film::default_tile_size }; block >= 1 and not out_of_time; block /= 2) {
+    const bool first_pass{ block == Film::default_tile_size };
+    pool.parallel_for(tiles.size(), [&](size_t i) {
+      // The first pass always completes, so the preview covers the frame.
+      if (not first_pass and time_budget_ms > 0) {
+        if (out_of_time.load(std::memory_order_relaxed)
+            or std::chrono::duration<double, std::milli>(clock::now() - start).count()
+                 > time_budget_ms) {
+          out_of_time = true;
+          return;
+        }
+      }
+      auto tile_start = clock::now();
+      {
+        ScopedTimer timer{ phase_e::RENDER, "refine tile", tiles[i].x0, tiles[i].y0 };
+        kernels.refine_tile(tiles[i], block, first_pass, film, scene, camera);
+      }
+      stats_add(counter_e::TILES);
+      scratch_arena().reset();
+      tile_ms[i] += std::chrono::duration<double, std::milli>(clock::now() - tile_start).count();
+    });
+    ++report.n_passes;
+    if (first_pass and block > 1) {
+      ScopedTimer timer{ phase_e::WRITE, "preview" };
+      film.write_image(&pool);
+      RT3_MESSAGE("    Preview written to \"" + film.m_filename + "\" after "
+                  + std::to_string(
+                    std::chrono::duration<double, std::milli>(clock::now() - start).count())
+                  + " ms.\n");
+    }
+  }
+
+  report.out_of_time = out_of_time;
+  report.n_tiles = tiles.size();
+  report.n_threads = pool.size();
+  for (auto t : tile_ms) {
+    stats_record_tile(t);
+  }
+  if (not tile_ms.empty()) {
+    auto [min_it, max_it] = std::minmax_element(tile_ms.begin(), tile_ms.end());
+    report.tile_ms_min = *min_it;
+    report.tile_ms_max = *max_it;
+    double sum{ 0 };
+    for (auto t : tile_ms) {
+      sum += t;
+    }
+    report.tile_ms_avg = sum / double(tile_ms.size());
+  }
+  return report;
+}
+
+RenderReport render(Film &film,
+                    const Scene &scene,
+                    const Camera &camera,
+                    const Sampler &sampler,
+                    ThreadPool &pool) {
+  return render(film, scene, camera, sampler, pool, film.tiles());
+}
+
+RenderReport render(Film &film,
+                    const Scene &scene,
+                    const Camera &camera,
+                    const Sampler &sampler,
+                    ThreadPool &pool,
+                    const std::vector<Tile> &tiles,
+                    const std::function<void(const Tile &)> &on_tile_done) {
+  // Each tile writes only its own slot, so no synchronization is needed.
+  std::vector<double> tile_ms(tiles.size(), 0.0);
+  std::vector<size_t> tile_samples(tiles.size(), 0);
+  if (not sampler.single_sample()) {
+    film.track_variance();
+  }
+  const TileKernels kernels{ select_kernels(scene) };
+
+  pool.parallel_for(tiles.size(), [&](size_t i) {
+    auto start = std::chrono::steady_clock::now();
+    {
+      ScopedTimer timer{ phase_e::RENDER, "tile", tiles[i].x0, tiles[i].y0 };
+      if (sampler.single_sample()) {
+        kernels.render_tile(tiles[i], film, scene, camera);
+        tile_samples[i] = size_t(tiles[i].x1 - tiles[i].x0) * size_t(tiles[i].y1 - tiles[i].y0);
+      } else {
+        tile_samples[i] = kernels.render_tile_sampled(tiles[i], film, scene, camera, sampler);
+      }
+      // Tile temporaries die with the tile; the arena keeps its memory.
+      scratch_arena().reset();
+      // Resolving and encoding the band, if this was its last tile, count
+      // as such, not as rendering.
+      film.tile_done(tiles[i]);
+      if (on_tile_done) {
+        on_tile_done(tiles[i]);
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    tile_ms[i] = std::chrono::duration<double, std::milli>(end - start).count();
+    stats_add(counter_e::TILES);
+    stats_add(counter_e::SAMPLES, tile_samples[i]);
+    stats_record_tile(tile_ms[i]);
+  });
+
+  RenderReport report;
+  report.n_tiles = tiles.size();
+  report.n_threads = pool.size();
+  for (size_t i{ 0 }; i < tiles.size(); ++i) {
+    report.n_pixels += size_t(tiles[i].x1 - tiles[i].x0) * size_t(tiles[i].y1 - tiles[i].y0);
+    report.n_samples += tile_samples[i];
+  }
+  if (not tile_ms.empty()) {
+    auto [min_it, max_it] = std::minmax_element(tile_ms.begin(), tile_ms.end());
+    report.tile_ms_min = *min_it;
+    report.tile_ms_max = *max_it;
+    double sum{ 0 };
+    for (auto t : tile_ms) {
+      sum += t;
+    }
+    report.tile_ms_avg = sum / double(tile_ms.size());
+  }
+  return report;
+}
+
+}  // namespace rt3
@@ -0,0 +1,90 @@
+#ifndef RENDER_H
+#define RENDER_H 1
+
+#include <functional>
+
+#include "camera.h"
+#include "film.h"
+#include "sampler.h"
+#include "scene.h"
+#include "thread_pool.h"
+
+namespace rt3 {
+
+/// Summary of a render loop run, reported by `API::world_end()`.
+struct RenderReport {
+  size_t n_tiles{ 0 };      //!< How many tiles were rendered.
+  size_t n_threads{ 0 };    //!< How many workers were available.
+  double tile_ms_min{ 0 };  //!< Fastest tile, in milliseconds.
+  double tile_ms_avg{ 0 };  //!< Average tile time, in milliseconds.
+  double tile_ms_max{ 0 };  //!< Slowest tile, in milliseconds.
+  int n_passes{ 1 };        //!< Refinement passes run (progressive mode).
+  size_t n_pixels{ 0 };     //!< Pixels rendered.
+  size_t n_samples{ 0 };    //!< Camera samples that went into them.
+  bool out_of_time{ false };  //!< The time budget stopped the refinement early.
+};
+
+/*!
+ * The ray tracer's main loop.
+ *
+ * The film is split into tiles, which are handed over to the worker pool.
+ * Workers that run out of tiles steal from the others, so a few expensive
+ * tiles do not leave the remaining cores idle.
+ *
+ * The camera rays of a tile are generated and traced as one batch, so the
+ * accelerator can take them through the tree together. Surfaces are flat
+ * shaded with their material's color; rays that hit nothing take the
+ * background's color.
+ *
+ * With more than one sample per pixel, each tile first traces the pixel
+ * centers and then further samples in rounds, as the sampler decides; the
+ * film keeps every pixel's running variance for the adaptive sampler.
+ *
+ * @param film The film that receives the samples.
+ * @param scene The geometry and the background.
+ * @param camera Where the rays come from.
+ * @param sampler How many samples each pixel gets.
+ * @param pool The persistent worker pool.
+ * @return Per-tile timing and sample counts.
+ */
+RenderReport render(Film &film,
+                    const Scene &scene,
+                    const Camera &camera,
+                    const Sampler &sampler,
+                    ThreadPool &pool);
+
+/// Same as `render()`, for some of the film's tiles only (e.g. the lease a
+/// distributed worker was handed). The tiles must lie on the grid of
+/// `film.tiles()`. If given, `on_tile_done` is called by the worker that
+/// finished each tile, right after `film.tile_done()`.
+RenderReport render(Film &film,
+                    const Scene &scene,
+                    const Camera &camera,
+                    const Sampler &sampler,
+                    ThreadPool &pool,
+                    const std::vector<Tile> &tiles,
+                    const std::function<void(const Tile &)> &on_tile_done = {});
+
+/*!
+ * Progressive version of `render()`, used by `--quick`.
+ *
+ * The first pass takes one sample per tile and fills the whole tile with it;
+ * that coarse image is written right away as a preview. Every further pass
+ * halves the block size, sampling the top-left pixel of each new block (the
+ * pixels sampled by earlier passes are skipped) and filling the block with
+ * it, until blocks are single pixels. Passes overwrite the film instead of
+ * accumulating, so the last pass leaves exactly one sample per pixel
+ * whatever the scene's sampler says.
+ *
+ * @param time_budget_ms Wall time after which no more tiles are refined; the
+ *        image keeps the coarser blocks there. `0` means no limit.
+ */
+RenderReport render_progressive(Film &film,
+                                const Scene &scene,
+                                const Camera &camera,
+                                ThreadPool &pool,
+                                double time_budget_ms);
+
+}  // namespace rt3
+
+#endif  // RENDER_H
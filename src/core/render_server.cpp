@@ -0,0 +1,218 @@
+#include "render_server.h"
+#include "bounded_queue.h"
+#include "net.h"
+#include "parser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace rt3 {
+
+#if defined(RT3_HAS_SOCKETS)
+namespace {
+
+// Messages are framed as `net.h` says.
+enum class message_e : uint32_t {
+  EDIT = 1,  //!< Client to server: scene tags to apply (XML text).
+  QUIT,      //!< Client to server: shut down.
+  FRAME,     //!< Server to client: film size, crop window, sample size, #tiles.
+  TILE,      //!< Server to client: tile rectangle and resolved samples.
+  DONE,      //!< Server to client: render time, samples, parts rebuilt.
+  ERROR      //!< Server to client: the edit was rejected.
+};
+/// Larger edits are refused; geometry cannot be edited anyway.
+constexpr uint64_t max_edit_bytes{ uint64_t(1) << 24 };
+/// Resolved tiles waiting for the socket. Workers that get this far ahead
+/// of a slow client wait for it.
+constexpr size_t max_tiles_queued{ 64 };
+/// A client may think for as long as it likes between edits, but one that
+/// stalls in the middle of a message is dropped after this.
+constexpr int recv_timeout_s{ 30 };
+/// A client that takes longer than this to read a message is dropped too;
+/// the render goes on without it.
+constexpr int send_timeout_ms{ 30000 };
+/// `accept()` failures (e.g. out of file descriptors) are retried after a
+/// pause that doubles up to a second; after this many in a row, the server
+/// gives up.
+constexpr int max_accept_failures{ 120 };
+
+}  // namespace
+
+RenderServer::RenderServer(int port) : m_listen_fd{ net::listen_on(port) } {
+  if (m_listen_fd < 0) {
+    RT3_WARNING("Could not listen on port " + std::to_string(port) + ".");
+    return;
+  }
+  RT3_MESSAGE("    Render server listening on port " + std::to_string(port) + ".\n");
+}
+
+RenderServer::~RenderServer() {
+  drop_client();
+  net::close_socket(m_listen_fd);
+}
+
+void RenderServer::drop_client() {
+  net::close_socket(m_client_fd);
+  m_client_fd = -1;
+}
+
+bool RenderServer::next_edit(SceneScript &script) {
+  int n_failures{ 0 };
+  while (ok()) {
+    if (m_client_fd < 0) {
+      m_client_fd = net::accept_on(m_listen_fd);
+      if (m_client_fd < 0) {
+        if (++n_failures == max_accept_failures) {
+          RT3_WARNING("Could not accept connections; shutting the server down.");
+          return false;
+        }
+        const int pause_ms{ std::min(1000, 10 << std::min(n_failures, 7)) };
+        std::this_thread::sleep_for(std::chrono::milliseconds(pause_ms));
+        continue;
+      }
+      n_failures = 0;
+      net::tune_socket(m_client_fd, recv_timeout_s);
+      RT3_MESSAGE("    Client connected.\n");
+    }
+    uint32_t type{ 0 };
+    std::vector<unsigned char> payload;
+    // The timeout only starts once the next message does.
+    if (not net::wait_readable(m_client_fd, -1)
+        or not net::recv_message(m_client_fd, type, payload, max_edit_bytes)) {
+      RT3_MESSAGE("    Client disconnected.\n");
+      drop_client();
+      continue;
+    }
+    if (message_e(type) == message_e::QUIT) {
+      return false;
+    }
+    net::Decoder d{ payload };
+    const std::string text{ d.blob() };
+    if (message_e(type) != message_e::EDIT or not d.ok()) {
+      send_error("unexpected message");
+      continue;
+    }
+    if (not parse_xml_text(text, script)) {
+      send_error("the edit is not well-formed XML");
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+RenderReport RenderServer::render(Film &film,
+                                  const Scene &scene,
+                                  const Camera &camera,
+                                  const Sampler &sampler,
+                                  ThreadPool &pool) {
+  const std::vector<Tile> tiles{ film.tiles() };
+  const size_t bytes{ size_t(film.m_resolver.bytes_per_sample()) };
+  net::Encoder frame;
+  frame.i32(film.m_full_resolution[0]);
+  frame.i32(film.m_full_resolution[1]);
+  frame.i32(film.m_crop.p_min.x);
+  frame.i32(film.m_crop.p_min.y);
+  frame.i32(film.m_crop.p_max.x);
+  frame.i32(film.m_crop.p_max.y);
+  frame.u32(uint32_t(bytes));
+  frame.u32(uint32_t(tiles.size()));
+  std::atomic<bool> connected{ net::send_message(m_client_fd, uint32_t(message_e::FRAME),
+                                                 frame.data(), send_timeout_ms) };
+
+  // Workers resolve their own tiles; a thread of its own does the sending,
+  // so a slow link does not hold up the render until the queue fills.
+  BoundedQueue<std::vector<unsigned char>> outgoing{ max_tiles_queued };
+  std::thread sender{ [&]() {
+    while (auto msg = outgoing.pop()) {
+      // After a failure the rest is drained, unsent, so no worker blocks.
+      if (connected
+          and not net::send_message(m_client_fd, uint32_t(message_e::TILE), *msg,
+                                    send_timeout_ms)) {
+        connected = false;
+      }
+    }
+  } };
+  auto on_tile_done = [&](const Tile &tile) {
+    if (not connected) {
+      return;  // Nobody to send it to.
+    }
+    net::Encoder msg;
+    msg.i32(tile.x0);
+    msg.i32(tile.y0);
+    msg.i32(tile.x1);
+    msg.i32(tile.y1);
+    std::vector<unsigned char> &out = msg.data();
+    const size_t header{ out.size() };
+    out.resize(header + 3 * bytes * size_t(tile.x1 - tile.x0) * size_t(tile.y1 - tile.y0));
+    film.resolve_tile(tile, out.data() + header);
+    outgoing.push(std::move(out));
+  };
+  RenderReport report{ rt3::render(film, scene, camera, sampler, pool, tiles, on_tile_done) };
+  outgoing.close();
+  sender.join();
+  if (not connected) {
+    RT3_MESSAGE("    Client disconnected.\n");
+    drop_client();
+  }
+  return report;
+}
+
+void RenderServer::send_done(double render_ms, const RenderReport &report,
+                             const std::string &rebuilt) {
+  if (m_client_fd < 0) {
+    return;
+  }
+  net::Encoder msg;
+  msg.u64(uint64_t(render_ms * 1000.0));
+  msg.u64(report.n_samples);
+  msg.blob(rebuilt);
+  if (not net::send_message(m_client_fd, uint32_t(message_e::DONE), msg.data(),
+                         send_timeout_ms)) {
+    drop_client();
+  }
+}
+
+void RenderServer::send_error(const std::string &what) {
+  if (m_client_fd < 0) {
+    return;
+  }
+  RT3_WARNING("Edit rejected: " + what + ".");
+  net::Encoder msg;
+  msg.blob(what);
+  if (not net::send_message(m_client_fd, uint32_t(message_e::ERROR), msg.data(),
+                         send_timeout_ms)) {
+    drop_client();
+  }
+}
+
+#else  // No sockets.
+
+RenderServer::RenderServer(int /* port */) {
+  RT3_WARNING("The render server is not supported on this platform.");
+}
+
+RenderServer::~RenderServer() {}
+
+void RenderServer::drop_client() {}
+
+bool RenderServer::next_edit(SceneScript & /* script */) { return false; }
+
+RenderReport RenderServer::render(Film &film,
+                                  const Scene &scene,
+                                  const Camera &camera,
+                                  const Sampler &sampler,
+                                  ThreadPool &pool) {
+  return rt3::render(film, scene, camera, sampler, pool);
+}
+
+void RenderServer::send_done(double, const RenderReport &, const std::string &) {}
+
+void RenderServer::send_error(const std::string & /* what */) {}
+
+#endif
+
+}  // namespace rt3
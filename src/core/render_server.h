@@ -0,0 +1,78 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H 1
+
+#include <string>
+
+#include "render.h"
+#include "scene_cache.h"
+
+namespace rt3 {
+
+/*!
+ * Render server for interactive editing (`rt3 --server <port> scene.xml`).
+ *
+ * The server parses the scene and builds its world once, then stays up:
+ * the accelerator, the thread pool and the texture cache are kept between
+ * renders. A client connects to `port` and sends *edits*, fragments of
+ * scene XML with the tags that change (e.g. `<lookat look_from="..."/>`);
+ * the server merges them over the scene's parameters, rebuilds only what
+ * they touch, renders, and streams the tiles back as they finish. An empty
+ * edit renders the scene as it stands.
+ *
+ * Messages are framed as `net.h` says:
+ *
+ *     client -> server
+ *       EDIT   XML text (blob)
+ *       QUIT   (empty; shuts the server down)
+ *     server -> client
+ *       FRAME  width, height of the film; x0, y0, x1, y1 of the crop
+ *              window; bytes per sample; number of tiles to come
+ *       TILE   x0, y0, x1, y1; the tile's resolved RGB samples, row after
+ *              row, as the film's output file would hold them
+ *       DONE   render time (microseconds), samples taken, and what was
+ *              rebuilt (blob, space-separated: "film camera background")
+ *       ERROR  what was wrong with the edit (blob); nothing was rendered
+ *
+ * One client is served at a time; when it disconnects, the server waits for
+ * the next one.
+ */
+class RenderServer {
+ public:
+  /// Listens on `port`; see `ok()`.
+  explicit RenderServer(int port);
+  ~RenderServer();
+  RenderServer(const RenderServer &) = delete;
+  RenderServer &operator=(const RenderServer &) = delete;
+
+  /// Whether the server is listening.
+  bool ok() const { return m_listen_fd >= 0; }
+  /*!
+   * Waits for the next edit, accepting a client first if there is none, and
+   * appends its directives to `script`. Edits that are not well-formed XML
+   * are answered with an ERROR and skipped. Returns `false` once a client
+   * asks the server to quit.
+   */
+  bool next_edit(SceneScript &script);
+  /// Renders the film's tiles and sends each one to the client as soon as it
+  /// is done, framed by FRAME and, once `send_done()` is called, DONE.
+  RenderReport render(Film &film,
+                      const Scene &scene,
+                      const Camera &camera,
+                      const Sampler &sampler,
+                      ThreadPool &pool);
+  /// Ends the frame started by `render()`.
+  void send_done(double render_ms, const RenderReport &report, const std::string &rebuilt);
+  /// Rejects the last edit.
+  void send_error(const std::string &what);
+
+ private:
+  /// Drops the current client, if any.
+  void drop_client();
+
+  int m_listen_fd{ -1 };
+  int m_client_fd{ -1 };
+};
+
+}  // namespace rt3
+
+#endif  // RENDER_SERVER_H
@@ -0,0 +1,104 @@
+#include "resolve.h"
+
+#include <cmath>
+
+namespace rt3 {
+
+float Resolver::srgb_encode(float linear) {
+  return linear <= 0.0031308f ? 12.92f * linear : 1.055f * std::pow(linear, 1.f / 2.4f) - 0.055f;
+}
+
+float Resolver::srgb_decode(float encoded) {
+  return encoded <= 0.04045f ? encoded / 12.92f : std::pow((encoded + 0.055f) / 1.055f, 2.4f);
+}
+
+namespace {
+
+/// Intervals of the sRGB table over \f$[0,1]\f$.
+constexpr int srgb_table_size{ 1 << 13 };
+
+/// `srgb_encode()` at the ends of every interval. 32 KiB: it stays in L1.
+struct SrgbTable {
+  float v[srgb_table_size + 1];
+  SrgbTable() {
+    for (int i{ 0 }; i <= srgb_table_size; ++i) {
+      v[i] = Resolver::srgb_encode(float(i) / float(srgb_table_size));
+    }
+  }
+};
+
+const SrgbTable &srgb_table() {
+  static const SrgbTable table;
+  return table;
+}
+
+/// 32-bit integer hash with good avalanche (lowbias32).
+inline uint32_t hash32(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x7feb352dU;
+  h ^= h >> 15;
+  h *= 0x846ca68bU;
+  h ^= h >> 16;
+  return h;
+}
+
+/*!
+ * The inner loop of `Resolver::encode()`, compiled once per combination of
+ * options so that none of them is tested per channel.
+ */
+template <bool Srgb, bool Dither, int Bytes>
+void encode_span(const float *rgb, size_t n, int x, int y, unsigned char *out) {
+  constexpr float max_value{ Bytes == 2 ? 65535.f : 255.f };
+  const float *lut = srgb_table().v;
+  const uint32_t row_key{ hash32(uint32_t(y)) };
+  for (size_t i{ 0 }; i < n; ++i) {
+    for (int c{ 0 }; c < 3; ++c) {
+      float v = *rgb++;
+      // Written so NaNs become 0.
+      v = v > 0.f ? (v < 1.f ? v : 1.f) : 0.f;
+      if constexpr (Srgb) {
+        const float t{ v * float(srgb_table_size) };
+        const int k{ int(t) < srgb_table_size ? int(t) : srgb_table_size - 1 };
+        v = lut[k] + (t - float(k)) * (lut[k + 1] - lut[k]);
+      }
+      float q{ v * max_value + 0.5f };
+      if constexpr (Dither) {
+        // Two 16-bit uniforms make triangular noise in [-1,1).
+        const uint32_t h{ hash32(row_key ^ (uint32_t(x + int(i)) * 3U + uint32_t(c))) };
+        q += float(h & 0xffffU) * (1.f / 65536.f) + float(h >> 16) * (1.f / 65536.f) - 1.f;
+        q = q > 0.f ? (q < max_value ? q : max_value) : 0.f;
+      }
+      const auto s = uint32_t(q);
+      if constexpr (Bytes == 2) {
+        *out++ = (unsigned char)(s >> 8);
+      }
+      *out++ = (unsigned char)(s & 0xffU);
+    }
+  }
+}
+
+template <bool Srgb, bool Dither>
+void encode_span(int bytes, const float *rgb, size_t n, int x, int y, unsigned char *out) {
+  if (bytes == 2) {
+    encode_span<Srgb, Dither, 2>(rgb, n, x, y, out);
+  } else {
+    encode_span<Srgb, Dither, 1>(rgb, n, x, y, out);
+  }
+}
+}  // namespace
+
+void Resolver::encode(const float *rgb, size_t n, int x, int y, unsigned char *out) const {
+  const int bytes{ bytes_per_sample() };
+  if (m_srgb) {
+    if (m_dither) {
+      encode_span<true, true>(bytes, rgb, n, x, y, out);
+    } else {
+      encode_span<true, false>(bytes, rgb, n, x, y, out);
+    }
+  } else if (m_dither) {
+    encode_span<false, true>(bytes, rgb, n, x, y, out);
+  } else {
+    encode_span<false, false>(bytes, rgb, n, x, y, out);
+  }
+}
+}  // namespace rt3
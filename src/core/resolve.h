@@ -0,0 +1,56 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H 1
+
+#include <cstdint>
+
+#include "rt3.h"
+
+namespace rt3 {
+
+/*!
+ * Turns the film's linear RGB floats into the integer samples of the image
+ * file: optional sRGB encoding (the film's `gamma_corrected` flag), clamping
+ * to \f$[0,1]\f$, optional dithering and quantization to 8 or 16 bits.
+ *
+ * - The sRGB curve comes from a lookup table with linear interpolation,
+ *   built once, instead of a `pow()` per channel; it is within a fraction of
+ *   a 16-bit step of the exact curve.
+ * - Dithering adds triangular noise of \f$\pm 1\f$ step before rounding,
+ *   which breaks up the bands of smooth gradients. The noise is a hash of
+ *   the pixel position and channel, so the same image always gets the same
+ *   pattern, whatever the thread count or band order.
+ * - 16-bit samples are stored big-endian, as both PNG and PPM want them.
+ *
+ * The encoder has no state besides its options; rows can be resolved from
+ * any number of threads at once.
+ */
+class Resolver {
+ public:
+  Resolver(bool srgb, bool dither, int bit_depth)
+      : m_srgb{ srgb }, m_dither{ dither }, m_bit_depth{ bit_depth == 16 ? 16 : 8 } {}
+
+  bool srgb() const { return m_srgb; }
+  bool dither() const { return m_dither; }
+  int bit_depth() const { return m_bit_depth; }
+  /// Bytes per channel in the output.
+  int bytes_per_sample() const { return m_bit_depth / 8; }
+
+  /*!
+   * Encodes `n` pixels of row `y`, starting at column `x`, from linear RGB
+   * floats (`3 * n` values) into `out` (`3 * n * bytes_per_sample()` bytes).
+   */
+  void encode(const float *rgb, size_t n, int x, int y, unsigned char *out) const;
+
+  /// sRGB transfer function (linear to encoded), exact.
+  static float srgb_encode(float linear);
+  /// Inverse of `srgb_encode()`, for images read back from disk.
+  static float srgb_decode(float encoded);
+
+ private:
+  bool m_srgb;
+  bool m_dither;
+  int m_bit_depth;
+};
+}  // namespace rt3
+
+#endif  // RESOLVE_H
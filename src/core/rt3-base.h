@@ -1,7 +1,6 @@
 #ifndef RT3_BASE_H
 #define RT3_BASE_H 1
 
-#include "../ext/lodepng.h"
 #include "error.h"
 #include "film.h"
 #include "image_io.h"
@@ -25,27 +25,30 @@ using std::array;
 //#define Dictionary std::unordered_map
 #define Dictionary std::map
 
+#include "geometry.h"
+#include "packet.h"
+#include "ray.h"
+#include "spectrum.h"
+
 //=== Aliases
 namespace rt3 {
-/// ATENTION: This is just to compile the project. You need to implement
-/// Point3f!!!!
-// Alias to a Point3f (simulation)
-using Point3f = std::array<float, 3>;
-// Temporary Vec3, just to compile. TODO: Implement a real one!!!
-using Vector3f = std::array<float, 3>;
-using ColorXYZ = std::array<float, 3>;
-using Spectrum = std::array<float, 3>;
-using Normal3f = std::array<float, 3>;
-using Ray = std::array<float, 3>;
+// Geometric types, see geometry.h.
+using Point3f = Point3<float>;
+using Vector3f = Vector3<float>;
+using Normal3f = Normal3<float>;
+// Colors, see spectrum.h. Both names refer to the same three-channel type.
+using ColorXYZ = Spectrum;
 
 // List of points
 using ListPoint3f = std::vector<Point3f>;
 
-// Temporary Vec3i. TODO: code a real one.
-using Vector3i = std::array<int, 3>;
-using Point3i = std::array<int, 3>;
-using Point2i = std::array<int, 2>;
-using Point2f = std::array<float, 2>;
+using Vector3i = Vector3<int>;
+using Point3i = Point3<int>;
+using Point2i = Point2<int>;
+using Point2f = Point2<float>;
+using Vector2f = Vector2<float>;
+using Bounds2i = Bounds2<int>;
+using Bounds3f = Bounds3<float>;
 
 template <typename T, size_t S>
 std::ostream& operator<<(std::ostream& os, const std::array<T, S>& v)
@@ -62,6 +65,12 @@ class Film;
 class Background;
 class BackgroundColor;
 class Camera;
+class Shape;
+class Primitive;
+class Material;
+class Scene;
+class TextureCache;
+class Sampler;
 
 //=== aliases
 typedef float real_type;
@@ -70,12 +79,14 @@ typedef std::tuple<bool, std::string> result_type;
 
 /// This struct holds information provided via command line arguments
 struct RunningOptions {
-  RunningOptions() : filename{ "" }, outfile{ "" }, quick_render{ false }
+  RunningOptions() : filename{ "" }, outfile{ "" }, quick_render{ false }, n_threads{ 0 }, png_compression{ -1 }, mmap_output{ false }, incremental{ false }, time_budget_ms{ 0 }, verbose{ 0 }, cache_scene{ false }, n_jobs{ 1 }, texture_cache_mb{ 512 }, coordinator_port{ 0 }, server_port{ 0 }
   {
     crop_window[0][0] = 0;  //!< x0
     crop_window[0][1] = 1;  //!< x1,
     crop_window[1][0] = 0;  //!< y0
     crop_window[1][1] = 1;  //!< y1
+    resolution[0] = 0;
+    resolution[1] = 0;
   }
   // [row=0] -> X; [row=1] -> Y
   // x0, x1, y0, y1
@@ -83,8 +94,22 @@ struct RunningOptions {
                                 //!< resolition.
   std::string filename;         //!< input scene file name.
   std::string outfile;          //!< output image file name.
-  bool quick_render;            //!< when set, render image with 1/4 of the requested
-                                //!< resolition.
+  bool quick_render;            //!< when set, render progressively, coarse blocks first.
+  size_t n_threads;             //!< # of render threads; 0 = one per hardware thread.
+  int png_compression;          //!< PNG deflate level override; -1 = use the scene's.
+  bool mmap_output;             //!< Write PPM6 images through a memory mapping.
+  bool incremental;             //!< Re-render only the crop window over the previous frame.
+  double time_budget_ms;        //!< Progressive mode stops refining after this; 0 = no limit.
+  int verbose;                  //!< Log level, see log.h; 0 = silent.
+  bool cache_scene;             //!< Load/save the parsed scene as a binary `.rt3c` sidecar.
+  std::vector<std::string> scene_files;  //!< Every scene to render, in order (batch mode).
+  size_t n_jobs;                //!< How many scenes to render at the same time.
+  size_t texture_cache_mb;      //!< Memory cap of the texture cache, in MiB.
+  int resolution[2];            //!< Overrides the film's x_res, y_res when both are > 0.
+  std::string trace_file;       //!< Chrome trace of the run goes here; empty = no trace.
+  int coordinator_port;         //!< Hand tiles out to workers on this port; 0 = render alone.
+  std::string worker_address;   //!< `host:port` of the coordinator to render for, if any.
+  int server_port;              //!< Stay up and render edits sent to this port; 0 = render once.
 };
 
 //=== Global Inline Functions
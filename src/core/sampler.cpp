@@ -0,0 +1,39 @@
+#include "sampler.h"
+#include "api.h"
+
+namespace rt3 {
+
+/// The `samples` parameter, at least 1.
+static int retrieve_samples(const ParamSet &ps, int default_value) {
+  int samples = retrieve(ps, "samples", default_value);
+  if (samples < 1) {
+    RT3_WARNING("A sampler needs at least 1 sample per pixel; using 1.");
+    samples = 1;
+  }
+  return samples;
+}
+
+Sampler *create_fixed_sampler(const ParamSet &ps) {
+  const int samples = retrieve_samples(ps, 1);
+  return RT3_ARENA_ALLOC(*API::build_arena, Sampler)(Sampler::type_e::fixed, samples, samples,
+                                                    samples, 0.f);
+}
+
+Sampler *create_adaptive_sampler(const ParamSet &ps) {
+  const int samples = retrieve_samples(ps, 16);
+  int max_samples = retrieve(ps, "max_samples", 4 * samples);
+  if (max_samples < samples) {
+    RT3_WARNING("max_samples is below samples; using " + std::to_string(samples) + ".");
+    max_samples = samples;
+  }
+  // Two samples at least: a variance needs them.
+  int min_samples = Clamp(retrieve(ps, "min_samples", 4), 2, std::max(max_samples, 2));
+  float threshold = retrieve(ps, "threshold", real_type{ 0.01 });
+  if (not(threshold > 0.f)) {
+    RT3_WARNING("Sampler threshold must be positive; using 0.01.");
+    threshold = 0.01f;
+  }
+  return RT3_ARENA_ALLOC(*API::build_arena, Sampler)(Sampler::type_e::adaptive, samples,
+                                                    min_samples, max_samples, threshold);
+}
+}  // namespace rt3
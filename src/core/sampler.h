@@ -0,0 +1,70 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H 1
+
+#include <cmath>
+
+#include "paramset.h"
+#include "rt3.h"
+
+namespace rt3 {
+
+/*!
+ * How many samples each pixel gets, and where they go inside it.
+ *
+ * Sample 0 of every pixel is its center, so a single sample per pixel gives
+ * exactly the classic render. Further samples follow the R2 sequence (the
+ * 2D generalization of the golden ratio sequence), which covers the pixel
+ * evenly for any number of samples; it needs no random numbers, so renders
+ * are repeatable.
+ *
+ * - `fixed`: every pixel gets `samples` samples.
+ * - `adaptive`: the first pass takes one sample per pixel. Pixels that
+ *   differ from a neighbor by more than `threshold` (in any channel) get
+ *   at least `min_samples` samples, and keep getting more, `min_samples`
+ *   at a time, until the standard error of the mean of their luminance
+ *   falls below `threshold` or they reach `max_samples`. The budget is
+ *   `samples` per pixel on average over a tile: samples saved on converged
+ *   pixels (flat backgrounds stay at one) go to the noisy ones (edges).
+ */
+class Sampler {
+ public:
+  enum class type_e { fixed = 0, adaptive };
+
+  Sampler(type_e type, int samples, int min_samples, int max_samples, float threshold)
+      : m_type{ type },
+        m_samples{ samples },
+        m_min_samples{ min_samples },
+        m_max_samples{ max_samples },
+        m_threshold{ threshold } {}
+
+  type_e type() const { return m_type; }
+  bool adaptive() const { return m_type == type_e::adaptive; }
+  /// One sample per pixel, at its center: the plain render loop does.
+  bool single_sample() const { return m_type == type_e::fixed and m_samples == 1; }
+  int samples() const { return m_samples; }
+  int min_samples() const { return m_min_samples; }
+  int max_samples() const { return m_max_samples; }
+  float threshold() const { return m_threshold; }
+
+  /// Position of sample `k` inside its pixel, in \f$[0,1)^2\f$.
+  static Point2f offset(int k) {
+    // 1/phi_2 and 1/phi_2^2, phi_2 being the plastic number.
+    constexpr double a1{ 0.7548776662466927 }, a2{ 0.5698402909980532 };
+    double x = 0.5 + a1 * double(k), y = 0.5 + a2 * double(k);
+    return Point2f{ float(x - std::floor(x)), float(y - std::floor(y)) };
+  }
+
+ private:
+  type_e m_type;
+  int m_samples;      //!< Per pixel: exact (fixed) or on average (adaptive).
+  int m_min_samples;  //!< Adaptive: first batch of a pixel that needs more.
+  int m_max_samples;  //!< Adaptive: cap per pixel.
+  float m_threshold;  //!< Adaptive: contrast and error tolerance.
+};
+
+// factory pattern functions.
+Sampler *create_fixed_sampler(const ParamSet &ps);
+Sampler *create_adaptive_sampler(const ParamSet &ps);
+}  // namespace rt3
+
+#endif  // SAMPLER_H
@@ -0,0 +1,53 @@
+#ifndef SCENE_H
+#define SCENE_H 1
+
+#include "background.h"
+#include "memory.h"
+#include "primitive.h"
+#include "stats.h"
+
+namespace rt3 {
+
+/// Everything a ray may meet: the geometry, behind an accelerator, and the
+/// background where it hits nothing.
+class Scene {
+ public:
+  Scene(ArenaPtr<Background> background, ArenaPtr<Primitive> aggregate)
+      : m_background{ std::move(background) }, m_aggregate{ std::move(aggregate) } {
+    if (m_aggregate) {
+      m_bounds = m_aggregate->world_bounds();
+    }
+  }
+
+  const Background &background() const { return *m_background; }
+  /// Swaps the background, e.g. after an edit to a resident scene; the
+  /// geometry stays.
+  void set_background(ArenaPtr<Background> background) { m_background = std::move(background); }
+  bool has_geometry() const { return m_aggregate != nullptr; }
+  /// Box around all the geometry; empty if there is none.
+  const Bounds3f &world_bounds() const { return m_bounds; }
+
+  /// Closest hit along `r`, which gets shortened to it.
+  bool intersect(const Ray &r, Surfel *sf) const {
+    return m_aggregate and m_aggregate->intersect(r, sf);
+  }
+  /// Same as `intersect()`, for `n` coherent rays (see `Primitive`).
+  void intersect_packet(const Ray *rays, size_t n, Surfel *sf, bool *hit) const {
+    stats_add(counter_e::RAYS, n);
+    if (m_aggregate) {
+      m_aggregate->intersect_packet(rays, n, sf, hit);
+    } else {
+      std::fill(hit, hit + n, false);
+    }
+  }
+  /// Whether anything blocks `r`.
+  bool intersect_p(const Ray &r) const { return m_aggregate and m_aggregate->intersect_p(r); }
+
+ private:
+  ArenaPtr<Background> m_background;
+  ArenaPtr<Primitive> m_aggregate;  //!< `nullptr` for an empty world.
+  Bounds3f m_bounds;
+};
+}  // namespace rt3
+
+#endif  // SCENE_H
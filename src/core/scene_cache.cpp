@@ -0,0 +1,263 @@
+#include "scene_cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "mapped_file.h"
+
+namespace rt3 {
+
+namespace {
+constexpr char cache_magic[4]{ 'R', 'T', '3', 'C' };
+constexpr uint32_t byte_order_mark{ 0x01020304 };
+constexpr size_t data_alignment{ 16 };
+
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t n_directives;
+  uint64_t source_size;
+  int64_t source_mtime;
+};
+
+struct DirectiveHeader {
+  uint32_t type;
+  uint32_t n_entries;
+};
+
+struct EntryHeader {
+  uint32_t name_length;
+  uint8_t tag;
+  uint8_t is_array;
+  uint16_t unused;
+  uint64_t count;
+  uint64_t n_bytes;
+};
+
+/// Size and modification time of the scene file, to tell stale caches apart.
+bool source_stamp(const std::string &scene_file, uint64_t &size, int64_t &mtime) {
+  std::error_code ec;
+  size = std::filesystem::file_size(scene_file, ec);
+  if (ec) return false;
+  auto time = std::filesystem::last_write_time(scene_file, ec);
+  if (ec) return false;
+  mtime = int64_t(time.time_since_epoch().count());
+  return true;
+}
+
+template <typename T> struct TypeTag {
+  using type = T;
+};
+
+/// Calls `fn(TypeTag<T>{})` with the C++ type behind `tag`.
+template <typename F> bool visit_tag(param_tag_e tag, F &&fn) {
+  switch (tag) {
+  case param_tag_e::BOOL: fn(TypeTag<bool>{}); return true;
+  case param_tag_e::INT: fn(TypeTag<int>{}); return true;
+  case param_tag_e::UINT: fn(TypeTag<unsigned int>{}); return true;
+  case param_tag_e::REAL: fn(TypeTag<real_type>{}); return true;
+  case param_tag_e::STRING: fn(TypeTag<std::string>{}); return true;
+  case param_tag_e::VEC3F: fn(TypeTag<Vector3f>{}); return true;
+  case param_tag_e::VEC3I: fn(TypeTag<Vector3i>{}); return true;
+  case param_tag_e::NORMAL3F: fn(TypeTag<Normal3f>{}); return true;
+  case param_tag_e::POINT3F: fn(TypeTag<Point3f>{}); return true;
+  case param_tag_e::POINT2I: fn(TypeTag<Point2i>{}); return true;
+  case param_tag_e::POINT2F: fn(TypeTag<Point2f>{}); return true;
+  case param_tag_e::SPECTRUM: fn(TypeTag<Spectrum>{}); return true;
+  }
+  return false;
+}
+
+/// Output stream that keeps track of its offset, to align the data blocks.
+class CacheWriter {
+ public:
+  explicit CacheWriter(const std::string &file) : m_ofs{ file, std::ios::out | std::ios::binary } {}
+  bool ok() const { return m_ofs.is_open() and not m_ofs.fail(); }
+  /// Flushes and closes the file; `false` if anything failed to be written.
+  bool close() {
+    m_ofs.close();
+    return not m_ofs.fail();
+  }
+
+  void write(const void *data, size_t n) {
+    m_ofs.write(static_cast<const char *>(data), std::streamsize(n));
+    m_offset += n;
+  }
+  template <typename T> void write(const T &pod) { write(&pod, sizeof(T)); }
+  void align(size_t alignment) {
+    static const char zeros[data_alignment]{};
+    write(zeros, (alignment - m_offset % alignment) % alignment);
+  }
+
+ private:
+  std::ofstream m_ofs;
+  size_t m_offset{ 0 };
+};
+
+/// Bounds-checked cursor over the mapped cache.
+class CacheReader {
+ public:
+  CacheReader(const unsigned char *data, size_t size) : m_data{ data }, m_size{ size } {}
+
+  /// Returns a pointer to the next `n` bytes and skips them, or `nullptr` if
+  /// the file is too short.
+  const unsigned char *take(size_t n) {
+    if (n > m_size - m_offset) return nullptr;
+    const unsigned char *p = m_data + m_offset;
+    m_offset += n;
+    return p;
+  }
+  template <typename T> bool read(T &pod) {
+    const unsigned char *p = take(sizeof(T));
+    if (p == nullptr) return false;
+    std::memcpy(&pod, p, sizeof(T));
+    return true;
+  }
+  bool align(size_t alignment) { return take((alignment - m_offset % alignment) % alignment) != nullptr; }
+
+ private:
+  const unsigned char *m_data;
+  size_t m_size;
+  size_t m_offset{ 0 };
+};
+
+void write_entry(CacheWriter &out, const ParamSet::Entry &e) {
+  const std::string &name = e.key.name();
+  const void *data = e.values();
+  size_t n_bytes{ 0 };
+  visit_tag(e.tag, [&](auto t) {
+    using T = typename decltype(t)::type;
+    if constexpr (std::is_same_v<T, std::string>) {
+      // Strings are always single values; store their characters.
+      const auto *str = static_cast<const std::string *>(data);
+      data = str->data();
+      n_bytes = str->size();
+    } else {
+      n_bytes = e.count * sizeof(T);
+    }
+  });
+  EntryHeader header{ uint32_t(name.size()), uint8_t(e.tag), uint8_t(e.is_array), 0,
+                      uint64_t(e.count), uint64_t(n_bytes) };
+  out.write(header);
+  out.write(name.data(), name.size());
+  out.align(8);
+  out.align(data_alignment);
+  out.write(data, n_bytes);
+  out.align(8);
+}
+
+bool read_entry(CacheReader &in, const std::shared_ptr<const void> &owner, ParamSet &ps) {
+  EntryHeader header;
+  if (not in.read(header)) return false;
+  const unsigned char *name = in.take(header.name_length);
+  if (name == nullptr or not in.align(8) or not in.align(data_alignment)) return false;
+  const unsigned char *data = in.take(size_t(header.n_bytes));
+  if (data == nullptr or not in.align(8)) return false;
+
+  ParamKey key{ std::string(reinterpret_cast<const char *>(name), header.name_length) };
+  bool ok{ false };
+  bool known = visit_tag(param_tag_e(header.tag), [&](auto t) {
+    using T = typename decltype(t)::type;
+    if constexpr (std::is_same_v<T, std::string>) {
+      if (header.is_array) return;
+      ps.add(key, std::string(reinterpret_cast<const char *>(data), size_t(header.n_bytes)));
+      ok = true;
+    } else {
+      if (header.n_bytes != header.count * sizeof(T)) return;
+      if (header.is_array) {
+        // Borrow the mapped values; `owner` keeps the mapping alive.
+        ps.add_array(key, reinterpret_cast<const T *>(data), size_t(header.count), owner);
+      } else {
+        if (header.count != 1) return;
+        T value;
+        std::memcpy(static_cast<void *>(&value), data, sizeof(T));
+        ps.add(key, value);
+      }
+      ok = true;
+    }
+  });
+  return known and ok;
+}
+}  // namespace
+
+std::string scene_cache_filename(const std::string &scene_file) { return scene_file + ".rt3c"; }
+
+bool save_scene_cache(const std::string &cache_file,
+                      const std::string &scene_file,
+                      const SceneScript &script) {
+  CacheHeader header;
+  std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.version = scene_cache_version;
+  header.byte_order = byte_order_mark;
+  header.n_directives = uint32_t(script.size());
+  if (not source_stamp(scene_file, header.source_size, header.source_mtime)) {
+    return false;
+  }
+  // Other processes may have the cache mapped, with parameter arrays
+  // pointing into it: it is replaced, never truncated.
+  const std::string tmp{ unique_temp_file(cache_file) };
+  if (tmp.empty()) return false;
+  bool written{ false };
+  {
+    CacheWriter out{ tmp };
+    if (out.ok()) {
+      out.write(header);
+      for (const auto &d : script) {
+        out.write(DirectiveHeader{ uint32_t(d.type), uint32_t(d.ps.size()) });
+        for (const auto &e : d.ps.entries()) {
+          write_entry(out, e);
+        }
+      }
+      written = out.close();
+    }
+  }
+  std::error_code ec;
+  if (written) {
+    std::filesystem::rename(tmp, cache_file, ec);
+    written = not ec;
+  }
+  if (not written) {
+    std::filesystem::remove(tmp, ec);
+  }
+  return written;
+}
+
+bool load_scene_cache(const std::string &cache_file,
+                      const std::string &scene_file,
+                      SceneScript &script) {
+  script.clear();
+  std::shared_ptr<const MappedFile> file{ MappedFile::open_read(cache_file) };
+  if (not file) return false;
+  CacheReader in{ file->data(), file->size() };
+
+  CacheHeader header;
+  uint64_t size{ 0 };
+  int64_t mtime{ 0 };
+  if (not in.read(header) or std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0
+      or header.version != scene_cache_version or header.byte_order != byte_order_mark
+      or not source_stamp(scene_file, size, mtime) or header.source_size != size
+      or header.source_mtime != mtime) {
+    return false;
+  }
+  script.reserve(header.n_directives);
+  for (uint32_t i{ 0 }; i < header.n_directives; ++i) {
+    DirectiveHeader dh;
+    if (not in.read(dh) or dh.type > uint32_t(directive_e::SAMPLER)) {
+      script.clear();
+      return false;
+    }
+    SceneDirective d{ directive_e(dh.type), ParamSet{} };
+    for (uint32_t k{ 0 }; k < dh.n_entries; ++k) {
+      if (not read_entry(in, file, d.ps)) {
+        script.clear();
+        return false;
+      }
+    }
+    script.push_back(std::move(d));
+  }
+  return true;
+}
+
+}  // namespace rt3
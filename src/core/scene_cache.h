@@ -0,0 +1,75 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H 1
+
+#include <string>
+#include <vector>
+
+#include "paramset.h"
+
+namespace rt3 {
+
+/// Scene-file directives, one per tag the parser acts upon.
+enum class directive_e : uint32_t {
+  CAMERA = 0,
+  LOOKAT,
+  FILM,
+  BACKGROUND,
+  WORLD_BEGIN,
+  WORLD_END,
+  FRAME_BEGIN,  //!< Film/camera/lookat up to FRAME_END belong to a new frame.
+  FRAME_END,
+  ACCELERATOR,
+  MATERIAL,
+  OBJECT,
+  SAMPLER
+};
+
+/// One directive of a parsed scene, with its parameters.
+struct SceneDirective {
+  directive_e type;
+  ParamSet ps;
+};
+
+/// A parsed scene: the directives, in file order, ready to be replayed
+/// through the API (see `run_scene()` in parser.h).
+using SceneScript = std::vector<SceneDirective>;
+
+/*!
+ * Binary scene cache.
+ *
+ * The cache holds the `SceneScript` of a scene file, so later runs can skip
+ * the XML altogether. Layout (native byte order, version `scene_cache_version`):
+ *
+ *     header:    "RT3C", version, byte-order mark, #directives,
+ *                size and modification time of the scene file
+ *     directive: type, #entries
+ *     entry:     name length, tag, is_array, count, #bytes,
+ *                name (padded to 8 bytes),
+ *                data (starting on a 16-byte boundary, padded to 8 bytes)
+ *
+ * A cache is only used if it was written from the scene file as it is now
+ * (same size and modification time). It is memory-mapped, and arrays are not
+ * copied out: their `ParamSet` entries borrow the mapped pages, which stay
+ * mapped for as long as any of those sets is alive. A large mesh therefore
+ * costs only the page faults of the parts actually read.
+ */
+constexpr uint32_t scene_cache_version{ 2 };
+
+/// Cache file that goes with `scene_file` (a `.rt3c` sidecar).
+std::string scene_cache_filename(const std::string &scene_file);
+
+/// Writes `script`, parsed from `scene_file`, to `cache_file`.
+bool save_scene_cache(const std::string &cache_file,
+                      const std::string &scene_file,
+                      const SceneScript &script);
+
+/// Maps `cache_file` and fills `script` with its directives. Returns `false`
+/// (leaving `script` empty) if the cache is missing, damaged, of another
+/// version, or older than `scene_file`.
+bool load_scene_cache(const std::string &cache_file,
+                      const std::string &scene_file,
+                      SceneScript &script);
+
+}  // namespace rt3
+
+#endif  // SCENE_CACHE_H
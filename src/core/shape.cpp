@@ -0,0 +1,211 @@
+#include "shape.h"
+#include "api.h"
+
+#include <cmath>
+
+namespace rt3 {
+
+// === Sphere
+
+Bounds3f Sphere::world_bounds() const {
+  Vector3f r{m_radius, m_radius, m_radius};
+  return {m_center - r, m_center + r};
+}
+
+bool Sphere::solve(const Ray &r, float *t0, float *t1) const {
+  // |o + t*d - c|^2 = R^2, with the factor 2 of the linear term folded in.
+  Vector3f oc = r.o - m_center;
+  float a = dot(r.d, r.d);
+  float half_b = dot(oc, r.d);
+  float c = dot(oc, oc) - m_radius * m_radius;
+  float disc = half_b * half_b - a * c;
+  if (disc < 0.f) {
+    return false;
+  }
+  float root = std::sqrt(disc);
+  *t0 = (-half_b - root) / a;
+  *t1 = (-half_b + root) / a;
+  return true;
+}
+
+bool Sphere::intersect(const Ray &r, float *t_hit, Surfel *sf) const {
+  float t0, t1;
+  if (not solve(r, &t0, &t1)) {
+    return false;
+  }
+  // Nearest root inside the ray's extent; the far one if we start inside.
+  float t = t0 > r.t_min ? t0 : t1;
+  if (t <= r.t_min or t >= r.t_max) {
+    return false;
+  }
+  *t_hit = t;
+  sf->p = r(t);
+  Vector3f n = (sf->p - m_center) / m_radius;
+  sf->n = Normal3f{flip_normals ? -n : n};
+  sf->wo = -r.d;
+  sf->uv = Point2f{
+      (std::atan2(n.z, n.x) + float(M_PI)) / (2.f * float(M_PI)),
+      std::acos(Clamp(n.y, -1.f, 1.f)) / float(M_PI)};
+  return true;
+}
+
+bool Sphere::intersect_p(const Ray &r) const {
+  float t0, t1;
+  if (not solve(r, &t0, &t1)) {
+    return false;
+  }
+  return (t0 > r.t_min and t0 < r.t_max) or (t1 > r.t_min and t1 < r.t_max);
+}
+
+// === Triangle
+
+Bounds3f Triangle::world_bounds() const {
+  const Point3f *v = m_mesh->vertices.data();
+  return bounds_union(Bounds3f{v[m_v[0]], v[m_v[1]]}, v[m_v[2]]);
+}
+
+bool Triangle::hit(const Ray &r, float *t, float *b1, float *b2) const {
+  // Below this, the ray is taken as parallel to the triangle.
+  constexpr float det_epsilon{1e-12f};
+  const Point3f *v = m_mesh->vertices.data();
+  const Point3f &p0 = v[m_v[0]];
+  Vector3f e1 = v[m_v[1]] - p0;
+  Vector3f e2 = v[m_v[2]] - p0;
+  Vector3f pv = cross(r.d, e2);
+  float det = dot(e1, pv);
+  // Counter-clockwise triangles face the viewer; culling drops the others.
+  if (m_mesh->backface_cull ? det < det_epsilon : std::abs(det) < det_epsilon) {
+    return false;
+  }
+  float inv_det = 1.f / det;
+  Vector3f tv = r.o - p0;
+  float u = dot(tv, pv) * inv_det;
+  if (u < 0.f or u > 1.f) {
+    return false;
+  }
+  Vector3f qv = cross(tv, e1);
+  float w = dot(r.d, qv) * inv_det;
+  if (w < 0.f or u + w > 1.f) {
+    return false;
+  }
+  float t_hit = dot(e2, qv) * inv_det;
+  if (t_hit <= r.t_min or t_hit >= r.t_max) {
+    return false;
+  }
+  *t = t_hit;
+  *b1 = u;
+  *b2 = w;
+  return true;
+}
+
+bool Triangle::intersect(const Ray &r, float *t_hit, Surfel *sf) const {
+  float b1, b2;
+  if (not hit(r, t_hit, &b1, &b2)) {
+    return false;
+  }
+  sf->p = r(*t_hit);
+  Normal3f n;
+  if (not m_mesh->normals.empty()) {
+    const Normal3f *vn = m_mesh->normals.data();
+    n = vn[m_v[0]] * (1.f - b1 - b2) + vn[m_v[1]] * b1 + vn[m_v[2]] * b2;
+  } else {
+    const Point3f *v = m_mesh->vertices.data();
+    n = Normal3f{cross(v[m_v[1]] - v[m_v[0]], v[m_v[2]] - v[m_v[0]])};
+  }
+  n = normalize(n);
+  sf->n = flip_normals ? -n : n;
+  sf->wo = -r.d;
+  sf->uv = Point2f{b1, b2};
+  return true;
+}
+
+bool Triangle::intersect_p(const Ray &r) const {
+  float t, b1, b2;
+  return hit(r, &t, &b1, &b2);
+}
+
+// === Factories
+
+/// Boolean attributes are strings in the scene file.
+static bool retrieve_flag(const ParamSet &ps, const char *key, bool default_value) {
+  std::string value = retrieve(ps, key, std::string{default_value ? "true" : "false"});
+  return value == "true" or value == "yes" or value == "on";
+}
+
+Sphere *create_sphere(const ParamSet &ps) {
+  Point3f center = retrieve(ps, "center", Point3f{0, 0, 0});
+  float radius = retrieve(ps, "radius", real_type{1});
+  // Shapes own nothing, so they need no destructor record in the arena.
+  return RT3_ARENA_ALLOC(*API::build_arena, Sphere)(
+      center, radius, retrieve_flag(ps, "flip_normals", false));
+}
+
+std::vector<const Shape *> create_triangle_mesh(const ParamSet &ps) {
+  std::vector<const Shape *> shapes;
+  auto *mesh = API::build_arena->make<TriangleMesh>();
+  mesh->ps = ps;
+  mesh->indices = retrieve_span<int>(ps, "indices");
+  mesh->vertices = retrieve_span<Point3f>(ps, "vertices");
+  mesh->normals = retrieve_span<Normal3f>(ps, "normals");
+  mesh->backface_cull = retrieve_flag(ps, "backface_cull", false);
+
+  // Validate the index list before any triangle looks at it.
+  size_t n_triangles = mesh->indices.size() / 3;
+  int n_given = retrieve(ps, "ntriangles", int(n_triangles));
+  if (n_given >= 0 and size_t(n_given) <= n_triangles) {
+    n_triangles = size_t(n_given);
+  } else {
+    RT3_WARNING("Mesh declares " + std::to_string(n_given) + " triangles, but has indices for " +
+                std::to_string(n_triangles) + " only.");
+  }
+  for (size_t i{0}; i < 3 * n_triangles; ++i) {
+    if (mesh->indices[i] < 0 or size_t(mesh->indices[i]) >= mesh->vertices.size()) {
+      RT3_WARNING("Mesh index " + std::to_string(mesh->indices[i]) +
+                  " is out of range; ignoring the mesh.");
+      return shapes;
+    }
+  }
+  if (not mesh->normals.empty() and mesh->normals.size() != mesh->vertices.size()) {
+    RT3_WARNING("Mesh has " + std::to_string(mesh->normals.size()) + " normals for " +
+                std::to_string(mesh->vertices.size()) + " vertices; ignoring the normals.");
+    mesh->normals = {};
+  }
+  mesh->n_triangles = n_triangles;
+
+  // Both options below need arrays of our own, stored in the mesh's set.
+  if (retrieve_flag(ps, "reverse_vertex_order", false)) {
+    std::vector<int> indices(mesh->indices.begin(), mesh->indices.begin() + 3 * n_triangles);
+    for (size_t t{0}; t < n_triangles; ++t) {
+      std::swap(indices[3 * t + 1], indices[3 * t + 2]);
+    }
+    mesh->ps.add_array("indices", std::move(indices));
+    mesh->indices = retrieve_span<int>(mesh->ps, "indices");
+  }
+  if (mesh->normals.empty() and retrieve_flag(ps, "compute_normals", false)) {
+    // Sum of the (area-weighted) normals of the faces around each vertex.
+    std::vector<Normal3f> normals(mesh->vertices.size());
+    for (size_t t{0}; t < n_triangles; ++t) {
+      const int *v = &mesh->indices[3 * t];
+      Normal3f n{cross(mesh->vertices[v[1]] - mesh->vertices[v[0]],
+                       mesh->vertices[v[2]] - mesh->vertices[v[0]])};
+      for (int k{0}; k < 3; ++k) {
+        normals[v[k]] = normals[v[k]] + n;
+      }
+    }
+    for (auto &n : normals) {
+      if (n.length_squared() > 0.f) {
+        n = normalize(n);
+      }
+    }
+    mesh->ps.add_array("normals", std::move(normals));
+    mesh->normals = retrieve_span<Normal3f>(mesh->ps, "normals");
+  }
+
+  const bool flip_normals = retrieve_flag(ps, "flip_normals", false);
+  shapes.reserve(n_triangles);
+  for (size_t t{0}; t < n_triangles; ++t) {
+    shapes.push_back(RT3_ARENA_ALLOC(*API::build_arena, Triangle)(mesh, t, flip_normals));
+  }
+  return shapes;
+}
+}  // namespace rt3
@@ -0,0 +1,99 @@
+#ifndef SHAPE_H
+#define SHAPE_H 1
+
+#include <vector>
+
+#include "paramset.h"
+#include "rt3.h"
+
+namespace rt3 {
+
+/// Where a ray hits a surface.
+struct Surfel {
+  Point3f p;   //!< Hit point.
+  Normal3f n;  //!< Unit normal at `p` (interpolated, for meshes with normals).
+  Vector3f wo;  //!< Opposite of the ray direction.
+  Point2f uv;   //!< Surface parametrization.
+  const Primitive *primitive{ nullptr };  //!< Set by the primitive that was hit.
+};
+
+/*!
+ * The geometry of an object, in world space (there are no transforms yet).
+ *
+ * `intersect()` only reports hits with \f$t\f$ in the open range
+ * \f$(t_{min}, t_{max})\f$ of the ray, so closest-hit searches just shrink
+ * `t_max` as they go.
+ */
+class Shape {
+ public:
+  explicit Shape(bool flip_normals = false) : flip_normals{ flip_normals } {}
+  virtual ~Shape() = default;
+
+  virtual Bounds3f world_bounds() const = 0;
+  /// Closest hit along `r`: its parameter goes to `t_hit`, the details to `sf`.
+  virtual bool intersect(const Ray &r, float *t_hit, Surfel *sf) const = 0;
+  /// Whether there is any hit along `r` (shadow rays).
+  virtual bool intersect_p(const Ray &r) const = 0;
+
+  bool flip_normals;  //!< Normals point inwards.
+};
+
+class Sphere : public Shape {
+ public:
+  Sphere(const Point3f &center, float radius, bool flip_normals = false)
+      : Shape{ flip_normals }, m_center{ center }, m_radius{ radius } {}
+
+  Bounds3f world_bounds() const override;
+  bool intersect(const Ray &r, float *t_hit, Surfel *sf) const override;
+  bool intersect_p(const Ray &r) const override;
+
+ private:
+  /// Parameters of both roots of the ray/sphere equation, `t0 <= t1`.
+  bool solve(const Ray &r, float *t0, float *t1) const;
+
+  Point3f m_center;
+  float m_radius;
+};
+
+/*!
+ * Vertex data shared by the triangles of a mesh.
+ *
+ * The arrays are read straight out of the scene's `ParamSet`, which the mesh
+ * keeps, so a mesh loaded from a scene cache borrows the mapped file instead
+ * of copying it. Only when the vertex order is reversed or normals have to be
+ * computed does the mesh own new arrays.
+ */
+struct TriangleMesh {
+  ParamSet ps;  //!< Keeps the arrays below alive.
+  size_t n_triangles{ 0 };
+  Span<int> indices;        //!< 3 vertex indices per triangle.
+  Span<Point3f> vertices;
+  Span<Normal3f> normals;   //!< Per vertex; may be empty.
+  bool backface_cull{ false };
+};
+
+/// One triangle of a `TriangleMesh`.
+class Triangle : public Shape {
+ public:
+  Triangle(const TriangleMesh *mesh, size_t tri_index, bool flip_normals = false)
+      : Shape{ flip_normals }, m_mesh{ mesh }, m_v{ &mesh->indices[3 * tri_index] } {}
+
+  Bounds3f world_bounds() const override;
+  bool intersect(const Ray &r, float *t_hit, Surfel *sf) const override;
+  bool intersect_p(const Ray &r) const override;
+
+ private:
+  /// Möller-Trumbore test: `t` and the barycentrics of vertices 1 and 2.
+  bool hit(const Ray &r, float *t, float *b1, float *b2) const;
+
+  const TriangleMesh *m_mesh;
+  const int *m_v;  //!< This triangle's 3 entries in `m_mesh->indices`.
+};
+
+// factory pattern functions. Shapes live in the scene arena (see `API`).
+Sphere *create_sphere(const ParamSet &ps);
+/// One shape per triangle; empty (with a warning) if the mesh is invalid.
+std::vector<const Shape *> create_triangle_mesh(const ParamSet &ps);
+}  // namespace rt3
+
+#endif  // SHAPE_H
@@ -0,0 +1,68 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H 1
+
+#include <algorithm>
+#include <iostream>
+
+namespace rt3 {
+
+/*!
+ * A color, stored as three floating point channels.
+ *
+ * Colors are kept apart from the geometric types, so a `Point3f` cannot be
+ * silently passed where a color is expected (and vice versa). Unlike vectors,
+ * colors multiply component-wise.
+ */
+class Spectrum {
+ public:
+  float c[3]{ 0.f, 0.f, 0.f };
+
+  constexpr Spectrum() = default;
+  constexpr Spectrum(float r, float g, float b) : c{ r, g, b } {}
+  /// A gray color.
+  constexpr explicit Spectrum(float v) : c{ v, v, v } {}
+
+  float operator[](int i) const { return c[i]; }
+  float &operator[](int i) { return c[i]; }
+
+  Spectrum operator+(const Spectrum &s) const { return { c[0] + s.c[0], c[1] + s.c[1], c[2] + s.c[2] }; }
+  Spectrum operator-(const Spectrum &s) const { return { c[0] - s.c[0], c[1] - s.c[1], c[2] - s.c[2] }; }
+  Spectrum operator*(const Spectrum &s) const { return { c[0] * s.c[0], c[1] * s.c[1], c[2] * s.c[2] }; }
+  Spectrum operator*(float f) const { return { c[0] * f, c[1] * f, c[2] * f }; }
+  Spectrum operator/(float f) const { return *this * (1.f / f); }
+  Spectrum &operator+=(const Spectrum &s) {
+    c[0] += s.c[0];
+    c[1] += s.c[1];
+    c[2] += s.c[2];
+    return *this;
+  }
+  Spectrum &operator*=(float f) {
+    c[0] *= f;
+    c[1] *= f;
+    c[2] *= f;
+    return *this;
+  }
+  bool operator==(const Spectrum &s) const {
+    return c[0] == s.c[0] and c[1] == s.c[1] and c[2] == s.c[2];
+  }
+  bool operator!=(const Spectrum &s) const { return not(*this == s); }
+
+  /// Rec. 709 luminance, for linear RGB.
+  float luminance() const { return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2]; }
+  /// Largest channel value.
+  float max_component() const { return std::max(c[0], std::max(c[1], c[2])); }
+  bool is_black() const { return c[0] == 0.f and c[1] == 0.f and c[2] == 0.f; }
+};
+
+inline Spectrum operator*(float f, const Spectrum &s) { return s * f; }
+
+/// Linear interpolation between two colors.
+inline Spectrum lerp(float t, const Spectrum &a, const Spectrum &b) { return a * (1.f - t) + b * t; }
+
+inline std::ostream &operator<<(std::ostream &os, const Spectrum &s) {
+  return os << "[ " << s.c[0] << " " << s.c[1] << " " << s.c[2] << " ]";
+}
+
+}  // namespace rt3
+
+#endif  // SPECTRUM_H
@@ -0,0 +1,319 @@
+#include "stats.h"
+#include "error.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace rt3 {
+
+namespace {
+
+constexpr int n_counters{ int(counter_e::N_COUNTERS) };
+constexpr int n_phases{ int(phase_e::N_PHASES) };
+/// Bucket `b` of the tile histogram holds tiles of [2^b, 2^(b+1)) microseconds.
+constexpr int n_tile_buckets{ 32 };
+
+const char *phase_name(phase_e p) {
+  static const char *names[n_phases]{ "parse",   "scene build", "render",
+                                      "resolve", "encode",      "write" };
+  return names[int(p)];
+}
+
+/// A closed scope, as the trace wants it.
+struct TraceEvent {
+  const char *name;
+  phase_e phase;
+  int64_t ts_ns;   //!< Start, since `epoch()`.
+  int64_t dur_ns;  //!< Duration.
+  int args[2];     //!< Negative if absent.
+};
+
+/// Counters and timers, summed over threads.
+struct Totals {
+  uint64_t counters[n_counters]{};
+  int64_t phase_ns[n_phases]{};
+  uint64_t tile_buckets[n_tile_buckets]{};
+
+  void clear() {
+    std::fill(std::begin(counters), std::end(counters), 0);
+    std::fill(std::begin(phase_ns), std::end(phase_ns), 0);
+    std::fill(std::begin(tile_buckets), std::end(tile_buckets), 0);
+  }
+  void add(const Totals &t) {
+    for (int i{ 0 }; i < n_counters; ++i) {
+      counters[i] += t.counters[i];
+    }
+    for (int i{ 0 }; i < n_phases; ++i) {
+      phase_ns[i] += t.phase_ns[i];
+    }
+    for (int i{ 0 }; i < n_tile_buckets; ++i) {
+      tile_buckets[i] += t.tile_buckets[i];
+    }
+  }
+};
+
+/// What each thread accumulates on its own.
+struct ThreadStats : Totals {
+  int index{ 0 };  //!< Registration order; the trace's thread id.
+  int worker{ -1 };  //!< `ThreadPool::worker_index()` of the thread.
+  const char *pool{ nullptr };  //!< `ThreadPool::worker_name()` of the thread.
+  std::vector<TraceEvent> events;
+};
+
+/*!
+ * The blocks of the threads alive. A thread that exits folds its numbers
+ * into `retired`, so they still count (e.g. the threads that resolve and
+ * encode each frame), and its trace events, if any, into `retired_traces`;
+ * the block itself goes. Runs that start threads for every frame therefore
+ * keep a fixed number of blocks.
+ */
+struct Registry {
+  std::mutex mtx;
+  std::vector<ThreadStats *> live;
+  Totals retired;
+  std::vector<std::unique_ptr<ThreadStats>> retired_traces;
+  int n_registered{ 0 };
+};
+
+Registry &registry() {
+  // Never destroyed: the pool's workers retire their blocks when the pool
+  // is joined, at static destruction time.
+  static Registry *reg = new Registry;
+  return *reg;
+}
+
+std::chrono::steady_clock::time_point epoch() {
+  static const auto start = std::chrono::steady_clock::now();
+  return start;
+}
+
+/// Read by every `~ScopedTimer()`, on any thread.
+std::atomic<bool> g_trace{ false };
+
+/// Owns the calling thread's block, and retires it when the thread exits.
+struct LocalStats {
+  std::unique_ptr<ThreadStats> stats;
+
+  LocalStats() : stats{ std::make_unique<ThreadStats>() } {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mtx);
+    stats->index = reg.n_registered++;
+    stats->worker = ThreadPool::worker_index();
+    stats->pool = ThreadPool::worker_name();
+    reg.live.push_back(stats.get());
+  }
+  ~LocalStats() {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mtx);
+    reg.live.erase(std::find(reg.live.begin(), reg.live.end(), stats.get()));
+    reg.retired.add(*stats);
+    if (not stats->events.empty()) {
+      reg.retired_traces.push_back(std::move(stats));
+    }
+  }
+};
+
+ThreadStats &local() {
+  thread_local LocalStats mine;
+  return *mine.stats;
+}
+
+/// Innermost open scope of the calling thread.
+thread_local ScopedTimer *t_current{ nullptr };
+
+std::string fixed(double v, int digits) {
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), "%.*f", digits, v);
+  return buf;
+}
+}  // namespace
+
+void stats_reset() {
+  Registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mtx);
+  // Trace events are kept: the trace covers the whole run, batches included.
+  for (ThreadStats *t : reg.live) {
+    t->clear();
+  }
+  reg.retired.clear();
+}
+
+void stats_enable_trace(bool on) {
+  epoch();
+  g_trace.store(on, std::memory_order_relaxed);
+}
+
+void stats_clear_trace() {
+  Registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mtx);
+  for (ThreadStats *t : reg.live) {
+    t->events.clear();
+    t->events.shrink_to_fit();
+  }
+  reg.retired_traces.clear();
+}
+
+void stats_add(counter_e c, uint64_t n) { local().counters[int(c)] += n; }
+
+void stats_record_tile(double ms) {
+  const double us{ ms * 1000.0 };
+  int b{ 0 };
+  while (b + 1 < n_tile_buckets and us >= double(uint64_t(1) << (b + 1))) {
+    ++b;
+  }
+  ++local().tile_buckets[b];
+}
+
+ScopedTimer::ScopedTimer(phase_e phase, const char *name, int arg0, int arg1)
+    : m_phase{ phase }, m_name{ name }, m_args{ arg0, arg1 }, m_parent{ t_current } {
+  m_start = m_resume = clock::now();
+  if (m_parent) {
+    // The enclosing scope pauses while this one runs.
+    m_parent->m_self += m_start - m_parent->m_resume;
+  }
+  t_current = this;
+}
+
+ScopedTimer::~ScopedTimer() {
+  const auto end = clock::now();
+  m_self += end - m_resume;
+  ThreadStats &s = local();
+  s.phase_ns[int(m_phase)] += std::chrono::duration_cast<std::chrono::nanoseconds>(m_self).count();
+  if (g_trace.load(std::memory_order_relaxed)) {
+    s.events.push_back(TraceEvent{
+      m_name, m_phase,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(m_start - epoch()).count(),
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_start).count(),
+      { m_args[0], m_args[1] } });
+  }
+  t_current = m_parent;
+  if (m_parent) {
+    m_parent->m_resume = end;
+  }
+}
+
+size_t peak_memory_bytes() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage {};
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  return size_t(usage.ru_maxrss);  // Bytes.
+#else
+  return size_t(usage.ru_maxrss) * 1024;  // KiB.
+#endif
+#else
+  return 0;
+#endif
+}
+
+void stats_print_report() {
+  Totals sum;
+  {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mtx);
+    sum = reg.retired;
+    for (const ThreadStats *t : reg.live) {
+      sum.add(*t);
+    }
+  }
+  const uint64_t *counters{ sum.counters };
+  const int64_t *phase_ns{ sum.phase_ns };
+  const uint64_t *tile_buckets{ sum.tile_buckets };
+
+  std::string phases;
+  for (int i{ 0 }; i < n_phases; ++i) {
+    phases += std::string{ i > 0 ? ", " : "" } + phase_name(phase_e(i)) + " "
+              + fixed(double(phase_ns[i]) * 1e-6, 2);
+  }
+  RT3_MESSAGE("    Statistics:\n");
+  RT3_MESSAGE("      Phases (ms, summed over threads): " + phases + "\n");
+
+  const uint64_t rays{ counters[int(counter_e::RAYS)] };
+  const double render_s{ double(counters[int(counter_e::RENDER_NS)]) * 1e-9 };
+  RT3_MESSAGE("      Rays: " + std::to_string(rays) + " traced"
+              + (render_s > 0 and rays > 0 ? " (" + fixed(double(rays) / render_s * 1e-6, 3) + " M rays/s)" : "")
+              + ", " + std::to_string(counters[int(counter_e::SAMPLES)]) + " samples, "
+              + std::to_string(counters[int(counter_e::TILES)]) + " tiles\n");
+
+  // Histogram rows from the fastest to the slowest non-empty bucket.
+  int lo{ 0 }, hi{ n_tile_buckets - 1 };
+  while (lo < n_tile_buckets and tile_buckets[lo] == 0) {
+    ++lo;
+  }
+  while (hi >= lo and tile_buckets[hi] == 0) {
+    --hi;
+  }
+  if (lo <= hi) {
+    const uint64_t most{ *std::max_element(tile_buckets + lo, tile_buckets + hi + 1) };
+    std::string histogram{ "      Tile times (ms):" };
+    for (int b{ lo }; b <= hi; ++b) {
+      const double from{ double(uint64_t(1) << b) * 1e-3 };
+      char line[80];
+      std::snprintf(line, sizeof(line), "\n        %9.3f - %9.3f %8llu ", b == 0 ? 0.0 : from,
+                    2.0 * from, (unsigned long long)tile_buckets[b]);
+      histogram += line + std::string(size_t((tile_buckets[b] * 40 + most - 1) / most), '#');
+    }
+    RT3_MESSAGE(histogram + "\n");
+  }
+
+  const size_t peak{ peak_memory_bytes() };
+  if (peak > 0) {
+    RT3_MESSAGE("      Peak memory: " + fixed(double(peak) / double(1 << 20), 1) + " MiB\n");
+  }
+}
+
+bool stats_write_trace(const std::string &filename) {
+  std::ofstream ofs{ filename };
+  if (not ofs.is_open()) {
+    return false;
+  }
+  Registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mtx);
+  ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first{ true };
+  auto separator = [&]() -> const char * {
+    const char *s = first ? "\n" : ",\n";
+    first = false;
+    return s;
+  };
+  std::vector<const ThreadStats *> threads(reg.live.begin(), reg.live.end());
+  for (const auto &t : reg.retired_traces) {
+    threads.push_back(t.get());
+  }
+  std::sort(threads.begin(), threads.end(),
+            [](const ThreadStats *a, const ThreadStats *b) { return a->index < b->index; });
+  for (const ThreadStats *t : threads) {
+    const std::string name{ t->worker >= 0 ? t->pool + (" " + std::to_string(t->worker))
+                            : t->index == 0 ? std::string{ "main" }
+                                            : "thread " + std::to_string(t->index) };
+    ofs << separator() << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << t->index
+        << R"(,"args":{"name":")" << name << "\"}}";
+    for (const auto &e : t->events) {
+      // Timestamps are in microseconds.
+      ofs << separator() << R"({"name":")" << (e.name ? e.name : phase_name(e.phase))
+          << R"(","cat":")" << phase_name(e.phase) << R"(","ph":"X","pid":1,"tid":)" << t->index
+          << R"(,"ts":)" << fixed(double(e.ts_ns) * 1e-3, 3) << R"(,"dur":)"
+          << fixed(double(e.dur_ns) * 1e-3, 3);
+      if (e.args[0] >= 0) {
+        ofs << R"(,"args":{"x":)" << e.args[0] << R"(,"y":)" << e.args[1] << "}";
+      }
+      ofs << "}";
+    }
+  }
+  ofs << "\n]}\n";
+  return not ofs.fail();
+}
+
+}  // namespace rt3
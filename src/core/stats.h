@@ -0,0 +1,96 @@
+#ifndef STATS_H
+#define STATS_H 1
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace rt3 {
+
+/*!
+ * Run statistics: event counters, phase timers and an optional trace.
+ *
+ * Every thread updates its own block of counters and timers, with plain
+ * (non-atomic) adds, and the blocks are only merged when the report is
+ * printed. The hot paths therefore pay for an add per batch of rays, and a
+ * pair of clock reads per timed scope (a tile, a band, a whole phase); no
+ * per-ray code is instrumented.
+ *
+ * Phase times are *exclusive*: when a scope opens inside another one on the
+ * same thread (a band resolved by the worker that finished its last tile),
+ * the outer one stops counting until the inner one closes. Summed over the
+ * threads, they tell where the CPU time went.
+ *
+ * With tracing on (`--trace <file>`), every scope is also recorded as a
+ * complete event of the Chrome trace format, which `chrome://tracing` and
+ * Perfetto display as one lane per thread.
+ */
+
+/// What the counters count.
+enum class counter_e : int {
+  RAYS = 0,   //!< Rays sent through the scene.
+  SAMPLES,    //!< Camera samples added to the film.
+  TILES,      //!< Tiles rendered, refinement passes included.
+  RENDER_NS,  //!< Wall time of the render loops, in nanoseconds.
+  N_COUNTERS
+};
+
+/// Where time goes.
+enum class phase_e : int {
+  PARSE = 0,    //!< Reading the scene file.
+  SCENE_BUILD,  //!< Background and accelerator.
+  RENDER,       //!< The render loop: tracing and shading.
+  RESOLVE,      //!< Film sums to integer samples.
+  ENCODE,       //!< Handing rows to the writer: PNG filtering and deflate, PPM text.
+  WRITE,        //!< Closing the image file and the buffer cache.
+  N_PHASES
+};
+
+/// Clears every thread's counters and timers, e.g. before a new scene.
+void stats_reset();
+/// Turns the recording of trace events on or off.
+void stats_enable_trace(bool on);
+/// Drops the trace events recorded so far, e.g. once they are written. Like
+/// `stats_reset()`, only between renders, with no other thread timing.
+void stats_clear_trace();
+
+/// Adds `n` to counter `c` of the calling thread.
+void stats_add(counter_e c, uint64_t n = 1);
+/// Files a tile that took `ms` milliseconds into the tile time histogram.
+void stats_record_tile(double ms);
+
+/// Prints the merged counters, phase times, tile histogram and peak memory.
+void stats_print_report();
+/// Writes every trace event recorded so far to `filename` (Chrome trace JSON).
+bool stats_write_trace(const std::string &filename);
+
+/// Peak resident memory of the process, in bytes; `0` where unknown.
+size_t peak_memory_bytes();
+
+/*!
+ * Times its own lifetime into phase `phase` of the calling thread. `name`
+ * (a string literal) labels the trace event, and may carry up to two
+ * integer arguments, e.g. the tile's corner.
+ */
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(phase_e phase, const char *name = nullptr, int arg0 = -1, int arg1 = -1);
+  ~ScopedTimer();
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  phase_e m_phase;
+  const char *m_name;
+  int m_args[2];
+  clock::time_point m_start;   //!< When the scope opened (for the trace).
+  clock::time_point m_resume;  //!< When it last started counting.
+  clock::duration m_self{ 0 };  //!< Time counted so far.
+  ScopedTimer *m_parent;        //!< Enclosing scope of this thread, if any.
+};
+
+}  // namespace rt3
+
+#endif  // STATS_H
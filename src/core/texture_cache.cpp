@@ -0,0 +1,361 @@
+#include "texture_cache.h"
+#include "error.h"
+#include "image_io.h"
+
+#include "mapped_file.h"
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+
+namespace rt3 {
+
+namespace {
+constexpr char sidecar_magic[4]{ 'R', 'T', '3', 'T' };
+constexpr uint32_t sidecar_version{ 2 };
+constexpr uint32_t byte_order_mark{ 0x01020304 };
+constexpr size_t data_alignment{ 64 };
+constexpr size_t tile_floats{ size_t(texture_tile_size) * texture_tile_size * 3 };
+
+/*
+ * Layout of a `.rt3tex` file (native byte order):
+ *
+ *     header:  "RT3T", version, byte-order mark, tile size, #levels,
+ *              size and modification time of the image file, size of
+ *              the texel data
+ *     levels:  width and height of each level
+ *     texels:  from the next 64-byte boundary on, the tiles of each level,
+ *              row by row, `texture_tile_size`² RGB floats each
+ */
+struct SidecarHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t tile_size;
+  uint32_t n_levels;
+  uint32_t unused;
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint64_t data_bytes;  //!< A shorter (or longer) file was not fully written.
+};
+
+/// Size and modification time of the image, to tell stale sidecars apart.
+bool source_stamp(const std::string &file, uint64_t &size, int64_t &mtime) {
+  std::error_code ec;
+  size = std::filesystem::file_size(file, ec);
+  if (ec) return false;
+  auto time = std::filesystem::last_write_time(file, ec);
+  if (ec) return false;
+  mtime = int64_t(time.time_since_epoch().count());
+  return true;
+}
+
+/// Dimensions of every mip level of a `width` x `height` image, and where
+/// its tiles start in the texel data.
+std::vector<Texture::Level> pyramid_levels(int width, int height) {
+  std::vector<Texture::Level> levels;
+  uint64_t offset{ 0 };
+  for (;;) {
+    Texture::Level l{ width, height, (width + texture_tile_size - 1) / texture_tile_size,
+                      (height + texture_tile_size - 1) / texture_tile_size, offset };
+    levels.push_back(l);
+    offset += uint64_t(l.tiles_x) * uint64_t(l.tiles_y) * tile_floats * sizeof(float);
+    if (width == 1 and height == 1) {
+      break;
+    }
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+  }
+  return levels;
+}
+
+/// Bytes of texel data of a pyramid.
+uint64_t pyramid_bytes(const std::vector<Texture::Level> &levels) {
+  const auto &last = levels.back();
+  return last.offset + uint64_t(last.tiles_x) * uint64_t(last.tiles_y) * tile_floats * sizeof(float);
+}
+
+size_t data_offset(size_t n_levels) {
+  size_t end = sizeof(SidecarHeader) + n_levels * 2 * sizeof(uint32_t);
+  return (end + data_alignment - 1) / data_alignment * data_alignment;
+}
+
+/// Next mip level: 2x2 box filter, with the last row/column repeated for
+/// odd sizes.
+std::vector<float> downsample(const std::vector<float> &src, int w, int h, int nw, int nh) {
+  std::vector<float> dst(size_t(nw) * size_t(nh) * 3);
+  for (int y{ 0 }; y < nh; ++y) {
+    const int y0{ std::min(2 * y, h - 1) }, y1{ std::min(2 * y + 1, h - 1) };
+    for (int x{ 0 }; x < nw; ++x) {
+      const int x0{ std::min(2 * x, w - 1) }, x1{ std::min(2 * x + 1, w - 1) };
+      for (int c{ 0 }; c < 3; ++c) {
+        dst[(size_t(y) * nw + x) * 3 + c] =
+            0.25f * (src[(size_t(y0) * w + x0) * 3 + c] + src[(size_t(y0) * w + x1) * 3 + c]
+                     + src[(size_t(y1) * w + x0) * 3 + c] + src[(size_t(y1) * w + x1) * 3 + c]);
+      }
+    }
+  }
+  return dst;
+}
+
+/// Cuts the image into tiles, level by level, and hands them to `emit` in
+/// sidecar order.
+template <typename F>
+void build_pyramid(std::vector<float> image, const std::vector<Texture::Level> &levels, F &&emit) {
+  std::vector<float> tile(tile_floats);
+  for (size_t l{ 0 }; l < levels.size(); ++l) {
+    const auto &lv = levels[l];
+    if (l > 0) {
+      const auto &prev = levels[l - 1];
+      image = downsample(image, prev.width, prev.height, lv.width, lv.height);
+    }
+    for (int ty{ 0 }; ty < lv.tiles_y; ++ty) {
+      for (int tx{ 0 }; tx < lv.tiles_x; ++tx) {
+        for (int y{ 0 }; y < texture_tile_size; ++y) {
+          const int sy{ std::min(ty * texture_tile_size + y, lv.height - 1) };
+          for (int x{ 0 }; x < texture_tile_size; ++x) {
+            const int sx{ std::min(tx * texture_tile_size + x, lv.width - 1) };
+            std::memcpy(&tile[(size_t(y) * texture_tile_size + x) * 3],
+                        &image[(size_t(sy) * lv.width + sx) * 3], 3 * sizeof(float));
+          }
+        }
+        emit(tile.data());
+      }
+    }
+  }
+}
+}  // namespace
+
+std::string texture_sidecar_filename(const std::string &image_file) { return image_file + ".rt3tex"; }
+
+int Texture::level_for(float texels) const {
+  if (not(texels > 1.f)) {
+    return 0;
+  }
+  return std::min(int(std::log2(texels)), n_levels() - 1);
+}
+
+TextureCache::Stats TextureCache::stats() const {
+  Stats s;
+  s.hits = m_hits;
+  s.misses = m_misses;
+  s.evictions = m_evictions;
+  std::lock_guard<std::mutex> lock{ m_mutex };
+  s.bytes_used = m_bytes_used;
+  return s;
+}
+
+const Texture *TextureCache::texture(const std::string &filename) {
+  std::lock_guard<std::mutex> lock{ m_mutex };
+  if (auto it = m_textures.find(filename); it != m_textures.end()) {
+    return it->second.get();
+  }
+  uint64_t size{ 0 };
+  int64_t mtime{ 0 };
+  if (not source_stamp(filename, size, mtime)) {
+    RT3_WARNING("Could not find texture \"" + filename + "\".");
+    return nullptr;
+  }
+  auto tex = std::make_unique<Texture>();
+  tex->m_filename = filename;
+  tex->m_id = uint32_t(m_textures.size());
+  const std::string sidecar{ texture_sidecar_filename(filename) };
+
+  // A sidecar written from the image as it is now needs no decoding at all.
+  tex->m_sidecar.open(sidecar, std::ios::in | std::ios::binary);
+  SidecarHeader header;
+  if (tex->m_sidecar.read(reinterpret_cast<char *>(&header), sizeof(header))
+      and std::memcmp(header.magic, sidecar_magic, 4) == 0 and header.version == sidecar_version
+      and header.byte_order == byte_order_mark and header.tile_size == texture_tile_size
+      and header.source_size == size and header.source_mtime == mtime and header.n_levels > 0) {
+    std::vector<uint32_t> dims(2 * size_t(header.n_levels));
+    tex->m_sidecar.read(reinterpret_cast<char *>(dims.data()),
+                        std::streamsize(dims.size() * sizeof(uint32_t)));
+    tex->m_levels = pyramid_levels(int(dims[0]), int(dims[1]));
+    std::error_code ec;
+    const uint64_t file_bytes{ std::filesystem::file_size(sidecar, ec) };
+    if (tex->m_sidecar and tex->m_levels.size() == header.n_levels
+        and header.data_bytes == pyramid_bytes(tex->m_levels) and not ec
+        and file_bytes == data_offset(tex->m_levels.size()) + header.data_bytes) {
+      m_textures[filename] = std::move(tex);
+      return m_textures[filename].get();
+    }
+  }
+  tex->m_sidecar.close();
+
+  std::vector<float> image;
+  int w{ 0 }, h{ 0 };
+  if (not load_image_float(filename, image, w, h) or w <= 0 or h <= 0) {
+    RT3_WARNING("Could not decode texture \"" + filename + "\".");
+    return nullptr;
+  }
+  tex->m_levels = pyramid_levels(w, h);
+  RT3_MESSAGE("    Building texture pyramid for \"" + filename + "\" (" + std::to_string(w) + " x "
+              + std::to_string(h) + ", " + std::to_string(tex->m_levels.size()) + " levels).\n");
+
+  // Written under a temporary name of its own, so a concurrent render never
+  // reads a half-written sidecar.
+  const std::string tmp{ unique_temp_file(sidecar) };
+  bool written{ false };
+  if (not tmp.empty()) {
+    std::ofstream ofs{ tmp, std::ios::out | std::ios::binary | std::ios::trunc };
+    if (ofs) {
+      SidecarHeader hdr{};
+      std::memcpy(hdr.magic, sidecar_magic, 4);
+      hdr.version = sidecar_version;
+      hdr.byte_order = byte_order_mark;
+      hdr.tile_size = texture_tile_size;
+      hdr.n_levels = uint32_t(tex->m_levels.size());
+      hdr.source_size = size;
+      hdr.source_mtime = mtime;
+      hdr.data_bytes = pyramid_bytes(tex->m_levels);
+      ofs.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+      for (const auto &lv : tex->m_levels) {
+        const uint32_t dims[2]{ uint32_t(lv.width), uint32_t(lv.height) };
+        ofs.write(reinterpret_cast<const char *>(dims), sizeof(dims));
+      }
+      const size_t pad{ data_offset(tex->m_levels.size()) - size_t(ofs.tellp()) };
+      const char zeros[data_alignment]{};
+      ofs.write(zeros, std::streamsize(pad));
+      build_pyramid(std::move(image), tex->m_levels, [&](const float *tile) {
+        ofs.write(reinterpret_cast<const char *>(tile), tile_floats * sizeof(float));
+      });
+      written = bool(ofs);
+    }
+  }
+  std::error_code ec;
+  if (written) {
+    std::filesystem::rename(tmp, sidecar, ec);
+    written = not ec;
+  }
+  if (written) {
+    tex->m_sidecar.open(sidecar, std::ios::in | std::ios::binary);
+    written = bool(tex->m_sidecar);
+  }
+  if (not written) {
+    if (not tmp.empty()) {
+      std::filesystem::remove(tmp, ec);
+    }
+    RT3_WARNING("Could not write texture sidecar \"" + sidecar
+                + "\"; keeping the whole texture in memory.");
+    if (image.empty()) {
+      // It was moved into the writer; decode it again.
+      load_image_float(filename, image, w, h);
+    }
+    build_pyramid(std::move(image), tex->m_levels, [&](const float *tile) {
+      tex->m_resident.insert(tex->m_resident.end(), tile, tile + tile_floats);
+    });
+  }
+  m_textures[filename] = std::move(tex);
+  return m_textures[filename].get();
+}
+
+std::shared_ptr<TextureTile> TextureCache::load_tile(const Texture &tex, int level, int tx, int ty) {
+  auto tile = std::make_shared<TextureTile>();
+  const auto &lv = tex.level(level);
+  const uint64_t offset{ lv.offset
+                         + (uint64_t(ty) * uint64_t(lv.tiles_x) + uint64_t(tx)) * sizeof(TextureTile) };
+  if (not tex.m_resident.empty()) {
+    std::memcpy(tile->texels, &tex.m_resident[offset / sizeof(float)], sizeof(TextureTile));
+    return tile;
+  }
+  std::lock_guard<std::mutex> lock{ tex.m_sidecar_mutex };
+  tex.m_sidecar.seekg(std::streamoff(data_offset(tex.m_levels.size()) + offset));
+  if (not tex.m_sidecar.read(reinterpret_cast<char *>(tile->texels), sizeof(TextureTile))) {
+    // A truncated sidecar: black texels, and one warning per texture.
+    tex.m_sidecar.clear();
+    std::fill(std::begin(tile->texels), std::end(tile->texels), 0.f);
+    if (not tex.m_read_failed) {
+      tex.m_read_failed = true;
+      RT3_WARNING("Could not read from texture sidecar of \"" + tex.m_filename + "\".");
+    }
+  }
+  return tile;
+}
+
+TileHandle TextureCache::tile(const Texture &tex, int level, int tx, int ty) {
+  const uint64_t key{ tile_key(tex, level, tx, ty) };
+  {
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    if (auto it = m_index.find(key); it != m_index.end()) {
+      m_lru.splice(m_lru.begin(), m_lru, it->second);
+      ++m_hits;
+      return it->second->tile;
+    }
+  }
+  // Read without holding the lock; two threads may load the same tile, in
+  // which case the first one to get back wins.
+  TileHandle tile{ load_tile(tex, level, tx, ty) };
+  ++m_misses;
+  std::lock_guard<std::mutex> lock{ m_mutex };
+  if (auto it = m_index.find(key); it != m_index.end()) {
+    return it->second->tile;
+  }
+  m_lru.push_front(Entry{ key, tile });
+  m_index[key] = m_lru.begin();
+  m_bytes_used += sizeof(TextureTile);
+  while (m_bytes_used > m_capacity and m_lru.size() > 1) {
+    m_index.erase(m_lru.back().key);
+    m_lru.pop_back();
+    m_bytes_used -= sizeof(TextureTile);
+    ++m_evictions;
+  }
+  return tile;
+}
+
+const float *TextureSampler::texel(int level, int x, int y) {
+  const int tx{ x / texture_tile_size }, ty{ y / texture_tile_size };
+  const uint64_t id{ uint64_t(level) << 40 | uint64_t(ty) << 20 | uint64_t(tx) };
+  if (id != m_tile_id) {
+    m_tile = m_cache.tile(m_tex, level, tx, ty);
+    m_tile_id = id;
+  }
+  const int lx{ x % texture_tile_size }, ly{ y % texture_tile_size };
+  return &m_tile->texels[(size_t(ly) * texture_tile_size + lx) * 3];
+}
+
+Spectrum TextureSampler::lookup(int level, float u, float v, bool wrap_u) {
+  const auto &lv = m_tex.level(level);
+  // Texel centers sit at half-integer coordinates.
+  float x = u * float(lv.width) - 0.5f;
+  float y = v * float(lv.height) - 0.5f;
+  if (not(std::isfinite(x) and std::isfinite(y))) {
+    return Spectrum{};
+  }
+  x = Clamp(x, -1.f, float(lv.width));
+  y = Clamp(y, -1.f, float(lv.height));
+  const int x0{ int(std::floor(x)) }, y0{ int(std::floor(y)) };
+  const float fx{ x - float(x0) }, fy{ y - float(y0) };
+  auto col = [&](int xi) {
+    if (wrap_u) {
+      return (xi % lv.width + lv.width) % lv.width;
+    }
+    return Clamp(xi, 0, lv.width - 1);
+  };
+  const int xa{ col(x0) }, xb{ col(x0 + 1) };
+  const int ya{ Clamp(y0, 0, lv.height - 1) }, yb{ Clamp(y0 + 1, 0, lv.height - 1) };
+  // Each texel is used before the next lookup, which may switch tiles.
+  Spectrum result;
+  const float *t00 = texel(level, xa, ya);
+  const float w00{ (1.f - fx) * (1.f - fy) };
+  for (int c{ 0 }; c < 3; ++c) {
+    result.c[c] = w00 * t00[c];
+  }
+  const float *t10 = texel(level, xb, ya);
+  const float w10{ fx * (1.f - fy) };
+  for (int c{ 0 }; c < 3; ++c) {
+    result.c[c] += w10 * t10[c];
+  }
+  const float *t01 = texel(level, xa, yb);
+  const float w01{ (1.f - fx) * fy };
+  for (int c{ 0 }; c < 3; ++c) {
+    result.c[c] += w01 * t01[c];
+  }
+  const float *t11 = texel(level, xb, yb);
+  const float w11{ fx * fy };
+  for (int c{ 0 }; c < 3; ++c) {
+    result.c[c] += w11 * t11[c];
+  }
+  return result;
+}
+}  // namespace rt3
@@ -0,0 +1,160 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H 1
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rt3.h"
+
+namespace rt3 {
+
+/// Edge length of a texture tile, in texels.
+constexpr int texture_tile_size{ 64 };
+
+/// `texture_tile_size`² RGB texels, row by row.
+struct TextureTile {
+  float texels[texture_tile_size * texture_tile_size * 3];
+};
+/// Keeps a tile alive after the cache has evicted it.
+using TileHandle = std::shared_ptr<const TextureTile>;
+
+/*!
+ * An image, as a pyramid of mip levels cut into square tiles.
+ *
+ * Level 0 is the image itself; every further level halves both dimensions
+ * (2x2 box filter), down to 1x1. Texels are RGB floats: 8-bit images are
+ * scaled to \f$[0,1]\f$, HDR images keep their values. Tiles on the right
+ * and bottom borders are padded by repeating the last texel.
+ *
+ * The texels live in a `.rt3tex` sidecar next to the image, written the
+ * first time the image is used, and are read a tile at a time through the
+ * `TextureCache`. Only the textures' metadata stays in memory.
+ */
+class Texture {
+ public:
+  /// Size of a mip level, in texels and tiles.
+  struct Level {
+    int width, height;
+    int tiles_x, tiles_y;
+    uint64_t offset;  //!< Of the level's first tile, in bytes into the texel data.
+  };
+
+  const std::string &filename() const { return m_filename; }
+  int width() const { return m_levels[0].width; }
+  int height() const { return m_levels[0].height; }
+  int n_levels() const { return int(m_levels.size()); }
+  const Level &level(int l) const { return m_levels[size_t(l)]; }
+  /// Level whose texels are about `texels` level-0 texels wide (the
+  /// footprint of a sample).
+  int level_for(float texels) const;
+
+ private:
+  friend class TextureCache;
+
+  std::string m_filename;
+  uint32_t m_id{ 0 };  //!< Part of the cache key of its tiles.
+  std::vector<Level> m_levels;
+  mutable std::ifstream m_sidecar;     //!< Tiles are read from here...
+  mutable std::mutex m_sidecar_mutex;  //!< ...one at a time.
+  mutable bool m_read_failed{ false };  //!< Already warned about a bad read.
+  /// Whole pyramid, in sidecar layout, when no sidecar could be written.
+  std::vector<float> m_resident;
+};
+
+/*!
+ * Tiles of the textures in use, loaded on first access.
+ *
+ * The cache keeps at most `capacity` bytes of tiles; when a new tile does
+ * not fit, the least recently used ones are dropped. Tiles are handed out
+ * as shared pointers, so a tile still held by a sampler outlives its
+ * eviction. Lookups and loads may come from any thread: the LRU list is
+ * behind a mutex, which is not held while a tile is read from disk.
+ *
+ * Textures themselves are never evicted (only their tiles are), so
+ * `Texture` pointers stay valid for the life of the cache. The cache
+ * survives `API::reset_engine()`: the scenes of a batch job (see `--jobs`)
+ * that share an environment map load its tiles once.
+ */
+class TextureCache {
+ public:
+  /// Counters since the cache was created.
+  struct Stats {
+    uint64_t hits{ 0 };       //!< Tiles found in the cache.
+    uint64_t misses{ 0 };     //!< Tiles read from a sidecar.
+    uint64_t evictions{ 0 };  //!< Tiles dropped to make room.
+    size_t bytes_used{ 0 };   //!< Tile memory held right now.
+  };
+
+  explicit TextureCache(size_t capacity_bytes) : m_capacity{ capacity_bytes } {}
+  TextureCache(const TextureCache &) = delete;
+  TextureCache &operator=(const TextureCache &) = delete;
+
+  size_t capacity() const { return m_capacity; }
+  Stats stats() const;
+
+  /// The texture of image file `filename`, building (or refreshing) its
+  /// sidecar if needed; `nullptr` if the image cannot be read.
+  const Texture *texture(const std::string &filename);
+  /// Tile `(tx, ty)` of mip level `level`.
+  TileHandle tile(const Texture &tex, int level, int tx, int ty);
+
+ private:
+  /// A cached tile, in the LRU list (most recently used first).
+  struct Entry {
+    uint64_t key;
+    TileHandle tile;
+  };
+  static uint64_t tile_key(const Texture &tex, int level, int tx, int ty) {
+    return uint64_t(tex.m_id) << 48 | uint64_t(level) << 40 | uint64_t(ty) << 20 | uint64_t(tx);
+  }
+  /// Reads a tile from the texture's sidecar (or resident copy).
+  static std::shared_ptr<TextureTile> load_tile(const Texture &tex, int level, int tx, int ty);
+
+  const size_t m_capacity;
+  mutable std::mutex m_mutex;
+  std::list<Entry> m_lru;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+  size_t m_bytes_used{ 0 };
+  std::unordered_map<std::string, std::unique_ptr<Texture>> m_textures;
+  std::atomic<uint64_t> m_hits{ 0 }, m_misses{ 0 }, m_evictions{ 0 };
+};
+
+/*!
+ * Bilinear lookups into one texture. It remembers the last tile it used,
+ * so neighboring lookups (the four texels of a bilinear lookup, the pixels
+ * of a span) rarely go to the cache. Cheap to create; meant to live on the
+ * stack of a single thread.
+ */
+class TextureSampler {
+ public:
+  TextureSampler(TextureCache &cache, const Texture &tex) : m_cache{ cache }, m_tex{ tex } {}
+
+  /*!
+   * Bilinear lookup at \f$(u, v) \in [0,1]^2\f$ of mip level `level`
+   * (\f$v\f$ grows downwards). `wrap_u` repeats the texture horizontally,
+   * as spherical mappings need; otherwise coordinates are clamped to the
+   * borders.
+   */
+  Spectrum lookup(int level, float u, float v, bool wrap_u);
+
+ private:
+  const float *texel(int level, int x, int y);
+
+  TextureCache &m_cache;
+  const Texture &m_tex;
+  TileHandle m_tile;  //!< Last tile used...
+  uint64_t m_tile_id{ ~uint64_t{ 0 } };  //!< ...and which one it is.
+};
+
+/// Sidecar file that goes with `image_file` (a `.rt3tex` file).
+std::string texture_sidecar_filename(const std::string &image_file);
+}  // namespace rt3
+
+#endif  // TEXTURE_CACHE_H
@@ -0,0 +1,183 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace rt3 {
+
+/// Index of the worker running on this thread; -1 for non-pool threads.
+static thread_local int t_worker_index{ -1 };
+/// The pool that worker belongs to.
+static thread_local const ThreadPool *t_worker_pool{ nullptr };
+
+size_t ThreadPool::resolve_thread_count(size_t n_threads) {
+  if (n_threads == 0) {
+    n_threads = std::thread::hardware_concurrency();
+  }
+  return std::max<size_t>(1, n_threads);
+}
+
+ThreadPool::ThreadPool(size_t n_threads, const char *name) : m_name{ name } {
+  n_threads = resolve_thread_count(n_threads);
+  for (size_t i{ 0 }; i < n_threads; ++i) {
+    m_queues.push_back(std::make_unique<WorkQueue>());
+  }
+  for (size_t i{ 0 }; i < n_threads; ++i) {
+    m_workers.emplace_back(&ThreadPool::worker_loop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_sleep_mtx);
+    m_stop = true;
+  }
+  m_wake_cv.notify_all();
+  for (auto &t : m_workers) {
+    t.join();
+  }
+}
+
+int ThreadPool::worker_index() { return t_worker_index; }
+
+const char *ThreadPool::worker_name() { return t_worker_pool ? t_worker_pool->m_name : nullptr; }
+
+int ThreadPool::own_queue() const { return t_worker_pool == this ? t_worker_index : -1; }
+
+size_t ThreadPool::next_queue() {
+  // Workers keep the work they spawn local; other threads deal round-robin.
+  if (own_queue() >= 0) {
+    return size_t(own_queue());
+  }
+  return m_round_robin.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+}
+
+void ThreadPool::push(size_t queue_idx, Task task) {
+  {
+    std::lock_guard<std::mutex> lock(m_queues[queue_idx]->mtx);
+    m_queues[queue_idx]->tasks.push_back(std::move(task));
+  }
+  m_pending.fetch_add(1);
+  {
+    // Taking the lock here avoids a lost wake-up between a worker checking
+    // `m_pending` and going to sleep.
+    std::lock_guard<std::mutex> lock(m_sleep_mtx);
+  }
+  m_wake_cv.notify_one();
+}
+
+bool ThreadPool::try_pop(int own, Task &task) {
+  if (m_pending.load() == 0) {
+    return false;
+  }
+  const size_t n_queues{ m_queues.size() };
+  // [1] Our own queue, from the front (oldest, most local work first).
+  if (own >= 0) {
+    auto &q = *m_queues[own];
+    std::lock_guard<std::mutex> lock(q.mtx);
+    if (not q.tasks.empty()) {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+      m_pending.fetch_sub(1);
+      return true;
+    }
+  }
+  // [2] Steal from the back of somebody else's queue.
+  const size_t start = own >= 0 ? size_t(own) + 1 : 0;
+  for (size_t k{ 0 }; k < n_queues; ++k) {
+    size_t victim = (start + k) % n_queues;
+    if (int(victim) == own) {
+      continue;
+    }
+    auto &q = *m_queues[victim];
+    std::lock_guard<std::mutex> lock(q.mtx);
+    if (not q.tasks.empty()) {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+      m_pending.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::help_one() {
+  Task task;
+  if (try_pop(own_queue(), task)) {
+    task();
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::worker_loop(size_t index) {
+  t_worker_index = int(index);
+  t_worker_pool = this;
+  for (;;) {
+    Task task;
+    if (try_pop(int(index), task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_sleep_mtx);
+    m_wake_cv.wait(lock, [this]() { return m_stop or m_pending.load() > 0; });
+    if (m_stop and m_pending.load() == 0) {
+      return;
+    }
+  }
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)> &fn) {
+  if (count == 0) {
+    return;
+  }
+  // Shared completion state for this batch of tasks. The tasks hold a
+  // reference to it, so the last one to finish may safely notify even if the
+  // caller has already returned.
+  struct Group {
+    std::atomic<size_t> remaining;
+    std::mutex mtx;
+    std::condition_variable done_cv;
+  };
+  auto group = std::make_shared<Group>();
+  group->remaining = count;
+
+  // Deal contiguous chunks of indices to each queue.
+  const size_t n_queues{ m_queues.size() };
+  for (size_t q{ 0 }; q < n_queues; ++q) {
+    size_t first = q * count / n_queues;
+    size_t last = (q + 1) * count / n_queues;
+    if (first == last) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_queues[q]->mtx);
+      for (size_t i{ first }; i < last; ++i) {
+        m_queues[q]->tasks.push_back([&fn, group, i]() {
+          fn(i);
+          if (group->remaining.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(group->mtx);
+            group->done_cv.notify_all();
+          }
+        });
+      }
+    }
+    m_pending.fetch_add(last - first);
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_sleep_mtx);
+  }
+  m_wake_cv.notify_all();
+
+  // Help out while waiting for the batch to finish.
+  Task task;
+  while (group->remaining.load() > 0) {
+    if (try_pop(own_queue(), task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(group->mtx);
+    group->done_cv.wait(lock, [&group]() { return group->remaining.load() == 0; });
+  }
+}
+
+}  // namespace rt3
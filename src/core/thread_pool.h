@@ -0,0 +1,106 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H 1
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rt3 {
+
+/*!
+ * A persistent pool of worker threads with work stealing.
+ *
+ * Each worker owns a double-ended queue of tasks. A worker pops tasks from
+ * the front of its own queue and, once it runs dry, steals tasks from the
+ * back of the other workers' queues. That way, a worker stuck on an expensive
+ * task does not keep the others waiting while its queue still holds work.
+ *
+ * The pool is meant to be created once (see `API::init_engine()`) and reused
+ * across several renders, so we do not pay for thread creation every frame.
+ */
+class ThreadPool {
+ public:
+  using Task = std::function<void()>;
+
+  /// Creates `n_threads` workers; `0` means one per hardware thread. `name`
+  /// (a literal) tells the workers of different pools apart, e.g. in traces.
+  explicit ThreadPool(size_t n_threads = 0, const char *name = "worker");
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /// Number of worker threads.
+  size_t size() const { return m_workers.size(); }
+
+  /*!
+   * Runs `fn(i)` for every `i` in `[0,count)` and returns when all of them
+   * are done. Indices are dealt to the workers in contiguous chunks, so
+   * neighboring indices (e.g. adjacent tiles) tend to run on the same thread.
+   * The calling thread helps running tasks while it waits, which makes it
+   * safe to call `parallel_for()` from inside a task.
+   */
+  void parallel_for(size_t count, const std::function<void(size_t)> &fn);
+
+  /// Submits a single task and returns a future to its result.
+  template <typename F> auto async(F &&fn) -> std::future<decltype(fn())> {
+    using R = decltype(fn());
+    auto job = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+    std::future<R> result = job->get_future();
+    push(next_queue(), [job]() { (*job)(); });
+    return result;
+  }
+
+  /*!
+   * Runs one queued task on the calling thread, if there is any. Threads
+   * that need to wait on a task's future should call this in a loop first:
+   * if it returns `false`, every queued task has been picked up, so waiting
+   * cannot deadlock.
+   */
+  bool help_one();
+
+  /// Index of the calling worker in `[0,size())`, or `-1` if the caller is not
+  /// one of the pool's threads.
+  static int worker_index();
+  /// Name of the pool the calling worker belongs to, or `nullptr`.
+  static const char *worker_name();
+
+  /// Resolves the `0 = automatic` convention for thread counts.
+  static size_t resolve_thread_count(size_t n_threads);
+
+ private:
+  /// A worker's own task queue.
+  struct WorkQueue {
+    std::mutex mtx;
+    std::deque<Task> tasks;
+  };
+
+  void worker_loop(size_t index);
+  void push(size_t queue_idx, Task task);
+  /// Take a task from the front of queue `own`, or steal one from the back of
+  /// any other queue.
+  bool try_pop(int own, Task &task);
+  /// Queue to receive a task submitted by the calling thread.
+  size_t next_queue();
+  /// The calling worker's queue, if it is one of ours; -1 otherwise.
+  int own_queue() const;
+
+  const char *m_name;
+  std::vector<std::unique_ptr<WorkQueue>> m_queues;
+  std::vector<std::thread> m_workers;
+  std::atomic<size_t> m_pending{ 0 };  //!< Tasks queued but not yet taken.
+  std::atomic<size_t> m_round_robin{ 0 };
+  std::mutex m_sleep_mtx;
+  std::condition_variable m_wake_cv;
+  bool m_stop{ false };
+};
+
+}  // namespace rt3
+
+#endif  // THREAD_POOL_H
@@ -0,0 +1,289 @@
+#include "wide_bvh.h"
+#include "api.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace rt3 {
+
+template <int W> WideBVHAccel<W>::RayData::RayData(const Ray &r) {
+  for (int a{0}; a < 3; ++a) {
+    org[a] = r.o[a];
+    inv[a] = 1.f / r.d[a];
+    inv_far[a] = inv[a] * slab_padding;
+    dir_is_neg[a] = inv[a] < 0;
+  }
+}
+
+template <int W>
+unsigned WideBVHAccel<W>::hit_children(const WideNode &node, const RayData &rd, float t_min,
+                                       float t_max, Floatx<W> &t_near) {
+  // One slab test for all W boxes: every line is a single SIMD operation.
+  Floatx<W> t0{t_min}, t1{t_max};
+  for (int a{0}; a < 3; ++a) {
+    const Floatx<W> org{rd.org[a]};
+    Floatx<W> near = (node.bounds[rd.dir_is_neg[a]][a] - org) * Floatx<W>{rd.inv[a]};
+    Floatx<W> far = (node.bounds[1 - rd.dir_is_neg[a]][a] - org) * Floatx<W>{rd.inv_far[a]};
+    // Argument order matters: a NaN distance (see `hit_bounds()` in
+    // bvh.cpp) must lose, so the interval stays as it was.
+    t0 = max(near, t0);
+    t1 = min(far, t1);
+  }
+  unsigned mask{0};
+  for (int i{0}; i < W; ++i) {
+    mask |= unsigned(t0.v[i] <= t1.v[i]) << i;
+  }
+  t_near = t0;
+  return mask;
+}
+
+template <int W>
+int32_t WideBVHAccel<W>::collapse(const BVHAccel &bvh, int32_t bin, int depth) {
+  const int32_t index{int32_t(m_nodes.size())};
+  m_nodes.emplace_back();
+
+  // Open up the binary subtree, largest box first, until there are W kids.
+  int32_t kids[W];
+  int n{0};
+  const auto &root = bvh.m_nodes[bin];
+  if (root.n_primitives > 0) {
+    kids[n++] = bin;  // A tree that is a single leaf.
+  } else {
+    kids[n++] = bin + 1;
+    kids[n++] = root.second_child_offset;
+  }
+  while (n < W) {
+    int best{-1};
+    float best_area{-1.f};
+    for (int i{0}; i < n; ++i) {
+      const auto &k = bvh.m_nodes[kids[i]];
+      if (k.n_primitives == 0 and k.bounds.surface_area() > best_area) {
+        best = i;
+        best_area = k.bounds.surface_area();
+      }
+    }
+    if (best < 0) {
+      break;  // Only leaves left.
+    }
+    const int32_t opened{kids[best]};
+    kids[best] = opened + 1;
+    kids[n++] = bvh.m_nodes[opened].second_child_offset;
+  }
+
+  // Unused slots get empty boxes (min above max), which every test misses.
+  WideNode node;
+  for (int m{0}; m < 2; ++m) {
+    for (int a{0}; a < 3; ++a) {
+      node.bounds[m][a] = Floatx<W>{m == 0 ? std::numeric_limits<float>::infinity()
+                                           : -std::numeric_limits<float>::infinity()};
+    }
+  }
+  std::fill(node.child, node.child + W, -1);
+  std::fill(node.count, node.count + W, uint16_t{0});
+  for (int i{0}; i < n; ++i) {
+    const auto &k = bvh.m_nodes[kids[i]];
+    for (int a{0}; a < 3; ++a) {
+      node.bounds[0][a].v[i] = k.bounds.p_min[a];
+      node.bounds[1][a].v[i] = k.bounds.p_max[a];
+    }
+    if (k.n_primitives > 0) {
+      node.child[i] = k.primitives_offset;
+      node.count[i] = k.n_primitives;
+      m_depth = std::max(m_depth, depth + 1);
+    } else {
+      node.child[i] = collapse(bvh, kids[i], depth + 1);
+    }
+  }
+  // Not a reference: the recursion above may have grown `m_nodes`.
+  m_nodes[index] = node;
+  return index;
+}
+
+template <int W>
+WideBVHAccel<W>::WideBVHAccel(std::vector<const Primitive *> prims, int max_prims_in_node,
+                              ThreadPool *pool) {
+  if (prims.empty()) {
+    return;
+  }
+  BVHAccel binary{std::move(prims), max_prims_in_node, pool};
+  m_bounds = binary.world_bounds();
+  // Each wide node replaces about W-1 binary interior nodes.
+  m_nodes.reserve(binary.node_count() / (2 * (W - 1)) + 1);
+  collapse(binary, 0, 1);
+  m_primitives = std::move(binary.m_primitives);
+}
+
+template <int W> bool WideBVHAccel<W>::intersect(const Ray &r, Surfel *sf) const {
+  if (m_nodes.empty()) {
+    return false;
+  }
+  const RayData rd{r};
+  StackEntry stack[stack_size];
+  int sp{0};
+  stack[sp++] = {0, 0, r.t_min};
+  bool hit{false};
+  while (sp > 0) {
+    const StackEntry e = stack[--sp];
+    // Entered beyond the closest hit so far: nothing nearer in there.
+    if (e.t_near > r.t_max) {
+      continue;
+    }
+    if (e.count > 0) {
+      for (int i{0}; i < e.count; ++i) {
+        hit |= m_primitives[e.child + i]->intersect(r, sf);
+      }
+      continue;
+    }
+    const WideNode &node = m_nodes[e.child];
+    Floatx<W> t_near;
+    unsigned mask = hit_children(node, rd, r.t_min, r.t_max, t_near);
+    // Push far to near, so the nearest child is popped first.
+    int order[W];
+    int m{0};
+    for (int i{0}; i < W; ++i) {
+      if (mask & (1u << i)) {
+        int j{m++};
+        for (; j > 0 and t_near.v[order[j - 1]] < t_near.v[i]; --j) {
+          order[j] = order[j - 1];
+        }
+        order[j] = i;
+      }
+    }
+    for (int j{0}; j < m; ++j) {
+      const int i{order[j]};
+      stack[sp++] = {node.child[i], node.count[i], t_near.v[i]};
+    }
+  }
+  return hit;
+}
+
+template <int W> bool WideBVHAccel<W>::intersect_p(const Ray &r) const {
+  if (m_nodes.empty()) {
+    return false;
+  }
+  const RayData rd{r};
+  StackEntry stack[stack_size];
+  int sp{0};
+  stack[sp++] = {0, 0, r.t_min};
+  while (sp > 0) {
+    const StackEntry e = stack[--sp];
+    if (e.count > 0) {
+      for (int i{0}; i < e.count; ++i) {
+        if (m_primitives[e.child + i]->intersect_p(r)) {
+          return true;
+        }
+      }
+      continue;
+    }
+    // Any hit will do, so there is no point in sorting the children.
+    const WideNode &node = m_nodes[e.child];
+    Floatx<W> t_near;
+    unsigned mask = hit_children(node, rd, r.t_min, r.t_max, t_near);
+    for (int i{0}; i < W; ++i) {
+      if (mask & (1u << i)) {
+        stack[sp++] = {node.child[i], node.count[i], t_near.v[i]};
+      }
+    }
+  }
+  return false;
+}
+
+template <int W>
+void WideBVHAccel<W>::intersect_packet(const Ray *rays, size_t n, Surfel *sf,
+                                       bool *hit) const {
+  std::fill(hit, hit + n, false);
+  if (m_nodes.empty()) {
+    return;
+  }
+  /// A subtree and the rays of the packet that still need it.
+  struct PacketEntry {
+    int32_t child;
+    uint16_t count;
+    uint32_t lanes;
+    float t_near;  //!< Nearest entry among those rays.
+  };
+  for (size_t base{0}; base < n; base += max_packet_size) {
+    const size_t n_lanes{std::min(max_packet_size, n - base)};
+    const Ray *r{rays + base};
+    RayData rd[max_packet_size];
+    for (size_t l{0}; l < n_lanes; ++l) {
+      rd[l] = RayData{r[l]};
+    }
+    PacketEntry stack[stack_size];
+    int sp{0};
+    stack[sp++] = {0, 0, uint32_t((uint64_t{1} << n_lanes) - 1), 0.f};
+    while (sp > 0) {
+      PacketEntry e = stack[--sp];
+      // Rays that already hit something nearer than the subtree drop out.
+      for (uint32_t lanes{e.lanes}; lanes != 0; lanes &= lanes - 1) {
+        const int l{__builtin_ctz(lanes)};
+        if (r[l].t_max < e.t_near) {
+          e.lanes &= ~(1u << l);
+        }
+      }
+      if (e.lanes == 0) {
+        continue;
+      }
+      if (e.count > 0) {
+        for (uint32_t lanes{e.lanes}; lanes != 0; lanes &= lanes - 1) {
+          const int l{__builtin_ctz(lanes)};
+          for (int i{0}; i < e.count; ++i) {
+            hit[base + l] |= m_primitives[e.child + i]->intersect(r[l], &sf[base + l]);
+          }
+        }
+        continue;
+      }
+      // The node is fetched once; each ray still tests all W boxes at once.
+      const WideNode &node = m_nodes[e.child];
+      uint32_t child_lanes[W] = {};
+      float child_t[W];
+      std::fill(child_t, child_t + W, std::numeric_limits<float>::infinity());
+      for (uint32_t lanes{e.lanes}; lanes != 0; lanes &= lanes - 1) {
+        const int l{__builtin_ctz(lanes)};
+        Floatx<W> t_near;
+        unsigned mask = hit_children(node, rd[l], r[l].t_min, r[l].t_max, t_near);
+        for (int i{0}; i < W; ++i) {
+          if (mask & (1u << i)) {
+            child_lanes[i] |= 1u << l;
+            child_t[i] = std::min(child_t[i], t_near.v[i]);
+          }
+        }
+      }
+      // Far to near, by the nearest entry among the packet's rays.
+      int order[W];
+      int m{0};
+      for (int i{0}; i < W; ++i) {
+        if (child_lanes[i] != 0) {
+          int j{m++};
+          for (; j > 0 and child_t[order[j - 1]] < child_t[i]; --j) {
+            order[j] = order[j - 1];
+          }
+          order[j] = i;
+        }
+      }
+      for (int j{0}; j < m; ++j) {
+        const int i{order[j]};
+        stack[sp++] = {node.child[i], node.count[i], child_lanes[i], child_t[i]};
+      }
+    }
+  }
+}
+
+template <int W>
+WideBVHAccel<W> *create_wide_bvh_accelerator(std::vector<const Primitive *> prims,
+                                             const ParamSet &ps,
+                                             ThreadPool *pool) {
+  return RT3_ARENA_ALLOC(*API::build_arena, WideBVHAccel<W>)(
+      std::move(prims), retrieve_max_prims_in_node(ps), pool);
+}
+
+// The two widths in use; everything else stays out of the header.
+template class WideBVHAccel<4>;
+template class WideBVHAccel<8>;
+template WideBVHAccel<4> *create_wide_bvh_accelerator<4>(std::vector<const Primitive *>,
+                                                         const ParamSet &,
+                                                         ThreadPool *);
+template WideBVHAccel<8> *create_wide_bvh_accelerator<8>(std::vector<const Primitive *>,
+                                                         const ParamSet &,
+                                                         ThreadPool *);
+}  // namespace rt3
@@ -0,0 +1,106 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H 1
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+#include "packet.h"
+
+namespace rt3 {
+
+/*!
+ * A BVH with `W` children per node (4 or 8), for SIMD traversal.
+ *
+ * **Build.** A binary `BVHAccel` is built first (SAH, in parallel) and then
+ * collapsed: starting from the two children of a node, the interior child
+ * with the largest surface area is repeatedly replaced by its own two
+ * children, until the node has `W` of them. Leaves are those of the binary
+ * tree. Each level of the wide tree thus swallows about log2(W) binary
+ * levels, and the tree is smaller and shallower.
+ *
+ * **Layout.** Each node stores the boxes of its `W` children in SoA form,
+ * one `Floatx<W>` per box coordinate, so a single slab test over
+ * `Floatx<W>` checks the ray against all children at once (one 128-bit
+ * register per coordinate for `W = 4`, one 256-bit register for `W = 8`).
+ * Unused slots hold empty boxes, which no ray can hit.
+ *
+ * **Traversal.** Children hit by a ray are visited nearest first, and
+ * subtrees entered beyond the closest hit found so far are skipped. Packets
+ * of coherent rays go down the tree together: each stack entry carries the
+ * mask of the rays that still need it, so a node is fetched once for the
+ * whole packet, and each ray only works on the subtrees its own box tests
+ * let through.
+ */
+template <int W> class WideBVHAccel : public AggregatePrimitive {
+ public:
+  static_assert(W == 4 or W == 8, "wide BVHs have 4 or 8 children per node");
+  /// Most rays traced together by `intersect_packet()`; one mask bit each.
+  static constexpr size_t max_packet_size{ 32 };
+
+  /// Builds the tree, on `pool` if given. `prims` must outlive the tree.
+  WideBVHAccel(std::vector<const Primitive *> prims,
+               int max_prims_in_node = BVHAccel::default_max_prims_in_node,
+               ThreadPool *pool = nullptr);
+
+  Bounds3f world_bounds() const override { return m_bounds; }
+  bool intersect(const Ray &r, Surfel *sf) const override;
+  bool intersect_p(const Ray &r) const override;
+  void intersect_packet(const Ray *rays, size_t n, Surfel *sf, bool *hit) const override;
+
+  size_t primitive_count() const { return m_primitives.size(); }
+  size_t node_count() const { return m_nodes.size(); }
+  /// Length of the longest root-to-leaf path, counting leaves.
+  int depth() const { return m_depth; }
+
+ private:
+  /// `W` child boxes, one lane per child, plus what each child is.
+  struct alignas(64) WideNode {
+    Floatx<W> bounds[2][3];  //!< [min/max][axis], lane = child.
+    int32_t child[W];        //!< Wide node index, or first primitive of a leaf.
+    uint16_t count[W];       //!< Primitives of a leaf; 0 for nodes and unused slots.
+  };
+
+  /// A subtree waiting on the traversal stack.
+  struct StackEntry {
+    int32_t child;
+    uint16_t count;  //!< As in `WideNode`: non-zero for a leaf.
+    float t_near;    //!< Where the ray enters the subtree's box.
+  };
+
+  /// What the slab tests need from a ray, computed once per ray.
+  struct RayData {
+    RayData() = default;
+    explicit RayData(const Ray &r);
+    float org[3];
+    float inv[3];      //!< Inverse direction.
+    float inv_far[3];  //!< Same, padded for the far planes.
+    int dir_is_neg[3];
+  };
+
+  /// Mask of the children of `node` whose box the ray enters within
+  /// `[t_min, t_max]`; the entry distances go to `t_near`.
+  static unsigned hit_children(const WideNode &node, const RayData &rd, float t_min, float t_max,
+                               Floatx<W> &t_near);
+  /// Converts the binary subtree at `bin` into wide nodes; returns the root.
+  int32_t collapse(const BVHAccel &bvh, int32_t bin, int depth);
+
+  std::vector<const Primitive *> m_primitives;  //!< In leaf order.
+  std::vector<WideNode> m_nodes;
+  Bounds3f m_bounds;
+  int m_depth{ 0 };
+  /// Stack size that covers any tree collapsed from a valid binary BVH.
+  static constexpr int stack_size{ 64 * (W - 1) + 1 };
+};
+
+using BVH4Accel = WideBVHAccel<4>;
+using BVH8Accel = WideBVHAccel<8>;
+
+// factory pattern functions.
+template <int W>
+WideBVHAccel<W> *create_wide_bvh_accelerator(std::vector<const Primitive *> prims,
+                                             const ParamSet &ps,
+                                             ThreadPool *pool);
+}  // namespace rt3
+
+#endif  // WIDE_BVH_H
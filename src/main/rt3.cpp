@@ -1,3 +1,11 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream> // std::cout, std::cerr
 using std::ifstream;
@@ -7,8 +15,16 @@ using std::ostringstream;
 using std::string;
 
 #include "../core/api.h"
+#include "../core/distributed.h"
 #include "../core/rt3.h"
 #include "../core/error.h"
+#include "../core/thread_pool.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace rt3;
 
@@ -24,17 +40,110 @@ void usage(const char *msg = nullptr) {
     std::cout << "RT3: " << msg << "\n\n";
   }
 
-  std::cout << "Usage: rt3 [<options>] <input_scene_file>\n"
+  std::cout << "Usage: rt3 [<options>] <input_scene_file> [<more scene files>...]\n"
             << "  Rendering simulation options:\n"
             << "    --help                     Print this help text.\n"
-            << "    --cropwindow <x0,x1,y0,y1> Specify an image crop window.\n"
-            << "    --quick                    Reduces quality parameters to "
-               "render image quickly.\n"
+            << "    --cropwindow <x0 x1 y0 y1> Specify an image crop window.\n"
+            << "    --incremental              Re-render only the crop window "
+               "over the previous\n"
+            << "                               output (or its .rt3buf cache).\n"
+            << "    --quick                    Render progressively: write a "
+               "coarse preview first,\n"
+            << "                               then refine to full "
+               "resolution.\n"
+            << "    --time-budget <ms>         Stop refining --quick renders "
+               "after <ms> milliseconds.\n"
+            << "    --threads <n>              Number of render threads "
+               "(0 = one per core).\n"
             << "    --outfile <filename>       Write the rendered image to "
-               "<filename>.\n\n";
+               "<filename>.\n"
+            << "    --resolution <w> <h>       Render at <w> x <h> pixels, "
+               "overriding the scene file.\n"
+            << "    --png-compression <0-9>    PNG deflate level, overrides "
+               "the scene file.\n"
+            << "    --verbose <0-3>            Debug log level: 1 = entities, "
+               "2 = parser,\n"
+            << "                               3 = everything. Default is 0 "
+               "(silent).\n"
+            << "    --cache-scene              Reuse (or create) a binary "
+               "<scene>.rt3c cache\n"
+            << "                               instead of parsing the XML.\n"
+            << "    --batch <list|dir>         Also render every scene listed "
+               "in a file\n"
+            << "                               (one per line) or every .xml "
+               "in a directory.\n"
+            << "    --jobs <n>                 Render <n> scenes at the same "
+               "time (batch mode).\n"
+            << "    --mmap                     Write ppm6 images through a "
+               "memory-mapped file.\n"
+            << "    --texture-cache-mb <n>     Memory for image background "
+               "tiles, in MiB.\n"
+            << "                               Default is 512.\n"
+            << "    --trace <file>             Write a Chrome trace (JSON) of "
+               "the run to <file>,\n"
+            << "                               for chrome://tracing or "
+               "Perfetto.\n"
+            << "    --coordinator <port>       Share the render with the "
+               "workers that connect\n"
+            << "                               to <port>.\n"
+            << "    --worker <host:port>       Render tiles for the "
+               "coordinator at <host:port>;\n"
+            << "                               the scene comes from the "
+               "coordinator.\n"
+            << "    --server <port>            Keep the scene loaded and "
+               "render the edits sent\n"
+            << "                               to <port>, streaming tiles "
+               "back.\n\n";
   exit(msg != nullptr ? 1 : 0);
 }
 
+/// The value `text` given to `option`, which must be a number of type `T`
+/// and nothing else; anything else ends the program through `usage()`.
+template <typename T> static T option_value(const char *text, const char *option) {
+  T value{};
+  const char *end = text + std::strlen(text);
+  auto [ptr, ec] = std::from_chars(text, end, value);
+  if (ec != std::errc{} or ptr != end or ptr == text) {
+    const std::string msg{std::string{"invalid value for "} + option + ": \"" + text + "\""};
+    usage(msg.c_str());
+  }
+  return value;
+}
+
+/// Appends the scenes of a batch to `scenes`: every `.xml` file of a
+/// directory (sorted by name), or every line of a list file (blank lines and
+/// lines starting with `#` are skipped).
+static void add_batch(const std::string &batch,
+                      std::vector<std::string> &scenes) {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  if (fs::is_directory(batch, ec)) {
+    std::vector<std::string> found;
+    for (const auto &entry : fs::directory_iterator(batch, ec)) {
+      if (entry.is_regular_file() and entry.path().extension() == ".xml") {
+        found.push_back(entry.path().string());
+      }
+    }
+    std::sort(found.begin(), found.end());
+    scenes.insert(scenes.end(), found.begin(), found.end());
+    return;
+  }
+  std::ifstream list{batch};
+  if (not list.is_open()) {
+    usage("could not open --batch list or directory");
+  }
+  std::string line;
+  while (std::getline(list, line)) {
+    // Trim surrounding blanks.
+    auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos or line[first] == '#') {
+      continue;
+    }
+    auto last = line.find_last_not_of(" \t\r");
+    scenes.push_back(line.substr(first, last - first + 1));
+  }
+}
+
 RunningOptions cli_parser(int argc, char *argv[]) {
   RunningOptions opt; // Stores incoming arguments.
   // Prepare to parse input argumnts.
@@ -47,10 +156,10 @@ RunningOptions cli_parser(int argc, char *argv[]) {
         usage("missing value after --cropwindow argument");
       }
       // Get crop values.
-      opt.crop_window[0][0] = std::stof(argv[++i]);
-      opt.crop_window[0][1] = std::stof(argv[++i]);
-      opt.crop_window[1][0] = std::stof(argv[++i]);
-      opt.crop_window[1][1] = std::stof(argv[++i]);
+      opt.crop_window[0][0] = option_value<real_type>(argv[++i], "--cropwindow");
+      opt.crop_window[0][1] = option_value<real_type>(argv[++i], "--cropwindow");
+      opt.crop_window[1][0] = option_value<real_type>(argv[++i], "--cropwindow");
+      opt.crop_window[1][1] = option_value<real_type>(argv[++i], "--cropwindow");
     } else if (option == "--outfile" or option == "-outfile" or
                option == "-o") {
       if (i + 1 == argc) { // The option's argument is missing.
@@ -58,27 +167,356 @@ RunningOptions cli_parser(int argc, char *argv[]) {
       }
       // Get output image file name.
       opt.outfile = std::string{argv[++i]};
+    } else if (option == "--resolution" or option == "-resolution") {
+      if (i + 2 >= argc) { // The option's arguments are missing.
+        usage("missing values after --resolution argument");
+      }
+      opt.resolution[0] = option_value<int>(argv[++i], "--resolution");
+      opt.resolution[1] = option_value<int>(argv[++i], "--resolution");
+      if (opt.resolution[0] <= 0 or opt.resolution[1] <= 0) {
+        usage("--resolution needs two positive values");
+      }
     } else if (option == "--quickrender" or option == "-quickrender" or
                option == "-q" or option == "--quick" or option == "-quick") {
       opt.quick_render = true;
+    } else if (option == "--time-budget" or option == "-time-budget") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --time-budget argument");
+      }
+      opt.time_budget_ms = option_value<double>(argv[++i], "--time-budget");
+    } else if (option == "--threads" or option == "-threads" or
+               option == "-t") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --threads argument");
+      }
+      opt.n_threads = option_value<size_t>(argv[++i], "--threads");
+    } else if (option == "--png-compression" or
+               option == "-png-compression") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --png-compression argument");
+      }
+      opt.png_compression = option_value<int>(argv[++i], "--png-compression");
+      if (opt.png_compression < 0 or opt.png_compression > 9) {
+        usage("--png-compression must be in [0,9]");
+      }
+    } else if (option == "--incremental" or option == "-incremental") {
+      opt.incremental = true;
+    } else if (option == "--verbose" or option == "-verbose" or
+               option == "-v") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --verbose argument");
+      }
+      opt.verbose = option_value<int>(argv[++i], "--verbose");
+    } else if (option == "--cache-scene" or option == "-cache-scene") {
+      opt.cache_scene = true;
+    } else if (option == "--batch" or option == "-batch") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --batch argument");
+      }
+      add_batch(argv[++i], opt.scene_files);
+    } else if (option == "--jobs" or option == "-jobs" or option == "-j") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --jobs argument");
+      }
+      opt.n_jobs = std::max<size_t>(1, option_value<size_t>(argv[++i], "--jobs"));
+    } else if (option == "--mmap" or option == "-mmap") {
+      opt.mmap_output = true;
+    } else if (option == "--texture-cache-mb" or
+               option == "-texture-cache-mb") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --texture-cache-mb argument");
+      }
+      opt.texture_cache_mb =
+          std::max<size_t>(1, option_value<size_t>(argv[++i], "--texture-cache-mb"));
+    } else if (option == "--trace" or option == "-trace") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --trace argument");
+      }
+      opt.trace_file = std::string{argv[++i]};
+    } else if (option == "--coordinator" or option == "-coordinator") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --coordinator argument");
+      }
+      opt.coordinator_port = option_value<int>(argv[++i], "--coordinator");
+      if (opt.coordinator_port <= 0 or opt.coordinator_port > 65535) {
+        usage("--coordinator needs a port number");
+      }
+    } else if (option == "--worker" or option == "-worker") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --worker argument");
+      }
+      opt.worker_address = std::string{argv[++i]};
+    } else if (option == "--server" or option == "-server") {
+      if (i + 1 == argc) { // The option's argument is missing.
+        usage("missing value after --server argument");
+      }
+      opt.server_port = option_value<int>(argv[++i], "--server");
+      if (opt.server_port <= 0 or opt.server_port > 65535) {
+        usage("--server needs a port number");
+      }
     } else if (option == "--help" or option == "-help" or option == "-h") {
       usage();
     } else {
-      opt.filename = std::string(argv[i]);
-      // Stream object to handle the input file.
-      std::ifstream scene_file_ifs{opt.filename};
-      // Check whether we had problem opening input level file.
-      if (!scene_file_ifs.is_open()) {
-        std::ostringstream oss;
-        oss << "Sorry, could not open scene file [" << opt.filename << "].\n";
-        RT3_ERROR(oss.str());
-      }
-      scene_file_ifs.close();
+      opt.scene_files.emplace_back(argv[i]);
     }
   } // for to traverse the argument list.
+
+  // Check whether we had problems opening any of the scene files.
+  for (const auto &scene : opt.scene_files) {
+    std::ifstream scene_file_ifs{scene};
+    if (!scene_file_ifs.is_open()) {
+      std::ostringstream oss;
+      oss << "Sorry, could not open scene file [" << scene << "].\n";
+      RT3_ERROR(oss.str());
+    }
+  }
+  if (not opt.worker_address.empty()) {
+    // The scene comes from the coordinator.
+    if (not opt.scene_files.empty() or opt.coordinator_port > 0 or
+        opt.server_port > 0) {
+      usage("--worker takes no scene file, no --coordinator and no --server");
+    }
+    return opt;
+  }
+  if (opt.scene_files.empty()) {
+    usage("no scene file given");
+  }
+  if (opt.scene_files.size() > 1 and opt.outfile != "") {
+    usage("--outfile cannot be used with more than one scene");
+  }
+  if (opt.server_port > 0 and
+      (opt.scene_files.size() > 1 or opt.coordinator_port > 0)) {
+    usage("--server takes a single scene and no --coordinator");
+  }
+  opt.filename = opt.scene_files.front();
   return opt;
 }
 
+/// Renders `scenes` one after the other, in this process. The engine is
+/// initialized and cleaned up once per scene, but the worker pool (and
+/// anything else the API keeps across cycles) stays alive from one scene to
+/// the next. A scene that fails (`RT3_ERROR()`) ends the process.
+static void render_scenes(RunningOptions opt,
+                          const std::vector<std::string> &scenes) {
+  for (const auto &scene : scenes) {
+    opt.filename = scene;
+    if (opt.scene_files.size() > 1) {
+      RT3_MESSAGE("==> Scene \"" + scene + "\"\n");
+    }
+    API::init_engine(opt);
+    API::run();
+    API::clean_up();
+  }
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/// Reads a scene index from a batch pipe; `false` once the other end is
+/// closed (or its process is gone).
+static bool read_index(int fd, uint32_t &index) {
+  size_t got{0};
+  auto *p = reinterpret_cast<char *>(&index);
+  while (got < sizeof(index)) {
+    const ssize_t n = read(fd, p + got, sizeof(index) - got);
+    if (n > 0) {
+      got += size_t(n);
+    } else if (n == 0 or errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Writes a scene index to a batch pipe.
+static bool write_index(int fd, uint32_t index) {
+  ssize_t n{0};
+  do {
+    n = write(fd, &index, sizeof(index));
+  } while (n < 0 and errno == EINTR);
+  return n == ssize_t(sizeof(index));
+}
+
+/// One of the processes a batch is rendered by.
+struct BatchJob {
+  pid_t pid{-1};
+  int to_job{-1};        //!< Scene indices go out here; closed when done.
+  int from_job{-1};      //!< The index of each scene rendered comes back.
+  size_t scene{SIZE_MAX};  //!< What the job is rendering, if anything.
+};
+
+/// The body of a batch job: renders the scenes it is sent, one after the
+/// other, until the pipe is closed.
+static void run_batch_job(const RunningOptions &opt, int from_parent,
+                          int to_parent) {
+  uint32_t index{0};
+  while (read_index(from_parent, index)) {
+    render_scenes(opt, {opt.scene_files[index]});
+    std::cout.flush();
+    if (not write_index(to_parent, index)) {
+      break;
+    }
+  }
+}
+#endif
+
+/*!
+ * Renders a batch of scenes with up to `opt.n_jobs` job processes; each job
+ * gets its share of the hardware threads unless `--threads` was given.
+ * A job lives for the whole batch and renders the scenes it is handed one
+ * after the other, in-process, like `render_scenes()`: its thread pool and
+ * texture cache stay warm between them. Scenes are handed out in order, to
+ * whichever job is free.
+ *
+ * Processes, rather than threads, keep each job's API state apart and
+ * confine a failing scene (`RT3_ERROR()` exits) to its own job: the scene
+ * it was rendering is reported and a new job takes its place, so the rest
+ * of the batch still renders.
+ *
+ * This process only forks and hands out scenes: it never starts the thread
+ * pool, so every job begins single-threaded. If no job can be forked at
+ * all, the scenes not rendered yet are rendered here, after the last one.
+ *
+ * Returns the scenes that failed.
+ */
+static std::vector<std::string> render_batch(RunningOptions opt) {
+  std::vector<std::string> failed;
+#if defined(__unix__) || defined(__APPLE__)
+  const size_t n_scenes{opt.scene_files.size()};
+  const size_t n_jobs = std::max<size_t>(1, std::min(opt.n_jobs, n_scenes));
+  if (opt.n_threads == 0) {
+    opt.n_threads = std::max<size_t>(
+        1, ThreadPool::resolve_thread_count(0) / n_jobs);
+  }
+  // A job that dies must not take this process with it.
+  std::signal(SIGPIPE, SIG_IGN);
+  std::vector<BatchJob> jobs;
+  std::vector<size_t> failed_scenes;
+  size_t next{0};
+  size_t n_started{0};
+
+  // Forks a job; `false` if that is not possible right now.
+  auto start_job = [&](BatchJob &job) -> bool {
+    int down[2], up[2];
+    if (pipe(down) != 0) {
+      return false;
+    }
+    if (pipe(up) != 0) {
+      close(down[0]);
+      close(down[1]);
+      return false;
+    }
+    // Flush before forking, or the child would print our buffers again.
+    std::cout.flush();
+    const pid_t pid = fork();
+    if (pid == 0) {
+      std::signal(SIGPIPE, SIG_DFL);
+      // The other jobs must see the end of their pipes when we close them.
+      for (const auto &other : jobs) {
+        if (other.from_job >= 0) {
+          close(other.from_job);
+        }
+        if (other.to_job >= 0) {
+          close(other.to_job);
+        }
+      }
+      close(down[1]);
+      close(up[0]);
+      // Each job traces on its own: "run.json" -> "run.json.2".
+      if (not opt.trace_file.empty()) {
+        opt.trace_file += "." + std::to_string(n_started);
+      }
+      run_batch_job(opt, down[0], up[1]);
+      std::cout.flush();
+      std::exit(EXIT_SUCCESS);
+    }
+    close(down[0]);
+    close(up[1]);
+    if (pid < 0) {
+      close(down[1]);
+      close(up[0]);
+      return false;
+    }
+    ++n_started;
+    job = BatchJob{pid, down[1], up[0], SIZE_MAX};
+    return true;
+  };
+  // Hands `job` the next scene, or tells it to finish if there is none.
+  auto dispatch = [&](BatchJob &job) {
+    if (next < n_scenes and write_index(job.to_job, uint32_t(next))) {
+      job.scene = next++;
+      return;
+    }
+    close(job.to_job);
+    job.to_job = -1;
+  };
+
+  for (size_t i{0}; i < n_jobs; ++i) {
+    BatchJob job;
+    if (not start_job(job)) {
+      break;
+    }
+    jobs.push_back(job);
+    dispatch(jobs.back());
+  }
+  while (not jobs.empty()) {
+    std::vector<pollfd> fds;
+    for (const auto &job : jobs) {
+      fds.push_back(pollfd{job.from_job, POLLIN, 0});
+    }
+    if (poll(fds.data(), nfds_t(fds.size()), -1) < 0) {
+      continue;  // Interrupted.
+    }
+    for (size_t i{jobs.size()}; i-- > 0;) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      BatchJob &job = jobs[i];
+      uint32_t done{0};
+      if (read_index(job.from_job, done)) {
+        job.scene = SIZE_MAX;
+        dispatch(job);
+        continue;
+      }
+      // The job is gone: it finished, or died with a scene in hand.
+      close(job.from_job);
+      if (job.to_job >= 0) {
+        close(job.to_job);
+      }
+      job.from_job = job.to_job = -1;
+      int status{0};
+      while (waitpid(job.pid, &status, 0) < 0 and errno == EINTR) {
+      }
+      if (job.scene != SIZE_MAX) {
+        failed_scenes.push_back(job.scene);
+      }
+      if (next < n_scenes and start_job(job)) {
+        dispatch(job);
+      } else {
+        jobs.erase(jobs.begin() + std::ptrdiff_t(i));
+      }
+    }
+  }
+  std::signal(SIGPIPE, SIG_DFL);
+  std::sort(failed_scenes.begin(), failed_scenes.end());
+  for (size_t scene : failed_scenes) {
+    failed.push_back(opt.scene_files[scene]);
+  }
+  if (next < n_scenes) {
+    RT3_WARNING("fork() failed; rendering the remaining " +
+                std::to_string(n_scenes - next) + " scene(s) here.");
+    render_scenes(opt, std::vector<std::string>(
+                           opt.scene_files.begin() + std::ptrdiff_t(next),
+                           opt.scene_files.end()));
+  }
+#else
+  if (opt.n_jobs > 1) {
+    RT3_WARNING("--jobs is not supported on this platform; rendering one "
+                "scene at a time.");
+  }
+  render_scenes(opt, opt.scene_files);
+#endif
+  return failed;
+}
+
 int main(int argc, char *argv[]) {
   // ================================================
   // (1) Validate command line arguments.
@@ -100,11 +538,38 @@ int main(int argc, char *argv[]) {
   // ================================================
   // (3) Initialize the renderer engine and load a scene.
   // ================================================
-  API::init_engine(opt);
-  API::run();
-  API::clean_up();
+  auto start = std::chrono::steady_clock::now();
+  int n_failed{0};
+  std::vector<std::string> failed_scenes;
+  if (not opt.worker_address.empty()) {
+    if (join_coordinator(opt.worker_address, opt)) {
+      render_scenes(opt, opt.scene_files);
+      leave_coordinator();
+    } else {
+      n_failed = 1;
+    }
+  } else if (opt.scene_files.size() > 1) {
+    failed_scenes = render_batch(opt);
+    n_failed = int(failed_scenes.size());
+  } else {
+    render_scenes(opt, opt.scene_files);
+  }
+  if (opt.scene_files.size() > 1) {
+    auto end = std::chrono::steady_clock::now();
+    RT3_MESSAGE("    Batch: " + std::to_string(opt.scene_files.size()) +
+                " scenes in " +
+                std::to_string(
+                    std::chrono::duration<double>(end - start).count()) +
+                " s" +
+                (n_failed > 0 ? ", " + std::to_string(n_failed) + " failed"
+                              : std::string{}) +
+                ".\n");
+    for (const auto &scene : failed_scenes) {
+      RT3_MESSAGE("    Failed: \"" + scene + "\"\n");
+    }
+  }
 
   RT3_MESSAGE("\n    Thanks for using RT3!\n\n");
 
-  return EXIT_SUCCESS;
+  return n_failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }